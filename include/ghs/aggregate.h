@@ -0,0 +1,199 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file aggregate.h
+ *
+ * @brief Provides le::ghs::Aggregator, for reductions (min, sum, count, ...) over a converged MST
+ *
+ */
+
+#ifndef GHS_AGGREGATE
+#define GHS_AGGREGATE
+
+#include "ghs/agent.h"
+#include "ghs/ghs.h"
+#include "le/errno.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace le{
+  namespace ghs{
+
+    /**
+     * @brief Runs K reductions at once up a converged MST, one message per agent per round
+     *
+     * Each reduction has its own combine function, which must be
+     * associative and commutative (min, max, sum, ...), since children are
+     * combined in whatever order they answer. A count is a sum of 1s.
+     *
+     * Each round, every agent calls contribute() with its own K values, and
+     * hands receive() the Partial its children send it. Once an agent has
+     * both its own values and a Partial from every child for that round, the
+     * call that completed it sets `done`, and `out` holds the combined
+     * values of its subtree: to send to its parent, or, at the root, the
+     * result for the whole tree.
+     *
+     * It is up to the caller how a Partial gets to the parent (it is plain
+     * data if T is, so it can be sent as raw bytes). Rounds are numbered by the caller, from 1. Only
+     * the newest round each agent has heard of is kept, so a round that a
+     * child skips (or that we skip) never completes; the next one does.
+     *
+     * ```
+     * Aggregator<int64_t,3> agg({min_fn, sum_fn, max_fn});
+     * agg.reset(ghs);
+     * //each round:
+     * Aggregator<int64_t,3>::Partial out; bool done;
+     * agg.contribute(round, {battery, queue_depth, load}, out, done);
+     * //on a Partial from a child:
+     * agg.receive(from, p, out, done);
+     * //whenever done: send `out` to agg.get_parent_id(), or use it if agg.is_root()
+     * ```
+     *
+     * @tparam T the type of each value
+     * @tparam K how many reductions run at once
+     */
+    template <typename T, std::size_t K>
+    class Aggregator
+    {
+      public:
+        /// Combines two values (or partial results) into one
+        typedef std::function<T(const T&, const T&)> Combine;
+
+        /// What one agent sends its parent: its subtree's K values for one round
+        struct Partial
+        {
+          /// The round these values belong to
+          uint32_t round=0;
+          /// One partial result per reduction
+          std::array<T,K> values;
+        };
+
+        /**
+         * @param ops the combine function of each reduction
+         */
+        Aggregator(const std::array<Combine,K> &ops);
+
+        /**
+         * Forgets all rounds and starts over on the given tree.
+         *
+         * @param my_id this agent
+         * @param parent our parent in the MST, or my_id if we are the root
+         * @param children our children in the MST
+         * @param n_children how many ids `children` holds
+         * @return le::Errno OK if successful
+         * @return le::Errno SET_INVALID_EDGE_NO_AGENT if any id is not valid
+         * @return le::Errno SET_INVALID_EDGE_SELF_LOOP if a child is my_id
+         */
+        le::Errno reset(agent_t my_id, agent_t parent, const agent_t *children, size_t n_children);
+
+        /**
+         * Starts over on the MST that `s` converged on.
+         *
+         * @return le::Errno PARTIAL_RESULT if `s` has not converged (and nothing is changed)
+         * @see reset()
+         */
+        template <std::size_t A, std::size_t B>
+        le::Errno reset(const GhsState<A,B> &s);
+
+        /**
+         * Adds our own values for a round. This is the last piece at a
+         * leaf, so it completes the round there.
+         *
+         * @param round the round, which must be after the last one we completed
+         * @param local our value for each reduction
+         * @param out set to our subtree's result, if `done`
+         * @param done set to true if this completed the round
+         * @return le::Errno OK if successful
+         * @return le::Errno AGG_STALE_ROUND if we have already completed that round (or a later one)
+         */
+        le::Errno contribute(uint32_t round, const std::array<T,K> &local, Partial &out, bool &done);
+
+        /**
+         * Keeps a child's Partial, replacing any older one from it.
+         *
+         * @param from the child that sent it
+         * @param p what it sent
+         * @param out set to our subtree's result, if `done`
+         * @param done set to true if this completed the round
+         * @return le::Errno OK if successful
+         * @return le::Errno PROCESS_SELFMSG if `from` is this agent
+         * @return le::Errno NO_SUCH_PEER if `from` is not one of our children
+         * @return le::Errno AGG_STALE_ROUND if the round is over, or older than one we have from that child (and `p` is ignored)
+         */
+        le::Errno receive(agent_t from, const Partial &p, Partial &out, bool &done);
+
+        /// @return the last round we completed, or 0 if none
+        uint32_t last_round() const { return completed; }
+
+        /// @return true if we have no parent, so a completed round covers every agent
+        bool is_root() const { return parent==my_id; }
+
+        /// @return our parent in the MST (my_id at the root)
+        agent_t get_parent_id() const { return parent; }
+
+        /// @return this agent
+        agent_t get_id() const { return my_id; }
+
+        /// @return how many children report to us
+        size_t n_children() const { return children.size(); }
+
+      private:
+        /// The newest values for one round from us or one child
+        struct Slot
+        {
+          agent_t  id;
+          bool     has;
+          Partial  p;
+        };
+
+        /// Combines the round if every slot holds it
+        void try_complete(Partial &out, bool &done);
+
+        std::array<Combine,K> ops;
+        agent_t               my_id;
+        agent_t               parent;
+        uint32_t              completed;
+        Slot                  local;
+        std::vector<Slot>     children;
+    };
+
+#include "aggregate_impl.hpp"
+
+  }
+}
+
+#endif
@@ -0,0 +1,143 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file aggregate_impl.hpp
+ * @brief the implementation for le::ghs::Aggregator
+ */
+
+template <typename T, std::size_t K>
+Aggregator<T,K>::Aggregator(const std::array<Combine,K> &fns)
+  : ops(fns), my_id(0), parent(0), completed(0)
+{
+  local.id=0;
+  local.has=false;
+}
+
+template <typename T, std::size_t K>
+le::Errno Aggregator<T,K>::reset(agent_t id, agent_t par, const agent_t *kids, size_t n_kids)
+{
+  auto ctl = check_tree_links(id, par, kids, n_kids);
+  if (OK != ctl){
+    return ctl;
+  }
+  std::vector<Slot> fresh;
+  fresh.reserve(n_kids);
+  for (size_t i=0;i<n_kids;i++){
+    Slot s;
+    s.id=kids[i];
+    s.has=false;
+    fresh.push_back(s);
+  }
+  my_id=id;
+  parent=par;
+  completed=0;
+  local.id=id;
+  local.has=false;
+  children.swap(fresh);
+  return OK;
+}
+
+template <typename T, std::size_t K>
+template <std::size_t A, std::size_t B>
+le::Errno Aggregator<T,K>::reset(const GhsState<A,B> &s)
+{
+  agent_t id, par;
+  std::vector<agent_t> kids;
+  auto tl = tree_links(s, id, par, kids);
+  if (OK != tl){
+    return tl;
+  }
+  return reset(id, par, kids.data(), kids.size());
+}
+
+template <typename T, std::size_t K>
+le::Errno Aggregator<T,K>::contribute(uint32_t round, const std::array<T,K> &values, Partial &out, bool &done)
+{
+  done=false;
+  if (round<=completed){
+    return AGG_STALE_ROUND;
+  }
+  local.has=true;
+  local.p.round=round;
+  local.p.values=values;
+  try_complete(out,done);
+  return OK;
+}
+
+template <typename T, std::size_t K>
+le::Errno Aggregator<T,K>::receive(agent_t from, const Partial &p, Partial &out, bool &done)
+{
+  done=false;
+  if (from==my_id){
+    return PROCESS_SELFMSG;
+  }
+  for (auto &c : children){
+    if (c.id!=from){
+      continue;
+    }
+    if (p.round<=completed || (c.has && p.round<c.p.round)){
+      return AGG_STALE_ROUND;
+    }
+    c.has=true;
+    c.p=p;
+    try_complete(out,done);
+    return OK;
+  }
+  return NO_SUCH_PEER;
+}
+
+template <typename T, std::size_t K>
+void Aggregator<T,K>::try_complete(Partial &out, bool &done)
+{
+  if (!local.has){
+    return;
+  }
+  uint32_t round = local.p.round;
+  for (const auto &c : children){
+    if (!c.has || c.p.round!=round){
+      return;
+    }
+  }
+  out.round=round;
+  out.values=local.p.values;
+  for (auto &c : children){
+    for (size_t k=0;k<K;k++){
+      out.values[k]=ops[k](out.values[k], c.p.values[k]);
+    }
+    c.has=false;
+  }
+  local.has=false;
+  completed=round;
+  done=true;
+}
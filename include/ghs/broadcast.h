@@ -0,0 +1,231 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file broadcast.h
+ *
+ * @brief Provides le::ghs::TreeBroadcast, which pipelines large payloads down a converged MST in chunks
+ *
+ */
+
+#ifndef GHS_BROADCAST
+#define GHS_BROADCAST
+
+#include "ghs/agent.h"
+#include "ghs/ghs.h"
+#include "le/errno.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace le{
+  namespace ghs{
+
+    /**
+     * @brief Heads every chunk of a TreeBroadcast, and every acknowledgement of one
+     *
+     * It holds no pointers, so it can be sent as raw bytes, followed by the
+     * `len` bytes of the chunk.
+     */
+    struct ChunkHeader
+    {
+      /// Which payload this is part of, counted by the root from 1
+      uint32_t blob=0;
+      /// The chunk's place in the payload, from 0. In an ack: every chunk before this one has arrived.
+      uint32_t index=0;
+      /// The number of chunks in the payload
+      uint32_t n_chunks=0;
+      /// The number of bytes in the whole payload
+      uint32_t size=0;
+      /// The number of bytes in this chunk (0 in an ack)
+      uint32_t len=0;
+      /// 1 if this acknowledges chunks, rather than carrying one
+      uint32_t ack=0;
+      /// In a chunk: the sender's window, so we know to ack before it fills
+      uint32_t window=0;
+    };
+
+    /**
+     * @brief A chunk, or an ack, for the caller to send
+     */
+    struct ChunkSend
+    {
+      /// Who to send it to
+      agent_t     to;
+      /// Goes first on the wire
+      ChunkHeader h;
+      /// The `h.len` bytes of the chunk, which stay put until the next payload starts (nullptr in an ack)
+      const uint8_t *data;
+    };
+
+    /**
+     * @brief Pipelines a large payload from the root down a converged MST
+     *
+     * The root splits the payload into equal chunks (but for the last) of at
+     * most `chunk_sz` bytes, which everyone can work out from the size and
+     * number of chunks in the ChunkHeader.
+     * Every agent passes each chunk on to its children as soon as it has
+     * every chunk before it, so chunk k goes down one edge while chunk k+1
+     * comes in over the one above: the payload reaches every agent in about
+     * (depth + number of chunks) hops, instead of (depth * number of chunks)
+     * if each agent waited for all of it.
+     *
+     * Each child may have at most `window` chunks that it has not
+     * acknowledged, so a slow child holds up only its own subtree, and
+     * agents acknowledge every window/2 chunks, cumulatively. Chunks may
+     * arrive out of order, and are reassembled in order, but none are sent
+     * again: this relies on the caller to deliver every message.
+     *
+     * Every call hands back what to send, in `out`, and the caller gives
+     * what arrives to receive().
+     */
+    class TreeBroadcast
+    {
+      public:
+        /**
+         * @param chunk_sz the most bytes in one chunk (at least 1)
+         * @param window the most chunks a child may have unacknowledged (at least 1)
+         */
+        TreeBroadcast(size_t chunk_sz, size_t window);
+
+        /**
+         * Forgets any payload and starts over on the given tree.
+         *
+         * @param my_id this agent
+         * @param parent our parent in the MST, or my_id if we are the root
+         * @param children our children in the MST
+         * @param n_children how many ids `children` holds
+         * @return le::Errno OK if successful
+         * @return le::Errno SET_INVALID_EDGE_NO_AGENT if any id is not valid
+         * @return le::Errno SET_INVALID_EDGE_SELF_LOOP if a child is my_id
+         */
+        le::Errno reset(agent_t my_id, agent_t parent, const agent_t *children, size_t n_children);
+
+        /**
+         * Starts over on the MST that `s` converged on.
+         *
+         * @return le::Errno PARTIAL_RESULT if `s` has not converged (and nothing is changed)
+         * @see reset()
+         */
+        template <std::size_t A, std::size_t B>
+        le::Errno reset(const GhsState<A,B> &s){
+          agent_t id, par;
+          std::vector<agent_t> kids;
+          auto tl = tree_links(s, id, par, kids);
+          if (OK != tl){
+            return tl;
+          }
+          return reset(id, par, kids.data(), kids.size());
+        }
+
+        /**
+         * Starts sending a new payload to every agent. Any payload still
+         * on its way is abandoned.
+         *
+         * @param data the payload, which is copied
+         * @param len its size in bytes
+         * @param out the first chunks to send
+         * @return le::Errno OK if successful
+         * @return le::Errno CAST_REQ_ROOT if we are not the root
+         * @return le::Errno BAD_MSG if the payload is too big to count in a ChunkHeader
+         */
+        le::Errno send(const uint8_t *data, size_t len, std::vector<ChunkSend> &out);
+
+        /**
+         * Takes a chunk from our parent, or an ack from a child.
+         *
+         * @param from who sent it
+         * @param h its header
+         * @param data the `h.len` bytes of a chunk (ignored for an ack)
+         * @param out what to send next: acks, and chunks for our children
+         * @return le::Errno OK if successful, or if it belongs to a payload we have already replaced (and is ignored)
+         * @return le::Errno PROCESS_SELFMSG if `from` is this agent
+         * @return le::Errno PROCESS_REQ_MST if a chunk is not from our parent
+         * @return le::Errno NO_SUCH_PEER if an ack is not from one of our children
+         * @return le::Errno BAD_MSG if the header does not fit the payload it names
+         */
+        le::Errno receive(agent_t from, const ChunkHeader &h, const uint8_t *data, std::vector<ChunkSend> &out);
+
+        /// @return true if we have every byte of the current payload
+        bool complete() const { return blob>0 && in_order==n_chunks; }
+
+        /// @return true if we have the whole payload and every child has acknowledged all of it
+        bool done() const;
+
+        /// @return the current payload, which is only whole once complete()
+        const std::vector<uint8_t>& payload() const { return buf; }
+
+        /// @return the number of the current payload (0 if none)
+        uint32_t get_blob() const { return blob; }
+
+        /// @return true if we have no parent, so we are the one to send()
+        bool is_root() const { return parent==my_id; }
+
+        /// @return our parent in the MST (my_id at the root)
+        agent_t get_parent_id() const { return parent; }
+
+      private:
+        /// How far one child has got
+        struct Child
+        {
+          agent_t  id;
+          uint32_t sent;
+          uint32_t acked;
+        };
+
+        /// Sizes `buf` and friends for a new payload
+        void begin(uint32_t id, uint32_t size, uint32_t n_chunks);
+
+        /// Where chunk `i` of the current payload starts, and how long it is
+        void span(uint32_t i, size_t &offset, size_t &len) const;
+
+        /// Sends each child whatever its window allows
+        void forward(Child &c, std::vector<ChunkSend> &out);
+
+        size_t              chunk_sz;
+        size_t              window;
+        agent_t             my_id;
+        agent_t             parent;
+        uint32_t            blob;
+        uint32_t            size;
+        uint32_t            n_chunks;
+        uint32_t            in_order;
+        uint32_t            acked_up;
+        std::vector<uint8_t> buf;
+        std::vector<bool>    have;
+        std::vector<Child>   children;
+    };
+  }
+}
+
+#endif
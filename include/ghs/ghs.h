@@ -36,6 +36,11 @@
  * @file ghs.h
  * @brief **The main GhsState object**
  *
+ * Nothing in le::ghs does I/O of its own. GhsState, SessionMux, and the
+ * protocols that run over a converged tree (TreeHealth, Aggregator and
+ * TreeBroadcast) hand back what to send, and the caller sends it however
+ * it sends everything else, and hands them what arrives.
+ *
  */
 
 #ifndef GHS_H
@@ -48,6 +53,7 @@
 #include "le/errno.h"
 #include "seque/static_queue.h"
 #include <array>
+#include <vector>
 
 using seque::StaticQueue;
 
@@ -61,6 +67,46 @@ namespace le{
    */
   namespace ghs{
 
+    /**
+     * @brief Per-peer storage for GhsState: a fixed std::array, or a std::vector if N==0
+     *
+     * The vector grows as edges are added with GhsState::set_edge(), so
+     * memory is proportional to the number of peers actually known.
+     */
+    template <typename T, std::size_t N>
+      struct PeerStorage { typedef std::array<T,N> type; };
+
+    /// @see PeerStorage
+    template <typename T>
+      struct PeerStorage<T,0> { typedef std::vector<T> type; };
+
+    /// @cond internal
+    //Fixed storage is always "big enough"; set_edge() checks the capacity.
+    template <typename T, std::size_t N>
+      inline void peer_storage_reset(std::array<T,N> &a, const T& v){ a.fill(v); }
+    template <typename T>
+      inline void peer_storage_reset(std::vector<T> &a, const T&){ a.clear(); }
+    template <typename T, std::size_t N>
+      inline void peer_storage_grow(std::array<T,N> &, std::size_t){ }
+    template <typename T>
+      inline void peer_storage_grow(std::vector<T> &a, std::size_t n){ if (a.size()<n){ a.resize(n); } }
+    /// @endcond
+
+    /**
+     * @brief The leader an agent would pick if it had to pick now (see GhsState::current_leader())
+     */
+    struct LeaderEstimate
+    {
+      /// The leader of the largest partition we know of
+      agent_t leader;
+
+      /// Its level. A partition at level l holds at least 2^l agents
+      level_t level;
+
+      /// How many agents it holds, as last counted (at least 1). Once we have converged, this is usually all of them
+      uint32_t size;
+    };
+
     /** 
      * @brief **The main state machine for the GHS algorithm**
      *
@@ -77,6 +123,11 @@ namespace le{
      * Then, as response messages come in from other nodes, just feed them into
      * process() until is_converged() is true. 
      *
+     * NUM_AGENTS bounds the number of peers (edges) of this node, and fixes
+     * the storage for them. If NUM_AGENTS is 0 there is no bound, and the
+     * storage grows with the number of edges set, which is useful when the
+     * cluster size is only known at runtime.
+     *
      */ 
     template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
       class GhsState
@@ -94,7 +145,7 @@ namespace le{
            * communication links to other agents that will not be modified
            * during execution.
            *
-           * The edge list may contain any number of edges (up to NUM_AGENTS). This class will ignore (not copy in) any edge that:
+           * The edge list may contain any number of edges (up to NUM_AGENTS, if it is not 0). This class will ignore (not copy in) any edge that:
            *
            * - Is not rooted on this node (Edge.root != my_id)
            * - Is directed to this node (Edge.peer == my_id)
@@ -114,6 +165,23 @@ namespace le{
            *
            */
           GhsState(agent_t my_id, Edge* edges, size_t num_edges);
+
+          /**
+           * Initializes the state as above, and then warm-starts it from
+           * what this agent remembers of the tree of a previous run (see
+           * set_hints()).
+           *
+           * @param my_id of type agent_t that tells the class which edges to consider
+           * @param edges a set of le::ghs::Edge structures, as above
+           * @param num_edges the length of the edge set
+           * @param hints our edges as they were when the previous run converged
+           * @param num_hints the length of the hint set
+           * @param leader the leader of the previous run
+           * @param level our level when the previous run converged
+           */
+          GhsState(agent_t my_id, Edge* edges, size_t num_edges,
+              const Edge* hints, size_t num_hints, agent_t leader, level_t level);
+
           ~GhsState(); 
 
           /**
@@ -165,6 +233,28 @@ namespace le{
            */
           bool is_converged() const;
 
+          /**
+           * Returns the best leader we know of so far, for callers that
+           * have a deadline and would rather have a good leader soon than
+           * the right one later. It never blocks or sends anything: check
+           * it when the deadline passes, and keep process()ing messages if
+           * you like, since the answer only gets better.
+           *
+           * The leader of each partition learns its size from the searches
+           * it runs: each SRCH_RET carries the size of the sender's
+           * subtree, and each SRCH the size the leader last counted. The
+           * IN_PART messages of each search tell us the size of each
+           * neighbouring partition, too. Before convergence, the answer is
+           * the leader of the largest of these (ours, on a tie), which is
+           * the one most agents already follow. This costs no messages, and
+           * the counts lag the partitions by at most one search.
+           *
+           * @param out the estimate to populate
+           * @return le::Errno OK if we have converged, and out.leader is final
+           * @return le::Errno PARTIAL_RESULT if we have not, and out is the best guess so far
+           */
+          le::Errno current_leader(LeaderEstimate &out) const;
+
           /**
            * Returns the number of peers, which is a counter that is incremented
            * every time you add_edge_to(id) (or variant), with a new id. 
@@ -318,6 +408,26 @@ namespace le{
            */
           size_t delayed_count() const;
 
+          /**
+           * Lists our children in the MST: the peers on the other end of our
+           * MST edges, other than our parent. Only meaningful once
+           * is_converged(); before that it lists the children in our current
+           * partition.
+           *
+           * @param out where to write the children's ids
+           * @param cap how many ids `out` has room for
+           * @return the number of children, which may be more than `cap` (only the first `cap` are written)
+           */
+          size_t mst_children(agent_t *out, size_t cap) const;
+
+          /**
+           * How much heavier than the MST our tree is, as the sum of the
+           * metrics of its edges, after the swaps that capped its degree
+           * (see set_max_degree()). Only meaningful once is_converged(),
+           * and 0 if no swap was made.
+           */
+          metric_t get_degree_cost() const;
+
           /**
            * Returns the current minimum weight outgoing edge (MWOE).
            *
@@ -427,6 +537,220 @@ namespace le{
           le::Errno typecast(const status_t status, const msg::Type, const msg::Data&, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t&) const;
 
 
+          /**
+           * Removes the edge to an agent that has failed (or that we no
+           * longer trust), so the algorithm stops waiting on it. This is the
+           * safe version of setting the status to DELETED (see
+           * set_edge_status()): it also forgets that we owe them a response
+           * or are waiting for one from them.
+           *
+           * If we were waiting for their answer to our search, the search is
+           * finished without them, which may enqueue the result for our
+           * parent (or the join, if we lead) in `buf`.
+           *
+           * Once we have converged, the tree mends itself. If they were
+           * our child, or not in the tree at all, there is nothing else to
+           * do: their subtree, if any, finds its own way back. If they were
+           * our parent, we now lead our subtree. We tell it so with a
+           * msg::RepairPayload, and once it has answered (with
+           * msg::RepairAckPayload), we start a search at our level, as though
+           * for a new round. Every edge in the subtree that was DELETED,
+           * except to agents that have been dropped, is searched again.
+           * The rest of the tree is converged, so it answers the search as
+           * it would a newcomer's (see add_peer()), and takes us back in
+           * over the lightest edge out of the subtree, which is the MST
+           * without the lost edge. If the leader was lost, its subtrees
+           * elect a new one among themselves, as usual. If they
+           * cannot reach anyone else, they converge on their own.
+           *
+           * Before convergence, the MST cannot be repaired from here,
+           * though. If the edge was part of it, or is the edge our search
+           * chose to join over, the edge is still removed, but every agent
+           * must start over with a new GhsState.
+           *
+           * @param who the agent on the other end of the edge
+           * @param buf StaticQueue in which to enqueue outgoing messages
+           * @param qsz set to the number of messages enqueued
+           * @return OK if successful
+           * @return le::Errno DROP_REQ_RESTART if we have not converged, and the MST or the chosen MWOE used that edge
+           * @return le::Errno NO_SUCH_PEER if we cannot find the given agent id
+           * @return le::Errno IMPL_REQ_PEER_MY_ID if who==my_id
+           */
+          le::Errno drop_edge(const agent_t &who, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz);
+
+          /**
+           * Adds an edge to an agent that was not around when we were
+           * constructed, so that it can join without a new election.
+           *
+           * The newcomer is constructed as usual, with its own edges, and
+           * calls start_round() once each of its peers has called
+           * add_peer() for it. Its search is answered like any other, so it
+           * finds its MWOE and sends JOIN_US over it. If we are
+           * converged, we take it in as our child and send it
+           * msg::AbsorbedPayload with our leader and level, and it is
+           * converged too. Only the newcomer's peers hear of it: the
+           * leader, and the rest of the tree, are none the wiser.
+           *
+           * The newcomer hangs off the tree by its MWOE. That is the MST
+           * unless one of its other edges is lighter than the heaviest
+           * edge on the path through the tree between its two ends.
+           *
+           * @param e the edge, rooted at us, which starts UNKNOWN whatever its status
+           * @return le::Errno OK if successful
+           * @return le::Errno SET_INVALID_EDGE if we already have an edge to that peer
+           * @return le::Errno TOO_MANY_AGENTS if there is no room for another peer
+           * @see set_edge() for the rest
+           */
+          le::Errno add_peer(const Edge &e);
+
+          /**
+           * Changes the metric of the edge to `to` once we have converged,
+           * and does whatever it takes to keep the tree an MST. Both ends
+           * of the edge must call it, with the same metric, before the
+           * messages it enqueues are delivered, and only one edge may
+           * change at a time.
+           *
+           * If the edge is in the tree, and has got worse, there may be a
+           * lighter way around it. The end nearer the leader takes it out
+           * of the tree (msg::CutPayload), and the other end repairs its
+           * subtree as though it had lost its parent (see drop_edge()),
+           * which finds the lightest way back: the same edge, or a
+           * lighter one.
+           *
+           * If the edge is not in the tree, and has got better, it may be
+           * lighter than the heaviest edge on the path through the tree
+           * between its ends. The end with the lower id asks along that
+           * path (msg::CyclePayload), and if so, the heaviest edge on it
+           * is cut as above, and the subtree comes back over this edge.
+           *
+           * Otherwise, the tree is still an MST, and only the metric
+           * changes.
+           *
+           * @param to the agent on the other end of the edge
+           * @param m the new metric
+           * @param buf StaticQueue in which to enqueue outgoing messages
+           * @param qsz set to the number of messages enqueued
+           * @return le::Errno OK if successful
+           * @return le::Errno UPDATE_REQ_CONVERGED if we have not converged (or are being repaired)
+           * @return le::Errno SET_INVALID_EDGE_METRIC if m is not a valid metric
+           * @return le::Errno NO_SUCH_PEER if we cannot find the given agent id
+           */
+          le::Errno update_edge_metric(const agent_t &to, const metric_t m, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz);
+
+          /**
+           * Warm-starts the election from the tree a previous run converged
+           * on, so that if nothing has changed it takes one pass up and
+           * down the tree instead of log(n) levels. Call it once all edges
+           * are set, and before start_round().
+           *
+           * The hints are our edges as get_edge() returned them when the
+           * previous run converged (MST, MST_PARENT or DELETED), with the
+           * leader and level. They are only used if they cover every edge
+           * we have now, each with the same metric, and give us a parent
+           * unless we led. Then each agent takes the tree from its hints,
+           * and confirms it up the tree (msg::WarmAckPayload) once its
+           * subtree has. Once the leader has heard from all of its
+           * children, the tree is the MST, since neither it nor any metric
+           * has changed, and the leader tells everyone so
+           * (msg::WarmDonePayload).
+           *
+           * Otherwise, or if a neighbour's hints do not agree with ours, or
+           * a neighbour elects from scratch, the agent falls back: it tells
+           * all of its peers to do the same (msg::WarmNackPayload), which
+           * spreads to the whole fleet, and starts from scratch.
+           *
+           * All the hints must come from the same converged tree. If they
+           * do not, an agent may converge on its tree, and then fall back
+           * when it hears of the mismatch, or, if the parents they name
+           * go round in a circle, the agents in it wait forever.
+           *
+           * @param hints our edges as they were when the previous run converged
+           * @param num_hints the length of the hint set
+           * @param leader the leader of the previous run
+           * @param level our level when the previous run converged
+           * @return le::Errno OK if the hints will be used
+           * @return le::Errno HINT_MISMATCH if they do not match our edges, and start_round() will start from scratch
+           */
+          le::Errno set_hints(const Edge* hints, size_t num_hints, agent_t leader, level_t level);
+
+          /**
+           * Moves the leader to the center of the tree once the election
+           * is over, so that broadcasts from it (and convergecasts to it)
+           * cross at most the radius of the tree rather than up to its
+           * diameter. Set it on every agent before start_round().
+           *
+           * GHS leaves the leader wherever the last join happened, which
+           * has nothing to do with the shape of the tree. With this set,
+           * every SRCH_RET also carries the height of the sender's subtree
+           * (msg::SrchRetPayload), so after the last search each agent
+           * knows how far down the tree reaches through each child. The
+           * old leader then walks towards the center, one hop per message
+           * (msg::CenterPayload), to the child that reaches furthest as
+           * long as that shortens the longest path from the root. Each
+           * agent on the way makes the next its parent, so the tree is
+           * re-rooted as the walk goes. The center becomes the leader, and
+           * tells everyone with the usual NOOP. Nobody reports converged
+           * before then. It takes one message per hop from the old leader
+           * to the center, which is at most half the diameter.
+           *
+           * Warm starts (see set_hints()) keep the leader they are given,
+           * which is already the center if the run they came from moved it.
+           *
+           * @param on true to move the leader to the center, false (the default) to leave it
+           */
+          void set_recenter(bool on);
+
+          /**
+           * Caps the number of tree edges each agent has, so that no agent
+           * has to send a broadcast down more than cap-1 links (cap, for
+           * the leader). Set it on every agent, with the same cap, before
+           * start_round().
+           *
+           * GHS builds the MST first, as usual. Each SRCH_RET
+           * is preceded by one that names the agent in the sender's subtree
+           * with the most tree edges over the cap (msg::CrowdedPayload),
+           * if there is one, so after the last
+           * search the leader knows the most crowded agent, and the way to
+           * it. If that agent is over the cap, the leader tells everyone the
+           * tree has converged, but for the swaps (msg::NoopPayload), so
+           * that they can answer the subtrees the swaps cut off, and sends
+           * the agent msg::ShedPayload. The agent cuts off its
+           * heaviest child that it has not tried to hand off before. The
+           * subtree repairs itself as in update_edge_metric(), except that
+           * its search ranks edges that leave both ends within the cap
+           * first, lightest first, then the edge it was cut from, then the
+           * rest: each msg::NackPartPayload carries the sender's degree. So
+           * a swap never pushes another agent over the cap, and if there
+           * is no room elsewhere the subtree comes back where it was. Only
+           * one subtree searches at a time, so it is safe to change the
+           * order of the edges it picks from, which would break GHS if
+           * partitions picked that way in parallel. The subtree searches
+           * one level up, so agents only answer once they know their tree
+           * is final (see drop_edge()).
+           *
+           * Once the subtree is back in the tree, the agent that led its
+           * repair tells the leader (msg::ShedDonePayload), which searches
+           * again to count the degrees afresh, and either starts the next
+           * swap or tells everyone the tree is done with the usual NOOP,
+           * which carries how much heavier than the MST it now is (see
+           * get_degree_cost()). Only then does is_converged() return true.
+           * Each agent tries each child once, and no swap puts an agent over
+           * the cap, so there are fewer than 2n swaps. Each costs a search
+           * of the whole tree, on top of the repair. Recentering (see
+           * set_recenter()) waits for the last swap.
+           *
+           * This is a local search, not an exact one: a tree within the
+           * cap may exist that the swaps do not find, and with a cap of 1
+           * there is none. The heuristic keeps the MST wherever it already
+           * meets the cap. Later changes (drop_edge(), update_edge_metric())
+           * repair the tree without regard to the cap. Warm starts (see
+           * set_hints()) keep the tree they are given.
+           *
+           * @param cap the most tree edges any agent may have, or 0 (the default) for no cap
+           */
+          void set_max_degree(uint32_t cap);
+
+
         private:
 
 
@@ -444,7 +768,7 @@ namespace le{
            *  @return le::Errno OK if successful
            *  @return le::Errno SET_INVALID_EDGE if edge has root!=my_id
            *  @return le::Errno IMPL_REQ_PEER_MY_ID if edge has peer==my_id
-           *  @return le::Errno TOO_MANY_AGENTS if this is a new edge and we would exceed MAX_AGENTS
+           *  @return le::Errno TOO_MANY_AGENTS if this is a new edge and we would exceed NUM_AGENTS (never, if NUM_AGENTS is 0)
            *  @param e an Edge to add
            *  @see Edge
            *  @see le::Errno 
@@ -617,7 +941,7 @@ namespace le{
           /**
            * Called by process() with specifically msg::NoopPayload messages
            */
-          le::Errno process_noop( StaticQueue<Msg, MSG_Q_SIZE>&,  size_t&);
+          le::Errno process_noop(        const msg::NoopPayload&, StaticQueue<Msg, MSG_Q_SIZE>&,  size_t&);
           
           /**
            * This does moderate lifting to determine if the search is complete for the
@@ -629,6 +953,154 @@ namespace le{
           //join_us does some heavy lifting to determine how partitions should be restructured and joined
           le::Errno process_join_us(     agent_t from, const msg::JoinUsPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
 
+          /**
+           * Called by process() with specifically msg::AbsorbedPayload messages
+           */
+          le::Errno process_absorbed(    agent_t from, const msg::AbsorbedPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::RepairPayload
+           * messages, and by drop_edge() (with from==my_id) when we lose
+           * our parent
+           */
+          le::Errno process_repair(      agent_t from, const msg::RepairPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::RepairAckPayload messages
+           */
+          le::Errno process_repair_ack(  agent_t from, const msg::RepairAckPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Once the whole subtree knows of a repair, tells our parent so,
+           * or, if we lead it, starts the search
+           */
+          le::Errno check_repair_status( StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::ProbePayload messages
+           */
+          le::Errno process_probe(       agent_t from, const msg::ProbePayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::ProbeRetPayload messages
+           */
+          le::Errno process_probe_ret(   agent_t from, const msg::ProbeRetPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Once converged, finds out whether our tree still reaches the
+           * leader, if we have not already, so that we can answer IN_PART
+           * from partitions at a higher level than ours.
+           *
+           * Until then, we may be in a subtree that has lost its way to the
+           * leader, and has not heard yet: it will be repaired, and may
+           * well end up in the partition that asked.
+           */
+          le::Errno check_rooted(        StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::CyclePayload messages,
+           * and by update_edge_metric() (with from==my_id) to start one
+           */
+          le::Errno process_cycle(       agent_t from, const msg::CyclePayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::CutPayload messages,
+           * and by update_edge_metric() and process_cycle() (with
+           * from==my_id) to start one
+           */
+          le::Errno process_cut(         agent_t from, const msg::CutPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::WarmAckPayload messages
+           */
+          le::Errno process_warm_ack(    agent_t from, const msg::WarmAckPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::WarmDonePayload messages
+           */
+          le::Errno process_warm_done(   agent_t from, const msg::WarmDonePayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::WarmNackPayload messages
+           */
+          le::Errno process_warm_nack(   agent_t from, const msg::WarmNackPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Once our whole subtree has confirmed the hints, tells our
+           * parent so, or, if we lead, tells everyone we have converged
+           */
+          le::Errno check_warm_status(   StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Gives up on the hints: tells every peer to do the same, forgets
+           * the tree, and starts from scratch with start_round()
+           */
+          le::Errno fall_back(           StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::CenterPayload
+           * messages, and by the leader itself (from==my_id) once the last
+           * search comes back empty: moves the root one hop closer to the
+           * center, or, if it is there, takes the lead and ends the
+           * election (see set_recenter())
+           */
+          le::Errno process_center(      agent_t from, const msg::CenterPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * The longest path down from us, in edges: the furthest any of
+           * our children reaches (see reach)
+           */
+          uint32_t height() const;
+
+          /**
+           * Called by process() with specifically msg::ShedPayload messages,
+           * and by the leader itself (from==my_id) once a search comes back
+           * empty with an agent over the cap: passes it on towards that
+           * agent, or, if we are it, cuts off a child (see set_max_degree())
+           */
+          le::Errno process_shed(        agent_t from, const msg::ShedPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::ShedDonePayload
+           * messages, and by process_absorbed() (with from==my_id) once a
+           * subtree cut off by a swap is back: passes it up to the leader,
+           * which searches again
+           */
+          le::Errno process_shed_done(   agent_t from, const msg::ShedDonePayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * Called by process() with specifically msg::CrowdedPayload
+           * messages: notes the child's crowded agent and rank for the
+           * SRCH_RET that comes next (see ret_rank)
+           */
+          le::Errno process_crowded(     agent_t from, const msg::CrowdedPayload&, StaticQueue<Msg, MSG_Q_SIZE>&, size_t&);
+
+          /**
+           * The number of our tree edges, including the one to our parent
+           */
+          uint32_t degree() const;
+
+          /**
+           * Counts us in as the most crowded agent in our subtree, if we are
+           * over the cap, with a child left to try, and more crowded than
+           * any agent our children told us of (see crowded)
+           */
+          void note_crowded();
+
+          /**
+           * How a subtree cut off by a swap ranks the edge to `to`, given
+           * how many tree edges they have: 0 if both ends have room, 1 if
+           * it is the edge we were cut from, 2 otherwise. Always 0 outside
+           * such a repair (see set_max_degree())
+           */
+          uint8_t rank_of(agent_t to, uint32_t their_degree) const;
+
+          /**
+           * Whether an edge of that rank and metric is better than best_edge
+           * (see rank_of()). With every rank 0, this is the lighter of the two
+           */
+          bool beats_best(uint8_t rank, metric_t m) const;
+
           /**
            * After our level changes, we may have to do some cleanup, including responding to old messages, so this function completes that check and buffers the new messages if required
            */
@@ -645,23 +1117,99 @@ namespace le{
            */
           le::Errno                  respond_no_mwoe( StaticQueue<Msg, MSG_Q_SIZE>&, size_t & );
 
+          /**
+           * Sends our SRCH_RET to our parent, after a msg::CrowdedPayload
+           * with crowded and rank if either says anything (see
+           * set_max_degree())
+           */
+          le::Errno                  return_srch( const msg::SrchRetPayload&, uint8_t rank, StaticQueue<Msg, MSG_Q_SIZE>&, size_t & );
+
 
           agent_t                  my_id;
           agent_t                  my_leader;
           level_t                  my_level;
           bool                     algorithm_converged;
+          /// We have converged, and the leader has told us (see check_rooted()) that we still reach it
+          bool                     rooted;
+          /// We asked our parent whether we still reach the leader, and have not heard back
+          bool                     probe_sent;
+          /// We were given hints (see set_hints()), and have not fallen back from them
+          bool                     hinted;
+          /// We took the tree from our hints, and are confirming it
+          bool                     warm;
+          /// The agents in our subtree that have answered this search (or warm start), including us
+          uint32_t                 subtree_size;
+          /// The size of our partition, as its leader last counted it (see current_leader())
+          uint32_t                 fragment_size;
+          /// The largest other partition that asked us IN_PART, if any
+          msg::InPartPayload       largest_heard;
+          /// Move the leader to the center of the tree once the election is over (see set_recenter())
+          bool                     recenter;
+          /// The most tree edges an agent may have, or 0 for no cap (see set_max_degree())
+          uint32_t                 max_degree;
+          /// We are in a subtree that a swap cut off, and it has not come back yet
+          bool                     shedding;
+          /// The agent that cut us off to cap its degree, if we lead the repair (NO_AGENT otherwise)
+          agent_t                  shed_from;
+          /// The rank of best_edge (see rank_of())
+          uint8_t                  best_rank;
+          /// The most crowded agent in our subtree that this search heard of (see note_crowded()), and its degree
+          agent_t                  crowded;
+          uint32_t                 crowded_degree;
+          /// The child we heard of crowded from, or us
+          agent_t                  crowded_via;
+          /// How much heavier than the MST the swaps made the tree (see get_degree_cost())
+          metric_t                 degree_cost;
+          /// The tree converged, but swaps to cap its degree follow, so is_converged() waits for the next NOOP
+          bool                     swapping;
           
           Edge                     best_edge;
 
           size_t                                n_peers;
-          std::array<agent_t,NUM_AGENTS>        peers;
-          std::array<bool,NUM_AGENTS>           waiting_for_response;
-          std::array<Edge,NUM_AGENTS>           outgoing_edges;
-          std::array<msg::InPartPayload,NUM_AGENTS>  response_prompt;
-          std::array<bool,NUM_AGENTS>           response_required;
+          typename PeerStorage<agent_t,NUM_AGENTS>::type            peers;
+          typename PeerStorage<bool,NUM_AGENTS>::type               waiting_for_response;
+          typename PeerStorage<Edge,NUM_AGENTS>::type               outgoing_edges;
+          typename PeerStorage<msg::InPartPayload,NUM_AGENTS>::type response_prompt;
+          typename PeerStorage<bool,NUM_AGENTS>::type               response_required;
+          /// We absorbed them at our own level: not yet our children, still searched with IN_PART (see process_join_us())
+          typename PeerStorage<bool,NUM_AGENTS>::type               join_owed;
+          /// The edge was dropped (see drop_edge()), so a repair does not search it again
+          typename PeerStorage<bool,NUM_AGENTS>::type               lost;
+          /// Our child asked whether we still reach the leader, and waits for the answer
+          typename PeerStorage<bool,NUM_AGENTS>::type               probed_by;
+          /// How far down the tree reaches through each child, in edges, as of its last SRCH_RET (0 for anyone else)
+          typename PeerStorage<uint32_t,NUM_AGENTS>::type           reach;
+          /// We cut them off to cap our degree once already (see process_shed())
+          typename PeerStorage<bool,NUM_AGENTS>::type               shed_tried;
+          /// The rank each child's msg::CrowdedPayload gave the edge in its coming SRCH_RET (see rank_of())
+          typename PeerStorage<uint8_t,NUM_AGENTS>::type            ret_rank;
 
       };
 
+    /**
+     * The tree around an agent, once its election has converged: for the
+     * reset() of TreeHealth, Aggregator and TreeBroadcast.
+     *
+     * @param s the agent's state
+     * @param id set to the agent
+     * @param parent set to its parent in the MST, or id if it is the root
+     * @param children set to its children in the MST
+     * @return le::Errno OK if successful
+     * @return le::Errno PARTIAL_RESULT if `s` has not converged (and nothing is changed)
+     */
+    template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+      le::Errno tree_links(const GhsState<NUM_AGENTS,MSG_Q_SIZE> &s, agent_t &id, agent_t &parent, std::vector<agent_t> &children);
+
+    /**
+     * Checks the tree given to the reset() of TreeHealth, Aggregator or
+     * TreeBroadcast.
+     *
+     * @return le::Errno OK if successful
+     * @return le::Errno SET_INVALID_EDGE_NO_AGENT if any id is not valid
+     * @return le::Errno SET_INVALID_EDGE_SELF_LOOP if a child is id
+     */
+    le::Errno check_tree_links(agent_t id, agent_t parent, const agent_t *children, size_t n_children);
+
 #include "ghs_impl.hpp"
 
   }
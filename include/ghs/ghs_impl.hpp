@@ -67,6 +67,15 @@ GhsState<MAX_AGENTS, BUF_SZ>::GhsState(agent_t my_id, Edge* edges, size_t num_ed
   }
 }
 
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+GhsState<MAX_AGENTS, BUF_SZ>::GhsState(agent_t my_id, Edge* edges, size_t num_edges,
+    const Edge* hints, size_t num_hints, agent_t leader, level_t level)
+  : GhsState(my_id, edges, num_edges)
+{
+  //if they are no good, start_round() says so
+  set_hints(hints, num_hints, leader, level);
+}
+
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
 GhsState<MAX_AGENTS, BUF_SZ>::~GhsState(){}
 
@@ -80,15 +89,38 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::reset() {
   set_level(LEVEL_START);
   set_parent_id(my_id);
 
-  for (size_t i=0;i<MAX_AGENTS;i++){
-    peers[i] = NO_AGENT;
-    outgoing_edges[i].status=UNKNOWN;
-    waiting_for_response[i]=false;
-    response_required[i]=false;
-    response_prompt[i]={};
-  }
+  Edge unknown_edge;
+  unknown_edge.status=UNKNOWN;
+  peer_storage_reset(peers, NO_AGENT);
+  peer_storage_reset(outgoing_edges, unknown_edge);
+  peer_storage_reset(waiting_for_response, false);
+  peer_storage_reset(response_required, false);
+  peer_storage_reset(response_prompt, InPartPayload{});
+  peer_storage_reset(join_owed, false);
+  peer_storage_reset(lost, false);
+  peer_storage_reset(probed_by, false);
+  peer_storage_reset(reach, (uint32_t)0);
+  peer_storage_reset(shed_tried, false);
+  peer_storage_reset(ret_rank, (uint8_t)0);
   this->best_edge            =  worst_edge();
   this->algorithm_converged  =  false;
+  this->rooted               =  false;
+  this->probe_sent           =  false;
+  this->hinted               =  false;
+  this->warm                 =  false;
+  this->subtree_size         =  1;
+  this->fragment_size        =  1;
+  this->largest_heard        =  InPartPayload{NO_AGENT, LEVEL_START, 0};
+  this->recenter             =  false;
+  this->max_degree           =  0;
+  this->shedding             =  false;
+  this->shed_from            =  NO_AGENT;
+  this->best_rank            =  0;
+  this->crowded              =  NO_AGENT;
+  this->crowded_degree       =  0;
+  this->crowded_via          =  NO_AGENT;
+  this->degree_cost          =  0;
+  this->swapping             =  false;
 
   return OK;
 }
@@ -100,10 +132,23 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::reset() {
  */
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
 le::Errno GhsState<MAX_AGENTS, BUF_SZ>::start_round(StaticQueue<Msg,BUF_SZ> &outgoing_buffer, size_t & qsz) {
+  if (warm){
+    //the leaves confirm the hints first, and the rest once their children have
+    qsz=0;
+    if (mst_children(nullptr, 0) > 0){
+      return OK;
+    }
+    return check_warm_status(outgoing_buffer, qsz);
+  }
+  if (hinted && !algorithm_converged){
+    //the hints did not match our edges
+    return fall_back(outgoing_buffer, qsz);
+  }
+
   //If I'm leader, then I need to start the process. Otherwise wait.
   if (get_leader_id() == get_id()){
     //nobody tells us what to do but ourselves
-    return process_srch(get_id(), {get_leader_id(), get_level()}, outgoing_buffer, qsz);
+    return process_srch(get_id(), {get_leader_id(), get_level(), fragment_size}, outgoing_buffer, qsz);
   }
   qsz=0;
   return OK;
@@ -130,6 +175,19 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process(const Msg &msg, StaticQueue<Msg,
     return PROCESS_NO_EDGE_FOUND;
   }
 
+  //anyone electing from scratch has given up on the hints, so we do too
+  bool warm_msg = msg.type() == msg::Type::WARM_ACK || msg.type() == msg::Type::WARM_DONE || msg.type() == msg::Type::WARM_NACK;
+  if (hinted && !algorithm_converged && !warm_msg){
+    size_t fell=0;
+    auto fbr = fall_back(outgoing_buffer, fell);
+    if (OK != fbr){
+      return fbr;
+    }
+    auto pr = process(msg, outgoing_buffer, qsz);
+    qsz += fell;
+    return pr;
+  }
+
   switch (msg.type()){
     case    (msg::Type::SRCH):{         return  process_srch(         msg.from(), msg.data().srch, outgoing_buffer, qsz);  }
     case    (msg::Type::SRCH_RET):{     return  process_srch_ret(     msg.from(), msg.data().srch_ret, outgoing_buffer, qsz);  }
@@ -137,7 +195,21 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process(const Msg &msg, StaticQueue<Msg,
     case    (msg::Type::ACK_PART):{     return  process_ack_part(     msg.from(), msg.data().ack_part, outgoing_buffer, qsz);  }
     case    (msg::Type::NACK_PART):{    return  process_nack_part(    msg.from(), msg.data().nack_part, outgoing_buffer, qsz);  }
     case    (msg::Type::JOIN_US):{      return  process_join_us(      msg.from(), msg.data().join_us, outgoing_buffer, qsz);  }
-    case    (msg::Type::NOOP):{         return  process_noop(         outgoing_buffer , qsz); }
+    case    (msg::Type::ABSORBED):{     return  process_absorbed(     msg.from(), msg.data().absorbed, outgoing_buffer, qsz);  }
+    case    (msg::Type::REPAIR):{       return  process_repair(       msg.from(), msg.data().repair, outgoing_buffer, qsz);  }
+    case    (msg::Type::REPAIR_ACK):{   return  process_repair_ack(   msg.from(), msg.data().repair_ack, outgoing_buffer, qsz);  }
+    case    (msg::Type::PROBE):{        return  process_probe(        msg.from(), msg.data().probe, outgoing_buffer, qsz);  }
+    case    (msg::Type::PROBE_RET):{    return  process_probe_ret(    msg.from(), msg.data().probe_ret, outgoing_buffer, qsz);  }
+    case    (msg::Type::CYCLE):{        return  process_cycle(        msg.from(), msg.data().cycle, outgoing_buffer, qsz);  }
+    case    (msg::Type::CUT):{          return  process_cut(          msg.from(), msg.data().cut, outgoing_buffer, qsz);  }
+    case    (msg::Type::WARM_ACK):{     return  process_warm_ack(     msg.from(), msg.data().warm_ack, outgoing_buffer, qsz);  }
+    case    (msg::Type::WARM_DONE):{    return  process_warm_done(    msg.from(), msg.data().warm_done, outgoing_buffer, qsz);  }
+    case    (msg::Type::WARM_NACK):{    return  process_warm_nack(    msg.from(), msg.data().warm_nack, outgoing_buffer, qsz);  }
+    case    (msg::Type::CENTER):{       return  process_center(       msg.from(), msg.data().center, outgoing_buffer, qsz);  }
+    case    (msg::Type::SHED):{         return  process_shed(         msg.from(), msg.data().shed, outgoing_buffer, qsz);  }
+    case    (msg::Type::SHED_DONE):{    return  process_shed_done(    msg.from(), msg.data().shed_done, outgoing_buffer, qsz);  }
+    case    (msg::Type::CROWDED):{      return  process_crowded(      msg.from(), msg.data().crowded, outgoing_buffer, qsz);  }
+    case    (msg::Type::NOOP):{         return  process_noop(         msg.data().noop, outgoing_buffer , qsz); }
     default:{ return PROCESS_INVALID_TYPE; }
   }
   return OK;
@@ -175,22 +247,45 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_srch(  agent_t from, const msg::
   //grab the new partition information, since only one node / partition sends srch() msgs.
   agent_t leader = data.your_leader;
   level_t   level  = data.your_level;
+  //Fragments we absorbed at our old level are behind us now, so this time
+  //they are searched as our children (see process_join_us())
+  if (level > my_level){
+    for (size_t idx=0;idx<n_peers;idx++){ join_owed[idx]=false; }
+  }
   my_leader = leader;
   my_level  = level;
+  //the leader counted the partition before its last join, so we may know
+  //better, having been in a bigger one
+  if (data.your_size > fragment_size){
+    fragment_size = data.your_size;
+  }
   //also note our parent may have changed
   auto err = set_parent_id(from);
   if (OK!=err){return err;}
 
+  //If we were absorbed, our new parent may have asked IN_PART while we were
+  //behind. This SRCH is its answer, and it waits for our SRCH_RET instead.
+  if (from!=my_id){
+    err = set_response_required(from, false);
+    if (OK!=err){return err;}
+  }
+
   //initialize the best edge to a bad value for comparisons
   best_edge = worst_edge();
   best_edge.root = my_id;
+  best_rank = 0;
+  subtree_size = 1;
+  crowded = NO_AGENT;
+  crowded_degree = 0;
+  crowded_via = NO_AGENT;
+  for (size_t idx=0;idx<n_peers;idx++){ reach[idx]=0; ret_rank[idx]=0; }
 
   //we'll cache outgoing messages temporarily
   StaticQueue<Msg,BUF_SZ> srchbuf;
 
   //first broadcast the SRCH down the tree
   msg::Data to_send;
-  to_send.srch = SrchPayload{my_leader, my_level};
+  to_send.srch = SrchPayload{my_leader, my_level, fragment_size};
   size_t srch_sent=0;
   le::Errno srch_ret = mst_broadcast(msg::Type::SRCH, to_send, srchbuf,srch_sent);
   if (srch_ret!=OK){
@@ -200,12 +295,19 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_srch(  agent_t from, const msg::
   //then ping unknown edges
   //OPTIMIZATION: Ping neighbors in sorted order, rather than flooding
 
-  to_send.in_part = InPartPayload{my_leader, my_level};
+  to_send.in_part = InPartPayload{my_leader, my_level, fragment_size};
   size_t part_sent=0;
   le::Errno part_ret = typecast(status_t::UNKNOWN, msg::Type::IN_PART, to_send, srchbuf, part_sent);
   if (part_ret!=OK){
     return part_ret;
   }
+  //a link we owe a JOIN_US is still a candidate, and is pinged like any other
+  for (size_t idx=0;idx<n_peers;idx++){
+    if (join_owed[idx]){
+      srchbuf.push(Msg(peers[idx], my_id, msg::Type::IN_PART, to_send));
+      part_sent++;
+    }
+  }
 
   //remember who we sent to so we can wait for them:
   size_t srchbuf_sz = srchbuf.size();
@@ -219,6 +321,10 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_srch(  agent_t from, const msg::
   //
   //If that's the case, we can safely respond with "No MWOE" and that's it.
   if (srchbuf_sz == 0 && delayed_count() ==0){
+    //a leader with nobody to ask has no links at all, and is done
+    if (my_leader == my_id){
+      return process_noop(NoopPayload{fragment_size, my_id, degree_cost}, buf, qsz);
+    }
     return respond_no_mwoe(buf,qsz);
   }
 
@@ -256,11 +362,56 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_srch(  agent_t from, const msg::
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
 le::Errno GhsState<MAX_AGENTS, BUF_SZ>::respond_no_mwoe( StaticQueue<Msg, BUF_SZ> &buf, size_t & qsz)
 {
+  note_crowded();
+  return return_srch(SrchRetPayload{0, 0, WORST_METRIC, subtree_size, height()}, 0, buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::return_srch( const SrchRetPayload &ret, uint8_t rank, StaticQueue<Msg, BUF_SZ> &buf, size_t & qsz)
+{
+  //the degree cap rides in front of the SRCH_RET, over the same link, but
+  //only if there is something to tell: uncapped trees never send it
+  size_t crowd_sent=0;
+  if (crowded != NO_AGENT || rank != 0){
+    msg::Data crowd;
+    crowd.crowded = CrowdedPayload{crowded, crowded_degree, rank};
+    auto cr = mst_convergecast(msg::Type::CROWDED, crowd, buf, crowd_sent);
+    if (OK != cr){
+      return cr;
+    }
+  }
   msg::Data pld;
-  pld.srch_ret.to=0;
-  pld.srch_ret.from=0;
-  pld.srch_ret.metric = WORST_METRIC;
-  return mst_convergecast(msg::Type::SRCH_RET, pld, buf,qsz);
+  pld.srch_ret = ret;
+  auto sr = mst_convergecast(msg::Type::SRCH_RET, pld, buf, qsz);
+  qsz += crowd_sent;
+  return sr;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_crowded(  agent_t from, const CrowdedPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  //only our children say this, and only while we wait for their SRCH_RET
+  bool wf=false;
+  auto wfr = is_waiting_for(from,wf);
+  if (OK!=wfr){
+    return wfr;
+  }
+  if ( !wf ){
+    return UNEXPECTED_SRCH_RET;
+  }
+  size_t idx;
+  auto cio = checked_index_of(from, idx);
+  if (OK != cio){
+    return cio;
+  }
+  ret_rank[idx] = data.rank;
+  if (data.crowded != NO_AGENT && data.degree > crowded_degree){
+    crowded        = data.crowded;
+    crowded_degree = data.degree;
+    crowded_via    = from;
+  }
+  qsz=0;
+  return OK;
 }
 
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
@@ -285,6 +436,16 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_srch_ret(  agent_t from, const S
   if (OK != swfr ){
     return swfr;
   }
+  subtree_size += data.subtree_size;
+  size_t idx;
+  auto cio = checked_index_of(from, idx);
+  if (OK != cio){
+    return cio;
+  }
+  reach[idx] = data.height + 1;
+  //sent just before this, if at all (see process_crowded())
+  uint8_t rank = ret_rank[idx];
+  ret_rank[idx] = 0;
 
   //compare our best edge to their best edge
   //first, get their best edge
@@ -293,10 +454,11 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_srch_ret(  agent_t from, const S
   theirs.root        =  data.from;
   theirs.metric_val  =  data.metric;
 
-  if (theirs.metric_val < best_edge.metric_val){
+  if (beats_best(rank, theirs.metric_val)){
     best_edge.root        =  theirs.root;
     best_edge.peer        =  theirs.peer;
     best_edge.metric_val  =  theirs.metric_val;
+    best_rank             =  rank;
   }
 
   return check_search_status(buf,qsz);
@@ -308,12 +470,19 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_in_part(  agent_t from, const In
   //let them know if we're in their partition or not. Easy.
   agent_t part_id = data.leader;
 
+  //note the biggest partition around us, in case we are asked before we
+  //converge (see current_leader())
+  if (part_id != my_leader && data.size > largest_heard.size){
+    largest_heard = data;
+  }
+
   //except if they are *ahead* of us in the execution of their algorithm. That is, what if we
   //don't actually know if we are in their partition or not? This is detectable if their level > ours. 
   level_t their_level   = data.level;
   level_t our_level     = my_level;
 
-  if (their_level <= our_level){
+  //once we know our converged partition is final, whatever their level
+  if (their_level <= our_level || rooted){
     //They aren't behind, so we can respond
     if (part_id == this->my_leader){
       Msg to_send (from, my_id, AckPartPayload{});
@@ -326,7 +495,7 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_in_part(  agent_t from, const In
       qsz=1;
       return OK;
     } else {
-      Msg to_send (from, my_id, NackPartPayload{});
+      Msg to_send (from, my_id, NackPartPayload{degree()});
       buf.push (to_send); 
       qsz=1;
       return OK;
@@ -334,6 +503,10 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_in_part(  agent_t from, const In
   } else {
     respond_later(from, data);
     qsz=0;
+    //we may be the only ones left at our level
+    if (algorithm_converged){
+      return check_rooted(buf, qsz);
+    }
     return OK;
   }
 }
@@ -388,8 +561,10 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_nack_part(  agent_t from, const
     return PROCESS_NO_EDGE_FOUND;
   }
   
-  if (best_edge.metric_val > their_edge.metric_val){
+  uint8_t rank = rank_of(from, data.degree);
+  if (beats_best(rank, their_edge.metric_val)){
     best_edge = their_edge;
+    best_rank = rank;
   }
 
   auto swfr = set_waiting_for(from,false);
@@ -409,14 +584,16 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::check_search_status(StaticQueue<Msg,BUF_
     bool am_leader      = (my_leader == my_id);
     bool found_new_edge = (e.metric_val < WORST_METRIC);
     bool its_my_edge    = (mwoe().root == my_id);
+    note_crowded();
 
     if (!am_leader){
       //pass on results, no matter how bad
-      msg::Data send_data;
-      send_data.srch_ret = SrchRetPayload{e.peer, e.root, e.metric_val};
-      return mst_convergecast( msg::Type::SRCH_RET, send_data, buf, qsz);
+      return return_srch(SrchRetPayload{e.peer, e.root, e.metric_val, subtree_size, height()}, best_rank, buf, qsz);
     }
 
+    //everyone in the partition has answered
+    fragment_size = subtree_size;
+
     if (am_leader && found_new_edge && its_my_edge){
       if (e.peer == e.root){
         return BAD_MSG;
@@ -427,7 +604,27 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::check_search_status(StaticQueue<Msg,BUF_
 
     if (am_leader && !found_new_edge ){
       //I'm leader, no new edge, let's move on b/c we're done here
-      return process_noop( buf, qsz);
+      //
+      //Unless someone has too many tree edges: then the tree converges,
+      //if it has not, so that it answers the subtree we cut off, and the
+      //swaps start (see set_max_degree())
+      if (max_degree > 0 && crowded_degree > max_degree && !shedding){
+        size_t sent=0;
+        if (!algorithm_converged){
+          auto pnr = process_noop(NoopPayload{fragment_size, my_id, degree_cost, true}, buf, sent);
+          if (OK != pnr){
+            return pnr;
+          }
+        }
+        size_t shed=0;
+        auto psr = process_shed(my_id, ShedPayload{crowded}, buf, shed);
+        qsz = sent + shed;
+        return psr;
+      }
+      if (recenter){
+        return process_center(my_id, CenterPayload{0, fragment_size, degree_cost}, buf, qsz);
+      }
+      return process_noop(NoopPayload{fragment_size, my_id, degree_cost}, buf, qsz);
     }
 
     if (am_leader && found_new_edge && !its_my_edge){
@@ -454,7 +651,7 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::check_new_level( StaticQueue<Msg,BUF_SZ>
       agent_t who = peers[idx];
       InPartPayload &m = response_prompt[idx];
       level_t their_level = m.level; 
-      if (their_level <= get_level() )
+      if (their_level <= get_level() || rooted)
       {
         size_t sentsz=0;
         //ok to answer, they were waiting for us to catch up
@@ -528,8 +725,9 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_join_us(  agent_t from, const Jo
     if (join_lead == my_leader){
       return JOIN_MY_LEADER;
     }
-    //level can be same, lower (from another partition), but not higher (we shouldn't have replied)
-    if (join_level > my_level){
+    //level can be same, lower (from another partition), but not higher (we
+    //shouldn't have replied), unless we had converged, and answered anyway
+    if (join_level > my_level && !algorithm_converged){
       return JOIN_UNEXPECTED_REPLY;
     }  
     //found the correct edge
@@ -538,29 +736,49 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_join_us(  agent_t from, const Jo
     { 
       return ger; 
     }
+    //we found them in our partition once, but a repair (see drop_edge())
+    //has since cut them off, and they ask to be taken back
+    if (algorithm_converged && edge_to_other_part.status == DELETED){
+      edge_to_other_part.status = UNKNOWN;
+    }
   }
 
   //after all that, we found the edge
 
   if ( edge_to_other_part.status == MST){
     //we already absorbed once, so now we merge()
+    //If the link is MST because we absorbed them at our level, and then our
+    //search picked the same edge (with unique metrics it can be no other
+    //edge to them), then unlike the usual merge they have not heard from
+    //us, and wait for this JOIN_US to see the merge themselves.
+    size_t owed=0;
+    size_t idx;
+    if (in_initiating_partition && OK==checked_index_of(join_peer,idx) && join_owed[idx]){
+      join_owed[idx]=false;
+      buf.push(Msg(join_peer, my_id, data));
+      owed=1;
+    }
     auto leader_id = max(join_peer, join_root);
     my_leader = leader_id;
     my_level++;
+    //and anyone else we absorbed at the old level is now simply behind us
+    for (size_t i=0;i<n_peers;i++){ join_owed[i]=false; }
     if (leader_id == my_id){
       //In this case, we already sent JOIN_US (since it's an MST link), and if
       //they have not procssed that, they will soon enough. At that time, they
       //will see the link to us as MST (after all they sent JOIN_US -- this
       //msg), AND they will recognize our leader-hood. We advance in faith that
       //they will march along. 
-      return start_round(buf, qsz);
+      auto srr = start_round(buf, qsz);
+      qsz += owed;
+      return srr;
     } else {
       //In this case, we already sent JOIN_US (b/c it's an MST link), meaning
       //this came from THEM. If they rec'd ours first, then they know if they
       //are leader or not. if not, AND we're not leader, we're at deadlock
       //until they process our JOIN_US and see the MST link from their JOIN_US
       //request and recognize their own leader-hood. We wait. 
-      qsz=0;
+      qsz = owed;
       return OK;
     } 
   } else if (edge_to_other_part.status == UNKNOWN) {
@@ -585,7 +803,7 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_join_us(  agent_t from, const Jo
         //are a prime candidate to absorb into our partition. 
         //NOTE, if we were waiting for them, they would not respond until their
         //level is == ours, so this should never fail:
-        if (my_level < join_level){
+        if (my_level < join_level && !algorithm_converged){
           return JOIN_UNEXPECTED_REPLY;
         }
 
@@ -598,6 +816,44 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_join_us(  agent_t from, const Jo
         if (OK != sesr){
           return sesr;
         }
+
+        //If we have converged, no search of ours will ever reach them, so
+        //tell them what they have joined (see add_peer())
+        if (algorithm_converged){
+          Msg to_send(join_root, my_id, AbsorbedPayload{my_leader, my_level});
+          buf.push(to_send);
+          qsz=1;
+          return OK;
+        }
+
+        //If they are behind us and we are mid-search, we asked them IN_PART,
+        //and they put off answering. They never will: nothing else tells
+        //them our leader and level. So bring them into the search ourselves,
+        //and keep waiting on them, now for the SRCH_RET of their whole
+        //subtree. (If we are not searching yet, the SRCH that starts our
+        //search will reach them as a child. At our level, they answer the
+        //IN_PART as usual.)
+        bool wf=false;
+        auto wfr = is_waiting_for(join_root, wf);
+        if (OK != wfr){
+          return wfr;
+        }
+        if (wf && join_level < my_level){
+          Msg to_send(join_root, my_id, SrchPayload{my_leader, my_level, fragment_size});
+          buf.push(to_send);
+          qsz=1;
+          return OK;
+        }
+        //At our level, they may have told some of us they are not in our
+        //partition during this search. Taking them in now would make those
+        //answers wrong, so they only join our searches once we move past
+        //their level; until then, the link is searched like an UNKNOWN one.
+        if (join_level == my_level){
+          size_t idx;
+          if (OK==checked_index_of(join_root,idx)){
+            join_owed[idx]=true;
+          }
+        }
         
         //Anyway, because we aren't in the initiating partition, the other guy
         //already has us marked MST, so we don't need to do anything.  -- a
@@ -616,9 +872,710 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_join_us(  agent_t from, const Jo
 }
 
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
-le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_noop(StaticQueue<Msg,BUF_SZ> &buf, size_t &qsz){
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_absorbed(  agent_t from, const AbsorbedPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  //we (or the one we pass this on from) asked to join them over this link
+  Edge to_them;
+  auto ger = get_edge(from, to_them);
+  if (OK != ger){
+    return ger;
+  }
+  if (to_them.status != MST && to_them.status != MST_PARENT){
+    return PROCESS_REQ_MST;
+  }
+
+  my_leader = data.leader;
+  my_level  = data.level;
+  auto spr = set_parent_id(from);
+  if (OK != spr){
+    return spr;
+  }
+  //if we led a subtree that a swap cut off, the swap is over, and the
+  //leader hears what it cost
+  bool swapped = shed_from != NO_AGENT;
+  ShedDonePayload done{best_edge.metric_val, 0};
+  if (swapped){
+    auto gem = get_edge_metric(shed_from, done.removed);
+    if (OK != gem){
+      return gem;
+    }
+  }
+  shedding  = false;
+  shed_from = NO_AGENT;
+  //our search is long over, and anyone that joined us at our level is now
+  //simply our child
+  for (size_t idx=0;idx<n_peers;idx++){
+    waiting_for_response[idx]=false;
+    join_owed[idx]=false;
+  }
+  best_edge = worst_edge();
+  best_rank = 0;
+  algorithm_converged = true;
+
+  size_t sent=0;
+  msg::Data to_send;
+  to_send.absorbed = data;
+  auto mbr = mst_broadcast(msg::Type::ABSORBED, to_send, buf, sent);
+  if (OK != mbr){
+    return mbr;
+  }
+  //and anyone we put off can have their answer now, or once we know the
+  //tree we joined is whole
+  size_t answered=0;
+  auto cnl = check_new_level(buf, answered);
+  if (OK != cnl){
+    return cnl;
+  }
+  size_t probed=0;
+  if (delayed_count() > 0){
+    auto crr = check_rooted(buf, probed);
+    if (OK != crr){
+      return crr;
+    }
+  }
+  size_t reported=0;
+  if (swapped){
+    auto psd = process_shed_done(my_id, done, buf, reported);
+    if (OK != psd){
+      return psd;
+    }
+  }
+  qsz = sent + answered + probed + reported;
+  return OK;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_repair(  agent_t from, const RepairPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  //like SRCH, we send this to ourselves when we lose our parent
+  if (from != my_id){
+    Edge to_them;
+    auto ger = get_edge(from, to_them);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_them.status != MST && to_them.status != MST_PARENT){
+      return PROCESS_REQ_MST;
+    }
+  }
+
+  my_leader = data.leader;
+  my_level  = data.level;
+  shedding  = data.shed;
+  if (!data.shed){
+    shed_from = NO_AGENT;
+  }
+  //we have lost part of the tree, and do not know how much yet
+  fragment_size = 1;
+  largest_heard = InPartPayload{NO_AGENT, LEVEL_START, 0};
+  algorithm_converged = false;
+  rooted = false;
+  probe_sent = false;
+  auto spr = set_parent_id(from);
+  if (OK != spr){
+    return spr;
+  }
+
+  //whoever we found in our partition may now be in another, so ask again,
+  //unless they are gone
+  best_edge = worst_edge();
+  best_rank = 0;
+  for (size_t idx=0;idx<n_peers;idx++){
+    waiting_for_response[idx]=false;
+    join_owed[idx]=false;
+    probed_by[idx]=false;
+    if (outgoing_edges[idx].status == DELETED && !lost[idx]){
+      outgoing_edges[idx].status = UNKNOWN;
+    }
+  }
+
+  //nobody in the subtree may search until all of it has the new leader, or
+  //it would tell itself it is not in its own partition
+  StaticQueue<Msg,BUF_SZ> repairbuf;
+  msg::Data to_send;
+  to_send.repair = data;
+  size_t sent=0;
+  auto mbr = mst_broadcast(msg::Type::REPAIR, to_send, repairbuf, sent);
+  if (OK != mbr){
+    return mbr;
+  }
+  for (size_t i=0;i<sent;i++){
+    Msg m;
+    repairbuf.pop(m);
+    auto swr = set_waiting_for(m.to(), true);
+    if (OK != swr){
+      return swr;
+    }
+    buf.push(m);
+  }
+  if (sent > 0){
+    qsz = sent;
+    return OK;
+  }
+  return check_repair_status(buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_repair_ack(  agent_t from, const RepairAckPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  bool wf=false;
+  auto wfr = is_waiting_for(from,wf);
+  if (OK!=wfr){
+    return wfr;
+  }
+  if (!wf){
+    return ACK_NOT_WAITING;
+  }
+  auto swfr = set_waiting_for(from, false);
+  if (OK != swfr){
+    return swfr;
+  }
+  return check_repair_status(buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::check_repair_status( StaticQueue<Msg,BUF_SZ> &buf, size_t & qsz){
+  if (waiting_count() != 0){
+    qsz=0;
+    return OK;
+  }
+  if (my_leader == my_id){
+    return process_srch(my_id, SrchPayload{my_leader, my_level, fragment_size}, buf, qsz);
+  }
+  buf.push(Msg(get_parent_id(), my_id, RepairAckPayload{}));
+  qsz=1;
+  return OK;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_noop(const NoopPayload &data, StaticQueue<Msg,BUF_SZ> &buf, size_t &qsz){
   algorithm_converged=true;
-  return mst_broadcast(msg::Type::NOOP, {},buf, qsz);
+  if (data.size > 0){
+    fragment_size = data.size;
+  }
+  degree_cost = data.cost;
+  swapping    = data.swapping;
+  //the leader may have moved since the last search (see process_center())
+  my_leader = data.leader;
+  msg::Data to_send;
+  to_send.noop = data;
+  auto mbr = mst_broadcast(msg::Type::NOOP, to_send, buf, qsz);
+  if (OK != mbr || delayed_count() == 0){
+    return mbr;
+  }
+  //someone got ahead of us, and now we are done, they can have their answer
+  size_t probed=0;
+  auto crr = check_rooted(buf, probed);
+  qsz += probed;
+  return crr;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::check_rooted(StaticQueue<Msg,BUF_SZ> &buf, size_t &qsz){
+  qsz=0;
+  if (!algorithm_converged || probe_sent){
+    return OK;
+  }
+  if (!rooted && my_leader != my_id){
+    buf.push(Msg(get_parent_id(), my_id, ProbePayload{}));
+    probe_sent=true;
+    qsz=1;
+    return OK;
+  }
+
+  //we are the leader, or have heard from it: tell whoever asked, and
+  //answer whoever we put off
+  rooted=true;
+  for (size_t idx=0;idx<n_peers;idx++){
+    if (probed_by[idx]){
+      probed_by[idx]=false;
+      buf.push(Msg(peers[idx], my_id, ProbeRetPayload{}));
+      qsz++;
+    }
+  }
+  size_t answered=0;
+  auto cnl = check_new_level(buf, answered);
+  qsz += answered;
+  return cnl;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_probe(  agent_t from, const ProbePayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  size_t idx;
+  auto cio = checked_index_of(from, idx);
+  if (OK != cio){
+    return cio;
+  }
+  if (outgoing_edges[idx].status != MST){
+    return PROCESS_REQ_MST;
+  }
+  //we are being repaired, and so they will be, too
+  if (!algorithm_converged){
+    qsz=0;
+    return OK;
+  }
+  probed_by[idx]=true;
+  return check_rooted(buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_probe_ret(  agent_t from, const ProbeRetPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  Edge to_them;
+  auto ger = get_edge(from, to_them);
+  if (OK != ger){
+    return ger;
+  }
+  if (to_them.status != MST_PARENT){
+    return PROCESS_REQ_MST;
+  }
+  //it answers for a tree we have since left
+  if (!algorithm_converged || !probe_sent){
+    qsz=0;
+    return OK;
+  }
+  probe_sent=false;
+  rooted=true;
+  return check_rooted(buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_cycle(  agent_t from, const CyclePayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  if (from != my_id){
+    Edge to_them;
+    auto ger = get_edge(from, to_them);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_them.status != MST && to_them.status != MST_PARENT){
+      return PROCESS_REQ_MST;
+    }
+
+    //we closed the cycle: the edge that asked belongs in the tree instead
+    //of the heaviest one on the path, if it is lighter
+    if (data.target == my_id){
+      Edge across;
+      auto ger = get_edge(data.origin, across);
+      if (OK != ger){
+        return ger;
+      }
+      if (data.heaviest > across.metric_val){
+        return process_cut(my_id, CutPayload{data.heavy_parent, data.heavy_child}, buf, qsz);
+      }
+      return OK;
+    }
+  }
+
+  //only one way through the tree leads to the target, but we do not know
+  //which, so try them all, noting the heaviest edge on each
+  for (size_t idx=0;idx<n_peers;idx++){
+    const Edge &e = outgoing_edges[idx];
+    if ((e.status != MST && e.status != MST_PARENT) || e.peer == from){
+      continue;
+    }
+    CyclePayload to_send = data;
+    if (e.metric_val > to_send.heaviest){
+      to_send.heaviest     = e.metric_val;
+      to_send.heavy_parent = e.status == MST ? my_id  : e.peer;
+      to_send.heavy_child  = e.status == MST ? e.peer : my_id;
+    }
+    buf.push(Msg(e.peer, my_id, to_send));
+    qsz++;
+  }
+  return OK;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_cut(  agent_t from, const CutPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  if (from != my_id){
+    Edge to_them;
+    auto ger = get_edge(from, to_them);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_them.status != MST && to_them.status != MST_PARENT){
+      return PROCESS_REQ_MST;
+    }
+  }
+
+  //our parent let go of us, so we lead our subtree back, maybe over the
+  //same edge
+  if (my_id == data.child && from == data.parent){
+    auto ses = set_edge_status(from, UNKNOWN);
+    if (OK != ses){
+      return ses;
+    }
+    //if it did so to cap its degree, we search a level up, so that only
+    //agents that know their tree is final answer us, and we rank the way
+    //back last but one (see set_max_degree())
+    if (data.shed){
+      shed_from = from;
+      return process_repair(my_id, RepairPayload{my_id, my_level+1, true}, buf, qsz);
+    }
+    return process_repair(my_id, RepairPayload{my_id, my_level, false}, buf, qsz);
+  }
+
+  //we let go of our child first, so that we answer its search like
+  //anyone else's
+  if (my_id == data.parent){
+    Edge to_child;
+    auto ger = get_edge(data.child, to_child);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_child.status != MST){
+      return OK;
+    }
+    auto ses = set_edge_status(data.child, UNKNOWN);
+    if (OK != ses){
+      return ses;
+    }
+    buf.push(Msg(data.child, my_id, data));
+    qsz=1;
+    return OK;
+  }
+
+  //pass it on until it finds the parent end
+  for (size_t idx=0;idx<n_peers;idx++){
+    const Edge &e = outgoing_edges[idx];
+    if ((e.status == MST || e.status == MST_PARENT) && e.peer != from){
+      buf.push(Msg(e.peer, my_id, data));
+      qsz++;
+    }
+  }
+  return OK;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_warm_ack(  agent_t from, const WarmAckPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  //we already gave up on the hints, and they will, too
+  if (!warm){
+    return OK;
+  }
+  size_t idx;
+  auto cio = checked_index_of(from, idx);
+  if (OK != cio){
+    return cio;
+  }
+  if (outgoing_edges[idx].status != MST || data.leader != my_leader || data.level != my_level){
+    return fall_back(buf, qsz);
+  }
+  if (!waiting_for_response[idx]){
+    return OK;
+  }
+  waiting_for_response[idx]=false;
+  subtree_size += data.subtree_size;
+  return check_warm_status(buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_warm_done(  agent_t from, const WarmDonePayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  if (!warm){
+    return OK;
+  }
+  Edge to_them;
+  auto ger = get_edge(from, to_them);
+  if (OK != ger){
+    return ger;
+  }
+  if (to_them.status != MST_PARENT){
+    return fall_back(buf, qsz);
+  }
+  //the hints are spent: later repairs and stray WARM_NACKs must not undo the tree
+  hinted=false;
+  warm=false;
+  algorithm_converged=true;
+  rooted=true;
+  fragment_size = data.size;
+  msg::Data to_send;
+  to_send.warm_done = data;
+  return mst_broadcast(msg::Type::WARM_DONE, to_send, buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_warm_nack(  agent_t from, const WarmNackPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  //we were never warm, or have already passed it on
+  if (!hinted){
+    return OK;
+  }
+  return fall_back(buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::check_warm_status( StaticQueue<Msg,BUF_SZ> &buf, size_t & qsz){
+  qsz=0;
+  if (waiting_count() != 0){
+    return OK;
+  }
+  if (my_leader != my_id){
+    buf.push(Msg(get_parent_id(), my_id, WarmAckPayload{my_leader, my_level, subtree_size}));
+    qsz=1;
+    return OK;
+  }
+  //nothing has changed since the tree was the MST, so it still is
+  hinted=false;
+  warm=false;
+  algorithm_converged=true;
+  rooted=true;
+  fragment_size = subtree_size;
+  msg::Data to_send;
+  to_send.warm_done = WarmDonePayload{fragment_size};
+  return mst_broadcast(msg::Type::WARM_DONE, to_send, buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::fall_back( StaticQueue<Msg,BUF_SZ> &buf, size_t & qsz){
+  hinted=false;
+  warm=false;
+  my_leader=my_id;
+  my_level=LEVEL_START;
+  subtree_size=1;
+  fragment_size=1;
+  largest_heard=InPartPayload{NO_AGENT, LEVEL_START, 0};
+  algorithm_converged=false;
+  rooted=false;
+  probe_sent=false;
+  best_edge=worst_edge();
+  size_t sent=0;
+  for (size_t idx=0;idx<n_peers;idx++){
+    waiting_for_response[idx]=false;
+    response_required[idx]=false;
+    join_owed[idx]=false;
+    probed_by[idx]=false;
+    if (lost[idx]){
+      continue;
+    }
+    outgoing_edges[idx].status=UNKNOWN;
+    //before anything else we send them, so they fall back first
+    buf.push(Msg(peers[idx], my_id, WarmNackPayload{}));
+    sent++;
+  }
+  size_t started=0;
+  auto srr = start_round(buf, started);
+  qsz = sent + started;
+  return srr;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_center(  agent_t from, const CenterPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  //like SRCH, the leader sends this to itself, once the last search is back
+  if (from != my_id){
+    Edge to_them;
+    auto ger = get_edge(from, to_them);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_them.status != MST_PARENT){
+      return PROCESS_REQ_MST;
+    }
+  }
+  fragment_size = data.size;
+  degree_cost   = data.cost;
+
+  //the child that reaches furthest, and the furthest any other does
+  size_t far = n_peers;
+  uint32_t first=0, second=0;
+  for (size_t idx=0;idx<n_peers;idx++){
+    if (outgoing_edges[idx].status != MST){
+      continue;
+    }
+    if (reach[idx] > first){
+      second = first;
+      first = reach[idx];
+      far = idx;
+    } else if (reach[idx] > second){
+      second = reach[idx];
+    }
+  }
+
+  //The longest path from here is max(up, first). From there, it would be
+  //max(first-1, 1+max(up, second)), so go if that is shorter
+  uint32_t there_up = 1 + std::max(data.up, second);
+  if (far < n_peers && std::max(first-1, there_up) < std::max(data.up, first)){
+    auto spr = set_parent_id(peers[far]);
+    if (OK != spr){
+      return spr;
+    }
+    buf.push(Msg(peers[far], my_id, CenterPayload{there_up, fragment_size, degree_cost}));
+    qsz=1;
+    return OK;
+  }
+
+  //we are the center
+  auto spr = set_parent_id(my_id);
+  if (OK != spr){
+    return spr;
+  }
+  my_leader = my_id;
+  return process_noop(NoopPayload{fragment_size, my_id, degree_cost}, buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+uint32_t GhsState<MAX_AGENTS, BUF_SZ>::height() const
+{
+  uint32_t h=0;
+  for (size_t idx=0;idx<n_peers;idx++){
+    h = std::max(h, reach[idx]);
+  }
+  return h;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+void GhsState<MAX_AGENTS, BUF_SZ>::set_recenter(bool on)
+{
+  recenter = on;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_shed(  agent_t from, const ShedPayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  //like SRCH, the leader sends this to itself, once a search comes back empty
+  if (from != my_id){
+    Edge to_them;
+    auto ger = get_edge(from, to_them);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_them.status != MST_PARENT){
+      return PROCESS_REQ_MST;
+    }
+  }
+
+  //pass it on the way our search heard of them
+  if (data.target != my_id){
+    size_t idx;
+    if (OK == checked_index_of(crowded_via, idx) && outgoing_edges[idx].status == MST){
+      buf.push(Msg(crowded_via, my_id, data));
+      qsz=1;
+      return OK;
+    }
+    //the tree changed since, so the leader had better look again
+    return process_shed_done(my_id, ShedDonePayload{0, 0}, buf, qsz);
+  }
+
+  //the heaviest child is the one most likely to have a way round it that
+  //costs little
+  size_t heavy = n_peers;
+  for (size_t idx=0;idx<n_peers;idx++){
+    if (outgoing_edges[idx].status != MST || shed_tried[idx]){
+      continue;
+    }
+    if (heavy == n_peers || outgoing_edges[idx].metric_val > outgoing_edges[heavy].metric_val){
+      heavy = idx;
+    }
+  }
+  if (heavy == n_peers){
+    return process_shed_done(my_id, ShedDonePayload{0, 0}, buf, qsz);
+  }
+  shed_tried[heavy] = true;
+  return process_cut(my_id, CutPayload{my_id, peers[heavy], true}, buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::process_shed_done(  agent_t from, const ShedDonePayload &data, StaticQueue<Msg,BUF_SZ>&buf, size_t & qsz)
+{
+  qsz=0;
+  if (from != my_id){
+    Edge to_them;
+    auto ger = get_edge(from, to_them);
+    if (OK != ger){
+      return ger;
+    }
+    if (to_them.status != MST){
+      return PROCESS_REQ_MST;
+    }
+  }
+  if (my_leader != my_id){
+    buf.push(Msg(get_parent_id(), my_id, data));
+    qsz=1;
+    return OK;
+  }
+  //the tree is no lighter than the MST, so this never wraps round, even
+  //if the edge that came back is lighter than the one that went
+  degree_cost = degree_cost + data.added - data.removed;
+  //count the degrees again, which ends in the next swap, or the last NOOP
+  return process_srch(my_id, SrchPayload{my_leader, my_level, fragment_size}, buf, qsz);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+uint32_t GhsState<MAX_AGENTS, BUF_SZ>::degree() const
+{
+  uint32_t d=0;
+  for (size_t idx=0;idx<n_peers;idx++){
+    if (outgoing_edges[idx].status == MST || outgoing_edges[idx].status == MST_PARENT){
+      d++;
+    }
+  }
+  return d;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+void GhsState<MAX_AGENTS, BUF_SZ>::note_crowded()
+{
+  uint32_t d = degree();
+  if (max_degree == 0 || d <= max_degree || d <= crowded_degree){
+    return;
+  }
+  for (size_t idx=0;idx<n_peers;idx++){
+    if (outgoing_edges[idx].status == MST && !shed_tried[idx]){
+      crowded        = my_id;
+      crowded_degree = d;
+      crowded_via    = my_id;
+      return;
+    }
+  }
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+uint8_t GhsState<MAX_AGENTS, BUF_SZ>::rank_of(agent_t to, uint32_t their_degree) const
+{
+  if (!shedding){
+    return 0;
+  }
+  if (to == shed_from){
+    return 1;
+  }
+  if (degree() >= max_degree || their_degree >= max_degree){
+    return 2;
+  }
+  return 0;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+bool GhsState<MAX_AGENTS, BUF_SZ>::beats_best(uint8_t rank, metric_t m) const
+{
+  if (m == WORST_METRIC){
+    return false;
+  }
+  if (best_edge.metric_val == WORST_METRIC){
+    return true;
+  }
+  return rank < best_rank || (rank == best_rank && m < best_edge.metric_val);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+void GhsState<MAX_AGENTS, BUF_SZ>::set_max_degree(uint32_t cap)
+{
+  max_degree = cap;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+metric_t GhsState<MAX_AGENTS, BUF_SZ>::get_degree_cost() const
+{
+  return degree_cost;
 }
 
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
@@ -648,7 +1605,8 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::mst_broadcast(const msg::Type m, const m
     if (e.root!=my_id){
       return CAST_INVALID_EDGE;
     }
-    if (e.status == MST ){
+    //they joined us at our level, but are not our children until they hear from us
+    if (e.status == MST && !join_owed[idx]){
       sent++;
       Msg to_send( e.peer, my_id, m, data);
       buf.push( to_send );
@@ -745,7 +1703,21 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::set_level(const level_t & l){
 
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
 bool GhsState<MAX_AGENTS, BUF_SZ>::is_converged() const {
-  return algorithm_converged;
+  //the tree is final, but for the swaps, only once they are done
+  return algorithm_converged && !swapping;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::current_leader(LeaderEstimate &out) const {
+  out = LeaderEstimate{my_leader, my_level, fragment_size};
+  if (is_converged()){
+    return OK;
+  }
+  //they may since have joined us, or we them, but if not, most agents follow them
+  if (largest_heard.leader != NO_AGENT && largest_heard.leader != my_leader && largest_heard.size > fragment_size){
+    out = LeaderEstimate{largest_heard.leader, largest_heard.level, largest_heard.size};
+  }
+  return PARTIAL_RESULT;
 }
 
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
@@ -912,6 +1884,144 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::set_edge_metric(const agent_t &to, const
 }
 
 
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::add_peer(const Edge &e)
+{
+  if (has_edge(e.peer)){
+    return SET_INVALID_EDGE;
+  }
+  Edge fresh = e;
+  fresh.status = UNKNOWN;
+  return set_edge(fresh);
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::update_edge_metric(const agent_t &to, const metric_t m, StaticQueue<Msg,BUF_SZ> &buf, size_t &qsz)
+{
+  qsz=0;
+  size_t idx;
+  le::Errno retcode=checked_index_of(to,idx);
+  if (retcode!=OK){return retcode;}
+  if (!is_valid(m)){
+    return SET_INVALID_EDGE_METRIC;
+  }
+  if (!algorithm_converged){
+    return UPDATE_REQ_CONVERGED;
+  }
+
+  metric_t was    = outgoing_edges[idx].metric_val;
+  status_t status = outgoing_edges[idx].status;
+  outgoing_edges[idx].metric_val = m;
+
+  //a tree edge that got worse: there may be a lighter way around it, which
+  //its subtree finds if we let go of it
+  if (status == MST && m > was){
+    return process_cut(my_id, CutPayload{my_id, to}, buf, qsz);
+  }
+
+  //an edge outside the tree that got better: it belongs in the tree if
+  //it is lighter than some edge on the tree path between us, which only
+  //one of us has to find out
+  bool in_tree = status == MST || status == MST_PARENT;
+  if (!in_tree && !lost[idx] && m < was && my_id < to){
+    return process_cycle(my_id, CyclePayload{to, my_id, NO_AGENT, NO_AGENT, METRIC_NOT_SET}, buf, qsz);
+  }
+  return OK;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::set_hints(const Edge* hints, size_t num_hints, agent_t leader, level_t level)
+{
+  //whatever happens, we start from scratch unless they all check out
+  hinted=true;
+  warm=false;
+  for (size_t idx=0;idx<n_peers;idx++){
+    outgoing_edges[idx].status=UNKNOWN;
+  }
+
+  //every edge we have, as it was, and a parent unless we led
+  bool ok = leader != NO_AGENT && num_hints == n_peers;
+  size_t parents=0;
+  for (size_t h=0;ok && h<num_hints;h++){
+    size_t idx;
+    const Edge &e = hints[h];
+    ok = e.root == my_id && OK == checked_index_of(e.peer, idx)
+      && outgoing_edges[idx].status == UNKNOWN
+      && outgoing_edges[idx].metric_val == e.metric_val
+      && (e.status == MST || e.status == MST_PARENT || e.status == DELETED);
+    if (ok){
+      outgoing_edges[idx].status = e.status;
+      parents += e.status == MST_PARENT;
+    }
+  }
+  ok = ok && parents == (leader == my_id ? 0u : 1u);
+  if (!ok){
+    for (size_t idx=0;idx<n_peers;idx++){
+      outgoing_edges[idx].status=UNKNOWN;
+    }
+    return HINT_MISMATCH;
+  }
+
+  warm=true;
+  my_leader=leader;
+  my_level=level;
+  subtree_size=1;
+  //our children confirm before we do, and may well do so before we start
+  for (size_t idx=0;idx<n_peers;idx++){
+    waiting_for_response[idx] = outgoing_edges[idx].status == MST;
+  }
+  return OK;
+}
+
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+le::Errno GhsState<MAX_AGENTS, BUF_SZ>::drop_edge(const agent_t &who, StaticQueue<Msg,BUF_SZ> &buf, size_t &qsz)
+{
+  qsz=0;
+  size_t idx;
+  le::Errno retcode=checked_index_of(who,idx);
+  if (retcode!=OK){return retcode;}
+
+  //we cannot confirm the hints without them, so start from scratch
+  if (warm){
+    outgoing_edges[idx].status = DELETED;
+    lost[idx]                  = true;
+    return fall_back(buf, qsz);
+  }
+
+  status_t was     = outgoing_edges[idx].status;
+  bool was_waiting = waiting_for_response[idx];
+
+  outgoing_edges[idx].status = DELETED;
+  waiting_for_response[idx]  = false;
+  response_required[idx]     = false;
+  join_owed[idx]             = false;
+  lost[idx]                  = true;
+
+  //a converged tree only has to find the way back to the leader, if that
+  //was our way to it
+  if (algorithm_converged){
+    if (was == MST_PARENT){
+      return process_repair(my_id, RepairPayload{my_id, my_level, false}, buf, qsz);
+    }
+    return OK;
+  }
+
+  //our partition (or the one we are about to join) is held together by
+  //that edge, and nothing but a new election puts it back together
+  if (was == MST || was == MST_PARENT){
+    return DROP_REQ_RESTART;
+  }
+  if (best_edge.root == my_id && best_edge.peer == who){
+    return DROP_REQ_RESTART;
+  }
+
+  if (was_waiting){
+    //they will never answer our IN_PART, so finish the search without them
+    return check_search_status(buf,qsz);
+  }
+  return OK;
+}
+
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
 le::Errno GhsState<MAX_AGENTS, BUF_SZ>::set_edge(const Edge &e) {
 
@@ -945,9 +2055,21 @@ le::Errno GhsState<MAX_AGENTS, BUF_SZ>::set_edge(const Edge &e) {
   else if (NO_SUCH_PEER == er)
   {
     //don't have em (yet)
-    if (n_peers>=MAX_AGENTS){
+    if (MAX_AGENTS>0 && n_peers>=MAX_AGENTS){
       return TOO_MANY_AGENTS;
     }
+    //no-op for fixed storage, which reset() already cleared
+    peer_storage_grow(peers, n_peers+1);
+    peer_storage_grow(outgoing_edges, n_peers+1);
+    peer_storage_grow(waiting_for_response, n_peers+1);
+    peer_storage_grow(response_required, n_peers+1);
+    peer_storage_grow(response_prompt, n_peers+1);
+    peer_storage_grow(join_owed, n_peers+1);
+    peer_storage_grow(lost, n_peers+1);
+    peer_storage_grow(probed_by, n_peers+1);
+    peer_storage_grow(reach, n_peers+1);
+    peer_storage_grow(shed_tried, n_peers+1);
+    peer_storage_grow(ret_rank, n_peers+1);
     peers[n_peers]=e.peer;
     outgoing_edges[n_peers] = e;
     n_peers++;
@@ -987,8 +2109,37 @@ size_t GhsState<MAX_AGENTS, BUF_SZ>::delayed_count() const
   return delayed;
 }
 
+template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
+size_t GhsState<MAX_AGENTS, BUF_SZ>::mst_children(agent_t *out, size_t cap) const
+{
+  size_t n=0;
+  for (size_t i=0;i<n_peers;i++){
+    //the edge to our parent is MST_PARENT, so MST edges lead to children
+    if (outgoing_edges[i].status==MST){
+      if (n<cap){
+        out[n]=outgoing_edges[i].peer;
+      }
+      n++;
+    }
+  }
+  return n;
+}
+
 template <std::size_t MAX_AGENTS, std::size_t BUF_SZ>
 agent_t GhsState<MAX_AGENTS, BUF_SZ>::get_id() const {
   return my_id;
 }
 
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+le::Errno tree_links(const GhsState<NUM_AGENTS,MSG_Q_SIZE> &s, agent_t &id, agent_t &parent, std::vector<agent_t> &children)
+{
+  if (!s.is_converged()){
+    return PARTIAL_RESULT;
+  }
+  std::vector<agent_t> kids(s.get_n_peers());
+  kids.resize(s.mst_children(kids.data(), kids.size()));
+  id=s.get_id();
+  parent=s.get_parent_id();
+  children.swap(kids);
+  return OK;
+}
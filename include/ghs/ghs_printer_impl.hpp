@@ -56,8 +56,12 @@ std::string  dump_edges(const le::ghs::GhsState<A,B> &s) {
   Edge mwoe = s.mwoe();
   ss<<" m:"<<mwoe.peer;
   ss<<" mw:"<<mwoe.metric_val;
-  for (std::size_t i=0;i<A;i++){
+  //with dynamic storage (A==0) there's no bound on the ids, so stop once
+  //every peer has been printed
+  std::size_t seen=0;
+  for (std::size_t i=0; A>0 ? i<A : seen<s.get_n_peers(); i++){
     if (s.has_edge(i)){
+      seen++;
       Edge e;
       if (OK!=s.get_edge((agent_t)i,e)){
         ss<<"Err: "<<i;
@@ -0,0 +1,189 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file health.h
+ *
+ * @brief Provides le::ghs::TreeHealth, which sums up which agents are alive along the MST
+ *
+ */
+
+#ifndef GHS_HEALTH
+#define GHS_HEALTH
+
+#include "ghs/agent.h"
+#include "ghs/ghs.h"
+#include "le/errno.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace le{
+  namespace ghs{
+
+    /// How many missing agents a HealthReport names. More than this are only counted.
+    const size_t HEALTH_MAX_MISSING=8;
+
+    /**
+     * @brief What one agent knows about the health of its subtree of the MST
+     *
+     * Every agent sends one of these to its parent each period, so the root
+     * receives a summary of the whole tree that is the same size no matter
+     * how many agents there are. It holds no pointers, so it can be sent as
+     * raw bytes, like Msg.
+     */
+    struct HealthReport
+    {
+      /// Counts the reports the sender has made, starting at 1
+      uint32_t seq=0;
+      /// The agents in the subtree that are alive, including the sender
+      uint32_t n_alive=0;
+      /// The agents in the subtree that have not been heard from within the time limit (see TreeHealth)
+      uint32_t n_missing=0;
+      /// How old the stalest news from a live agent in the subtree is, in ms. The oldest last-seen time is the time of the report, less this.
+      uint32_t oldest_ms=0;
+      /// The first HEALTH_MAX_MISSING agents that have gone missing, padded with NO_AGENT. Each is the root of a subtree that went missing with it.
+      agent_t missing[HEALTH_MAX_MISSING]={NO_AGENT,NO_AGENT,NO_AGENT,NO_AGENT,NO_AGENT,NO_AGENT,NO_AGENT,NO_AGENT};
+    };
+
+    /**
+     * @brief Aggregates liveness up a converged MST by periodic convergecast
+     *
+     * Rather than every agent telling the leader it is alive, which is N
+     * messages per period into one agent, each agent calls report() once a
+     * period and sends the result to its parent, which hands it to
+     * receive(). report() folds in the latest report from each child, so
+     * each agent sends one message per period, and the root's own report()
+     * is the health of the whole tree.
+     *
+     * A child that has not reported for `miss_after_ms` is missing, along
+     * with every agent its last report counted. This reads no clock: the
+     * caller passes the time in, in ms from any fixed point.
+     *
+     * ```
+     * TreeHealth health;
+     * health.reset(ghs, 3*period_ms, now_ms());
+     * //every period:
+     * HealthReport r = health.report(now_ms());
+     * if (health.is_root()) { print(r); } else { send(health.get_parent_id(), r); }
+     * //on a report from a child:
+     * health.receive(from, r, now_ms());
+     * ```
+     */
+    class TreeHealth
+    {
+      public:
+        /// A lone root with no children, until reset()
+        TreeHealth();
+
+        /**
+         * Forgets all reports and starts over on the given tree. Children
+         * that have not reported yet are counted alive until `miss_after_ms`
+         * has passed since `now_ms`.
+         *
+         * @param my_id this agent
+         * @param parent our parent in the MST, or my_id if we are the root
+         * @param children our children in the MST
+         * @param n_children how many ids `children` holds
+         * @param miss_after_ms how long a child may go without reporting before it is missing
+         * @param now_ms the time now
+         * @return le::Errno OK if successful
+         * @return le::Errno SET_INVALID_EDGE_NO_AGENT if any id is not valid
+         * @return le::Errno SET_INVALID_EDGE_SELF_LOOP if a child is my_id
+         */
+        le::Errno reset(agent_t my_id, agent_t parent, const agent_t *children, size_t n_children, uint32_t miss_after_ms, uint64_t now_ms);
+
+        /**
+         * Starts over on the MST that `s` converged on.
+         *
+         * @return le::Errno PARTIAL_RESULT if `s` has not converged (and nothing is changed)
+         * @see reset()
+         */
+        template <std::size_t A, std::size_t B>
+        le::Errno reset(const GhsState<A,B> &s, uint32_t miss_after_ms, uint64_t now_ms){
+          agent_t id, par;
+          std::vector<agent_t> kids;
+          auto tl = tree_links(s, id, par, kids);
+          if (OK != tl){
+            return tl;
+          }
+          return reset(id, par, kids.data(), kids.size(), miss_after_ms, now_ms);
+        }
+
+        /**
+         * Keeps a report from a child, replacing the last one.
+         *
+         * @return le::Errno OK if successful
+         * @return le::Errno PROCESS_SELFMSG if `from` is this agent
+         * @return le::Errno NO_SUCH_PEER if `from` is not one of our children
+         */
+        le::Errno receive(agent_t from, const HealthReport &r, uint64_t now_ms);
+
+        /**
+         * Sums up our subtree from the latest report of each child: ours to
+         * send to our parent, or, at the root, the health of the whole tree.
+         */
+        HealthReport report(uint64_t now_ms);
+
+        /// @return true if we have no parent, so report() covers every agent
+        bool is_root() const { return parent==my_id; }
+
+        /// @return our parent in the MST (my_id at the root)
+        agent_t get_parent_id() const { return parent; }
+
+        /// @return this agent
+        agent_t get_id() const { return my_id; }
+
+        /// @return how many children report to us
+        size_t n_children() const { return children.size(); }
+
+      private:
+        /// What we last heard from one child
+        struct Child
+        {
+          agent_t      id;
+          bool         heard;
+          uint64_t     last_ms;
+          HealthReport last;
+        };
+
+        agent_t            my_id;
+        agent_t            parent;
+        uint32_t           miss_after_ms;
+        uint32_t           seq;
+        std::vector<Child> children;
+    };
+  }
+}
+
+#endif
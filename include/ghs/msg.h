@@ -44,6 +44,7 @@
 #include "ghs/agent.h"
 #include "ghs/level.h"
 #include "ghs/edge.h"
+#include <cstdint>
 
 /**
 */
@@ -65,16 +66,40 @@ namespace le{
         ACK_PART,///< data is a AckPartPayload
         NACK_PART,///< data is a NackPartPayload
         JOIN_US,///< data is a JoinUsPayload
+        ABSORBED,///< data is a AbsorbedPayload
+        REPAIR,///< data is a RepairPayload
+        REPAIR_ACK,///< data is a RepairAckPayload
+        PROBE,///< data is a ProbePayload
+        PROBE_RET,///< data is a ProbeRetPayload
+        CYCLE,///< data is a CyclePayload
+        CUT,///< data is a CutPayload
+        WARM_ACK,///< data is a WarmAckPayload
+        WARM_DONE,///< data is a WarmDonePayload
+        WARM_NACK,///< data is a WarmNackPayload
+        CENTER,///< data is a CenterPayload
+        SHED,///< data is a ShedPayload
+        SHED_DONE,///< data is a ShedDonePayload
+        CROWDED,///< data is a CrowdedPayload
       };
 
       /// No further action necessary (i.e., we have completed the MST construction)
       struct NoopPayload{ 
+        /// The number of agents in the tree, as the leader counted them in its last search (see SrchRetPayload)
+        uint32_t size;
+        /// The leader, which is not the one that ran the last search if it moved the root to the center of the tree (see CenterPayload)
+        agent_t leader;
+        /// How much heavier than the MST the tree is, after the swaps that capped its degree (see ShedDonePayload)
+        metric_t cost;
+        /// The tree may yet change: swaps to cap its degree follow, and another NOOP once they are done (see GhsState::set_max_degree())
+        bool swapping;
       }; 
 
       /// Requests a search begin in the MST subtree rooted at the receiver, for the minimum weight outgoing edge (one that spans two partitions).
       struct SrchPayload{
         agent_t your_leader;
         level_t   your_level;
+        /// The number of agents in the partition, as the leader last counted them (0 if it has not)
+        uint32_t your_size;
       };
 
       /** 
@@ -86,12 +111,18 @@ namespace le{
         agent_t to;
         agent_t from;
         metric_t metric;
+        /// The number of agents in the subtree, including the sender, so the leader learns the size of its partition
+        uint32_t subtree_size;
+        /// The longest path down the subtree from the sender, in edges (0 for a leaf)
+        uint32_t height;
       };
 
       /// Asks "Are you in my partition"
       struct InPartPayload{
         agent_t leader;
         level_t   level; 
+        /// The number of agents in the sender's partition, as far as it knows (see SrchPayload)
+        uint32_t size;
       };
 
       /// States "I am in your partition"
@@ -100,6 +131,8 @@ namespace le{
 
       /// States "I am not in your partition"
       struct NackPartPayload{ 
+        /// How many tree edges the sender has, so a subtree looking for room can tell (see GhsState::set_max_degree())
+        uint32_t degree;
       };
 
       /** 
@@ -113,6 +146,170 @@ namespace le{
         level_t proposed_level;
       };
 
+      /**
+       * @brief Tells a partition that a converged tree has taken it in
+       *
+       * Sent back over the edge the partition asked to join over (see
+       * JoinUsPayload), and passed on down the partition's tree, so every
+       * agent in it learns the tree's leader and level, and that the
+       * algorithm has converged.
+       */
+      struct AbsorbedPayload{
+        agent_t leader;
+        level_t level;
+      };
+
+      /**
+       * @brief Tells a subtree that has lost its way to the leader to search again
+       *
+       * Sent down the subtree by the agent that lost its parent (see
+       * GhsState::drop_edge()), which leads it from now on.
+       */
+      struct RepairPayload{
+        agent_t leader;
+        level_t level;
+        /// The subtree was cut off to cap its old parent's degree (see ShedPayload), so it prefers edges to agents with room
+        bool shed;
+      };
+
+      /// States "my subtree knows its new leader", so the search can start
+      struct RepairAckPayload{
+      };
+
+      /**
+       * @brief Asks "does our tree still reach the leader?"
+       *
+       * Sent up a converged tree by an agent that was asked IN_PART by a
+       * partition at a higher level than ours, which it can only answer
+       * if its own partition is final (see GhsState::drop_edge()).
+       */
+      struct ProbePayload{
+      };
+
+      /// States "the leader is still there", and goes back down the way the ProbePayload came
+      struct ProbeRetPayload{
+      };
+
+      /**
+       * @brief Asks "is the edge from where this started lighter than the tree path to target?"
+       *
+       * Sent through a converged tree by one end of an edge outside it that
+       * got lighter (see GhsState::update_edge_metric()), and passed on over
+       * every tree edge but the one it came in on, so it reaches target
+       * along the tree path. It carries the heaviest edge it has crossed.
+       * Both ends already hold the new metric, so target looks up the
+       * edge to origin instead of it being sent along.
+       */
+      struct CyclePayload{
+        agent_t target;
+        agent_t origin;
+        agent_t heavy_parent;
+        agent_t heavy_child;
+        metric_t heaviest;
+      };
+
+      /**
+       * @brief Takes the tree edge between parent and child out of the tree
+       *
+       * Passed on through the tree until it reaches parent, which lets go
+       * of child and sends it on to child, which then leads the repair of
+       * its subtree (see RepairPayload).
+       */
+      struct CutPayload{
+        agent_t parent;
+        agent_t child;
+        /// The parent lets go to cap its degree (see ShedPayload), not because the edge got worse
+        bool shed;
+      };
+
+      /**
+       * @brief States "my subtree has the same tree, leader and level as last time"
+       *
+       * Sent up the tree a warm start took from its hints (see
+       * GhsState::set_hints()), once the sender's children have sent it.
+       */
+      struct WarmAckPayload{
+        agent_t leader;
+        level_t level;
+        /// The number of agents in the subtree, including the sender
+        uint32_t subtree_size;
+      };
+
+      /// States "the tree from the hints is the MST", and goes down it from the leader
+      struct WarmDonePayload{
+        /// The number of agents in the tree
+        uint32_t size;
+      };
+
+      /// States "the hints are no good, start from scratch", and goes to every peer
+      struct WarmNackPayload{
+      };
+
+      /**
+       * @brief Hands the root of a final tree on towards its center
+       *
+       * Sent by the root to the child whose subtree reaches furthest, if
+       * the tree is shallower from there (see GhsState::set_recenter()).
+       * The sender makes the receiver its parent, and the receiver passes
+       * it on the same way, or, if it is the center, becomes the leader
+       * and tells everyone (msg::NoopPayload).
+       */
+      struct CenterPayload{
+        /// The longest path from the receiver that starts with the edge to the sender, in edges
+        uint32_t up;
+        /// The number of agents in the tree, as the old leader counted them
+        uint32_t size;
+        /// How much heavier than the MST the tree is (see NoopPayload)
+        metric_t cost;
+      };
+
+      /**
+       * @brief Asks target to hand one of its children to an agent with room
+       *
+       * Sent by the leader of a converged tree towards the agent that has
+       * the most tree edges over the cap, as its last search found
+       * (see GhsState::set_max_degree()). Each agent passes it on to the
+       * child it heard of target from. Target cuts its heaviest child it
+       * has not tried before (msg::CutPayload), and the subtree repairs
+       * itself, preferring edges to agents with room over the edge it
+       * was cut from.
+       */
+      struct ShedPayload{
+        agent_t target;
+      };
+
+      /**
+       * @brief States "the subtree that was cut off is back in the tree"
+       *
+       * Sent up the tree to the leader by the agent that led the repair,
+       * once it is absorbed, so the leader can look for the next swap.
+       * The leader adds added, and takes away removed, from the cost it
+       * keeps (see NoopPayload).
+       */
+      struct ShedDonePayload{
+        /// The metric of the edge the subtree came back over
+        metric_t added;
+        /// The metric of the edge it was cut from
+        metric_t removed;
+      };
+
+      /**
+       * @brief Adds what a capped tree needs to know to the SrchRetPayload that follows it
+       *
+       * Sent to the parent just before a SRCH_RET, over the same link, and
+       * only if the tree has a degree cap (see GhsState::set_max_degree())
+       * and there is something to tell: an agent over the cap, or a rank
+       * other than 0. Ordinary SRCH_RETs are sent without it.
+       */
+      struct CrowdedPayload{
+        /// The agent in the subtree with the most tree edges over the cap, and a child it has not tried to hand off (NO_AGENT if none)
+        agent_t crowded;
+        /// How many tree edges crowded has
+        uint32_t degree;
+        /// 0 unless the subtree was cut off to cap a degree: then 1 for the edge it was cut from, and 2 for an edge to an agent without room
+        uint8_t rank;
+      };
+
       union Data{
         NoopPayload noop;
         SrchPayload srch;
@@ -121,10 +318,35 @@ namespace le{
         AckPartPayload ack_part;
         NackPartPayload nack_part;
         JoinUsPayload join_us;
+        AbsorbedPayload absorbed;
+        RepairPayload repair;
+        RepairAckPayload repair_ack;
+        ProbePayload probe;
+        ProbeRetPayload probe_ret;
+        CyclePayload cycle;
+        CutPayload cut;
+        WarmAckPayload warm_ack;
+        WarmDonePayload warm_done;
+        WarmNackPayload warm_nack;
+        CenterPayload center;
+        ShedPayload shed;
+        ShedDonePayload shed_done;
+        CrowdedPayload crowded;
       };
     }
 
 
+    /**
+     * @brief Which election a Msg belongs to, so that one transport can carry several (see SessionMux)
+     *
+     * Sessions are numbered by the application, and a newer election gets a
+     * higher number. A GhsState on its own sends and expects NO_SESSION.
+     */
+    typedef uint32_t session_t;
+
+    /// The session of every Msg that no SessionMux has stamped
+    const session_t NO_SESSION=0;
+
     /** 
      * @brief An aggregate type containing all the data to exchange with to/from information
      *
@@ -157,12 +379,31 @@ namespace le{
         Msg(agent_t to, agent_t from, msg::AckPartPayload p);
         Msg(agent_t to, agent_t from, msg::NackPartPayload p);
         Msg(agent_t to, agent_t from, msg::JoinUsPayload p);
+        Msg(agent_t to, agent_t from, msg::AbsorbedPayload p);
+        Msg(agent_t to, agent_t from, msg::RepairPayload p);
+        Msg(agent_t to, agent_t from, msg::RepairAckPayload p);
+        Msg(agent_t to, agent_t from, msg::ProbePayload p);
+        Msg(agent_t to, agent_t from, msg::ProbeRetPayload p);
+        Msg(agent_t to, agent_t from, msg::CyclePayload p);
+        Msg(agent_t to, agent_t from, msg::CutPayload p);
+        Msg(agent_t to, agent_t from, msg::WarmAckPayload p);
+        Msg(agent_t to, agent_t from, msg::WarmDonePayload p);
+        Msg(agent_t to, agent_t from, msg::WarmNackPayload p);
+        Msg(agent_t to, agent_t from, msg::CenterPayload p);
+        Msg(agent_t to, agent_t from, msg::ShedPayload p);
+        Msg(agent_t to, agent_t from, msg::ShedDonePayload p);
+        Msg(agent_t to, agent_t from, msg::CrowdedPayload p);
 
         /**
          * A 'redirect' constructor that perserves type and payload, but allows new to/from fields
          */
         Msg(agent_t to, agent_t from, const Msg &other);
 
+        /**
+         * A 'stamp' constructor that preserves everything but the session
+         */
+        Msg(session_t session, const Msg &other);
+
         /**
          * A generic constructor for generic data, and known type
          */
@@ -174,6 +415,7 @@ namespace le{
         agent_t from() const {return from_;}
         msg::Type type() const {return type_;}
         msg::Data data() const {return data_;}
+        session_t session() const {return session_;}
 
       private:
         /// who to send to
@@ -186,6 +428,9 @@ namespace le{
 
         msg::Type type_;
 
+        /// which election this is part of
+        session_t session_=NO_SESSION;
+
     };
 
     /**
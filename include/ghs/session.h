@@ -0,0 +1,179 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file session.h
+ *
+ * @brief Provides le::ghs::SessionMux, which runs several elections over one transport
+ *
+ */
+
+#ifndef GHS_SESSION
+#define GHS_SESSION
+
+#include "ghs/ghs.h"
+#include "ghs/msg.h"
+#include "le/errno.h"
+#include "seque/static_queue.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace le{
+  namespace ghs{
+
+    /**
+     * @brief Routes each Msg to the GhsState of its session, and drops those of old sessions
+     *
+     * Every Msg carries a session_t (see Msg::session()). A SessionMux holds
+     * one GhsState per open session, stamps whatever they send with their
+     * session, and hands whatever comes in to the state of its session.
+     * Several elections can run at once this way (on different graphs, say),
+     * or one can follow another without waiting for the network to drain:
+     * once a newer election starts, retire_before() closes the older ones,
+     * and anything still on its way from them is dropped with a comparison
+     * (SESSION_STALE), without being looked at.
+     *
+     * A message for a session we have not opened (SESSION_UNKNOWN) is
+     * usually the first of an election someone else started before us: open
+     * it, start it, and process the message again.
+     *
+     * ```
+     * SessionMux<0,Q> mux;
+     * mux.open(epoch, GhsState<0,Q>(my_id, edges, n_edges));
+     * mux.start(epoch, buf, sz);
+     * //on each message:
+     * auto err = mux.process(msg, buf, sz);
+     * //to start over:
+     * mux.retire_before(epoch+1);
+     * mux.open(epoch+1, GhsState<0,Q>(my_id, edges, n_edges));
+     * mux.start(epoch+1, buf, sz);
+     * ```
+     */
+    template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+    class SessionMux
+    {
+      public:
+        /// The election each session runs
+        typedef GhsState<NUM_AGENTS,MSG_Q_SIZE> State;
+
+        SessionMux();
+
+        /**
+         * Adds a session, which runs `state`.
+         *
+         * @return le::Errno OK if successful
+         * @return le::Errno SESSION_EXISTS if it is already open
+         * @return le::Errno SESSION_STALE if it is older than retire_before() allows
+         */
+        le::Errno open(session_t s, const State &state);
+
+        /**
+         * Starts the election of a session (see GhsState::start_round()),
+         * and stamps the messages it enqueues.
+         *
+         * @return le::Errno SESSION_UNKNOWN if it is not open
+         * @return whatever GhsState::start_round() returns otherwise
+         */
+        le::Errno start(session_t s, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz);
+
+        /**
+         * Hands the message to the state of its session (see
+         * GhsState::process()), and stamps the messages it enqueues.
+         *
+         * @return le::Errno SESSION_STALE if its session has been retired (and the message is dropped)
+         * @return le::Errno SESSION_UNKNOWN if its session is not open
+         * @return whatever GhsState::process() returns otherwise
+         */
+        le::Errno process(const Msg &m, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz);
+
+        /**
+         * Closes a session. Its later messages are SESSION_UNKNOWN, not
+         * SESSION_STALE (see retire_before()).
+         *
+         * @return le::Errno SESSION_UNKNOWN if it is not open
+         */
+        le::Errno close(session_t s);
+
+        /**
+         * Closes every session older than `s`, and drops any message from
+         * them (or any older one) from now on. It never lowers the bar.
+         *
+         * @return le::Errno OK. Never fails
+         */
+        le::Errno retire_before(session_t s);
+
+        /**
+         * @return the state of a session, or nullptr if it is not open
+         *
+         * The state does not move while its session is open: the pointer
+         * stays valid as other sessions are opened and closed, until this
+         * session is closed (close(), retire_before()) or the SessionMux
+         * is destroyed.
+         */
+        State* find(session_t s);
+
+        /// @return the state of a session, or nullptr if it is not open (see find())
+        const State* find(session_t s) const;
+
+        /// @return the newest open session, or NO_SESSION if none is
+        session_t newest() const;
+
+        /// @return the oldest session whose messages are not dropped
+        session_t oldest_allowed() const { return min_session; }
+
+        /// @return how many sessions are open
+        size_t size() const { return sessions.size(); }
+
+      private:
+        struct Session
+        {
+          session_t id;
+          State     state;
+        };
+
+        /// Moves everything from scratch to buf, stamped with s
+        void stamp(session_t s, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz);
+
+        /// Each on the heap, so that find() stays valid as the others come and go
+        std::vector<std::unique_ptr<Session>> sessions;
+        session_t                     min_session;
+        StaticQueue<Msg, MSG_Q_SIZE>  scratch;
+    };
+
+#include "session_impl.hpp"
+
+  }
+}
+
+#endif
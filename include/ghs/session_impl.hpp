@@ -0,0 +1,165 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file session_impl.hpp
+ * @brief the implementation for le::ghs::SessionMux
+ */
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+SessionMux<NUM_AGENTS,MSG_Q_SIZE>::SessionMux()
+  : min_session(NO_SESSION)
+{
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+le::Errno SessionMux<NUM_AGENTS,MSG_Q_SIZE>::open(session_t s, const State &state)
+{
+  if (s < min_session){
+    return SESSION_STALE;
+  }
+  if (find(s) != nullptr){
+    return SESSION_EXISTS;
+  }
+  sessions.push_back(std::unique_ptr<Session>(new Session{s, state}));
+  return OK;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+le::Errno SessionMux<NUM_AGENTS,MSG_Q_SIZE>::start(session_t s, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz)
+{
+  qsz=0;
+  State *state = find(s);
+  if (state == nullptr){
+    return SESSION_UNKNOWN;
+  }
+  size_t sent=0;
+  auto srr = state->start_round(scratch, sent);
+  stamp(s, buf, qsz);
+  return srr;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+le::Errno SessionMux<NUM_AGENTS,MSG_Q_SIZE>::process(const Msg &m, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz)
+{
+  qsz=0;
+  //the cheap way out, for everything an election we gave up on left behind
+  if (m.session() < min_session){
+    return SESSION_STALE;
+  }
+  State *state = find(m.session());
+  if (state == nullptr){
+    return SESSION_UNKNOWN;
+  }
+  size_t sent=0;
+  auto pr = state->process(m, scratch, sent);
+  stamp(m.session(), buf, qsz);
+  return pr;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+le::Errno SessionMux<NUM_AGENTS,MSG_Q_SIZE>::close(session_t s)
+{
+  for (size_t i=0;i<sessions.size();i++){
+    if (sessions[i]->id == s){
+      sessions.erase(sessions.begin()+i);
+      return OK;
+    }
+  }
+  return SESSION_UNKNOWN;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+le::Errno SessionMux<NUM_AGENTS,MSG_Q_SIZE>::retire_before(session_t s)
+{
+  if (s <= min_session){
+    return OK;
+  }
+  min_session = s;
+  size_t kept=0;
+  for (size_t i=0;i<sessions.size();i++){
+    if (sessions[i]->id >= min_session){
+      if (kept != i){
+        sessions[kept] = std::move(sessions[i]);
+      }
+      kept++;
+    }
+  }
+  sessions.erase(sessions.begin()+kept, sessions.end());
+  return OK;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+typename SessionMux<NUM_AGENTS,MSG_Q_SIZE>::State* SessionMux<NUM_AGENTS,MSG_Q_SIZE>::find(session_t s)
+{
+  for (auto &x : sessions){
+    if (x->id == s){
+      return &x->state;
+    }
+  }
+  return nullptr;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+const typename SessionMux<NUM_AGENTS,MSG_Q_SIZE>::State* SessionMux<NUM_AGENTS,MSG_Q_SIZE>::find(session_t s) const
+{
+  for (auto &x : sessions){
+    if (x->id == s){
+      return &x->state;
+    }
+  }
+  return nullptr;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+session_t SessionMux<NUM_AGENTS,MSG_Q_SIZE>::newest() const
+{
+  session_t s=NO_SESSION;
+  for (auto &x : sessions){
+    if (x->id > s){
+      s = x->id;
+    }
+  }
+  return s;
+}
+
+template <std::size_t NUM_AGENTS, std::size_t MSG_Q_SIZE>
+void SessionMux<NUM_AGENTS,MSG_Q_SIZE>::stamp(session_t s, StaticQueue<Msg, MSG_Q_SIZE> &buf, size_t &qsz)
+{
+  Msg m;
+  while (scratch.size() > 0){
+    scratch.pop(m);
+    buf.push(Msg(s, m));
+    qsz++;
+  }
+}
@@ -83,6 +83,14 @@ namespace le{
     ERR_QUEUE_EMPTY,///< Operation failed, the queue is empty
     ERR_BAD_IDX,///< Operation failed and is not possible to succeed: that idx is beyond the static size of the queue
     ERR_NO_SUCH_ELEMENT,///< Operation failed, there are less elements than the given index in the queue
+    DROP_REQ_RESTART,          ///< Dropped an edge that the MST (or the edge we chose to join over) depends on: every agent must elect again
+    AGG_STALE_ROUND,           ///< A contribution to (or partial result of) a round of aggregation that is already over
+    CAST_REQ_ROOT,             ///< Only the root of the MST can start a broadcast
+    UPDATE_REQ_CONVERGED,      ///< update_edge_metric() only re-optimises a converged tree
+    HINT_MISMATCH,             ///< The hints from a previous run do not match our edges, so the election starts from scratch
+    SESSION_STALE,             ///< The message (or session) belongs to an election that has been retired
+    SESSION_UNKNOWN,           ///< There is no open session with that id
+    SESSION_EXISTS,            ///< A session with that id is already open
   };
 
   /**
@@ -52,6 +52,12 @@ namespace demo{
   /// for argp
   static const char KEY_TEST='t';
   /// for argp
+  static const char KEY_CLUSTER='c';
+  /// for argp
+  static const char KEY_EMULATE='e';
+  /// for argp
+  static const char KEY_BROADCAST='b';
+  /// for argp
   const char *argp_program_bug_address = "Joshua Vander Hook <hook@jpl.nasa.gov>";
 
   static error_t parse_it(int key, char *arg, struct argp_state *state) 
@@ -84,6 +90,24 @@ namespace demo{
                       printf("[debug] set 'test'='1' \n");
                       break;
                     }
+      case KEY_CLUSTER:{
+                      p->cluster = atoi(arg);
+                      printf("[debug] set 'cluster'='%s' (%d)\n",arg,p->cluster);
+                      break;
+                    }
+      case KEY_EMULATE:{
+                      if (read_link_profiles(arg,p)){
+                        printf("[debug] set 'emulate'='%s'\n",arg);
+                      } else {
+                        printf("[debug] unable to read link profiles from '%s'\n",arg);
+                      }
+                      break;
+                    }
+      case KEY_BROADCAST:{
+                      p->broadcast_file = arg;
+                      printf("[debug] set 'broadcast'='%s'\n",arg);
+                      break;
+                    }
       case ARGP_KEY_NO_ARGS: {break;}
       default:{return ARGP_ERR_UNKNOWN;}
     };
@@ -98,8 +122,11 @@ namespace demo{
     {
       {"id", KEY_MY_ID, "MY_ID", 0, "The ID to assume, which must be included in the config"},
       {"start", KEY_START, 0, OPTION_ARG_OPTIONAL, "Start the algorithm."},
-      {0, KEY_WAIT, "X", 0, "wait X seconds before sending first round of messages (good to help with initializing connections)"},
+      {0, KEY_WAIT, "X", 0, "wait at most X seconds for all peers to come up before measuring links (the rest are left out)"},
       {"test", KEY_TEST, 0, 0, "for 10 seconds, blast msgs (if agent 0), or wait for msgs (otherwise)"},
+      {"cluster", KEY_CLUSTER, "N", 0, "run N agents as threads of this process, over mem:// endpoints, instead of one agent"},
+      {"emulate", KEY_EMULATE, "FILE", 0, "delay, rate-limit and drop messages on each link as the profiles in FILE say"},
+      {"broadcast", KEY_BROADCAST, "FILE", 0, "once elected, the leader sends FILE to every agent down the tree"},
       {0}//null terminated, of course
     };
 
@@ -38,16 +38,24 @@
  */
 //and our header
 #include "ghs-demo-comms.h"
+#include "ghs-demo-log.h"
+#include "ghs-demo-transport-nng.h"
+#include "ghs-demo-transport-shm.h"
+#include "ghs-demo-transport-udp.h"
+#include "ghs-demo-transport-mem.h"
+#include "ghs-demo-transport-emu.h"
 
-#include <nng/protocol/reqrep0/req.h>
-#include <nng/protocol/reqrep0/rep.h>
-//#include <nng/protocol/pair0/pair.h>
 #include <cassert>  //assert
 #include <cstring>  //mem operations
 #include <cstdio>   //printf and such
 #include <unistd.h> //sleep
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <cerrno>
 #include <mutex>
 #include <chrono>
+#include <future>
+#include <map>
 
 ///
 namespace demo{
@@ -55,104 +63,134 @@ namespace demo{
 
   static Comms static_inst;
 
+  /// Sent messages at least this big are used as passive throughput samples
+  static const size_t PASSIVE_TPUT_MIN_SZ = PAYLOAD_MAX_SZ/2;
+
   Comms::Comms()
   {
     //TODO in an active system, some error recovery would load sequence from storage. 
     outgoing_seq= 1;
+    read_continues=false;
+    app_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (app_fd<0){
+      DEMO_LOG_ERROR("eventfd: %s\n",strerror(errno));
+    }
   }
 
   Comms::~Comms(){
     read_continues=false;
-    nng_close(incoming);
-    nng_close(outgoing);
-  }
-
-  /** 
-   * Q: WHY REQ/REP SOCKETS?
-   *
-   * A: Look, we could use survey/respondent sockets for a lot of the GHS
-   * algorithm, but at this time, due to the radio, it's not clear if that's
-   * the right approach. In fact the radio specifically says we should *not*
-   * broadcast, and that (being a mesh) msgs to agent A may go through B.  For
-   * that reason, I _recommend_ that any broadcast-like action be handled with
-   * an MST-based broadcast to avoid duplication. See ghs.hpp, which could very
-   * easily be ported to the comms handler. 
-   *
-   * So, that leaves pt to pt comms, with fanout handled in the application
-   * layer.  That means nng_pair (1-1) or nng_req/nng_rep. The docs for req/rep
-   * say that it is reliable, because it will retry until a reply is  received.
-   * This reply is not handled at lower levels. it literally means that the
-   * application code has to package and send a response packet like an RPC call.
-   * You can't, for example, queue up reqs and handle them one at a time, because
-   * those req-holders will be waiting for replies (i.e., blocked). They can go
-   * on and send more reqs and override the last one, but now we're just back to
-   * nng_pair conops.
-   *
-   * The docs for pair say:
-   *
-   * > Even though this mode may appear to be "reliable", because back-pressure
-   * > prevents discarding messages most of the time there are topologies
-   * > involving devices (see nng_device(3)) or raw mode sockets where messages 
-   * > may be discarded
-   *
-   * If we do go with pair, I hope (https://stackoverflow.com/q/72293870/389599)
-   * that this means the network stack will handle reliable delivery at lvl 3,
-   * rather than trying to finagle something at lvl 4+. 
-   *
-   */
-  void Comms::validate_sockets(){
-
-    //TODO set up the default options for send / recv on both incoming and
-    //outgoing sockets to allow this single-threaded operation
-    if (nng_socket_id(incoming) == -1){ 
-      int ret = nng_rep0_open(&incoming);
-      if (ret!=0){ assert(false); }
-      //ret=(nng_socket_set_int(incoming, NNG_OPT_RECVBUF, 256));
-      //ret=(nng_socket_set_size(incoming, NNG_OPT_RECVMAXSZ, sizeof(WireMessage)));
-      ret=(nng_socket_set_ms(incoming, NNG_OPT_RECVTIMEO, nng_duration(5000)));
-      assert(0==ret);
-      //ret=(nng_socket_set_ms(incoming, NNG_OPT_SENDTIMEO, nng_duration(500)));
-      //ret=(nng_socket_set_ms(incoming, NNG_OPT_RECONNMINT,nng_duration(100)));
-      //ret=(nng_socket_set_ms(incoming, NNG_OPT_RECONNMAXT,nng_duration(10000)));
-    }
-    if (nng_socket_id(outgoing) == -1){ 
-      int ret;
-      ret=(nng_req0_open(&outgoing));
-      if (ret!=0){ assert(false); }
-      assert(0==ret);
-      //ret=(nng_socket_set_ms(outgoing, NNG_OPT_RECVTIMEO, nng_duration(1000)));
-      ret=(nng_socket_set_ms(outgoing, NNG_OPT_SENDTIMEO, nng_duration(1000)));
-      assert(0==ret);
-      //ret=(nng_socket_set_ms(outgoing, NNG_OPT_RECONNMINT,nng_duration(100)));
-      //ret=(nng_socket_set_ms(outgoing, NNG_OPT_RECONNMAXT,nng_duration(10000)));
-      //there's a couple of settings we need that are TCP specific, too...
-      //NNG_OPT_TCP_KEEPALIVE  (true) to support "pings" periodically.
+    stop_liveness();
+    stop_metrics();
+    stop_io();
+    if (app_fd>=0){
+      close(app_fd);
     }
   }
 
-  Comms& Comms::with_config(Config &c)
+  std::string endpoint_scheme(const std::string &endpoint)
   {
-    validate_sockets();
-    assert(cfg_is_ok(c));
+    size_t pos = endpoint.find("://");
+    if (pos==std::string::npos){
+      return "";
+    }
+    return endpoint.substr(0,pos);
+  }
 
-    if (nng_listener_id(ghs_listener) != -1){
-      int ret;
-      ret=(nng_listener_close(ghs_listener));
-      if (ret!=0){assert(false);}
+  Transport* make_transport(const std::string &scheme, EventLoop &loop, const Config &config)
+  {
+    Transport *t;
+    if (scheme=="shm"){
+      t = new ShmTransport(loop,config);
+    } else if (scheme=="udp"){
+      t = new UdpTransport(loop,config);
+    } else if (scheme=="mem"){
+      t = new MemTransport(loop,config);
+    } else {
+      //nng knows tcp, ipc, inproc, ws, ... and reports the rest when dialing
+      t = new NngTransport(loop,config);
+    }
+    if (!config.emulate.empty()){
+      t = new EmuTransport(loop,config,t);
+    }
+    return t;
+  }
+
+  void Comms::start_io()
+  {
+    if (!io_thread.joinable()){
+      io_thread = std::thread(&EventLoop::run, &loop);
     }
+  }
 
-    printf("[info] Starting listener for ghs on : %s\n", c.endpoints[c.my_id]);
-    int ret;
-    ret=(nng_listener_create(&ghs_listener,incoming,c.endpoints[c.my_id]));
-    if (ret!=0){assert(false);}
-    assert(0==ret);
-    ret=(nng_listener_start(ghs_listener,0));
-    assert(0==ret);
+  void Comms::stop_io()
+  {
+    if (io_thread.joinable()){
+      loop.stop();
+      io_thread.join();
+    }
+    //nobody will acknowledge these now, so don't leave anyone waiting
+    for (auto &q : send_qs){
+      for (auto &p : q){
+        if (p.timer>=0){
+          loop.cancel_timer(p.timer);
+        }
+        if (p.cb){
+          p.cb(ERR_HANGUP,0);
+        }
+      }
+      q.clear();
+    }
+    in_flight_n.assign(send_qs.size(),0);
+  }
 
-    //std::copy you can go to hell
-    memmove((void*)&ghs_cfg, &c, sizeof(Config));
+  Comms& Comms::with_config(Config &c)
+  {
+    assert(cfg_is_ok(c));
 
-    printf("[info] Initialized GHS comms subsystem!\n");
+    //start over. Transports are only created and destroyed while the loop is stopped.
+    stop_io();
+    listener=nullptr;
+    peer_transport.clear();
+    transports.clear();
+
+    ghs_cfg = c;
+
+    //one transport per scheme, shared by every agent whose endpoint uses it
+    std::map<std::string,Transport*> by_scheme;
+    peer_transport.assign(c.n_agents,nullptr);
+    for (int i=0;i<c.n_agents;i++){
+      std::string scheme = endpoint_scheme(c.endpoints[i]);
+      if (by_scheme.count(scheme)==0){
+        transports.push_back(std::unique_ptr<Transport>(make_transport(scheme,loop,ghs_cfg)));
+        by_scheme[scheme]=transports.back().get();
+      }
+      peer_transport[i]=by_scheme[scheme];
+    }
+    listener = peer_transport[c.my_id];
+    listening = (listener->listen()==OK);
+
+    //everything per-peer is sized from the config, once
+    size_t n = c.n_agents;
+    sequence_counters.assign(n,0);
+    kbps.assign(n,0);
+    reported_kbps.assign(n,0);
+    reported.assign(n,false);
+    rtt_us.assign(n,0);
+    up.assign(n,true);
+    send_qs.assign(n,std::deque<PendingSend>());
+    in_flight_n.assign(n,0);
+
+    link_stats.reset(c.n_agents, c.metric_alpha, c.metric_change_threshold);
+    probe_backoff = Backoff(std::chrono::milliseconds((long)(c.retry_base_s*1000)),
+        std::chrono::milliseconds((long)(c.retry_max_s*1000)), c.n_agents, c.my_id+1);
+    probe_after.assign(c.n_agents, std::chrono::steady_clock::time_point());
+    liveness.reset(c.n_agents, std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<float>(c.heartbeat_s>0 ? c.heartbeat_s : 1.0f)), std::chrono::steady_clock::now());
+    suspected.assign(c.n_agents, false);
+
+    start_io();
+
+    DEMO_LOG_INFO("Initialized GHS comms subsystem!\n");
 
     return (*this);
   }
@@ -161,176 +199,136 @@ namespace demo{
 
   bool Comms::ok()
   {
-    //verify state
-    return true;
+    return listening;
   }
 
-  int Comms::recv(WireMessage &buf)
+  void Comms::on_message(WireMessage &m)
   {
+    auto from = m.header.agent_from;
+    SequenceCounter msg_seq = m.control.sequence;
 
-    WireMessage local_msg;
-    //this line saves 100 lines of C++ in the definition of WireMessage (constructing
-    //from buffer)
-    auto local_msg_charptr =  (uint8_t*) &local_msg ;
-    size_t recvsz=sizeof(WireMessage);
+    //Transports may deliver more than once, so we use sequence #s to drop
+    //duplicates. But warn if it appears order is violated, for debugging.
 
-    printf("[info] RECV: waiting for msg ... \n");
-    int ret = nng_recv( incoming, static_cast<void*>(local_msg_charptr), &recvsz, 0);
-    //Note, local_msg is now populated
-
-    const char* errstr = nng_strerror(ret);
-    printf("[info] RECV: %s\n",errstr);
-
-    switch (ret){
-      case 0: {break;}
-      case NNG_EAGAIN: {return 0;}
-      case NNG_ETIMEDOUT : {return 0;}
-      case NNG_ECLOSED: {printf("[error] RECV: Socket closed! Fatal.\n");return -ret;}
-      case NNG_EINVAL: {printf("[error] RECV: invalid flags! Fatal programmer error.\n");return -ret;}
-      case NNG_EMSGSIZE: {printf("[error] RECV: invalid msg size -- too big! nonfatal\n");return 0;}
-      case NNG_ENOMEM: {printf("[error] RECV: Out of memory. fatal!\n");return -ret;}
-      case NNG_ENOTSUP: {printf("[error] RECV: cannot recv on this socket. fatal programmer error!\n");return -ret;}
-      case NNG_ESTATE: {printf("[error] RECV: cannot recv on this socket at this time -- did you use the right protocol and correct socket creation function? fatal programmer error!\n");return -ret;}
-      default: {printf("[error] RECV: Unknown error! %d:%s", ret, errstr);return -ret;}
+    if (from >= sequence_counters.size()) {
+      DEMO_LOG_WARN("RECV: msg from unknown agent %u, dropping\n", from);
+      return;
     }
-
-    /*
-       if (debug){
-       printf("[info] RECV: Read %zu :", recvsz);
-       for (size_t i=0;i<recvsz;i++){
-       printf("%x",local_msg_charptr[i]);
-       }
-       printf("\n");
-       }*/
-
-    printf("[info] RECV: sending confirmation\n");
-    SequenceCounter msg_seq = local_msg.control.sequence;
-    recvsz = sizeof(SequenceCounter);
-    auto from = local_msg.header.agent_from;
-    ret = nng_send(incoming,(void*)&msg_seq,recvsz,0);
-    if (ret!=0){ 
-      printf("[error] RECV: failure to send confirmation: %s\n", nng_strerror(ret));
-    }
-
-    //nng_sock assures delivery before returning, but may send multiple times.
-    //So we use sequence #s to drop duplicates. But warn if it appears order is
-    //violated, for debugging.
-
+    link_stats.touch(from);
+    //even a duplicate says they are alive
+    liveness.heard(from, std::chrono::steady_clock::now());
     if (msg_seq == 0) {
-      printf("[warn] RECV: error on sending side, received seq==0 (payload not set?)\n");
-      return 0;
+      DEMO_LOG_WARN("RECV: error on sending side, received seq==0 (payload not set?)\n");
+      return;
     } else if (sequence_counters[from]>msg_seq){
-      printf("[warn] RECV: msg seq indicates reorder!!, dropping and proceeding anyway\n");
-      return 0;
+      DEMO_LOG_WARN("RECV: msg seq indicates reorder!!, dropping and proceeding anyway\n");
+      return;
     } else if (sequence_counters[from]==msg_seq){
-      printf("[info] RECV: msg seq indicates duplicate, dropping\n");
-      return 0;
+      DEMO_LOG_DEBUG("RECV: msg seq indicates duplicate, dropping\n");
+      return;
     } else {
       sequence_counters[from]=msg_seq;
     }
 
-    if (recvsz==0){
-      printf("[error] RECV: no bytes read by nng, but message returned. Fatal.\n");
-      return -1;
-    } else {
-      printf("[info] RECV: Copying to user buf\n");
-      memmove(
-          static_cast<void*>(&buf),
-          static_cast<void*>(&local_msg),
-          local_msg.size()
-          );
-    }
-
-    return recvsz;
+    dispatch(m);
   }
 
-  void Comms::read_loop()
+  void Comms::dispatch(WireMessage &m)
   {
-    while(read_continues)
-    {
+    //take action by type
+    switch (m.header.type){
+      case PAYLOAD_TYPE_GHS:
+      case PAYLOAD_TYPE_HEALTH:
+      case PAYLOAD_TYPE_CHUNK:
+        {
+          {
+            //it has been acknowledged, so it must not be dropped here
+            std::lock_guard<std::mutex> guard(q_mut);
+            in_q.push_back(m);
+          }
+          notify_app();
+          break;
+        }
+      case PAYLOAD_TYPE_METRICS:
+        {
+          auto from = m.header.agent_from;
+          auto sent  = *(Kbps*)&m.bytes[0];
+          std::lock_guard<std::mutex> lock(report_mut);
+          reported_kbps[from]=sent;
+          reported[from]=true;
+          if (exchanged){
+            //too late for exchange_iperf(), so apply it here
+            auto prior = kbps[from];
+            kbps[from] = std::min(prior, sent);
+            DEMO_LOG_DEBUG("updated metrics to %u from %u b/c rec %u\n",kbps[from],prior, sent);
+          }
+          report_cv.notify_all();
+          break;
+        }
+      case PAYLOAD_TYPE_CONTROL: 
+        {break;}
+      case PAYLOAD_TYPE_PING: 
+        {break;}
+      case PAYLOAD_TYPE_HEARTBEAT: 
+        {break;}
+      case PAYLOAD_TYPE_HELLO: 
+        {break;}
+      default: 
+        {
+          DEMO_LOG_ERROR("unrecognized msg type: %d",m.header.type);
+          break;
+        }
+    }
+  }
 
-      WireMessage m;
-      int ret = recv(m);
+  void Comms::notify_app()
+  {
+    uint64_t one=1;
+    if (write(app_fd,&one,sizeof(one))<0 && errno!=EAGAIN){
+      DEMO_LOG_ERROR("eventfd write: %s\n",strerror(errno));
+    }
+  }
 
-      if (ret<0){ //fatal
-        read_continues = false;
-      } else if (ret==0) { //nonfatal
-        continue;
-      } else { //take action by type
-        switch (m.header.type){
-          case PAYLOAD_TYPE_GHS:
-            {
-              std::lock_guard<std::mutex> guard(q_mut);
-              le::Errno ret;
-              if ( (ret= in_q.push(m)) != seque::OK)
-              {
-                printf("[error] queue err: %s", le::strerror(ret)); 
-              }
-              break;
-            }
-          case PAYLOAD_TYPE_METRICS:
-            {
-              auto from = m.header.agent_from;
-              auto prior = kbps[from];
-              auto sent  = *(Kbps*)&m.bytes[0];
-              kbps[from] = std::min(prior, sent);;
-              printf("[info] updated metrics to %u from %u b/c rec %u\n",kbps[from],prior, sent);
-              break;
-            }
-          case PAYLOAD_TYPE_CONTROL: 
-            {break;}
-          case PAYLOAD_TYPE_PING: 
-            {break;}
-          default: 
-            {
-              printf("[error] unrecognized msg type: %d",m.header.type);
-              break;
-            }
-        }
+  bool Comms::wait(std::chrono::milliseconds timeout)
+  {
+    if (has_msg() || !read_continues){
+      return has_msg();
+    }
+    struct pollfd fd;
+    fd.fd=app_fd;
+    fd.events=POLLIN;
+    if (poll(&fd,1,(int)timeout.count())>0){
+      uint64_t count;
+      if (read(app_fd,&count,sizeof(count))<0 && errno!=EAGAIN){
+        DEMO_LOG_ERROR("eventfd read: %s\n",strerror(errno));
       }
-      //while...
     }
+    return has_msg();
+  }
+
+  void Comms::wake()
+  {
+    notify_app();
+  }
+
+  int Comms::event_fd() const
+  {
+    return app_fd;
   }
 
   bool    Comms::has_msg(){
     std::lock_guard<std::mutex> guard(q_mut);
-    return in_q.size()>0;
+    return !in_q.empty();
   }
 
   bool Comms::get_next(WireMessage&m){
     std::lock_guard<std::mutex> guard(q_mut);
-    if (in_q.size()>0){
-      le::Errno ret;
-      if ( (ret=in_q.pop(m)) == seque::OK){
-        return true;
-      } else {
-        switch(ret)
-        {
-          case seque::ERR_QUEUE_EMPTY:
-            {
-              printf("[error] Queue empty unexpectedly!");
-              break;
-            }
-          case seque::ERR_BAD_IDX:
-            {
-              printf("[error] Queue error, no element 0!");
-              break;
-            }
-          case seque::ERR_NO_SUCH_ELEMENT:
-            {
-              printf("[error] Queue error, no element 0!");
-              break;
-            }
-          default:
-            {
-              printf("[error] unexpected queue return: %d", ret); 
-              read_continues=false; 
-              break;
-            }
-        }
-      }
+    if (in_q.empty()){
+      return false;
     }
-    return false;
+    m = in_q.front();
+    in_q.pop_front();
+    return true;
   }
 
   Errno Comms::send(WireMessage& msg, OptMask mask)
@@ -342,18 +340,228 @@ namespace demo{
     }
 
     //infer endpoint from destination / subsystem pairs
-    const char* endpoint; 
     switch (msg.header.type){
       case (PAYLOAD_TYPE_NOT_SET):{ return ERR_NO_PAYLOAD_TYPE ;}
-      case (PAYLOAD_TYPE_GHS):{ endpoint = ghs_cfg.endpoints[destination]; break;}
+      case (PAYLOAD_TYPE_GHS):{ break;}
       default: { return ERR_UNRECOGNIZED_PAYLOAD_TYPE; }
     }
     long us_rt;
-    return internal_send(msg,endpoint,us_rt);
+    return internal_send(msg,us_rt);
+  }
+
+  Errno Comms::send_async(const WireMessage& msg, SendCallback cb)
+  {
+    Destination destination = msg.header.agent_to;
+    if (destination == (Destination)MESSAGE_DEST_UNSET || destination >= ghs_cfg.n_agents){
+      return ERR_DEST_UNSET;
+    }
+    if (!io_thread.joinable()){
+      DEMO_LOG_ERROR("send_async() before with_config()\n");
+      return ERR_NNG;
+    }
+
+    PendingSend p;
+    p.m = msg;
+    p.cb = cb;
+    p.in_flight = false;
+    p.timer = -1;
+    //probes draw from the same counter concurrently, so take ours up front
+    p.m.control.sequence = outgoing_seq++;
+    loop.post([this,p](){
+        send_qs[p.m.header.agent_to].push_back(p);
+        kick(p.m.header.agent_to);
+        });
+    return OK;
+  }
+
+  //start messages from the head of the peer's queue, as many at once as its transport takes
+  void Comms::kick(const uint16_t to)
+  {
+    auto &q = send_qs[to];
+    size_t window = peer_transport[to]->window();
+    //the messages in flight are always the first in_flight_n[to] in the queue
+    while (in_flight_n[to] < q.size() && in_flight_n[to] < window){
+      size_t idx = in_flight_n[to];
+      PendingSend &p = q[idx];
+      p.in_flight = true;
+      in_flight_n[to]++;
+      p.start = std::chrono::steady_clock::now();
+      SequenceCounter seq = p.m.control.sequence;
+      Errno ret = peer_transport[to]->send(p.m, [this,to,seq](Errno result){
+          delivered(to, seq, result);
+          });
+      if (ret!=OK){
+        PendingSend failed = take(to, idx);
+        if (failed.cb){
+          failed.cb(ret, 0);
+        }
+        continue;
+      }
+      if (idx==0){
+        arm_timeout(to);
+      }
+    }
+  }
+
+  //only the oldest message in flight is timed; the rest went out after it
+  void Comms::arm_timeout(const uint16_t to)
+  {
+    using namespace std::chrono;
+    auto &q = send_qs[to];
+    if (q.empty() || !q.front().in_flight || q.front().timer>=0){
+      return;
+    }
+    auto deadline = q.front().start + duration_cast<steady_clock::duration>(duration<float>(ghs_cfg.send_timeout_s));
+    auto remaining = duration_cast<milliseconds>(deadline - steady_clock::now());
+    q.front().timer = loop.add_timer(std::max(remaining, milliseconds(0)), [this,to](){
+        DEMO_LOG_ERROR("send() to %u timed out\n", to); 
+        send_qs[to].front().timer=-1;
+        //the transport gives up on all of them, so we do too
+        peer_transport[to]->cancel(to);
+        while (in_flight_n[to]>0){
+          PendingSend p = take(to, 0);
+          if (p.cb){
+            p.cb(ERR_TIMEOUT, 0);
+          }
+        }
+        kick(to);
+        });
+  }
+
+  //called by the transport; anything but a message in flight is stale
+  void Comms::delivered(const uint16_t to, const SequenceCounter seq, const Errno result)
+  {
+    auto &q = send_qs[to];
+    size_t idx = 0;
+    while (idx < in_flight_n[to] && q[idx].m.control.sequence != seq){
+      idx++;
+    }
+    if (idx == in_flight_n[to]){
+      DEMO_LOG_WARN("stale delivery of %zu to %u, dropping\n", seq, to);
+      return;
+    }
+    const PendingSend &p = q[idx];
+    long us_rt = 0;
+    if (result==OK){
+      auto now = std::chrono::steady_clock::now();
+      liveness.heard(to, now);
+      auto diff = std::chrono::duration_cast<std::chrono::microseconds>(now-p.start);
+      us_rt = diff.count();
+      size_t obsz = p.m.size();
+      DEMO_LOG_DEBUG("Round-trip time: %ld \xC2\xB5s\n", us_rt);
+      //small messages only tell us about latency; big ones about throughput
+      //too. Probes report their own results.
+      if (p.m.header.type==PAYLOAD_TYPE_PING){
+        DEMO_LOG_DEBUG("probe to %u acknowledged\n", to);
+      } else if (obsz >= PASSIVE_TPUT_MIN_SZ && us_rt>0){
+        link_stats.observe(to, (8000.0*obsz)/us_rt, us_rt);
+      } else {
+        link_stats.observe_rtt(to, us_rt);
+      }
+    }
+    PendingSend done = take(to, idx);
+    if (done.cb){
+      done.cb(result, us_rt);
+    }
+    kick(to);
+  }
+
+  //remove a message from the peer's queue, and time the next one if it was the oldest
+  Comms::PendingSend Comms::take(const uint16_t to, const size_t idx)
+  {
+    auto &q = send_qs[to];
+    PendingSend p = q[idx];
+    q.erase(q.begin()+idx);
+    if (p.in_flight){
+      in_flight_n[to]--;
+    }
+    if (p.timer>=0){
+      loop.cancel_timer(p.timer);
+    }
+    if (idx==0){
+      arm_timeout(to);
+    }
+    return p;
+  }
+
+  int Comms::await_peers(const std::chrono::steady_clock::time_point deadline)
+  {
+    using namespace std::chrono;
+    auto b = std::make_shared<Barrier>();
+    b->up.assign(ghs_cfg.n_agents, false);
+    b->left = ghs_cfg.n_agents-1;
+    b->deadline = deadline;
+    b->backoff = Backoff(milliseconds((long)(ghs_cfg.retry_base_s*1000)),
+        milliseconds((long)(ghs_cfg.retry_max_s*1000)), ghs_cfg.n_agents, ghs_cfg.my_id+1);
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      if (i==ghs_cfg.my_id) continue;
+      loop.post([this,i,b](){ hello(i,b); });
+    }
+
+    std::unique_lock<std::mutex> lock(b->mut);
+    b->cv.wait_until(lock, deadline, [&b](){ return b->left<=0; });
+    int n_up=0;
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      if (i==ghs_cfg.my_id) continue;
+      up[i] = b->up[i];
+      if (up[i]){
+        n_up++;
+      } else {
+        DEMO_LOG_WARN("agent %d is not up, going on without it\n", i);
+      }
+    }
+    //nothing acknowledged from here on changes our mind
+    b->left = -1;
+    return n_up;
+  }
+
+  //on the loop thread: say hello until they answer, or the barrier is over
+  void Comms::hello(const uint16_t i, std::shared_ptr<Barrier> b)
+  {
+    WireMessage m;
+    m.header.type = PAYLOAD_TYPE_HELLO;
+    m.header.agent_from = ghs_cfg.my_id;
+    m.header.agent_to = i;
+    m.header.payload_size = 0;
+    Errno ret = send_async(m, [this,i,b](Errno e, long){
+        using namespace std::chrono;
+        std::lock_guard<std::mutex> lock(b->mut);
+        if (b->left<0){
+          return;
+        }
+        if (e==OK){
+          b->up[i]=true;
+          b->left--;
+          b->cv.notify_all();
+          return;
+        }
+        auto wait = b->backoff.failed(i);
+        if (steady_clock::now()+wait < b->deadline){
+          DEMO_LOG_DEBUG("agent %u is not up yet (%d), asking again in %ld ms\n", i, e, (long)wait.count());
+          loop.add_timer(duration_cast<milliseconds>(wait), [this,i,b](){ hello(i,b); });
+        }
+        });
+    if (ret!=OK){
+      DEMO_LOG_ERROR("cannot say hello to %u: %d\n", i, ret);
+    }
+  }
+
+  bool Comms::is_up(const uint16_t to) const
+  {
+    return to<up.size() && up[to];
   }
 
   void Comms::exchange_iperf()
   {
+    using namespace std::chrono;
+    //shared with the sends, which may be acknowledged after we have stopped waiting
+    struct Round
+    {
+      std::mutex mut;
+      std::condition_variable cv;
+      int pending=0;
+    };
+    auto round = std::make_shared<Round>();
     for (int i=0;i<ghs_cfg.n_agents;i++){
       if (i==ghs_cfg.my_id) continue;
 
@@ -361,122 +569,406 @@ namespace demo{
       m.header.type = PAYLOAD_TYPE_METRICS;
       m.header.agent_from = ghs_cfg.my_id;
       auto metric = kbps[i];
-      printf("[info] sending: %u to %d\n",metric,i);
+      DEMO_LOG_INFO("sending: %u to %d\n",metric,i);
       auto msz    = sizeof(metric);
       m.header.payload_size=msz;
       memmove(m.bytes,&metric,msz);
       m.header.agent_to = i;
-      const char* endpoint = ghs_cfg.endpoints[i];
 
-      long us_rt;
-      Errno ret;
-      ret = internal_send(m,endpoint,us_rt);
-      if (ret!=0){
-        printf("Ignoring error: %d",ret);
+      //all at once, so a peer that went away costs one send timeout, not one
+      //each. One that was not up gets our 0 too, in case it comes up late:
+      //then it drops its edge to us, as we have no edge to it.
+      bool wait_for_it = up[i];
+      if (wait_for_it){
+        std::lock_guard<std::mutex> lock(round->mut);
+        round->pending++;
+      }
+      Errno ret = send_async(m, [round,i,wait_for_it](Errno e, long){
+          if (e!=OK){
+            DEMO_LOG_WARN("Ignoring error sending metrics to %d: %d\n",i,e);
+          }
+          if (wait_for_it){
+            std::lock_guard<std::mutex> lock(round->mut);
+            round->pending--;
+            round->cv.notify_all();
+          }
+          });
+      if (ret!=OK){
+        DEMO_LOG_WARN("Ignoring error sending metrics to %d: %d\n",i,ret);
+        if (wait_for_it){
+          std::lock_guard<std::mutex> lock(round->mut);
+          round->pending--;
+        }
       }
-      //blithely ignore failures here
     }
+    {
+      std::unique_lock<std::mutex> lock(round->mut);
+      round->cv.wait(lock, [&round](){ return round->pending==0; });
+    }
+
+    //wait for the peers we could reach to tell us what they measured, so we
+    //do not build the tree on one-sided metrics
+    auto deadline = steady_clock::now() 
+      + duration_cast<steady_clock::duration>(duration<float>(ghs_cfg.iperf_timeout_s));
+    std::unique_lock<std::mutex> lock(report_mut);
+    report_cv.wait_until(lock, deadline, [this]{
+        for (int i=0;i<ghs_cfg.n_agents;i++){
+          if (i!=ghs_cfg.my_id && kbps[i]>0 && !reported[i]){ return false; }
+        }
+        return true;
+        });
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      if (i==ghs_cfg.my_id) continue;
+      if (reported[i]){
+        auto prior = kbps[i];
+        kbps[i] = std::min(prior, reported_kbps[i]);
+        DEMO_LOG_DEBUG("updated metrics to %u from %u b/c rec %u\n",kbps[i],prior, reported_kbps[i]);
+      } else if (kbps[i]>0){
+        DEMO_LOG_WARN("No metrics from %d, keeping my own (%u)\n",i,kbps[i]);
+      }
+    }
+    exchanged=true;
   }
 
   void Comms::little_iperf(){
-    //infer endpoint from destination / subsystem pairs
-    size_t sz = std::min(PAYLOAD_MAX_SZ, 1024);
-    WireMessage m;
-    memset(m.bytes,0,sz);
-    m.header.type = PAYLOAD_TYPE_PING;
-    m.header.agent_from = ghs_cfg.my_id;
-    m.header.payload_size=sz;
+    using namespace std::chrono;
+    std::lock_guard<std::mutex> guard(probe_mut);
+    auto deadline = steady_clock::now() 
+      + duration_cast<steady_clock::duration>(duration<float>(ghs_cfg.iperf_timeout_s));
+
+    //shared with the trains, which may end after we have stopped waiting for them
+    struct Round
+    {
+      std::mutex mut;
+      std::condition_variable cv;
+      int pending=0;
+      bool closed=false;
+    };
+    auto round = std::make_shared<Round>();
+
+    //one train per peer, all at once, so the total time is bounded by the
+    //deadline rather than growing with the number of peers.
     for (int i=0;i<ghs_cfg.n_agents;i++){
       kbps[i]=0;
+      rtt_us[i]=0;
+      if (i!=ghs_cfg.my_id && up[i]){
+        round->pending++;
+      }
+    }
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      if (i==ghs_cfg.my_id || !up[i]) continue;
+      probe(i, deadline, ghs_cfg.iperf_train_len, [this,i,round](size_t bytes, long train_us, long best_rtt){
+          std::lock_guard<std::mutex> lock(round->mut);
+          if (!round->closed && bytes>0 && train_us>0){
+            //bits per millisecond is kilobits per second
+            kbps[i] = (Kbps) ((8000.0*bytes)/train_us);
+            rtt_us[i] = (uint32_t) best_rtt;
+            link_stats.observe(i, kbps[i], best_rtt);
+          }
+          DEMO_LOG_INFO("probe %d: %zu bytes in %ld \xC2\xB5s, rtt=%ld \xC2\xB5s\n", i, bytes, train_us, best_rtt);
+          round->pending--;
+          round->cv.notify_all();
+          });
     }
-    for (int repeat=0;repeat<10;repeat++){
-      for (int i=0;i<ghs_cfg.n_agents;i++){
 
-        if (i==ghs_cfg.my_id) continue;
+    std::unique_lock<std::mutex> lock(round->mut);
+    round->cv.wait_until(lock, deadline, [&round](){ return round->pending==0; });
+    round->closed=true;
+  }
 
-        const char* endpoint = ghs_cfg.endpoints[i];
-        m.header.agent_to = i;
-        long us_rt;
-        if (internal_send(m,endpoint,us_rt)==0){
-          kbps[i]+=(2e6*m.size())/(us_rt*10);//2e5, really, but that's annoying
-        }//if err: assume 0 kbps (adding 0 does nothing)
+  void Comms::probe(const uint16_t i, const std::chrono::steady_clock::time_point deadline, const int train_len, ProbeCallback done)
+  {
+    using namespace std::chrono;
+    auto t = std::make_shared<Train>();
+    size_t sz = std::min(std::max(ghs_cfg.iperf_payload_sz,1), PAYLOAD_MAX_SZ);
+    memset(t->m.bytes,0,sz);
+    t->m.header.type = PAYLOAD_TYPE_PING;
+    t->m.header.agent_from = ghs_cfg.my_id;
+    t->m.header.agent_to = i;
+    t->m.header.payload_size=sz;
+    t->left = train_len;
+    t->acked = 0;
+    t->best_rtt_us = 0;
+    t->timer = -1;
+    t->finished = false;
+    t->done = done;
+    loop.post([this,t,deadline](){
+        if (t->left<=0){
+          train_done(t);
+          return;
+        }
+        auto remaining = duration_cast<milliseconds>(deadline - steady_clock::now());
+        t->timer = loop.add_timer(std::max(remaining, milliseconds(0)), [this,t](){
+            t->timer=-1;
+            train_done(t);
+            });
+        //back to back: the send queue keeps as many in flight as the Transport allows
+        int n = t->left;
+        for (int k=0;k<n;k++){
+          Errno ret = send_async(t->m, [this,t](Errno e, long us){ train_acked(t, e, us); });
+          if (ret!=OK){
+            DEMO_LOG_ERROR("probe %u: cannot send: %d\n", t->m.header.agent_to, ret);
+            train_acked(t, ret, 0);
+          }
+        }
+        });
+  }
+
+  void Comms::train_acked(std::shared_ptr<Train> t, const Errno e, const long us_rt)
+  {
+    if (t->finished){
+      return;
+    }
+    t->left--;
+    if (e!=OK){
+      DEMO_LOG_ERROR("probe %u: send failed: %d\n", t->m.header.agent_to, e);
+    } else {
+      //the connection is up by the first acknowledgement, so the clock starts there
+      t->last_ack = std::chrono::steady_clock::now();
+      if (t->acked==0){
+        t->first_ack = t->last_ack;
+      }
+      t->acked++;
+      if (t->best_rtt_us==0 || us_rt<t->best_rtt_us){
+        t->best_rtt_us=us_rt;
       }
     }
+    if (t->left<=0){
+      train_done(t);
+    }
   }
 
-  void Comms::print_iperf(){
-    for (int i=0;i<ghs_cfg.n_agents;i++){
-      printf("[info] avg kbps[%d]=%d\n",i,kbps[i]);
+  void Comms::train_done(std::shared_ptr<Train> t)
+  {
+    using namespace std::chrono;
+    if (t->finished){
+      return;
+    }
+    t->finished=true;
+    if (t->timer>=0){
+      loop.cancel_timer(t->timer);
+      t->timer=-1;
+    }
+    size_t bytes=0;
+    long train_us=0;
+    if (t->acked>=2){
+      //the dispersion of the acknowledgements, not counting the first
+      bytes = (t->acked-1)*t->m.size();
+      train_us = std::max(duration_cast<microseconds>(t->last_ack-t->first_ack).count(), (long)1);
+    } else if (t->acked==1){
+      bytes = t->m.size();
+      train_us = t->best_rtt_us;
+    }
+    t->done(bytes, train_us, t->best_rtt_us);
+
+    //out of time: the PINGs still queued would only hold up what comes after them
+    if (t->left>0){
+      uint16_t to = t->m.header.agent_to;
+      std::vector<PendingSend> dropped;
+      for (size_t idx=send_qs[to].size(); idx>in_flight_n[to]; idx--){
+        if (send_qs[to][idx-1].m.header.type==PAYLOAD_TYPE_PING){
+          dropped.push_back(take(to, idx-1));
+        }
+      }
+      for (auto &p : dropped){
+        if (p.cb){
+          p.cb(ERR_TIMEOUT, 0);
+        }
+      }
     }
   }
 
-  Errno Comms::internal_send(WireMessage&m, const char* endpoint, long &us_rt)
-  {
-    std::lock_guard<std::mutex> guard(send_mut);
-    m.control.sequence=outgoing_seq;
-    void* outbuf = (void*)&m;
-    size_t obsz = m.size();
-    size_t return_seq=0;
-    size_t return_seq_sz = sizeof(return_seq);
-    std::chrono::time_point<std::chrono::steady_clock> start;
-    std::chrono::time_point<std::chrono::steady_clock> end;
+  void Comms::start_metrics(){
+    using namespace std::chrono;
+    std::lock_guard<std::mutex> guard(metric_mut);
+    if (metrics_continue){
+      return;
+    }
+    metrics_continue=true;
+    if (ghs_cfg.metric_idle_s<=0){
+      //passive tracking only
+      return;
+    }
+    //wake a few times per idle period, so no link stays unprobed much longer than that
+    auto period = duration_cast<milliseconds>(duration<float>(ghs_cfg.metric_idle_s))/4;
+    loop.post([this,period](){
+        if (metric_timer<0){
+          metric_timer = loop.add_timer(period, [this,period](){ probe_idle_links(period); }, true);
+        }
+        });
+  }
+
+  void Comms::stop_metrics(){
+    std::lock_guard<std::mutex> guard(metric_mut);
+    if (!metrics_continue){
+      return;
+    }
+    metrics_continue=false;
+    //no probe starts after this runs; those under way end by their deadline
+    loop.post([this](){
+        if (metric_timer>=0){
+          loop.cancel_timer(metric_timer);
+          metric_timer=-1;
+        }
+        });
+  }
 
-    //Create connection
-    nng_dialer dialer;
-    printf("[info] Dialing: %s \n",endpoint);
+  void Comms::on_metric_change(LinkChangeCallback cb){
+    link_stats.on_change(cb);
+  }
 
-    int ret = nng_dialer_create(&dialer, this->outgoing, endpoint);
-    if (ret!=0){ 
-      printf("[error] send() error: %s\n", nng_strerror(ret)); 
-      return ERR_NNG;
+  bool Comms::link_estimate(const uint16_t to, LinkEstimate &out) const{
+    return link_stats.get(to,out);
+  }
+
+  void Comms::probe_idle_links(const std::chrono::milliseconds period)
+  {
+    using namespace std::chrono;
+    auto idle = duration_cast<steady_clock::duration>(duration<float>(ghs_cfg.metric_idle_s));
+    auto now = steady_clock::now();
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      if (i==ghs_cfg.my_id) continue;
+      if (link_stats.idle_for(i) < idle) continue;
+      //a peer that did not answer last time is left alone for a while
+      if (now < probe_after[i]) continue;
+      //a short train, bounded by one period, that reports on its own
+      probe(i, now+period, 2, [this,i](size_t bytes, long train_us, long best_rtt){
+          if (bytes>0 && train_us>0){
+            link_stats.observe(i, (8000.0*bytes)/train_us, best_rtt);
+            probe_backoff.succeeded(i);
+          } else {
+            auto wait = probe_backoff.failed(i);
+            probe_after[i] = steady_clock::now()+wait;
+            DEMO_LOG_DEBUG("probe %d failed %d times, next in %ld ms\n", i, probe_backoff.failures(i), (long)wait.count());
+          }
+          });
     }
+  }
 
-    //dialer exists...
-    ret = nng_dialer_start(dialer,0);
-    if (ret!=0){ goto send_cleanup; }
+  void Comms::start_liveness(){
+    using namespace std::chrono;
+    if (ghs_cfg.heartbeat_s<=0 || liveness_on.exchange(true)){
+      return;
+    }
+    auto period = duration_cast<milliseconds>(duration<float>(ghs_cfg.heartbeat_s));
+    loop.post([this,period](){
+        if (liveness_timer<0){
+          //nobody is blamed for the time before we were listening for them
+          auto now = steady_clock::now();
+          liveness.reset(ghs_cfg.n_agents, period, now);
+          suspected.assign(ghs_cfg.n_agents, false);
+          liveness_due = now+period;
+          liveness_timer = loop.add_timer(period, [this,period](){ check_liveness(period); }, true);
+        }
+        });
+  }
 
-    start = std::chrono::steady_clock::now();
-    ret = nng_send(this->outgoing,outbuf,obsz,0);
-    if (ret!=0){ goto send_cleanup; } 
-    if (obsz!=m.size()){
-      printf("[error] sent: %zu/%zu\n",obsz,m.size());
+  void Comms::stop_liveness(){
+    if (!liveness_on.exchange(false)){
+      return;
     }
+    loop.post([this](){
+        if (liveness_timer>=0){
+          loop.cancel_timer(liveness_timer);
+          liveness_timer=-1;
+        }
+        });
+  }
 
-    ret = nng_recv( this->outgoing, (void*) &return_seq, &return_seq_sz, 0);
-    if (ret!=0){ goto send_cleanup; } 
-    printf("[info] Sent w/%zu, conf= %zu\n", m.control.sequence, return_seq);
-    assert(return_seq == m.control.sequence);
-    outgoing_seq++;
+  void Comms::on_suspect(SuspectCallback cb){
+    std::lock_guard<std::mutex> guard(suspect_mut);
+    suspect_cb = cb;
+  }
 
-send_cleanup:
+  double Comms::suspicion(const uint16_t to) const{
+    if (!liveness_on){
+      return 0;
+    }
+    return liveness.phi(to, std::chrono::steady_clock::now());
+  }
 
-    if (ret!=0){ 
-      printf("[error] send() error: %s\n", nng_strerror(ret)); 
-      //TODO: handle ret, for example dialer error not avail means kbps=0.
+  void Comms::check_liveness(const std::chrono::milliseconds period)
+  {
+    using namespace std::chrono;
+    auto now = steady_clock::now();
+    //if this runs a whole period late, it was us that stalled
+    bool late = now > liveness_due+period;
+    liveness_due = now+period;
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      if (i==ghs_cfg.my_id) continue;
+      //a link that is carrying messages needs no heartbeat, and one that
+      //cannot deliver them gets no more than one at a time
+      if (send_qs[i].empty() && liveness.silent_for(i,now) >= period){
+        WireMessage hb;
+        hb.header.type = PAYLOAD_TYPE_HEARTBEAT;
+        hb.header.agent_from = ghs_cfg.my_id;
+        hb.header.agent_to = i;
+        hb.header.payload_size = 0;
+        send_async(hb, nullptr);
+      }
+      if (late) continue;
+      double phi = liveness.phi(i,now);
+      bool suspect = (phi >= ghs_cfg.suspect_phi);
+      if (suspect == suspected[i]) continue;
+      suspected[i] = suspect;
+      if (suspect){
+        DEMO_LOG_WARN("agent %d has been silent for %.1f s (phi=%.1f), suspecting it\n", i,
+            duration<double>(liveness.silent_for(i,now)).count(), phi);
+      } else {
+        DEMO_LOG_INFO("agent %d was suspected, but is back\n", i);
+      }
+      std::lock_guard<std::mutex> guard(suspect_mut);
+      if (suspect_cb){
+        suspect_cb(i, phi);
+      }
     }
-    else {
-      //capture metrics
-      end = std::chrono::steady_clock::now();
-      auto diff = std::chrono::duration_cast<std::chrono::microseconds>(end-start);
-      us_rt = diff.count();
-      printf("[info] Round-trip time: %ld \xC2\xB5s\n", us_rt);
+  }
+
+  void Comms::print_iperf(){
+    for (int i=0;i<ghs_cfg.n_agents;i++){
+      DEMO_LOG_INFO("avg kbps[%d]=%d, rtt=%u\n",i,kbps[i],rtt_us[i]);
     }
+  }
 
-    int retclose=(nng_dialer_close(dialer));
-    if (retclose!=0){
-      printf("[error] closing dialer: %s",nng_strerror(retclose));
+  Errno Comms::internal_send(WireMessage&m, long &us_rt)
+  {
+    if (loop.in_loop_thread()){
+      DEMO_LOG_ERROR("send() from the I/O thread would deadlock, use send_async()\n");
+      return ERR_NNG;
     }
-    return ret==0?OK:ERR_NNG;
+    std::promise<Errno> result;
+    std::future<Errno> done = result.get_future();
+    us_rt = 0;
+    Errno ret = send_async(m, [&result,&us_rt](Errno e, long rt){
+        us_rt = rt;
+        result.set_value(e);
+        });
+    if (ret!=OK){
+      return ret;
+    }
+    return done.get();
   }
 
   void Comms::start_receiver(){
+    if (!listener){
+      DEMO_LOG_ERROR("start_receiver() before with_config()\n");
+      return;
+    }
+    start_io();
     read_continues=true;
-    reader_thread = std::thread(&Comms::read_loop, this);
+    loop.post([this](){
+        listener->receive([this](WireMessage &m){ on_message(m); });
+        });
   }
 
   void Comms::stop_receiver(){
     read_continues=false;
-    reader_thread.join();
+    if (listener){
+      loop.post([this](){
+          listener->receive(nullptr);
+          });
+    }
+    notify_app();
   }
 
   //Globally unique, symmetric metric.
@@ -490,4 +982,9 @@ send_cleanup:
   {
     return kbps[to];
   }
+
+  uint32_t Comms::rtt_us_to(const uint16_t to) const
+  {
+    return rtt_us[to];
+  }
 }
@@ -43,18 +43,22 @@
 #include "ghs-demo-config.h"
 #include "ghs-demo-msgutils.h"
 #include "ghs-demo-edgemetrics.h"
-#include "seque/static_queue.h"
-#include <nng/nng.h>//req_s, rep_s, msg
+#include "ghs-demo-linkstats.h"
+#include "ghs-demo-eventloop.h"
+#include "ghs-demo-timerwheel.h"
+#include "ghs-demo-failuredetector.h"
 #include <cstring> //memcpy, memset
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
 #include <thread>
 #include <mutex>
-
-#ifndef COMMS_DEMO_MAX_N
-/// The max number of agents to demonstrate
-#define COMMS_DEMO_MAX_N 8
-#endif
+#include <condition_variable>
+#include <chrono>
 
 #ifndef PAYLOAD_MAX_SZ
 /// The max size of the payload to send over the wire
@@ -78,6 +82,8 @@ namespace demo{
     ERR_DEST_UNSET,         ///< Bad or unspecified Destination
     ERR_HANGUP,             ///< Connection was lost
     ERR_NNG,                ///< NNG returned an error code, please see logging output
+    ERR_TIMEOUT,            ///< The message was not acknowledged within Config::send_timeout_s
+    ERR_TRANSPORT,          ///< A (non-nng) Transport failed, please see logging output
   };
 
   /** 
@@ -91,6 +97,10 @@ namespace demo{
     PAYLOAD_TYPE_METRICS,      ///< Metrics messages are for exchanging data about links
     PAYLOAD_TYPE_PING,         ///< Ping messages are used to benchmark links to gather metrics
     PAYLOAD_TYPE_GHS,          ///< message was intended for GHS, don't process, just send it
+    PAYLOAD_TYPE_HEARTBEAT,    ///< Heartbeats keep quiet links from looking dead to the failure detector
+    PAYLOAD_TYPE_HELLO,        ///< Announces an agent to its peers at start-up (see Comms::await_peers())
+    PAYLOAD_TYPE_HEALTH,       ///< A le::ghs::HealthReport, sent up the MST after convergence, for the app
+    PAYLOAD_TYPE_CHUNK,        ///< A le::ghs::ChunkHeader and chunk of a le::ghs::TreeBroadcast (or its ack), for the app
   };
 
 //typedef uint8_t ControlCommand;
@@ -121,6 +131,19 @@ namespace demo{
    */
   typedef size_t SequenceCounter;
 
+  /**
+   * Called on the Comms I/O thread when an asynchronous send completes,
+   * with the result and (on success) the round-trip time in microseconds.
+   */
+  typedef std::function<void(Errno result, long us_rt)> SendCallback;
+
+  /**
+   * Called on the Comms I/O thread with an agent id and its phi (see
+   * FailureDetector) when that agent becomes suspected, and again when it is
+   * heard from after that.
+   */
+  typedef std::function<void(uint16_t agent_id, double phi)> SuspectCallback;
+
   /**
    * @brief a structure that defines source and destination for WireMessage objects
    *
@@ -187,20 +210,115 @@ namespace demo{
       }
     };
 
+  /**
+   * Called on the Comms I/O thread when a Transport has delivered a message
+   * (OK) or has given up on it.
+   */
+  typedef std::function<void(Errno result)> DeliveryCallback;
+
+  /**
+   * Called on the Comms I/O thread with each message a Transport receives.
+   */
+  typedef std::function<void(WireMessage &m)> ReceiveCallback;
+
+  /**
+   * @brief the interface between Comms and one way of moving WireMessage objects between agents
+   *
+   * Comms creates one Transport for each endpoint scheme in the config (see
+   * make_transport()), and sends to each agent over the Transport for the
+   * scheme of that agent's endpoint. It listens on the Transport for the
+   * scheme of its own endpoint.
+   *
+   * Every Transport is driven by the EventLoop it was constructed with.
+   * Except for the constructor, listen() and the destructor (which are
+   * called while the loop is not running), every method is called on the
+   * loop thread, and every callback must be made there too, but never from
+   * inside the call that installed it.
+   *
+   * Comms keeps at most window() messages in flight per agent, and takes
+   * care of ordering, sequence numbers, duplicates and timeouts, so a
+   * Transport only has to move the bytes and report when they arrived.
+   */
+  class Transport
+  {
+    public:
+      virtual ~Transport(){}
+
+      /**
+       * Starts accepting messages at Config::endpoints[Config::my_id]. They
+       * are held (or refused) until receive() is called.
+       */
+      virtual Errno listen()=0;
+
+      /**
+       * Passes every received message to `cb`, or holds them again if `cb` is empty.
+       */
+      virtual void receive(ReceiveCallback cb)=0;
+
+      /**
+       * Sends `m` to `m.header.agent_to`, and calls `done` when it has
+       * arrived or cannot be sent. 
+       *
+       * @return OK, or the reason it could not be started (and `done` is not called)
+       */
+      virtual Errno send(const WireMessage &m, DeliveryCallback done)=0;
+
+      /**
+       * Gives up on every message in flight to `agent_id`. Their `done`
+       * callbacks may still be called, and Comms ignores them.
+       */
+      virtual void cancel(const uint16_t agent_id)=0;
+
+      /**
+       * How many messages Comms may have in flight to one agent at once.
+       * They are sent in order, and must be delivered in that order.
+       */
+      virtual size_t window() const { return 1; }
+  };
+
+  /**
+   * @return the scheme of an endpoint, e.g. "tcp" for "tcp://localhost:5000", or "" if it has none
+   */
+  std::string endpoint_scheme(const std::string &endpoint);
+
+  /**
+   * Creates the Transport for an endpoint scheme:
+   *
+   *   * `shm` : ShmTransport, for agents on the same host
+   *   * `udp` : UdpTransport, datagrams with our own reliability
+   *   * `mem` : MemTransport, for agents that are threads of the same process
+   *   * anything else : NngTransport (`tcp`, `ipc`, `inproc`, ...)
+   *
+   * If Config::emulate is set, it is wrapped in an EmuTransport.
+   *
+   * @return a new Transport, owned by the caller
+   */
+  Transport* make_transport(const std::string &scheme, EventLoop &loop, const Config &config);
+
   /**
    *
-   * @brief a message passing class that uses nng, suitable for testing GhsState
+   * @brief a message passing class that uses nng (or another Transport), suitable for testing GhsState
    *
    * This class encapsulates the network layer for a demonstration of GHS over a real network.
    * It is initialized by populating a DemoConfig struct and calling with_config()
    *
    * After that, you can use send() and call get_next() at will to exchanges messages using nng_socket of type req-rep.
+   *
+   * All I/O (receiving, sending and waiting for acknowledgements, send
+   * timeouts) runs on a single I/O thread driven by an EventLoop, over the
+   * Transport chosen by each endpoint's scheme. Callers of send() only block until their
+   * own message is acknowledged, and the application can sleep in wait()
+   * until a message arrives instead of polling has_msg().
    */
   class Comms
   {
     public:
       Comms();
       ~Comms();
+
+      /**
+       * @return true if with_config() has been called and we are listening on our endpoint
+       */
       bool ok();
 
       /**
@@ -225,27 +343,64 @@ namespace demo{
        * Sends a demo::WireMessage.
        * The demo::WireMessage contains all the destination and routing information in it, so this is a singular call that blocks then returns a status message.
        *
+       * The message is handed to the I/O thread, and this call blocks until
+       * the destination acknowledges it or Config::send_timeout_s passes.
+       * Do not call it from a Comms callback.
+       *
        * @return demo::WireMessageErrno denoting success or failure
        */
       Errno send(demo::WireMessage&, demo::OptMask=0);
 
       /**
+       * Queues a demo::WireMessage for sending and returns immediately.
+       *
+       * Messages to the same agent are sent in order, as many at a time as
+       * its Transport::window() allows. `cb` (if set) is called on the I/O
+       * thread once the message is acknowledged, or with ERR_TIMEOUT if that
+       * does not happen within Config::send_timeout_s.
        *
-       * Starts a background process to copy incoming message into a buffer for later processing.
+       * @return OK if the message was queued, otherwise the reason it was not (and `cb` is not called)
+       */
+      Errno send_async(const demo::WireMessage&, SendCallback cb);
+
+      /**
        *
-       * This is implementation specific, I use plain old threads here.  Note, ZMQ does
-       * this for you, but requires a lot of std:: and platform assumptions.
+       * Starts copying incoming messages into a buffer for later processing.
        *
-       * So, we avoid *some of* that with nng, and one use of std::thread.
+       * This is implementation specific. The I/O thread asks the Transport
+       * we listen on to hand over what it receives, which it does without
+       * blocking. Note, ZMQ does this for you, but requires a lot of std::
+       * and platform assumptions.
        */
       void start_receiver();
       /**
        *
-       * Stops the background process by interrupting it after it's next timeout, then `join`ing the thread until it exits cleanly. This will block for a few seconds, but shouldn't fail. 
+       * Stops copying incoming messages, and wakes anyone blocked in wait(). This returns immediately.
        *
        */
       void stop_receiver();
 
+      /**
+       * Blocks until a message is waiting in the incoming buffer, the
+       * receiver is stopped, or `timeout` passes.
+       *
+       * @return has_msg()
+       */
+      bool wait(std::chrono::milliseconds timeout);
+
+      /**
+       * Wakes anyone blocked in wait(), e.g. from a send_async() callback
+       * that has made more work for them.
+       */
+      void wake();
+
+      /**
+       * An eventfd(2) that becomes readable when a message is added to the
+       * incoming buffer, for callers that run their own poll() loop. Read it
+       * to clear it, then drain with get_next().
+       */
+      int event_fd() const;
+
       /**
        * Returns true if there is a message waiting in the incoming buffer. 
        *
@@ -259,13 +414,51 @@ namespace demo{
       bool get_next(demo::WireMessage&);
 
       /**
-       * This will block for a while, during which time it will repeatedly send and receive messages from all known endpoints to guage the throughput of the links. This information is used to populate the GhsState::mwoe() and Edge metric_t information.
+       * The start-up barrier. Announces this agent to every peer, and
+       * blocks until each of them has acknowledged (so is up, and receiving)
+       * or `deadline` passes. A peer that cannot be reached yet is asked
+       * again after a Backoff, so peers may come up in any order.
+       *
+       * Peers that were not up in time are left out of little_iperf() and
+       * exchange_iperf() (and so get no edge), instead of each costing a
+       * probe deadline and a send timeout. Until this is called, every peer
+       * is taken to be up.
+       *
+       * @return how many peers are up
+       */
+      int await_peers(std::chrono::steady_clock::time_point deadline);
+
+      /**
+       * @return false if await_peers() gave up on the given agent
+       */
+      bool is_up(const uint16_t agent_id) const;
+
+      /**
+       * This will block for at most Config::iperf_timeout_s, during which time it sends a packet train of Config::iperf_train_len PING messages to every known endpoint to guage the throughput of the links. This information is used to populate the GhsState::mwoe() and Edge metric_t information.
+       *
+       * All peers are probed at once through the same per-peer queue and
+       * Transport as every other message. Each train is queued whole, so
+       * the Transport keeps as many PINGs in flight as its window() allows,
+       * and no thread is spent per peer. The throughput is taken from the
+       * spacing of the acknowledgements: the bytes acknowledged after the
+       * first one, divided by the time from the first to the last. Setting
+       * up the connection happens before the first acknowledgement, so it
+       * is not counted. A train with only one acknowledgement falls back to
+       * its size over its round trip. The fastest round trip in the train
+       * is kept as the RTT. Peers that do not answer before the deadline
+       * get 0 kbps.
+       *
        * However, the actual link metrics that are used are calculated by unique_link_metric_to()
        */
       void little_iperf();
       /**
        * This will block for a while, during which time it will synchronize with all known endpoints so that everyone uses the same link metric values. 
        *
+       * It sends our measurement to every peer, then waits (at most
+       * Config::iperf_timeout_s) until each peer we could reach has sent
+       * theirs, and keeps the smaller of the two. Reports that arrive later
+       * are applied as they come in.
+       *
        * However, the actual link metrics that are used are calculated by unique_link_metric_to()
        */
       void exchange_iperf();
@@ -280,6 +473,79 @@ namespace demo{
        */
       Kbps kbps_to(const uint16_t agent_id) const;
 
+      /**
+       * Returns the fastest round-trip time to the given agent observed by little_iperf(), in microseconds (0 if unknown)
+       */
+      uint32_t rtt_us_to(const uint16_t agent_id) const;
+
+      /**
+       * Starts the background metric service. From then on, every link that
+       * has been idle for Config::metric_idle_s is probed with a short
+       * packet train, and all traffic (sent or received) updates the
+       * smoothed estimates available from link_estimate(). The probes are
+       * driven by a timer on the I/O thread, and a peer that does not answer
+       * one is not probed again until its Backoff has passed.
+       *
+       * The metrics used for GhsState (kbps_to(), unique_link_metric_to())
+       * are *not* changed by this service, since every agent must agree on
+       * them. Use on_metric_change() to decide when they are stale enough to
+       * measure again and re-elect.
+       */
+      void start_metrics();
+
+      /**
+       * Stops the background metric service. Probes already under way run
+       * out their (short) deadline.
+       */
+      void stop_metrics();
+
+      /**
+       * Installs a callback that is invoked whenever the smoothed throughput
+       * to an agent drifts by more than Config::metric_change_threshold from
+       * the value last reported. It is called from a Comms thread.
+       */
+      void on_metric_change(LinkChangeCallback cb);
+
+      /**
+       * Starts the failure detector. From then on, every message from a peer
+       * and every acknowledgement of one of ours is a sign of life, and a
+       * peer we have not heard from for Config::heartbeat_s is sent a
+       * heartbeat (unless messages to it are already waiting), so a link
+       * costs nothing extra while it is busy. Every Config::heartbeat_s, the
+       * I/O thread works out each peer's phi, and one that reaches
+       * Config::suspect_phi is reported to the on_suspect() callback.
+       *
+       * A round in which the I/O thread itself ran late is not judged, since
+       * it was us, not our peers, that went quiet.
+       */
+      void start_liveness();
+
+      /**
+       * Stops the failure detector and the heartbeats. Peers will soon
+       * suspect us, unless we keep talking to them.
+       */
+      void stop_liveness();
+
+      /**
+       * Installs a callback for when agents become suspected, or are heard
+       * from again after that. It is called on the I/O thread, under a
+       * lock that on_suspect() also takes, so once on_suspect(nullptr)
+       * returns it is not running and will not run again. It must not
+       * block.
+       */
+      void on_suspect(SuspectCallback cb);
+
+      /**
+       * @return the phi of an agent, i.e., how suspicious its silence is (0 if unknown or the detector is stopped)
+       */
+      double suspicion(const uint16_t agent_id) const;
+
+      /**
+       * Copies out the smoothed estimate of the link to the given agent
+       * @return false if the agent is unknown
+       */
+      bool link_estimate(const uint16_t agent_id, LinkEstimate &out) const;
+
       /**
        *
        * @brief **This function is really important for the working of your system**
@@ -299,24 +565,100 @@ namespace demo{
 
     private:
 
-      void validate_sockets();
-      void read_loop();
-      int recv(demo::WireMessage& buf);
-      demo::Errno internal_send(demo::WireMessage &m, const char* endpoint, long &us_rt);
-
-      seque::StaticQueue<demo::WireMessage,1024> in_q;
-      bool read_continues;
+      /// A message waiting for its turn, or for its acknowledgement, on the I/O thread
+      struct PendingSend
+      {
+        WireMessage m;
+        SendCallback cb;
+        std::chrono::steady_clock::time_point start;
+        bool in_flight;
+        int timer;
+      };
+
+      void start_io();
+      void stop_io();
+      void on_message(demo::WireMessage &m);
+      void dispatch(demo::WireMessage &m);
+      void notify_app();
+      demo::Errno internal_send(demo::WireMessage &m, long &us_rt);
+      void kick(const uint16_t agent_id);
+      void arm_timeout(const uint16_t agent_id);
+      void delivered(const uint16_t agent_id, const SequenceCounter seq, const Errno result);
+      PendingSend take(const uint16_t agent_id, const size_t idx);
+      /// Called once a packet train ends, with the bytes acknowledged, the time they took, and the fastest round trip
+      typedef std::function<void(size_t bytes_acked, long train_us, long best_rtt_us)> ProbeCallback;
+
+      /// One packet train, queued all at once, and timed by the spacing of its acknowledgements
+      struct Train
+      {
+        WireMessage m;
+        int left;
+        int acked;
+        long best_rtt_us;
+        std::chrono::steady_clock::time_point first_ack, last_ack;
+        int timer;
+        bool finished;
+        ProbeCallback done;
+      };
+
+      void probe(const uint16_t agent_id, const std::chrono::steady_clock::time_point deadline, const int train_len, ProbeCallback done);
+      void train_acked(std::shared_ptr<Train> t, const Errno e, const long us_rt);
+      void train_done(std::shared_ptr<Train> t);
+      void probe_idle_links(const std::chrono::milliseconds period);
+      void check_liveness(const std::chrono::milliseconds period);
+      /// Shared between await_peers() and the HELLOs, which may be acknowledged after it has stopped waiting
+      struct Barrier
+      {
+        std::mutex mut;
+        std::condition_variable cv;
+        std::vector<bool> up;
+        int left;
+        std::chrono::steady_clock::time_point deadline;
+        Backoff backoff{std::chrono::milliseconds(100), std::chrono::milliseconds(10000), 0, 0};
+      };
+      void hello(const uint16_t agent_id, std::shared_ptr<Barrier> b);
+
+      /// Grows as needed: a slow application must not lose acknowledged messages
+      std::deque<demo::WireMessage> in_q;
+      std::atomic<bool> read_continues;
       Config ghs_cfg;
-      nng_listener ctr_listener = NNG_LISTENER_INITIALIZER;
-      nng_listener ghs_listener = NNG_LISTENER_INITIALIZER;
-      nng_socket incoming=NNG_SOCKET_INITIALIZER;
-      nng_socket outgoing=NNG_SOCKET_INITIALIZER;
-      size_t outgoing_seq;
-      std::array<size_t,COMMS_DEMO_MAX_N> sequence_counters;
-      std::array<Kbps,COMMS_DEMO_MAX_N> kbps;
+      int app_fd=-1;
+      EventLoop loop;
+      std::thread io_thread;
+      //declared after the loop, so they are destroyed before it
+      std::vector<std::unique_ptr<Transport>> transports;
+      std::vector<Transport*> peer_transport;
+      Transport* listener=nullptr;
+      bool listening=false;
+      std::vector<std::deque<PendingSend>> send_qs;
+      std::vector<size_t> in_flight_n;
+      std::atomic<size_t> outgoing_seq;
+      std::vector<size_t> sequence_counters;
+      std::vector<Kbps> kbps;
+      std::vector<Kbps> reported_kbps;
+      std::vector<bool> reported;
+      bool exchanged=false;
+      std::mutex report_mut;
+      std::condition_variable report_cv;
+      std::vector<uint32_t> rtt_us;
+      std::vector<bool> up;
+      LinkStats link_stats;
+      std::mutex probe_mut;
+      std::mutex metric_mut;
+      bool metrics_continue=false;
+      //the rest of the metric service lives on the loop thread
+      int metric_timer=-1;
+      Backoff probe_backoff{std::chrono::milliseconds(100), std::chrono::milliseconds(10000), 0, 0};
+      std::vector<std::chrono::steady_clock::time_point> probe_after;
+      FailureDetector liveness;
+      std::atomic<bool> liveness_on{false};
+      std::mutex suspect_mut;
+      SuspectCallback suspect_cb;
+      //on the loop thread
+      int liveness_timer=-1;
+      std::chrono::steady_clock::time_point liveness_due;
+      std::vector<bool> suspected;
       std::mutex q_mut;
-      std::mutex send_mut;
-      std::thread reader_thread;
 
   };
 }
@@ -40,12 +40,6 @@
 #ifndef DEMO_CONFIG
 #define DEMO_CONFIG
 
-/// The maximum number of agents the demo can accomodate
-#define MAX_N 8
-
-/// The max strlen() of the endpoint
-#define MAX_ENDPOINT_SZ 256
-
 /// A special value for N that means "not set yet"
 #define N_UNSET 0
 
@@ -53,9 +47,31 @@
 #define ID_UNSET -1
 
 #include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 ///
 namespace demo{
+  /**
+   * @brief How one emulated link behaves (see EmuTransport)
+   */
+  struct LinkProfile
+  {
+    /// The one-way delay, in ms
+    float latency_ms=0;
+
+    /// Each message is delayed by latency_ms plus or minus up to this much, in ms
+    float jitter_ms=0;
+
+    /// The link rate in kbit/s, or 0 for no limit
+    float kbps=0;
+
+    /// The chance that each copy of a message is lost and has to be sent again (1 takes the link down)
+    float loss=0;
+  };
+
   /** 
    *
    * @brief A struct that holds the union of all configuration variables. 
@@ -63,14 +79,14 @@ namespace demo{
    */
   struct Config
   {
-    /// The time to wait before starting the main algorithm
+    /// The longest to wait for every peer to come up before measuring links, in seconds (0: take them all to be up already, see Comms::await_peers())
     float wait_s= 0 ;
 
     /// The number of agents currently loaded
     int n_agents=N_UNSET;
 
-    /// The endpoint for each agent, as read from the config
-    char endpoints[MAX_N][MAX_ENDPOINT_SZ]={0};
+    /// The endpoint for each agent, as read from the config. There is no fixed limit on the number of agents.
+    std::vector<std::string> endpoints;
 
     /// A bool to determine if we should do a test-and-die routine or not
     int test=0;
@@ -89,6 +105,84 @@ namespace demo{
     /// If we fail to dial up an agent, should we retry later (true) or drop the message (false)
     bool retry_connections=false;
 
+    /// How many PING messages make up one packet train sent to each peer by Comms::little_iperf()
+    int iperf_train_len=10;
+
+    /// How many payload bytes each PING in the packet train carries (capped at PAYLOAD_MAX_SZ)
+    int iperf_payload_sz=1024;
+
+    /// The upper bound on the time Comms::little_iperf() spends probing all peers, in seconds
+    float iperf_timeout_s=2.0;
+
+    /// The least severe demo::LogLevel that is written (0=debug, 1=info, 2=warn, 3=error, 4=none)
+    int log_level=1;
+
+    /// How long Comms::send() waits for a message to be acknowledged before giving up, in seconds
+    float send_timeout_s=5.0;
+
+    /// The first pause before a failed send (with retry_connections) or link probe is tried again, in seconds; it doubles with each failure in a row
+    float retry_base_s=0.1;
+
+    /// The longest pause between retries, in seconds
+    float retry_max_s=10.0;
+
+    /// Links that carried no traffic for this many seconds are probed in the background (<=0 disables probing)
+    float metric_idle_s=5.0;
+
+    /// The weight of a new sample in the smoothed link metrics, in (0,1]
+    float metric_alpha=0.2;
+
+    /// The relative throughput change that triggers the Comms::on_metric_change() callback
+    float metric_change_threshold=0.25;
+
+    /// A peer we have not heard from for this many seconds is sent a heartbeat, and the failure detector runs this often (<=0 disables it)
+    float heartbeat_s=1.0;
+
+    /// The phi (see FailureDetector) at which a silent peer is suspected to have failed, and is dropped from the election
+    float suspect_phi=8.0;
+
+    /// Move the leader to the center of the tree once GHS converges, so the tree is as shallow as it can be (see le::ghs::GhsState::set_recenter()). Every agent must agree.
+    bool center_leader=false;
+
+    /// Cap the number of tree links of each agent, so no agent sends a broadcast down too many of them, at the cost of a heavier tree (see le::ghs::GhsState::set_max_degree()). Every agent must agree (0: no cap)
+    uint32_t max_degree=0;
+
+    /// If GHS has not converged this many seconds after it started, log the best leader known so far (see le::ghs::GhsState::current_leader()) and carry on (<=0: never)
+    float leader_deadline_s=0;
+
+    /// After convergence, each agent tells its parent how its subtree is doing this often, and the leader logs the health of the fleet (see le::ghs::TreeHealth). In seconds (<=0: exit once converged)
+    float health_period_s=0;
+
+    /// If set, after convergence the leader sends this file down the MST to every agent in chunks (see le::ghs::TreeBroadcast), and each agent stays up until it and its subtree have all of it. Only the leader reads it, but every agent must be given one to wait for it.
+    std::string broadcast_file;
+
+    /// How many chunks of the broadcast each child may have unacknowledged
+    int broadcast_window=8;
+
+    /// How many messages each sender can have waiting for a `shm://` agent (rounded up to a power of two)
+    int shm_ring_slots=64;
+
+    /// How many unacknowledged messages a `udp://` link may have in flight
+    int udp_window=32;
+
+    /// How many unanswered requests an nng (`tcp://`, `ipc://`, ...) link may have in flight
+    int nng_window=8;
+
+    /// The fraction of datagrams a `udp://` link drops on purpose, to test retransmission (0 in real use)
+    float udp_loss=0.0;
+
+    /// If >0, run this many agents as threads of one process, over `mem://` endpoints, instead of just my_id
+    int cluster=0;
+
+    /// If set, a file of link profiles (see read_link_profiles()), and every Transport is wrapped in an EmuTransport
+    std::string emulate;
+
+    /// The profile of every link that the `emulate` file does not list
+    LinkProfile emu_default;
+
+    /// The profiles of the links the `emulate` file lists, by (lower id, higher id)
+    std::map<std::pair<int,int>,LinkProfile> emu_links;
+
     ///How many seconds should we wait before starting to send messages? This is useful to let others startup
 
   };
@@ -99,7 +193,7 @@ namespace demo{
    * @return true if it is ok
    * @return false if not
    */
-  bool cfg_is_ok(Config config);
+  bool cfg_is_ok(const Config &config);
 
   /**
    * Reads the config from an ini-formatted file (if you compiled in
@@ -119,6 +213,26 @@ namespace demo{
    */
   void read_cfg_stdin(Config*c);
 
+  /**
+   * Reads per-link profiles for EmuTransport from an ini-formatted file into
+   * Config::emu_default and Config::emu_links (if you compiled in
+   * ghs-demo-inireader.cpp), and sets Config::emulate. Links are undirected,
+   * and a link section starts from the `[default]` values read before it:
+   *
+   *     [default]
+   *     latency_ms=20
+   *     jitter_ms=5
+   *     kbps=2000
+   *     loss=0.01
+   *
+   *     [0-3]
+   *     latency_ms=150
+   *     loss=0.2
+   *
+   * @return false if the file cannot be read or has a bad line
+   */
+  bool read_link_profiles(const char* fname, Config* c);
+
   /** 
    * Populates config variables based on command line switches.
    * Uses arpg.h.
@@ -40,9 +40,34 @@
 
 #include "doctest/doctest.h"
 #include "ghs/msg.h"
+#include "ghs/ghs.h"
 #include "ghs-demo-msgutils.h"
 #include "ghs-demo-config.h"
 #include "ghs-demo-comms.h"
+#include "ghs-demo-linkstats.h"
+#include "ghs-demo-eventloop.h"
+#include "ghs-demo-log.h"
+#include "ghs-demo-transport-shm.h"
+#include "ghs-demo-transport-udp.h"
+#include "ghs-demo-transport-emu.h"
+#include "ghs-demo-outbox.h"
+#include "ghs-demo-timerwheel.h"
+#include "ghs-demo-failuredetector.h"
+#include "ghs-demo.h" //GhsDemoExec, for the in-process cluster
+#include <unistd.h>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
 
 demo::Config get_cfg(int a=4){
   demo::Config ret;
@@ -99,4 +124,1345 @@ TEST_CASE("unique_metric")
       sym_metric(0,1,101) ,
       sym_metric(0,1,100) 
       );
+
+  //faster is better across the whole range, and a dead link is the worst
+  std::vector<Kbps> rates{0,1,2,100,101,1000,1000000,4000000000u,std::numeric_limits<Kbps>::max()};
+  for (size_t i=1;i<rates.size();i++){
+    CHECK_LT(sym_metric(3,2,rates[i]), sym_metric(2,3,rates[i-1]));
+    CHECK_LT(sym_metric(3,2,rates[i]), sym_metric(9,8,rates[i-1]));
+    CHECK(le::ghs::is_valid((le::ghs::metric_t)sym_metric(3,2,rates[i])));
+  }
+}
+
+///The slowest link on the tree path between each pair of agents, by (lower, higher) id
+std::map<std::pair<int,int>,Kbps> path_bottlenecks(int n, const std::vector<std::tuple<int,int,Kbps>> &tree)
+{
+  std::vector<std::vector<std::pair<int,Kbps>>> adj(n);
+  for (auto &e : tree){
+    adj[std::get<0>(e)].push_back({std::get<1>(e),std::get<2>(e)});
+    adj[std::get<1>(e)].push_back({std::get<0>(e),std::get<2>(e)});
+  }
+  std::map<std::pair<int,int>,Kbps> out;
+  for (int a=0;a<n;a++){
+    std::vector<Kbps> slowest(n,0);
+    std::vector<bool> seen(n,false);
+    std::vector<int> todo{a};
+    seen[a]=true;
+    slowest[a]=std::numeric_limits<Kbps>::max();
+    while (!todo.empty()){
+      int at=todo.back();
+      todo.pop_back();
+      for (auto &next : adj[at]){
+        if (!seen[next.first]){
+          seen[next.first]=true;
+          slowest[next.first]=std::min(slowest[at],next.second);
+          todo.push_back(next.first);
+        }
+      }
+    }
+    for (int b=a+1;b<n;b++){
+      out[{a,b}]=slowest[b];
+    }
+  }
+  return out;
+}
+
+///The tree of least total metric over the complete graph with the given throughputs (what GHS builds)
+std::vector<std::tuple<int,int,Kbps>> least_metric_tree(int n, const std::vector<std::vector<Kbps>> &kbps,
+    std::function<uint64_t(uint16_t,uint16_t,Kbps)> metric)
+{
+  std::vector<std::tuple<uint64_t,int,int>> edges;
+  for (int a=0;a<n;a++){
+    for (int b=a+1;b<n;b++){
+      edges.emplace_back(metric(a,b,kbps[a][b]),a,b);
+    }
+  }
+  std::sort(edges.begin(),edges.end());
+  std::vector<int> part(n);
+  for (int i=0;i<n;i++){
+    part[i]=i;
+  }
+  std::function<int(int)> find = [&](int i){ return part[i]==i ? i : part[i]=find(part[i]); };
+  std::vector<std::tuple<int,int,Kbps>> tree;
+  for (auto &e : edges){
+    int a=std::get<1>(e), b=std::get<2>(e);
+    if (find(a)!=find(b)){
+      part[find(a)]=find(b);
+      tree.emplace_back(a,b,kbps[a][b]);
+    }
+  }
+  return tree;
+}
+
+TEST_CASE("bottleneck tree")
+{
+  //what sym_metric() used to compute: the inverse throughput, shifted out of its top 32 bits
+  auto legacy_metric = [](uint16_t a, uint16_t b, Kbps kbps){
+    uint64_t ikbps = (uint64_t)((double)std::numeric_limits<uint64_t>::max()/(double)kbps);
+    return ((uint64_t)std::max(a,b)<<16) + (uint64_t)std::min(a,b) + (ikbps<<32);
+  };
+  //the widest path between each pair runs through the tree of greatest throughput
+  auto widest = [](uint16_t a, uint16_t b, Kbps kbps){
+    return (uint64_t)(std::numeric_limits<Kbps>::max()-kbps);
+  };
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> decades(2,6);
+  const int N=12;
+  long pairs=0, best_now=0, best_before=0;
+  double share_now=0, share_before=0;
+  for (int trial=0;trial<50;trial++){
+    std::vector<std::vector<Kbps>> kbps(N, std::vector<Kbps>(N,0));
+    for (int a=0;a<N;a++){
+      for (int b=a+1;b<N;b++){
+        kbps[a][b] = kbps[b][a] = (Kbps)std::pow(10.0, decades(rng));
+      }
+    }
+    auto best = path_bottlenecks(N, least_metric_tree(N, kbps, widest));
+    auto now = path_bottlenecks(N, least_metric_tree(N, kbps, sym_metric));
+    auto before = path_bottlenecks(N, least_metric_tree(N, kbps, legacy_metric));
+    for (auto &p : best){
+      pairs++;
+      CHECK_EQ(now[p.first], p.second);
+      best_now += now[p.first]==p.second;
+      best_before += before[p.first]==p.second;
+      share_now += (double)now[p.first]/p.second;
+      share_before += (double)before[p.first]/p.second;
+    }
+  }
+  MESSAGE(pairs << " pairs of agents got the widest path through the tree for " << best_now
+      << " of them (" << 100*share_now/pairs << "% of the best throughput on average), against "
+      << best_before << " (" << 100*share_before/pairs << "%) with the old metric");
+}
+
+TEST_CASE("iperf config")
+{
+  const char* fname = "ghs-demo-doctest-iperf.ini";
+  FILE* f = fopen(fname,"w");
+  REQUIRE(f!=NULL);
+  fprintf(f,"[ghs]\n0=tcp://localhost:5000\n1=tcp://localhost:5001\n");
+  fprintf(f,"[runtime]\niperf_train_len=4\niperf_payload_bytes=256\niperf_timeout_seconds=0.5\nnng_window=3\n");
+  fclose(f);
+
+  demo::Config c;
+  demo::read_cfg_file(fname,&c);
+  CHECK_EQ(c.n_agents,2);
+  CHECK_EQ(c.iperf_train_len,4);
+  CHECK_EQ(c.iperf_payload_sz,256);
+  CHECK_EQ(c.iperf_timeout_s,0.5);
+  CHECK_EQ(c.nng_window,3);
+  remove(fname);
+}
+
+TEST_CASE("linkstats ewma")
+{
+  demo::LinkStats stats(3, 0.5, 0.25);
+  int calls=0;
+  Kbps last_old=0, last_new=0;
+  stats.on_change([&](uint16_t id, Kbps o, Kbps n){
+      CHECK_EQ(id,1);
+      calls++;
+      last_old=o;
+      last_new=n;
+      });
+
+  demo::LinkEstimate e;
+  CHECK_FALSE(stats.get(3,e));
+  REQUIRE(stats.get(1,e));
+  CHECK_EQ(e.kbps_samples,0);
+
+  //first sample is taken as-is, and does not count as a change
+  stats.observe(1,1000,100);
+  REQUIRE(stats.get(1,e));
+  CHECK_EQ(e.kbps_mean,1000);
+  CHECK_EQ(e.rtt_mean_us,100);
+  CHECK_EQ(e.kbps_var,0);
+  CHECK_EQ(calls,0);
+
+  //mean moves halfway, but 1100 is within threshold of 1000
+  stats.observe(1,1200,100);
+  REQUIRE(stats.get(1,e));
+  CHECK_EQ(e.kbps_mean,1100);
+  CHECK_GT(e.kbps_var,0);
+  CHECK_EQ(calls,0);
+
+  //1100 -> 1550 is > 25% above the last reported 1000
+  stats.observe(1,2000,100);
+  CHECK_EQ(calls,1);
+  CHECK_EQ(last_old,1000);
+  CHECK_EQ(last_new,1550);
+
+  //rtt-only samples never fire the callback
+  stats.observe_rtt(1,300);
+  REQUIRE(stats.get(1,e));
+  CHECK_EQ(e.rtt_mean_us,200);
+  CHECK_EQ(e.kbps_samples,3);
+  CHECK_EQ(e.rtt_samples,4);
+  CHECK_EQ(calls,1);
+
+  //untouched links are idle 'forever'
+  CHECK(stats.idle_for(2) > stats.idle_for(1));
+}
+
+TEST_CASE("eventloop")
+{
+  using namespace std::chrono;
+  demo::EventLoop loop;
+  REQUIRE(loop.ok());
+  CHECK_FALSE(loop.in_loop_thread());
+
+  int fds[2];
+  REQUIRE_EQ(pipe(fds),0);
+
+  std::atomic<int> reads(0), ticks(0), posts(0);
+  bool posted_in_loop=false;
+  int tick_timer=-1;
+
+  //a readable fd is delivered on the loop, and can unwatch itself
+  REQUIRE(loop.watch(fds[0],[&](){
+        char c;
+        CHECK_EQ(read(fds[0],&c,1),1);
+        reads++;
+        loop.unwatch(fds[0]);
+        }));
+
+  //a repeating timer can cancel itself
+  tick_timer = loop.add_timer(milliseconds(5),[&](){
+      if (++ticks==3){
+        CHECK(loop.cancel_timer(tick_timer));
+      }
+      },true);
+  REQUIRE_GE(tick_timer,0);
+
+  std::thread io(&demo::EventLoop::run, &loop);
+
+  loop.post([&](){ posted_in_loop=loop.in_loop_thread(); posts++; });
+  CHECK_EQ(write(fds[1],"ab",2),2);
+
+  auto give_up = steady_clock::now()+seconds(2);
+  while ((ticks<3 || posts<1 || reads<1) && steady_clock::now()<give_up){
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  std::this_thread::sleep_for(milliseconds(20));
+
+  //stop() wakes the loop at once, without any timeout to wait out
+  auto stop_start = steady_clock::now();
+  loop.stop();
+  io.join();
+  CHECK_LT(duration_cast<milliseconds>(steady_clock::now()-stop_start).count(), 100);
+
+  CHECK(posted_in_loop);
+  CHECK_EQ(posts.load(),1);
+  CHECK_EQ(ticks.load(),3);
+  //the second byte is never read, since the fd was unwatched
+  CHECK_EQ(reads.load(),1);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_CASE("eventloop timers")
+{
+  using namespace std::chrono;
+  demo::EventLoop loop;
+  REQUIRE(loop.ok());
+
+  //far more than there are file descriptors to go around, since they share one
+  const int N=50000;
+  std::vector<int> order;
+  std::vector<int> ids(N);
+  for (int i=0;i<N;i++){
+    //later ids are due sooner, so they must not fire in the order they were added
+    ids[i] = loop.add_timer(milliseconds(50 - (i*40)/N),[&order,i](){ order.push_back(i); });
+    REQUIRE_GE(ids[i],0);
+  }
+  //and every other one is cancelled before it is due
+  for (int i=0;i<N;i+=2){
+    CHECK(loop.cancel_timer(ids[i]));
+  }
+  CHECK_FALSE(loop.cancel_timer(ids[0]));
+
+  std::thread io(&demo::EventLoop::run, &loop);
+  auto give_up = steady_clock::now()+seconds(5);
+  while (steady_clock::now()<give_up){
+    std::atomic<size_t> n(0);
+    std::atomic<bool> done(false);
+    loop.post([&](){ n=order.size(); done=true; });
+    while (!done){ std::this_thread::sleep_for(milliseconds(1)); }
+    if (n==(size_t)N/2){ break; }
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  loop.stop();
+  io.join();
+
+  REQUIRE_EQ(order.size(),(size_t)N/2);
+  size_t odd=0, late_first=0;
+  for (size_t k=0;k<order.size();k++){
+    odd += order[k]%2;
+    if (k>0 && order[k]<order[k-1]){ late_first++; }
+  }
+  CHECK_EQ(odd,(size_t)N/2);
+  //the 40 distinct deadlines run backwards through the ids
+  CHECK_GE(late_first,(size_t)30);
+}
+
+TEST_CASE("timer wheel")
+{
+  using namespace std::chrono;
+  typedef demo::TimerWheel::Clock Clock;
+  auto t0 = Clock::now();
+  demo::TimerWheel wheel(t0);
+  Clock::time_point at;
+  CHECK_FALSE(wheel.next_expiry(at));
+
+  //against a plain map, with deadlines from this tick to well past the third wheel
+  std::mt19937 rng(7);
+  std::map<int,Clock::time_point> due;
+  std::map<int,demo::TimerWheel::Handle> handles;
+  std::vector<int> expired;
+  auto now = t0;
+  int next_id=0;
+  for (int round=0; round<2000; round++){
+    for (int k=0;k<20;k++){
+      long us = (rng()%4==0) ? (long)(rng()%(20000000000ULL)) : (long)(rng()%300000);
+      auto d = now+microseconds(us);
+      handles[next_id] = wheel.add(d,next_id);
+      due[next_id] = d;
+      next_id++;
+    }
+    for (int k=0;k<5 && !handles.empty();k++){
+      auto it = handles.begin();
+      std::advance(it, rng()%handles.size());
+      REQUIRE(wheel.cancel(it->second));
+      due.erase(it->first);
+      handles.erase(it);
+    }
+    REQUIRE(wheel.next_expiry(at));
+    //never later than the soonest deadline (to the tick)
+    auto soonest = Clock::time_point::max();
+    for (auto &kv : due){ soonest = std::min(soonest, kv.second); }
+    CHECK(at <= soonest+milliseconds(1));
+
+    now += microseconds((rng()%8==0) ? rng()%100000000 : rng()%5000);
+    expired.clear();
+    wheel.advance(now, expired);
+    for (int id : expired){
+      REQUIRE_EQ(due.count(id),1);
+      //never early
+      CHECK(due[id] <= now);
+      due.erase(id);
+      handles.erase(id);
+    }
+    //and nothing that is a whole tick overdue is left behind
+    for (auto &kv : due){
+      REQUIRE(kv.second > now-milliseconds(1));
+    }
+    REQUIRE_EQ(wheel.size(), due.size());
+  }
+  CHECK_FALSE(wheel.cancel(demo::TimerWheel::NONE));
+
+  //the cost of a timer that is cancelled before it fires, as most send timeouts are
+  const int N=1000000;
+  std::vector<demo::TimerWheel::Handle> hs(N);
+  auto b0 = steady_clock::now();
+  for (int i=0;i<N;i++){
+    hs[i] = wheel.add(now+milliseconds(5000+i%1000), i);
+  }
+  for (int i=0;i<N;i++){
+    wheel.cancel(hs[i]);
+  }
+  auto ns = duration_cast<nanoseconds>(steady_clock::now()-b0).count();
+  MESSAGE("timer wheel add+cancel: " << (double)ns/N << " ns");
+}
+
+TEST_CASE("backoff")
+{
+  using namespace std::chrono;
+  demo::Backoff b(milliseconds(100), milliseconds(1000), 3, 1);
+  CHECK_EQ(b.failures(1),0);
+  long expect=100;
+  for (int n=1;n<=8;n++){
+    auto d = b.failed(1);
+    //half to all of the doubled base, capped
+    CHECK_GE(d.count(), expect/2);
+    CHECK_LE(d.count(), expect);
+    CHECK_EQ(b.failures(1),n);
+    expect = std::min(expect*2, 1000L);
+  }
+  //other peers are untouched
+  CHECK_EQ(b.failures(2),0);
+  CHECK_LE(b.failed(2).count(),100);
+  b.succeeded(1);
+  CHECK_EQ(b.failures(1),0);
+  CHECK_LE(b.failed(1).count(),100);
+
+  //agents that fail together do not all come back together
+  std::set<long> waits;
+  for (unsigned seed=0;seed<20;seed++){
+    demo::Backoff peer(milliseconds(100), milliseconds(1000), 1, seed);
+    peer.failed(0);
+    waits.insert(peer.failed(0).count());
+  }
+  CHECK_GT(waits.size(),10);
+}
+
+TEST_CASE("log")
+{
+  using namespace std::chrono;
+  FILE* f = tmpfile();
+  REQUIRE(f!=NULL);
+  demo::Log &log = demo::Log::inst();
+  log.set_sink(f);
+  demo::set_log_level(demo::LOG_INFO);
+
+  int evaluated=0;
+  //below the runtime level: arguments are not even evaluated
+  DEMO_LOG_DEBUG("never %d", ++evaluated);
+  CHECK_EQ(evaluated,0);
+  //not started: written right away
+  DEMO_LOG_WARN("sync %d", 1);
+
+  log.start();
+  {
+    //strings are copied at the call site, so this may go out of scope
+    std::string tmp("copied");
+    DEMO_LOG_INFO("async %s %d %zu %.1f", tmp.c_str(), -2, (size_t)3, 4.5);
+  }
+  DEMO_LOG_ERROR("no args");
+  log.flush();
+
+  //hot-path cost: queueing a record. Take the best of many short runs, so
+  //that a run preempted by the writer thread (or anything else) is ignored.
+  //All runs fit in the ring, so nothing is dropped. The ring is cycled
+  //once first, so we don't time the first touch of its memory.
+  const int WARM=4096;
+  for (int i=0;i<WARM;i++){
+    DEMO_LOG_INFO("warm %d", i);
+    if (i%1024==1023){ log.flush(); }
+  }
+  const int N=32;
+  const int RUNS=120;
+  double best_ns=1e9;
+  for (int run=0;run<RUNS;run++){
+    auto start = steady_clock::now();
+    for (int i=0;i<N;i++){
+      DEMO_LOG_INFO("bench %d %u", i, 7u);
+    }
+    double ns = duration_cast<nanoseconds>(steady_clock::now()-start).count()/(double)N;
+    if (ns<best_ns){ best_ns=ns; }
+  }
+  log.flush();
+  //reported, not checked: it depends on the machine and what else it is doing
+  MESSAGE("log record cost: " << best_ns << " ns");
+  CHECK_EQ(log.dropped(), 0);
+
+  log.stop();
+  log.set_sink(stdout);
+
+  rewind(f);
+  char line[256];
+  std::vector<std::string> lines;
+  while (fgets(line,sizeof(line),f)){
+    lines.push_back(line);
+  }
+  fclose(f);
+  REQUIRE_EQ(lines.size(), (size_t)(3+WARM+RUNS*N));
+  CHECK_EQ(lines[0], "[warn] sync 1\n");
+  CHECK_EQ(lines[1], "[info] async copied -2 3 4.5\n");
+  CHECK_EQ(lines[2], "[error] no args\n");
+  CHECK_EQ(lines[3], "[info] warm 0\n");
+  CHECK_EQ(lines[3+WARM], "[info] bench 0 7\n");
+}
+
+TEST_CASE("startup with 1000 endpoints")
+{
+  using namespace std::chrono;
+  const int N=1000;
+  const char* fname = "ghs-demo-doctest-1000.ini";
+  FILE* f = fopen(fname,"w");
+  REQUIRE(f!=NULL);
+  fprintf(f,"[ghs]\n");
+  for (int i=0;i<N;i++){
+    fprintf(f,"%d=ipc://ghs-demo-doctest-%d\n",i,i);
+  }
+  fclose(f);
+
+  auto t0 = steady_clock::now();
+  demo::Config c;
+  c.my_id=0;
+  demo::read_cfg_file(fname,&c);
+  auto t1 = steady_clock::now();
+  REQUIRE_EQ(c.n_agents,N);
+  REQUIRE(demo::cfg_is_ok(c));
+  CHECK_EQ(c.endpoints[N-1],"ipc://ghs-demo-doctest-999");
+
+  {
+    demo::Comms comms;
+    comms.with_config(c);
+    CHECK_EQ(comms.kbps_to(N-1),0);
+    demo::LinkEstimate e;
+    CHECK(comms.link_estimate(N-1,e));
+  }
+  auto t2 = steady_clock::now();
+
+  //the edges initialize_ghs() would build if every link were alive
+  std::vector<le::ghs::Edge> edges;
+  for (int i=1;i<N;i++){
+    edges.push_back({i,0,le::ghs::UNKNOWN,(le::ghs::metric_t)sym_metric(i,0,1000)});
+  }
+  le::ghs::GhsState<0,256> ghs(0,edges.data(),edges.size());
+  auto t3 = steady_clock::now();
+  CHECK_EQ(ghs.get_n_peers(),(size_t)N-1);
+
+  auto ms = [](steady_clock::duration d){ return duration_cast<microseconds>(d).count()/1000.0; };
+  MESSAGE("1000 endpoints: config " << ms(t1-t0) << " ms, comms " << ms(t2-t1)
+      << " ms, ghs " << ms(t3-t2) << " ms");
+  CHECK_LT(ms(t3-t0), 1000.0);
+  remove(fname);
+}
+
+/// Two agents in this process, talking over the given endpoints
+static demo::Config pair_cfg(int my_id, const std::string &a, const std::string &b)
+{
+  demo::Config c;
+  c.my_id=my_id;
+  c.n_agents=2;
+  c.endpoints.push_back(a);
+  c.endpoints.push_back(b);
+  c.send_timeout_s=1.0;
+  return c;
+}
+
+/// N agents in this process, probing each link briefly and then leaving it be
+static demo::Config small_cluster_config(int N, float iperf_timeout_s=1.0)
+{
+  demo::Config c;
+  c.cluster=N;
+  c.iperf_train_len=4;
+  c.iperf_timeout_s=iperf_timeout_s;
+  c.metric_idle_s=0;
+  demo::cluster_config(c);
+  return c;
+}
+
+/// Turns logging down for as long as it lives, so a cluster's worth of info
+/// logs does not bury the test output, and back up however the test ends
+struct QuietLogs
+{
+  explicit QuietLogs(demo::LogLevel lvl):was((demo::LogLevel)demo::log_level_runtime.load()){
+    demo::set_log_level(lvl);
+  }
+  ~QuietLogs(){
+    demo::set_log_level(was);
+  }
+  demo::LogLevel was;
+};
+
+/// Runs the cluster c describes to the end, with logging turned down to lvl,
+/// and checks that every agent reported back
+static void run_quiet_cluster(demo::Config &c, std::vector<demo::AgentResult> &results,
+    std::atomic<bool> &keep_going, demo::LogLevel lvl=demo::LOG_WARN)
+{
+  REQUIRE(demo::cfg_is_ok(c));
+  QuietLogs quiet(lvl);
+  demo::GhsDemoExec exec;
+  CHECK_EQ(exec.run_cluster(c, keep_going, &results), 0);
+  REQUIRE_EQ(results.size(),(size_t)c.cluster);
+}
+
+static void run_quiet_cluster(demo::Config &c, std::vector<demo::AgentResult> &results,
+    demo::LogLevel lvl=demo::LOG_WARN)
+{
+  std::atomic<bool> keep_going(true);
+  run_quiet_cluster(c, results, keep_going, lvl);
+}
+
+static demo::WireMessage numbered_msg(uint16_t from, uint16_t to, uint32_t n, uint16_t sz)
+{
+  demo::WireMessage m;
+  m.header.type=demo::PAYLOAD_TYPE_GHS;
+  m.header.agent_from=from;
+  m.header.agent_to=to;
+  m.header.payload_size=sz;
+  memset(m.bytes,0,sz);
+  memcpy(m.bytes,&n,sizeof(n));
+  return m;
+}
+
+///Checks that two Comms on c0 and c1 deliver: a send to a peer that is not up
+///yet waits for it, then N messages arrive once each and in order, each is
+///acknowledged, and a blocking send goes back the other way
+void check_pair_delivery(demo::Config c0, demo::Config c1, uint32_t N)
+{
+  demo::Comms x0;
+  x0.with_config(c0);
+  REQUIRE(x0.ok());
+
+  //the peer is not up yet, so this waits for it
+  std::atomic<int> early(-1);
+  auto m = numbered_msg(0,1,0,16);
+  REQUIRE_EQ(x0.send_async(m,[&early](demo::Errno e, long){ early=e; }), demo::OK);
+  usleep(30*1000);
+  CHECK_EQ(early.load(),-1);
+
+  demo::Comms x1;
+  x1.with_config(c1);
+  REQUIRE(x1.ok());
+  x1.start_receiver();
+  CHECK(x1.wait(std::chrono::milliseconds(1000)));
+  for (int i=0;i<1000 && early.load()==-1;i++){
+    usleep(1000);
+  }
+  CHECK_EQ(early.load(),(int)demo::OK);
+
+  //everything arrives, once, in order
+  std::atomic<uint32_t> acked(0);
+  for (uint32_t i=1;i<=N;i++){
+    auto mi = numbered_msg(0,1,i,PAYLOAD_MAX_SZ);
+    REQUIRE_EQ(x0.send_async(mi,[&acked](demo::Errno e, long){ if (e==demo::OK){ acked++; } }), demo::OK);
+  }
+  uint32_t expect=0, in_order=0;
+  auto until = std::chrono::steady_clock::now()+std::chrono::seconds(5);
+  while (expect<=N && std::chrono::steady_clock::now()<until){
+    demo::WireMessage in;
+    if (!x1.get_next(in)){
+      x1.wait(std::chrono::milliseconds(10));
+      continue;
+    }
+    uint32_t n;
+    memcpy(&n,in.bytes,sizeof(n));
+    if (n==expect){
+      in_order++;
+    }
+    expect=n+1;
+  }
+  CHECK_EQ(in_order,N+1);
+  //the last acknowledgements may trail the messages by a moment
+  while (acked.load()<N && std::chrono::steady_clock::now()<until){
+    usleep(1000);
+  }
+  CHECK_EQ(acked.load(),N);
+
+  //and back the other way, blocking
+  x0.start_receiver();
+  auto back = numbered_msg(1,0,7,8);
+  CHECK_EQ(x1.send(back),demo::OK);
+  CHECK(x0.wait(std::chrono::milliseconds(1000)));
+}
+
+TEST_CASE("shm transport")
+{
+  CHECK_EQ(demo::endpoint_scheme("shm://ghs-0"),"shm");
+  CHECK_EQ(demo::endpoint_scheme("tcp://localhost:5000"),"tcp");
+  CHECK_EQ(demo::endpoint_scheme("localhost"),"");
+  CHECK_EQ(demo::ShmTransport::segment_name("shm://ghs-0"),"/ghs-0");
+  CHECK_EQ(demo::ShmTransport::segment_name("shm://a/b"),"/a_b");
+
+  std::string a = "shm://ghs-demo-doctest-"+std::to_string(getpid())+"-a";
+  std::string b = "shm://ghs-demo-doctest-"+std::to_string(getpid())+"-b";
+  auto c0 = pair_cfg(0,a,b);
+  auto c1 = pair_cfg(1,a,b);
+  //small rings, so the sender has to wait for room during the burst
+  c0.shm_ring_slots=4;
+  c1.shm_ring_slots=4;
+  check_pair_delivery(c0,c1,200);
+}
+
+TEST_CASE("mem transport")
+{
+  auto c0 = pair_cfg(0,"mem://doctest-a","mem://doctest-b");
+  auto c1 = pair_cfg(1,"mem://doctest-a","mem://doctest-b");
+
+  //a name can only be taken once per process, until its owner goes
+  {
+    demo::Comms x0;
+    x0.with_config(c0);
+    REQUIRE(x0.ok());
+    demo::Comms dup;
+    dup.with_config(c0);
+    CHECK_FALSE(dup.ok());
+  }
+  check_pair_delivery(c0,c1,500);
+}
+
+TEST_CASE("failure detector")
+{
+  using namespace std::chrono;
+  typedef demo::FailureDetector::Clock Clock;
+
+  //half of all gaps run past the mean, and ever fewer past that
+  CHECK(std::fabs(demo::FailureDetector::phi_of(100,100,10)-0.301)<0.01);
+  CHECK_LT(demo::FailureDetector::phi_of(50,100,10),0.01);
+  CHECK_EQ(demo::FailureDetector::phi_of(0,100,10),0);
+  double last=0;
+  for (int ms=100;ms<=400;ms+=10){
+    double phi = demo::FailureDetector::phi_of(ms,100,20);
+    CHECK_GT(phi,last);
+    last=phi;
+  }
+  CHECK_GT(last,100);
+
+  //a peer that beats every 100 ms
+  Clock::time_point t0;
+  demo::FailureDetector fd(3, milliseconds(100), t0);
+  auto t = t0;
+  for (int i=0;i<30;i++){
+    t += milliseconds(100);
+    fd.heard(1,t);
+  }
+  CHECK_LT(fd.phi(1,t),0.01);
+  CHECK_LT(fd.phi(1,t+milliseconds(100)),1);
+  CHECK_LT(fd.phi(1,t+milliseconds(200)),8);
+  CHECK_GT(fd.phi(1,t+milliseconds(600)),8);
+  CHECK(fd.silent_for(1,t+milliseconds(600))==milliseconds(600));
+
+  //a burst of traffic does not teach it to expect short gaps
+  for (int i=0;i<200;i++){
+    t += milliseconds(1);
+    fd.heard(1,t);
+  }
+  CHECK_LT(fd.phi(1,t+milliseconds(200)),8);
+
+  //never heard from: as silent as since the start
+  CHECK_GT(fd.phi(2,t0+seconds(1)),8);
+  CHECK_EQ(fd.phi(7,t),0);
+
+  //two agents that heartbeat each other
+  auto c0 = pair_cfg(0,"mem://doctest-fd-a","mem://doctest-fd-b");
+  auto c1 = pair_cfg(1,"mem://doctest-fd-a","mem://doctest-fd-b");
+  c0.heartbeat_s = c1.heartbeat_s = 0.1;
+  demo::Comms x0;
+  x0.with_config(c0);
+  REQUIRE(x0.ok());
+  std::mutex mut;
+  std::vector<double> seen;
+  x0.on_suspect([&mut,&seen](uint16_t id, double phi){
+      std::lock_guard<std::mutex> guard(mut);
+      seen.push_back(phi);
+      });
+  auto count = [&mut,&seen](){ std::lock_guard<std::mutex> guard(mut); return seen.size(); };
+  x0.start_receiver();
+  x0.start_liveness();
+  {
+    demo::Comms x1;
+    x1.with_config(c1);
+    REQUIRE(x1.ok());
+    x1.start_receiver();
+    x1.start_liveness();
+
+    //idle, but alive: the heartbeats keep them in touch
+    usleep(1000*1000);
+    CHECK_EQ(count(),0);
+    CHECK_LT(x0.suspicion(1),8);
+  }
+
+  //x1 is gone, and is soon suspected
+  auto gone = steady_clock::now();
+  for (int i=0;i<500 && count()==0;i++){
+    usleep(10*1000);
+  }
+  REQUIRE_EQ(count(),1);
+  CHECK_GE(seen[0],c0.suspect_phi);
+  CHECK_GE(x0.suspicion(1),c0.suspect_phi);
+  CHECK(steady_clock::now()-gone < seconds(3));
+
+  //and it is cleared when x1 comes back
+  demo::Comms x1;
+  x1.with_config(c1);
+  REQUIRE(x1.ok());
+  x1.start_receiver();
+  for (int i=0;i<500 && count()==1;i++){
+    usleep(10*1000);
+  }
+  REQUIRE_EQ(count(),2);
+  CHECK_LT(seen[1],c0.suspect_phi);
+  x0.on_suspect(nullptr);
+}
+
+TEST_CASE("startup barrier")
+{
+  using namespace std::chrono;
+  auto c0 = pair_cfg(0,"mem://doctest-up-a","mem://doctest-up-b");
+  auto c1 = pair_cfg(1,"mem://doctest-up-a","mem://doctest-up-b");
+  demo::Comms x0;
+  x0.with_config(c0);
+  REQUIRE(x0.ok());
+  x0.start_receiver();
+  //until we ask, everyone is up
+  CHECK(x0.is_up(1));
+
+  //the peer comes up a little later, and we start as soon as it does
+  std::atomic<bool> done(false);
+  std::thread later([&c1,&done](){
+      usleep(300*1000);
+      demo::Comms x1;
+      x1.with_config(c1);
+      x1.start_receiver();
+      while (!done){
+        usleep(10*1000);
+      }
+      });
+  auto t0 = steady_clock::now();
+  CHECK_EQ(x0.await_peers(t0+seconds(5)),1);
+  auto took = steady_clock::now()-t0;
+  CHECK(took >= milliseconds(250));
+  CHECK(took < seconds(2));
+  CHECK(x0.is_up(1));
+  done=true;
+  later.join();
+
+  //a peer that never comes up is given up on at the deadline, and then
+  //costs nothing to measure
+  auto c2 = pair_cfg(0,"mem://doctest-up-c","mem://doctest-up-d");
+  c2.iperf_timeout_s=2.0;
+  demo::Comms y0;
+  y0.with_config(c2);
+  REQUIRE(y0.ok());
+  y0.start_receiver();
+  t0 = steady_clock::now();
+  CHECK_EQ(y0.await_peers(t0+milliseconds(500)),0);
+  took = steady_clock::now()-t0;
+  CHECK(took >= milliseconds(450));
+  CHECK(took < milliseconds(1500));
+  CHECK_FALSE(y0.is_up(1));
+  t0 = steady_clock::now();
+  y0.little_iperf();
+  CHECK(steady_clock::now()-t0 < milliseconds(500));
+  CHECK_EQ(y0.kbps_to(1),0);
+}
+
+TEST_CASE("udp transport")
+{
+  sockaddr_in addr;
+  CHECK(demo::UdpTransport::resolve("udp://127.0.0.1:5000",addr));
+  CHECK_EQ(ntohs(addr.sin_port),5000);
+  CHECK_FALSE(demo::UdpTransport::resolve("tcp://127.0.0.1:5000",addr));
+  CHECK_FALSE(demo::UdpTransport::resolve("udp://127.0.0.1",addr));
+
+  //a lossy link in both directions, so data and ACKs both go missing
+  auto c0 = pair_cfg(0,"udp://127.0.0.1:45821","udp://127.0.0.1:45822");
+  auto c1 = pair_cfg(1,"udp://127.0.0.1:45821","udp://127.0.0.1:45822");
+  c0.udp_loss = c1.udp_loss = 0.2;
+  c0.udp_window = c1.udp_window = 8;
+  //a message can lose six rounds in a row (one in ~500), and the doubling
+  //RTO then adds up to more than 5 s on its own
+  c0.send_timeout_s = c1.send_timeout_s = 20.0;
+
+  demo::Comms x0, x1;
+  x0.with_config(c0);
+  x1.with_config(c1);
+  REQUIRE(x0.ok());
+  REQUIRE(x1.ok());
+  x1.start_receiver();
+
+  //everything arrives, once, in order
+  const uint32_t N=300;
+  std::atomic<uint32_t> acked(0);
+  for (uint32_t i=0;i<N;i++){
+    auto m = numbered_msg(0,1,i,128);
+    REQUIRE_EQ(x0.send_async(m,[&acked](demo::Errno e, long){ if (e==demo::OK){ acked++; } }), demo::OK);
+  }
+  uint32_t got=0, in_order=0;
+  auto until = std::chrono::steady_clock::now()+std::chrono::seconds(30);
+  while (got<N && std::chrono::steady_clock::now()<until){
+    demo::WireMessage in;
+    if (!x1.get_next(in)){
+      x1.wait(std::chrono::milliseconds(10));
+      continue;
+    }
+    uint32_t n;
+    memcpy(&n,in.bytes,sizeof(n));
+    if (n==got){
+      in_order++;
+    }
+    got++;
+  }
+  CHECK_EQ(got,N);
+  CHECK_EQ(in_order,N);
+  while (acked.load()<N && std::chrono::steady_clock::now()<until){
+    usleep(1000);
+  }
+  CHECK_EQ(acked.load(),N);
+  usleep(50*1000);
+  CHECK_FALSE(x1.has_msg());
+
+  //a peer that never answers times out, and does not hold up the next message
+  auto c2 = pair_cfg(0,"udp://127.0.0.1:45823","udp://127.0.0.1:45824");
+  c2.send_timeout_s = 0.2;
+  demo::Comms x2;
+  x2.with_config(c2);
+  auto m = numbered_msg(0,1,0,16);
+  CHECK_EQ(x2.send(m),demo::ERR_TIMEOUT);
+}
+
+/**
+ * Latency (blocking send() round trips) and throughput (a burst of
+ * send_async()) between two agents in this process. Transports that cannot
+ * listen or deliver here are reported and skipped.
+ */
+static void bench_transport(const std::string &name, const std::string &a, const std::string &b, float udp_loss=0)
+{
+  using namespace std::chrono;
+  const int RT_N=500;
+  const uint32_t BURST_N=2000;
+
+  auto c0 = pair_cfg(0,a,b);
+  auto c1 = pair_cfg(1,a,b);
+  c0.udp_loss = udp_loss;
+  c1.udp_loss = udp_loss;
+  demo::Comms x0, x1;
+  x0.with_config(c0);
+  x1.with_config(c1);
+  x1.start_receiver();
+  auto probe = numbered_msg(0,1,0,64);
+  demo::WireMessage in;
+  if (!x0.ok() || !x1.ok() || x0.send(probe)!=demo::OK || !x1.wait(milliseconds(1000))){
+    MESSAGE(name << ": unavailable here");
+    return;
+  }
+  x1.get_next(in);
+
+  std::vector<long> rts;
+  for (int i=0;i<RT_N;i++){
+    auto m = numbered_msg(0,1,i,64);
+    auto t0 = steady_clock::now();
+    REQUIRE_EQ(x0.send(m),demo::OK);
+    rts.push_back(duration_cast<nanoseconds>(steady_clock::now()-t0).count());
+    x1.get_next(in);
+  }
+  std::sort(rts.begin(),rts.end());
+  while (x1.get_next(in)){}
+
+  std::atomic<uint32_t> acked(0);
+  uint32_t got=0;
+  auto t0 = steady_clock::now();
+  for (uint32_t i=0;i<BURST_N;i++){
+    auto m = numbered_msg(0,1,i,PAYLOAD_MAX_SZ);
+    x0.send_async(m,[&acked](demo::Errno, long){ acked++; });
+    while (x1.get_next(in)){ got++; }
+  }
+  auto until = t0+seconds(10);
+  while (got<BURST_N && steady_clock::now()<until){
+    if (x1.get_next(in)){
+      got++;
+    } else {
+      x1.wait(milliseconds(10));
+    }
+  }
+  double s = duration_cast<microseconds>(steady_clock::now()-t0).count()/1e6;
+  CHECK_EQ(got,BURST_N);
+
+  MESSAGE(name << ": round trip median " << rts[RT_N/2]/1000.0 << " us, p99 " 
+      << rts[RT_N*99/100]/1000.0 << " us; burst " << got/s << " msgs/s, "
+      << (got*sizeof(demo::WireMessage))/s/1e6 << " MB/s");
+}
+
+TEST_CASE("transport bench")
+{
+  std::string tag = std::to_string(getpid());
+  bench_transport("mem://", "mem://ghs-demo-bench-a", "mem://ghs-demo-bench-b");
+  bench_transport("shm://", "shm://ghs-demo-bench-"+tag+"-a", "shm://ghs-demo-bench-"+tag+"-b");
+  bench_transport("ipc://", "ipc://ghs-demo-bench-"+tag+"-a", "ipc://ghs-demo-bench-"+tag+"-b");
+  bench_transport("tcp://localhost", "tcp://127.0.0.1:45831", "tcp://127.0.0.1:45832");
+  bench_transport("udp://localhost", "udp://127.0.0.1:45833", "udp://127.0.0.1:45834");
+  bench_transport("udp://localhost, 5% loss", "udp://127.0.0.1:45835", "udp://127.0.0.1:45836", 0.05);
+}
+
+TEST_CASE("cluster runtime")
+{
+  const int N=12;
+  auto c = small_cluster_config(N);
+  REQUIRE(demo::cfg_is_ok(c));
+  CHECK_EQ(c.endpoints[N-1],"mem://ghs-11");
+
+  //everyone is up at once, so the barrier should cost nothing
+  c.wait_s=5;
+
+  std::vector<demo::AgentResult> results;
+  auto t0 = std::chrono::steady_clock::now();
+  run_quiet_cluster(c, results);
+  auto s = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+  std::chrono::microseconds cold(0);
+  for (auto &r : results){
+    CHECK(r.cold_start > std::chrono::microseconds(0));
+    CHECK(r.cold_start <= r.elapsed);
+    cold = std::max(cold, r.cold_start);
+  }
+  //one probe round, and the exchange, without waiting them out
+  CHECK(cold < std::chrono::milliseconds(1500));
+  MESSAGE(N << " agents in one process: " << s << " s, start to finish, " << cold.count()/1e6 << " s to the last first SRCH");
+}
+
+TEST_CASE("cluster center leader")
+{
+  auto c = small_cluster_config(8);
+  c.center_leader=true;
+
+  //the leader moves once the tree is built, and only then does anyone report it
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results);
+  for (auto &r : results){
+    CHECK(r.converged);
+    CHECK_EQ(r.leader, results[0].leader);
+  }
+}
+
+TEST_CASE("cluster degree cap")
+{
+  const int N=8;
+  const uint32_t CAP=3;
+  auto c = small_cluster_config(N);
+  c.max_degree=CAP;
+
+  //nobody reports the tree until the swaps are done, so it is within the cap
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results);
+  std::vector<uint32_t> degree(N,0);
+  for (int i=0;i<N;i++){
+    CHECK(results[i].converged);
+    CHECK_EQ(results[i].leader, results[0].leader);
+    le::ghs::agent_t p = results[i].parent;
+    REQUIRE(p>=0);
+    REQUIRE(p<N);
+    if (p!=i){
+      degree[i]++;
+      degree[p]++;
+    }
+  }
+  for (int i=0;i<N;i++){
+    CHECK_LE(degree[i], CAP);
+  }
+}
+
+TEST_CASE("cluster bottleneck tree")
+{
+  //links come in three speeds, far enough apart that the probes tell them apart
+  const int N=6;
+  auto c = small_cluster_config(N, 3.0);
+  c.emulate="doctest";
+  std::mt19937 rng(3);
+  const Kbps speeds[3]={500,4000,32000};
+  std::vector<std::vector<Kbps>> kbps(N, std::vector<Kbps>(N,0));
+  for (int a=0;a<N;a++){
+    for (int b=a+1;b<N;b++){
+      demo::LinkProfile p;
+      p.kbps = speeds[rng()%3];
+      c.emu_links[std::make_pair(a,b)]=p;
+      kbps[a][b] = kbps[b][a] = p.kbps;
+    }
+  }
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results);
+
+  //the tree they built is as wide as it can be between every pair
+  std::vector<std::tuple<int,int,Kbps>> tree;
+  for (int i=0;i<N;i++){
+    REQUIRE(results[i].converged);
+    int p=results[i].parent;
+    if (p!=i){
+      tree.emplace_back(i,p,kbps[i][p]);
+    }
+  }
+  REQUIRE_EQ(tree.size(),N-1);
+  auto got = path_bottlenecks(N, tree);
+  auto best = path_bottlenecks(N, least_metric_tree(N, kbps, sym_metric));
+  int widest=0;
+  Kbps slowest=std::numeric_limits<Kbps>::max(), slowest_best=slowest;
+  for (auto &p : best){
+    widest += got[p.first]==p.second;
+    slowest = std::min(slowest, got[p.first]);
+    slowest_best = std::min(slowest_best, p.second);
+  }
+  CHECK_EQ(slowest, slowest_best);
+  MESSAGE(widest << " of " << best.size() << " pairs got the widest path through the emulated tree, whose slowest link is "
+      << slowest << " kbit/s (" << slowest_best << " at best)");
+}
+
+TEST_CASE("cluster health")
+{
+  const int N=8;
+  auto c = small_cluster_config(N);
+  c.health_period_s=0.05;
+
+  //the agents stay up after converging, reporting to their parents, until told to stop
+  std::atomic<bool> keep_going(true);
+  std::thread stopper([&keep_going](){
+      std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+      keep_going=false;
+      });
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results, keep_going);
+  stopper.join();
+  REQUIRE(results[0].converged);
+
+  //the leader has heard, one report per child per period, from all of them
+  const le::ghs::HealthReport &h = results[results[0].leader].health;
+  CHECK_EQ(h.n_alive, N);
+  CHECK_EQ(h.n_missing, 0);
+  CHECK_EQ(h.missing[0], le::ghs::NO_AGENT);
+  CHECK(h.seq > 1);
+  //a report is at most a period old at each hop
+  CHECK(h.oldest_ms < 1000);
+  for (int i=0;i<N;i++){
+    if (i!=results[0].leader){
+      CHECK_EQ(results[i].health.seq, 0);
+    }
+  }
+  MESSAGE("leader " << results[0].leader << " after " << h.seq << " periods: " << h.n_alive << " alive, oldest news " << h.oldest_ms << " ms");
+}
+
+TEST_CASE("cluster broadcast")
+{
+  const int N=8;
+  auto c = small_cluster_config(N);
+
+  //a few hundred chunks
+  std::vector<uint8_t> blob(300*1000);
+  std::mt19937 rng(5);
+  for (auto &b : blob){
+    b=(uint8_t)rng();
+  }
+  c.broadcast_file="ghs-demo-doctest-broadcast.bin";
+  FILE *f = fopen(c.broadcast_file.c_str(),"wb");
+  REQUIRE(f);
+  REQUIRE_EQ(fwrite(blob.data(),1,blob.size(),f),blob.size());
+  fclose(f);
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results);
+  remove(c.broadcast_file.c_str());
+
+  //every agent got all of it, in order, before it exited
+  std::chrono::microseconds slowest(0);
+  for (auto &r : results){
+    CHECK_EQ(r.broadcast.size(), blob.size());
+    CHECK(r.broadcast==blob);
+    slowest = std::max(slowest, r.broadcast_elapsed);
+  }
+  MESSAGE(blob.size() << " bytes to " << N << " agents down the tree in " << slowest.count()/1e3 << " ms");
+}
+
+TEST_CASE("emu transport")
+{
+  using namespace std::chrono;
+  std::string fname = "/tmp/ghs-demo-doctest-links-"+std::to_string(getpid())+".ini";
+  FILE* f = fopen(fname.c_str(),"w");
+  REQUIRE(f);
+  fprintf(f,"[default]\nlatency_ms=20\njitter_ms=5\n\n[1-0]\nkbps=800\nloss=0.5\n");
+  fclose(f);
+  demo::Config parsed;
+  CHECK(demo::read_link_profiles(fname.c_str(),&parsed));
+  unlink(fname.c_str());
+  CHECK_EQ(parsed.emulate,fname);
+  CHECK_EQ(parsed.emu_default.latency_ms,20);
+  CHECK_EQ(parsed.emu_default.kbps,0);
+  REQUIRE_EQ(parsed.emu_links.count(std::make_pair(0,1)),1);
+  //a link starts from the defaults, and is the same link both ways
+  CHECK_EQ(demo::link_profile(parsed,0,1).jitter_ms,5);
+  CHECK_EQ(demo::link_profile(parsed,1,0).kbps,800);
+  CHECK_EQ(demo::link_profile(parsed,0,1).loss,0.5);
+  CHECK_EQ(demo::link_profile(parsed,0,2).kbps,0);
+  CHECK_FALSE(demo::read_link_profiles("/nonexistent/links.ini",&parsed));
+
+  auto c0 = pair_cfg(0,"mem://doctest-emu-a","mem://doctest-emu-b");
+  auto c1 = pair_cfg(1,"mem://doctest-emu-a","mem://doctest-emu-b");
+  c0.emulate = c1.emulate = "doctest";
+  c0.emu_default.latency_ms = 20;
+  c0.emu_default.jitter_ms = 15;
+  c0.iperf_train_len = 10;
+  demo::LinkProfile narrow;
+  narrow.kbps = 800;
+  c1.emu_links[std::make_pair(0,1)] = narrow;
+  demo::Comms x0, x1;
+  x0.with_config(c0);
+  x1.with_config(c1);
+  REQUIRE(x0.ok());
+  REQUIRE(x1.ok());
+  x0.start_receiver();
+  x1.start_receiver();
+
+  //there and back again
+  auto t0 = steady_clock::now();
+  auto m = numbered_msg(0,1,0,16);
+  CHECK_EQ(x0.send(m),demo::OK);
+  CHECK_GE(duration_cast<milliseconds>(steady_clock::now()-t0).count(),2*(20-15));
+
+  //jitter does not reorder one link
+  const uint32_t N=50;
+  for (uint32_t i=1;i<=N;i++){
+    REQUIRE_EQ(x0.send_async(numbered_msg(0,1,i,16),[](demo::Errno, long){}), demo::OK);
+  }
+  uint32_t expect=0, in_order=0;
+  auto until = steady_clock::now()+seconds(5);
+  while (expect<=N && steady_clock::now()<until){
+    demo::WireMessage in;
+    if (!x1.get_next(in)){
+      x1.wait(milliseconds(10));
+      continue;
+    }
+    uint32_t n;
+    memcpy(&n,in.bytes,sizeof(n));
+    if (n==expect){
+      in_order++;
+    }
+    expect=n+1;
+  }
+  CHECK_EQ(in_order,N+1);
+
+  //the probes see the emulated rate: 10 kB at 800 kbit/s is >100 ms
+  t0 = steady_clock::now();
+  x1.little_iperf();
+  CHECK_GE(duration_cast<milliseconds>(steady_clock::now()-t0).count(),100);
+  CHECK_GT(x1.kbps_to(0),0);
+  CHECK_LE(x1.kbps_to(0),800);
+  MESSAGE("probe over an emulated 800 kbit/s link: " << x1.kbps_to(0) << " kbit/s");
+
+  //a link that loses everything times out
+  demo::Config c2 = pair_cfg(0,"mem://doctest-emu-c","mem://doctest-emu-d");
+  c2.emulate = "doctest";
+  c2.emu_default.loss = 1;
+  c2.send_timeout_s = 0.1;
+  demo::Config c3 = pair_cfg(1,"mem://doctest-emu-c","mem://doctest-emu-d");
+  demo::Comms x2, x3;
+  x2.with_config(c2);
+  x3.with_config(c3);
+  x3.start_receiver();
+  auto lost = numbered_msg(0,1,0,16);
+  CHECK_EQ(x2.send(lost),demo::ERR_TIMEOUT);
+}
+
+TEST_CASE("probe trains fill the window")
+{
+  //On a link that takes many messages at once, a train is not paced by its
+  //round trips, so it sees the rate of the link rather than a PING per
+  //round trip (about 160 kbit/s here).
+  auto c0 = pair_cfg(0,"udp://127.0.0.1:45831","udp://127.0.0.1:45832");
+  auto c1 = pair_cfg(1,"udp://127.0.0.1:45831","udp://127.0.0.1:45832");
+  c0.emulate = c1.emulate = "doctest";
+  c0.emu_default.latency_ms = c1.emu_default.latency_ms = 20;
+  c0.emu_default.kbps = c1.emu_default.kbps = 800;
+  c1.iperf_train_len = 10;
+  c1.iperf_timeout_s = 2;
+  demo::Comms x0, x1;
+  x0.with_config(c0);
+  x1.with_config(c1);
+  REQUIRE(x0.ok());
+  REQUIRE(x1.ok());
+  x0.start_receiver();
+  x1.start_receiver();
+
+  x1.little_iperf();
+  CHECK_GE(x1.rtt_us_to(0), 2*20*1000);
+  //the emulator's timers are good to a millisecond or so
+  CHECK_GT(x1.kbps_to(0), 400);
+  CHECK_LT(x1.kbps_to(0), 1000);
+  MESSAGE("a probe train over an emulated 800 kbit/s link with a 40 ms round trip: " << x1.kbps_to(0) << " kbit/s");
+}
+
+TEST_CASE("outbox")
+{
+  using namespace std::chrono;
+  //agent 2 never shows up
+  demo::Config c0 = pair_cfg(0,"mem://doctest-outbox-0","mem://doctest-outbox-1");
+  c0.endpoints.push_back("mem://doctest-outbox-2");
+  c0.n_agents=3;
+  c0.send_timeout_s=0.2;
+  c0.retry_connections=true;
+  demo::Config c1 = c0;
+  c1.my_id=1;
+  demo::Comms x0, x1;
+  x0.with_config(c0);
+  x1.with_config(c1);
+  REQUIRE(x0.ok());
+  REQUIRE(x1.ok());
+  x1.start_receiver();
+
+  demo::Outbox out(x0,c0);
+  CHECK_EQ(out.push(numbered_msg(0,2,0,16)),demo::OK);
+  for (uint32_t i=1;i<=3;i++){
+    CHECK_EQ(out.push(numbered_msg(0,1,i,16)),demo::OK);
+  }
+  auto bad = numbered_msg(0,7,0,16);
+  CHECK_EQ(out.push(bad),demo::ERR_DEST_UNSET);
+  CHECK_EQ(out.size(),4);
+
+  //agent 1 gets all of its messages, in order, while agent 2's waits
+  uint32_t expect=1;
+  auto until = steady_clock::now()+seconds(2);
+  while (expect<=3 && steady_clock::now()<until){
+    x0.wait(out.pump(milliseconds(10)));
+    demo::WireMessage in;
+    while (x1.get_next(in)){
+      uint32_t n;
+      memcpy(&n,in.bytes,sizeof(n));
+      CHECK_EQ(n,expect);
+      expect++;
+    }
+  }
+  CHECK_EQ(expect,4);
+  CHECK(duration_cast<milliseconds>(steady_clock::now()-(until-seconds(2))).count() < 200);
+  while (out.size(1)>0 && steady_clock::now()<until){
+    x0.wait(out.pump(milliseconds(10)));
+  }
+  CHECK_EQ(out.size(1),0);
+
+  //agent 2's message timed out, and is kept to be sent again
+  until = steady_clock::now()+seconds(1);
+  while (steady_clock::now()<until){
+    CHECK_LE(out.pump(milliseconds(50)).count(),50);
+    usleep(10*1000);
+  }
+  CHECK_EQ(out.size(2),1);
+  CHECK_EQ(out.size(),1);
+}
+
+TEST_CASE("cluster with one slow agent")
+{
+  const int N=8;
+  auto c = small_cluster_config(N, 3.0);
+  //every link to the last agent takes 100 ms each way
+  c.emulate="doctest";
+  demo::LinkProfile slow;
+  slow.latency_ms=100;
+  for (int i=0;i<N-1;i++){
+    c.emu_links[std::make_pair(i,N-1)]=slow;
+  }
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results);
+  std::chrono::microseconds fast(0), slowest(0);
+  for (int i=0;i<N-1;i++){
+    fast = std::max(fast, results[i].ghs_elapsed);
+  }
+  slowest = std::max(fast, results[N-1].ghs_elapsed);
+  MESSAGE(N << " agents, one of them 100 ms from the rest: GHS took " << slowest.count()/1e3
+      << " ms (" << fast.count()/1e3 << " ms for the others to converge)");
+}
+
+TEST_CASE("cluster leader deadline")
+{
+  const int N=8;
+  auto c = small_cluster_config(N, 3.0);
+  //nobody can converge before hearing from the last agent, 100 ms away
+  c.emulate="doctest";
+  demo::LinkProfile slow;
+  slow.latency_ms=100;
+  for (int i=0;i<N-1;i++){
+    c.emu_links[std::make_pair(i,N-1)]=slow;
+  }
+  c.leader_deadline_s=0.5;
+  std::vector<demo::AgentResult> results;
+  run_quiet_cluster(c, results, demo::LOG_ERROR);
+
+  //each had some leader by the deadline, and the election still finished
+  std::map<le::ghs::agent_t,int> votes;
+  for (int i=0;i<N;i++){
+    CHECK(results[i].converged);
+    CHECK_GE(results[i].early.leader, 0);
+    CHECK_LT(results[i].early.leader, N);
+    CHECK_GE(results[i].early.size, 1);
+    CHECK_LE(results[i].early.size, N);
+    votes[results[i].early.leader]++;
+  }
+  int most=0;
+  for (auto &v : votes){ most = std::max(most, v.second); }
+  MESSAGE(most << " of " << N << " agents had the same leader by the deadline");
 }
@@ -38,6 +38,7 @@
  */
 #include "ghs-demo-edgemetrics.h"
 #include <algorithm>
+#include <limits>
 
 CommsEdgeMetric sym_metric(
     const uint16_t agent_to,
@@ -46,16 +47,14 @@ CommsEdgeMetric sym_metric(
 {
   uint16_t bigger = (uint16_t) std::max((int)agent_to, (int)agent_from);
   uint16_t smaller = (uint16_t) std::min((int)agent_to, (int)agent_from);
-  CommsEdgeMetric ikbps=kbps;
-  //how long would it take to send lots of data over this link?
-  if (ikbps==0){ //or, if ikbps == 1, really
-    ikbps=std::numeric_limits<CommsEdgeMetric>::max();//too long
-  } else {
-    ikbps =(CommsEdgeMetric)  ((double) std::numeric_limits<CommsEdgeMetric>::max() / (double) kbps);//not so long (min=1 "unit")
-  }
+  //how much slower is this link than the fastest one we could measure?
+  //This has to fit in the top 32 bits, and go down as kbps goes up, one
+  //step per kbps, so no two throughputs share a metric. A 0 kbps link is
+  //the slowest there is.
+  CommsEdgeMetric slowness = (CommsEdgeMetric) (std::numeric_limits<Kbps>::max() - kbps);
   return 
      ((uint64_t)bigger<<16)
     +((uint64_t)smaller<<0)
-    +((uint64_t)ikbps <<32) 
+    +((uint64_t)slowness <<32) 
     ;
 }
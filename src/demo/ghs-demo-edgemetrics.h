@@ -53,13 +53,22 @@ typedef uint32_t Kbps;
  * @brief **Dark magic** to provide a symmetric, unique link-metric based on throughput and the two agent ids
  *
  * Required for proper execution of le::ghs::GhsState.
- * The 64bit return value is composed of 32 bits of throguhput left-shifted by 32 bits, OR-masked with the larger agent id left shifted 16 bits, finally OR-masked with the lower agent id.
+ * The 64bit return value is composed of 32 bits of "slowness" (UINT32_MAX - kbps) left-shifted by 32 bits, OR-masked with the larger agent id left shifted 16 bits, finally OR-masked with the lower agent id.
+ *
+ * GhsState builds the tree of least total metric. Since the metric goes
+ * down strictly as the throughput goes up, that is the same tree as the
+ * one of greatest total throughput (the maximum spanning tree), and in it
+ * the slowest link on the path between any two agents is as fast as on
+ * any path between them: the tree maximises the bottleneck bandwidth.
+ * Only the order of the metrics matters for this, so no precision is lost
+ * to an inverse.
  *
  * The resulting "hashy-metric" is:
  *
  *    * Unique, in that even with identical throughputs, no two pairs of agents will have identical comms metrics
  *    * Symmetrical, in that both agents, if they agree on throughput can agree on the metric to use
  *    * Dominated by throughput, so no two agent ids are somehow more important than raw transmission power
+ *    * Strictly decreasing in throughput, over the whole range of Kbps
  *
  *  @see le::ghs::metric_t
  *  @see le::ghs::GhsState
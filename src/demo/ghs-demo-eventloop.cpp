@@ -0,0 +1,307 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-eventloop.cpp
+ *
+ */
+#include "ghs-demo-eventloop.h"
+#include "ghs-demo-log.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+namespace demo{
+
+  /// How many events to take from the kernel per epoll_wait()
+  static const int MAX_EVENTS=16;
+
+  EventLoop::EventLoop()
+  {
+    running=false;
+    stopping=false;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd<0){
+      DEMO_LOG_ERROR("epoll_create1: %s\n",strerror(errno));
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (wake_fd<0){
+      DEMO_LOG_ERROR("eventfd: %s\n",strerror(errno));
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timer_fd<0){
+      DEMO_LOG_ERROR("timerfd_create: %s\n",strerror(errno));
+    }
+    if (epoll_fd>=0 && wake_fd>=0 && timer_fd>=0){
+      for (int fd : {wake_fd, timer_fd}){
+        struct epoll_event ev;
+        memset(&ev,0,sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)!=0){
+          DEMO_LOG_ERROR("epoll_ctl(%d): %s\n",fd,strerror(errno));
+        }
+      }
+    }
+  }
+
+  EventLoop::~EventLoop()
+  {
+    if (timer_fd>=0){ close(timer_fd); }
+    if (wake_fd>=0){ close(wake_fd); }
+    if (epoll_fd>=0){ close(epoll_fd); }
+  }
+
+  bool EventLoop::ok() const
+  {
+    return epoll_fd>=0 && wake_fd>=0 && timer_fd>=0;
+  }
+
+  bool EventLoop::watch(int fd, Callback cb)
+  {
+    struct epoll_event ev;
+    memset(&ev,0,sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    int op = watches.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd, op, fd, &ev)!=0){
+      DEMO_LOG_ERROR("epoll_ctl(%d): %s\n",fd,strerror(errno));
+      return false;
+    }
+    watches[fd]=cb;
+    return true;
+  }
+
+  bool EventLoop::unwatch(int fd)
+  {
+    if (watches.erase(fd)==0){
+      return false;
+    }
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL)!=0){
+      DEMO_LOG_ERROR("epoll_ctl(del %d): %s\n",fd,strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  int EventLoop::add_timer(std::chrono::milliseconds delay, Callback cb, bool repeat)
+  {
+    if (timer_fd<0){
+      return -1;
+    }
+    if (delay.count()<0){
+      delay = std::chrono::milliseconds(0);
+    }
+    //ids are never reused while the old one could still be cancelled
+    do {
+      next_timer_id = (next_timer_id==std::numeric_limits<int>::max()) ? 0 : next_timer_id+1;
+    } while (timers.count(next_timer_id));
+    int id = next_timer_id;
+
+    Timer &t = timers[id];
+    t.period = delay;
+    t.repeat = repeat;
+    t.cb = cb;
+    t.due = std::chrono::steady_clock::now()+delay;
+    t.handle = wheel.add(t.due, id);
+    arm_timer_fd();
+    return id;
+  }
+
+  bool EventLoop::cancel_timer(int timer_id)
+  {
+    auto it = timers.find(timer_id);
+    if (it==timers.end()){
+      return false;
+    }
+    if (it->second.handle!=TimerWheel::NONE){
+      wheel.cancel(it->second.handle);
+    }
+    timers.erase(it);
+    //the timerfd may stay armed for it, which only costs a spurious wakeup
+    return true;
+  }
+
+  //only a syscall if the soonest deadline moved earlier (or there was none)
+  void EventLoop::arm_timer_fd()
+  {
+    TimePoint at;
+    if (!wheel.next_expiry(at) || (armed && armed_at<=at)){
+      return;
+    }
+    struct itimerspec spec;
+    memset(&spec,0,sizeof(spec));
+    //steady_clock is CLOCK_MONOTONIC, so its deadlines can be used as they are
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        at.time_since_epoch()).count();
+    //a zero it_value would disarm the timer, so round up to 1ns
+    if (ns<=0){ ns=1; }
+    spec.it_value.tv_sec  = ns/1000000000LL;
+    spec.it_value.tv_nsec = ns%1000000000LL;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL)!=0){
+      DEMO_LOG_ERROR("timerfd_settime: %s\n",strerror(errno));
+      return;
+    }
+    armed=true;
+    armed_at=at;
+  }
+
+  void EventLoop::expire_timers()
+  {
+    uint64_t expirations;
+    if (read(timer_fd,&expirations,sizeof(expirations))<0 && errno!=EAGAIN){
+      DEMO_LOG_ERROR("timerfd read: %s\n",strerror(errno));
+    }
+    armed=false;
+    TimePoint now = std::chrono::steady_clock::now();
+    expired.clear();
+    wheel.advance(now, expired);
+    //they have all left the wheel, before any callback can cancel one
+    for (int id : expired){
+      timers[id].handle = TimerWheel::NONE;
+    }
+    //the wheel only knows whole ticks, but we run them in deadline order
+    std::stable_sort(expired.begin(), expired.end(), [this](int a, int b){
+        return timers[a].due < timers[b].due;
+        });
+    for (int id : expired){
+      //an earlier callback may have cancelled it
+      auto it = timers.find(id);
+      if (it==timers.end()){
+        continue;
+      }
+      Timer &t = it->second;
+      //copy, since the callback may cancel (and so destroy) its own timer
+      Callback cb = t.cb;
+      if (t.repeat){
+        //never due again in this pass, even with a zero period
+        t.due += t.period;
+        if (t.due<=now){
+          t.due = now+std::chrono::nanoseconds(1);
+        }
+        t.handle = wheel.add(t.due, id);
+      } else {
+        timers.erase(it);
+      }
+      cb();
+    }
+    arm_timer_fd();
+  }
+
+  void EventLoop::post(Callback cb)
+  {
+    {
+      std::lock_guard<std::mutex> guard(post_mut);
+      posted.push_back(cb);
+    }
+    wake();
+  }
+
+  void EventLoop::stop()
+  {
+    stopping=true;
+    wake();
+  }
+
+  bool EventLoop::in_loop_thread() const
+  {
+    return running && std::this_thread::get_id()==loop_tid;
+  }
+
+  void EventLoop::wake()
+  {
+    uint64_t one=1;
+    if (write(wake_fd,&one,sizeof(one))<0 && errno!=EAGAIN){
+      DEMO_LOG_ERROR("eventfd write: %s\n",strerror(errno));
+    }
+  }
+
+  void EventLoop::drain_posted()
+  {
+    std::vector<Callback> todo;
+    {
+      std::lock_guard<std::mutex> guard(post_mut);
+      todo.swap(posted);
+    }
+    for (auto &cb : todo){
+      cb();
+    }
+  }
+
+  void EventLoop::run()
+  {
+    loop_tid = std::this_thread::get_id();
+    running=true;
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping){
+      int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+      if (n<0){
+        if (errno==EINTR){ continue; }
+        DEMO_LOG_ERROR("epoll_wait: %s\n",strerror(errno));
+        break;
+      }
+      for (int i=0;i<n;i++){
+        int fd = events[i].data.fd;
+        if (fd==wake_fd){
+          uint64_t count;
+          if (read(wake_fd,&count,sizeof(count))<0 && errno!=EAGAIN){
+            DEMO_LOG_ERROR("eventfd read: %s\n",strerror(errno));
+          }
+          drain_posted();
+          continue;
+        }
+        if (fd==timer_fd){
+          expire_timers();
+          continue;
+        }
+        //an earlier callback in this batch may have removed this fd
+        auto it = watches.find(fd);
+        if (it==watches.end()){ continue; }
+        //copy, since the callback may unwatch (and so destroy) itself
+        Callback cb = it->second;
+        cb();
+      }
+    }
+    drain_posted();
+    running=false;
+    stopping=false;
+  }
+}
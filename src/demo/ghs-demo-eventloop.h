@@ -0,0 +1,162 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-eventloop.h
+ *
+ * @brief a small epoll-based event loop used by demo::Comms for all its I/O
+ *
+ */
+#ifndef GHS_DEMO_EVENTLOOP
+#define GHS_DEMO_EVENTLOOP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ghs-demo-timerwheel.h"
+
+///
+namespace demo{
+
+  /**
+   * @brief A single-threaded reactor over epoll(7), eventfd(2) and timerfd_create(2)
+   *
+   * One thread calls run(), and from then on every callback (fd readiness,
+   * timer expiry, posted work) is executed on that thread, one at a time, so
+   * the callbacks need no locking among themselves.
+   *
+   * post() and stop() may be called from any thread; they wake the loop
+   * through an eventfd, so stop() takes effect immediately rather than after
+   * some poll timeout. All other methods must be called from the loop thread
+   * (e.g., from inside a posted callback), or before run() is called.
+   *
+   * All timers share one timerfd, armed for the earliest deadline, and are
+   * kept in a TimerWheel, so adding or cancelling one is O(1) however many
+   * are pending (every message in flight has its send timeout, and
+   * transports, link probes and retries all use them). They fire within
+   * a millisecond of their deadline, never early, and in deadline order.
+   *
+   * Failures of the underlying system calls are logged and reported with a
+   * false / -1 return.
+   */
+  class EventLoop
+  {
+    public:
+      /// The type of all loop callbacks
+      typedef std::function<void()> Callback;
+
+      EventLoop();
+      ~EventLoop();
+
+      /// @return false if the epoll or eventfd descriptors could not be created
+      bool ok() const;
+
+      /**
+       * Calls `cb` on the loop thread whenever `fd` is readable (level-triggered).
+       * Watching an fd that is already watched replaces its callback.
+       */
+      bool watch(int fd, Callback cb);
+
+      /// Stops watching `fd`. It is safe to call this from the fd's own callback.
+      bool unwatch(int fd);
+
+      /**
+       * Calls `cb` on the loop thread after `delay`, and then every `delay`
+       * if `repeat` is set.
+       *
+       * @return a timer id for cancel_timer(), or -1 on error
+       */
+      int add_timer(std::chrono::milliseconds delay, Callback cb, bool repeat=false);
+
+      /// Cancels a timer. It is safe to call this from the timer's own callback.
+      bool cancel_timer(int timer_id);
+
+      /// Queues `cb` to be called on the loop thread. Thread safe.
+      void post(Callback cb);
+
+      /**
+       * Dispatches events until stop() is called. Posted callbacks that were
+       * queued before stop() still run.
+       */
+      void run();
+
+      /// Makes run() return as soon as the current callback finishes. Thread safe.
+      void stop();
+
+      /// @return true if called from inside run()
+      bool in_loop_thread() const;
+
+    private:
+      typedef std::chrono::steady_clock::time_point TimePoint;
+
+      /// A pending timer, and its place in the wheel
+      struct Timer
+      {
+        TimerWheel::Handle handle;
+        TimePoint due;
+        std::chrono::milliseconds period;
+        bool repeat;
+        Callback cb;
+      };
+
+      void wake();
+      void drain_posted();
+      void expire_timers();
+      void arm_timer_fd();
+
+      int epoll_fd;
+      int wake_fd;
+      int timer_fd;
+      std::atomic<bool> running;
+      std::atomic<bool> stopping;
+      std::thread::id loop_tid;
+      std::unordered_map<int,Callback> watches;
+      int next_timer_id=0;
+      std::unordered_map<int,Timer> timers;
+      TimerWheel wheel;
+      /// When the timerfd goes off, if `armed`
+      TimePoint armed_at;
+      bool armed=false;
+      /// Reused by expire_timers()
+      std::vector<int> expired;
+      std::mutex post_mut;
+      std::vector<Callback> posted;
+  };
+}
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-failuredetector.cpp
+ *
+ * @brief implements demo::FailureDetector
+ *
+ */
+#include "ghs-demo-failuredetector.h"
+
+#include <algorithm>
+#include <cmath>
+
+///
+namespace demo{
+
+  const size_t FailureDetector::WINDOW;
+
+  FailureDetector::FailureDetector(size_t n_agents, Clock::duration expected, Clock::time_point now)
+  {
+    reset(n_agents, expected, now);
+  }
+
+  void FailureDetector::reset(size_t n_agents, Clock::duration expected, Clock::time_point now)
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    expected_ms = std::chrono::duration<double,std::milli>(expected).count();
+    peers.resize(n_agents);
+    for (auto &p : peers){
+      clear(p, now);
+    }
+  }
+
+  //the window starts with one gap of the heartbeat period
+  void FailureDetector::clear(Peer &p, Clock::time_point now) const
+  {
+    p.last = now;
+    p.gaps_ms[0] = expected_ms;
+    p.n = 1;
+    p.next = 1;
+    p.sum = expected_ms;
+    p.sum_sq = expected_ms*expected_ms;
+  }
+
+  void FailureDetector::heard(uint16_t id, Clock::time_point now)
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id>=peers.size()){
+      return;
+    }
+    Peer &p = peers[id];
+    double gap = std::chrono::duration<double,std::milli>(now-p.last).count();
+    if (gap >= expected_ms/2){
+      if (p.n==WINDOW){
+        double old = p.gaps_ms[p.next];
+        p.sum -= old;
+        p.sum_sq -= old*old;
+      } else {
+        p.n++;
+      }
+      p.gaps_ms[p.next] = gap;
+      p.next = (p.next+1)%WINDOW;
+      p.sum += gap;
+      p.sum_sq += gap*gap;
+    }
+    p.last = std::max(p.last, now);
+  }
+
+  double FailureDetector::phi(uint16_t id, Clock::time_point now) const
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id>=peers.size()){
+      return 0;
+    }
+    const Peer &p = peers[id];
+    double silence = std::chrono::duration<double,std::milli>(now-p.last).count();
+    double mean = p.sum/p.n;
+    double var = std::max(p.sum_sq/p.n - mean*mean, 0.0);
+    double std_ms = std::max(std::sqrt(var), expected_ms/2);
+    return phi_of(silence, mean, std_ms);
+  }
+
+  FailureDetector::Clock::duration FailureDetector::silent_for(uint16_t id, Clock::time_point now) const
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id>=peers.size()){
+      return Clock::duration(0);
+    }
+    return std::max(now-peers[id].last, Clock::duration(0));
+  }
+
+  double FailureDetector::phi_of(double silence_ms, double mean_ms, double std_ms)
+  {
+    if (silence_ms<=0 || std_ms<=0){
+      return 0;
+    }
+    //the logistic approximation of the normal tail, written so that neither
+    //end of it turns into inf/inf
+    double y = (silence_ms-mean_ms)/std_ms;
+    double e = std::exp(-y*(1.5976+0.070566*y*y));
+    double p_later = 1.0/(1.0+1.0/e);
+    return -std::log10(std::max(p_later, 1e-300));
+  }
+}
@@ -0,0 +1,128 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-failuredetector.h
+ *
+ * @brief a per-link phi-accrual failure detector, fed by the traffic Comms already sees
+ *
+ */
+#ifndef GHS_DEMO_FAILUREDETECTOR
+#define GHS_DEMO_FAILUREDETECTOR
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @brief How suspicious the silence of each peer is, as a phi value
+   *
+   * Every sign of life from a peer (a message, or an acknowledgement of one
+   * of ours) goes to heard(). A peer that is quiet for a while sends a
+   * heartbeat (see Comms::start_liveness()), so the gaps between signs of
+   * life are at most about one heartbeat period while the peer is up. The
+   * detector keeps the last WINDOW of those gaps and, for the current
+   * silence, reports
+   *
+   *     phi = -log10( P(a gap is at least this long) )
+   *
+   * under a normal fit of the window (Hayashibara et al., "The phi accrual
+   * failure detector"). So phi=1 means 10% of gaps have run this long, phi=8 means one in
+   * 10^8 has. The application picks the threshold that trades detection
+   * time for mistakes, rather than the detector picking a timeout.
+   *
+   * Gaps much shorter than the heartbeat period (a burst of traffic) say
+   * nothing about how long a quiet link stays quiet, so only gaps of at
+   * least half of it are kept, and the standard deviation is kept to at
+   * least half of it as well, so a very regular link does not become
+   * suspicious the moment a heartbeat is late.
+   *
+   * All methods are thread safe.
+   */
+  class FailureDetector
+  {
+    public:
+      typedef std::chrono::steady_clock Clock;
+
+      /// How many gaps are kept per peer
+      static const size_t WINDOW=64;
+
+      /**
+       * @param n_agents how many peers to track (indexed by agent id)
+       * @param expected the heartbeat period, which is also the first guess at the gaps
+       * @param now every peer is taken to have been heard from then
+       */
+      FailureDetector(size_t n_agents=0,
+          Clock::duration expected=std::chrono::seconds(1),
+          Clock::time_point now=Clock::time_point());
+
+      /// Re-size and forget all gaps; every peer is taken to have been heard from at `now`
+      void reset(size_t n_agents, Clock::duration expected, Clock::time_point now);
+
+      /// Note a sign of life from a peer
+      void heard(uint16_t agent_id, Clock::time_point now);
+
+      /// @return the suspicion level of a peer: 0 if it was just heard from, growing the longer it is silent (0 if out of range)
+      double phi(uint16_t agent_id, Clock::time_point now) const;
+
+      /// @return how long a peer has been silent (0 if out of range)
+      Clock::duration silent_for(uint16_t agent_id, Clock::time_point now) const;
+
+      /// @return the phi of a peer `silence` after it was last heard from, for a window with this mean and standard deviation (all in ms)
+      static double phi_of(double silence_ms, double mean_ms, double std_ms);
+
+    private:
+      struct Peer
+      {
+        Clock::time_point last;
+        double gaps_ms[WINDOW];
+        size_t n;
+        size_t next;
+        double sum;
+        double sum_sq;
+      };
+
+      void clear(Peer &p, Clock::time_point now) const;
+
+      mutable std::mutex mut;
+      double expected_ms;
+      std::vector<Peer> peers;
+  };
+}
+
+#endif
@@ -45,16 +45,19 @@
 #include <unistd.h>
 #include <poll.h>
 #include <cerrno>
+#include <algorithm>
 // apt:
 #include <ini.h> // use get_deps.sh
 // ghs:
 #include "ghs-demo-config.h"
+#include "ghs-demo-log.h"
 
 namespace demo{
 
   //there's a perfectly good C++ api too
   //https://github.com/benhoyt/inih/blob/master/examples/INIReaderExample.cpp
   static int read_cfg_item(void* user, const char* section, const char* name, const char * value);
+  static int read_link_item(void* user, const char* section, const char* name, const char * value);
 
   void read_cfg_file(const char* fname, Config*config){
     int error = ini_parse(fname,read_cfg_item,(void*)config);
@@ -78,7 +81,7 @@ namespace demo{
   int read_cfg_item(void* user, const char* section, const char* name, const char * value)
   {
 
-    //this is more than enough, but note this is coupled to MAX_N
+    //this is more than enough for any int
     static char agent_str[32]={0};
 
     Config * config = (Config*) user;
@@ -91,7 +94,6 @@ namespace demo{
     //process "ghs" section
     if (strcmp(section,"ghs")==0){
       //process agent.
-      assert(config->n_agents < MAX_N);
       //create a string for comparison, from the next agent id,
       //which, becasue they are zero-indexed, is simply 
       //the size of the set of current agents.
@@ -101,10 +103,10 @@ namespace demo{
       //of the form [agent], 0=<hostname>, so "0" is the name string
       if (strcmp(name,agent_str)==0){
         //copy over value
-        snprintf(config->endpoints[config->n_agents],MAX_ENDPOINT_SZ,"%s",value);
+        config->endpoints.push_back(value);
 
-        //print for funsies
-        printf("[info] set '%s.%s'=%s (%d)\n",section,name,config->endpoints[config->n_agents], config->n_agents);
+        //print for funsies (but not a line per agent by default, there may be many)
+        DEMO_LOG_DEBUG("set 'ghs.%d'=%s\n",config->n_agents,config->endpoints.back().c_str());
 
         //note the new agent
         config->n_agents++;
@@ -137,7 +139,15 @@ namespace demo{
     } else if (strcmp(section,"runtime")==0)
     {
       if (strcmp(name,"debug")==0){
-        printf("[warn] ok, but unimplemented: %s.%s=%s\n",section,name,value);
+        if (strcmp(value,"true")==0 || strcmp(value,"1")==0){
+          config->log_level=LOG_DEBUG;
+        }
+        return 1;
+      } 
+
+      if (strcmp(name,"log_level")==0){
+        config->log_level=log_level_from_string(value);
+        printf("[info] log level = %s (%d)\n",value,config->log_level);
         return 1;
       } 
 
@@ -164,11 +174,214 @@ namespace demo{
           printf("[warn] Error converting %s to a float: %s\n",value,strerror(err));
           return 0;
         }
-        printf("[info] config says wait %f seconds\n",val);
+        printf("[info] config says wait up to %f seconds for peers\n",val);
         config->wait_s=val;
         return 1;
       }
 
+      if(strcmp(name,"iperf_train_len")==0){
+        int val = atoi(value);
+        if (val<=0){
+          printf("[warn] iperf_train_len must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->iperf_train_len=val;
+        return 1;
+      }
+
+      if(strcmp(name,"iperf_payload_bytes")==0){
+        int val = atoi(value);
+        if (val<=0){
+          printf("[warn] iperf_payload_bytes must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->iperf_payload_sz=val;
+        return 1;
+      }
+
+      if(strcmp(name,"metric_idle_seconds")==0){
+        config->metric_idle_s=strtof(value,0);
+        return 1;
+      }
+
+      if(strcmp(name,"metric_alpha")==0){
+        double val = strtof(value,0);
+        if (val<=0.0 || val>1.0){
+          printf("[warn] metric_alpha must be in (0,1], got: %s\n",value);
+          return 0;
+        }
+        config->metric_alpha=val;
+        return 1;
+      }
+
+      if(strcmp(name,"metric_change_threshold")==0){
+        double val = strtof(value,0);
+        if (val<=0.0){
+          printf("[warn] metric_change_threshold must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->metric_change_threshold=val;
+        return 1;
+      }
+
+      if(strcmp(name,"send_timeout_seconds")==0){
+        double val = strtof(value,0);
+        if (val<=0.0){
+          printf("[warn] send_timeout_seconds must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->send_timeout_s=val;
+        return 1;
+      }
+
+      if(strcmp(name,"retry_base_seconds")==0){
+        double val = strtof(value,0);
+        if (val<=0.0){
+          printf("[warn] retry_base_seconds must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->retry_base_s=val;
+        return 1;
+      }
+
+      if(strcmp(name,"retry_max_seconds")==0){
+        double val = strtof(value,0);
+        if (val<=0.0){
+          printf("[warn] retry_max_seconds must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->retry_max_s=val;
+        return 1;
+      }
+
+      if(strcmp(name,"heartbeat_seconds")==0){
+        config->heartbeat_s=strtof(value,0);
+        return 1;
+      }
+
+      if(strcmp(name,"center_leader")==0){
+        if (strcmp(value,"true")==0 || strcmp(value,"1")==0){
+          config->center_leader=true;
+          return 1;
+        }
+        if (strcmp(value,"false")==0 || strcmp(value,"0")==0){
+          config->center_leader=false;
+          return 1;
+        }
+        return 0;
+      }
+
+      if(strcmp(name,"max_degree")==0){
+        config->max_degree=(uint32_t)strtoul(value,0,10);
+        return 1;
+      }
+
+      if(strcmp(name,"leader_deadline_seconds")==0){
+        config->leader_deadline_s=strtof(value,0);
+        return 1;
+      }
+
+      if(strcmp(name,"health_period_seconds")==0){
+        config->health_period_s=strtof(value,0);
+        return 1;
+      }
+
+      if(strcmp(name,"suspect_phi")==0){
+        double val = strtof(value,0);
+        if (val<=0.0){
+          printf("[warn] suspect_phi must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->suspect_phi=val;
+        return 1;
+      }
+
+      if(strcmp(name,"shm_ring_slots")==0){
+        int val = atoi(value);
+        if (val<=0){
+          printf("[warn] shm_ring_slots must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->shm_ring_slots=val;
+        return 1;
+      }
+
+      if(strcmp(name,"udp_window")==0){
+        int val = atoi(value);
+        if (val<=0){
+          printf("[warn] udp_window must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->udp_window=val;
+        return 1;
+      }
+
+      if(strcmp(name,"nng_window")==0){
+        int val = atoi(value);
+        if (val<=0){
+          printf("[warn] nng_window must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->nng_window=val;
+        return 1;
+      }
+
+      if(strcmp(name,"udp_loss")==0){
+        double val = strtof(value,0);
+        if (val<0.0 || val>=1.0){
+          printf("[warn] udp_loss must be in [0,1), got: %s\n",value);
+          return 0;
+        }
+        config->udp_loss=val;
+        return 1;
+      }
+
+      if(strcmp(name,"cluster")==0){
+        int val = atoi(value);
+        if (val<0){
+          printf("[warn] cluster must be >=0, got: %s\n",value);
+          return 0;
+        }
+        config->cluster=val;
+        return 1;
+      }
+
+      if(strcmp(name,"broadcast_file")==0){
+        config->broadcast_file=value;
+        return 1;
+      }
+
+      if(strcmp(name,"broadcast_window")==0){
+        int val = atoi(value);
+        if (val<1){
+          printf("[warn] broadcast_window must be >0, got: %s\n",value);
+          return 0;
+        }
+        config->broadcast_window=val;
+        return 1;
+      }
+
+      if(strcmp(name,"emulate")==0){
+        if (!read_link_profiles(value,config)){
+          printf("[warn] could not read link profiles from %s\n",value);
+          return 0;
+        }
+        printf("[info] emulating links from %s\n",value);
+        return 1;
+      }
+
+      if(strcmp(name,"iperf_timeout_seconds")==0){
+        errno=0;
+        double val = strtof(value,0);
+        int err = errno;
+        if (val<=0.0 || err!=0){
+          printf("[warn] Error converting %s to a positive float\n",value);
+          return 0;
+        }
+        config->iperf_timeout_s=val;
+        return 1;
+      }
+
 
       return 0;
     } 
@@ -176,12 +389,74 @@ namespace demo{
     return 0;
   }
 
+  bool read_link_profiles(const char* fname, Config*config){
+    config->emu_default = LinkProfile();
+    config->emu_links.clear();
+    int error = ini_parse(fname,read_link_item,(void*)config);
+    if (error!=0){
+      printf("[warn] %s: error on line %d\n",fname,error);
+      return false;
+    }
+    config->emulate = fname;
+    return true;
+  }
+
+  /*
+   * Handles one name=value pair of a link profile file, see
+   * read_link_profiles()
+   */
+  int read_link_item(void* user, const char* section, const char* name, const char * value)
+  {
+    Config * config = (Config*) user;
+
+    LinkProfile *p;
+    if (strcmp(section,"default")==0){
+      p = &config->emu_default;
+    } else {
+      int a,b;
+      char rest;
+      if (sscanf(section,"%d-%d%c",&a,&b,&rest)!=2 || a<0 || b<0 || a==b){
+        printf("[warn] link sections are [default] or [<id>-<id>], got: [%s]\n",section);
+        return 0;
+      }
+      auto key = std::make_pair(std::min(a,b),std::max(a,b));
+      if (config->emu_links.count(key)==0){
+        config->emu_links[key]=config->emu_default;
+      }
+      p = &config->emu_links[key];
+    }
+
+    errno=0;
+    double val = strtof(value,0);
+    if (errno!=0 || val<0){
+      printf("[warn] %s.%s must be a number >=0, got: %s\n",section,name,value);
+      return 0;
+    }
+    if (strcmp(name,"latency_ms")==0){
+      p->latency_ms=val;
+    } else if (strcmp(name,"jitter_ms")==0){
+      p->jitter_ms=val;
+    } else if (strcmp(name,"kbps")==0){
+      p->kbps=val;
+    } else if (strcmp(name,"loss")==0){
+      if (val>1.0){
+        printf("[warn] %s.loss must be in [0,1], got: %s\n",section,value);
+        return 0;
+      }
+      p->loss=val;
+    } else {
+      printf("[warn] unrecognized: %s.%s=%s\n",section,name,value);
+      return 0;
+    }
+    return 1;
+  }
+
   /**
    * Validate the config file, and return 'false' if the config is misread (some
    * variable unset) or has semantic errors. For example if my_id is >=
    * num_agents, or is <0. 
    */
-  bool cfg_is_ok(Config config){
+  bool cfg_is_ok(const Config &config){
 
     if (config.my_id==ID_UNSET){
       fprintf(stderr,"[error] Invalid my_id!\n");
@@ -193,8 +468,13 @@ namespace demo{
       return false;
     }
 
+    if ((size_t)config.n_agents != config.endpoints.size()){
+      fprintf(stderr,"[error] %d agents, but %zu endpoints\n",config.n_agents,config.endpoints.size());
+      return false;
+    }
+
     for (int i=0;i<config.n_agents;i++){
-      if (strlen(config.endpoints[i])==0){
+      if (config.endpoints[i].empty()){
         fprintf(stderr,"[error] Error parsing endpoint for agent %d",i);
         return false;
       }
@@ -0,0 +1,143 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-linkstats.cpp
+ *
+ */
+#include "ghs-demo-linkstats.h"
+#include <cmath>
+
+namespace demo{
+
+  LinkStats::LinkStats(size_t n, double a, double t)
+  {
+    reset(n,a,t);
+  }
+
+  void LinkStats::reset(size_t n, double a, double t)
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    alpha = a;
+    threshold = t;
+    links.assign(n, LinkEstimate());
+    reported_kbps.assign(n, 0.0);
+  }
+
+  void LinkStats::on_change(LinkChangeCallback c)
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    cb = c;
+  }
+
+  //Welford-style exponentially weighted mean and variance. The first sample
+  //is taken as-is, so the estimate is not biased towards zero.
+  void LinkStats::fold(double x, double a, double &mean, double &var, size_t &n)
+  {
+    if (n==0){
+      mean = x;
+      var = 0;
+    } else {
+      double diff = x - mean;
+      double incr = a * diff;
+      mean += incr;
+      var = (1.0 - a) * (var + diff * incr);
+    }
+    n++;
+  }
+
+  void LinkStats::observe(uint16_t id, double kbps, double rtt_us)
+  {
+    LinkChangeCallback to_call;
+    Kbps old_kbps=0, new_kbps=0;
+    {
+      std::lock_guard<std::mutex> guard(mut);
+      if (id >= links.size()){ return; }
+      LinkEstimate &e = links[id];
+      fold(kbps, alpha, e.kbps_mean, e.kbps_var, e.kbps_samples);
+      if (rtt_us>0){
+        fold(rtt_us, alpha, e.rtt_mean_us, e.rtt_var_us, e.rtt_samples);
+      }
+      e.last_activity = std::chrono::steady_clock::now();
+
+      double &ref = reported_kbps[id];
+      if (e.kbps_samples==1){
+        ref = e.kbps_mean;
+      } else {
+        double base = ref > 1.0 ? ref : 1.0;
+        if (std::fabs(e.kbps_mean - ref)/base > threshold){
+          old_kbps = (Kbps) ref;
+          new_kbps = (Kbps) e.kbps_mean;
+          ref = e.kbps_mean;
+          to_call = cb;
+        }
+      }
+    }
+    if (to_call){
+      to_call(id, old_kbps, new_kbps);
+    }
+  }
+
+  void LinkStats::observe_rtt(uint16_t id, double rtt_us)
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id >= links.size()){ return; }
+    LinkEstimate &e = links[id];
+    fold(rtt_us, alpha, e.rtt_mean_us, e.rtt_var_us, e.rtt_samples);
+    e.last_activity = std::chrono::steady_clock::now();
+  }
+
+  void LinkStats::touch(uint16_t id)
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id >= links.size()){ return; }
+    links[id].last_activity = std::chrono::steady_clock::now();
+  }
+
+  bool LinkStats::get(uint16_t id, LinkEstimate &out) const
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id >= links.size()){ return false; }
+    out = links[id];
+    return true;
+  }
+
+  std::chrono::steady_clock::duration LinkStats::idle_for(uint16_t id) const
+  {
+    std::lock_guard<std::mutex> guard(mut);
+    if (id >= links.size() || links[id].last_activity.time_since_epoch().count()==0){
+      return std::chrono::steady_clock::duration::max();
+    }
+    return std::chrono::steady_clock::now() - links[id].last_activity;
+  }
+}
@@ -0,0 +1,140 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-linkstats.h
+ *
+ * @brief smoothed, continuously-updated link metrics for demo::Comms
+ *
+ */
+#ifndef GHS_DEMO_LINKSTATS
+#define GHS_DEMO_LINKSTATS
+
+#include "ghs-demo-edgemetrics.h"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+///
+namespace demo{
+
+  /**
+   * @brief the smoothed estimate of a single link
+   *
+   * Means and variances are exponentially-weighted moving averages (EWMA)
+   * over all samples seen so far.
+   */
+  struct LinkEstimate
+  {
+    /// Smoothed throughput in kbps
+    double kbps_mean=0;
+    /// Smoothed variance of the throughput samples
+    double kbps_var=0;
+    /// Smoothed round-trip time in microseconds
+    double rtt_mean_us=0;
+    /// Smoothed variance of the round-trip time samples
+    double rtt_var_us=0;
+    /// How many throughput samples have been folded into kbps_mean
+    size_t kbps_samples=0;
+    /// How many RTT samples have been folded into rtt_mean_us
+    size_t rtt_samples=0;
+    /// The last time any traffic was seen on this link (either direction)
+    std::chrono::steady_clock::time_point last_activity;
+  };
+
+  /**
+   * Called with the agent id, the last reported throughput, and the new one.
+   */
+  typedef std::function<void(uint16_t agent_id, Kbps old_kbps, Kbps new_kbps)> LinkChangeCallback;
+
+  /**
+   * @brief Per-link EWMA tracking of throughput and RTT, with change notification
+   *
+   * Comms feeds this from little_iperf() packet trains, from every
+   * successful send (passive samples) and from background probes. Whenever
+   * the smoothed throughput of a link drifts more than `threshold`
+   * (relative) away from the value last reported, the change callback is
+   * invoked and the new value becomes the reference.
+   *
+   * All methods are thread safe. The callback is called without holding
+   * the internal lock, on whichever thread supplied the sample.
+   */
+  class LinkStats
+  {
+    public:
+      /**
+       * @param n_agents how many links to track (indexed by agent id)
+       * @param alpha the EWMA weight of a new sample, in (0,1]
+       * @param threshold the relative throughput change that triggers the callback
+       */
+      LinkStats(size_t n_agents=0, double alpha=0.2, double threshold=0.25);
+
+      /// Re-size and clear all estimates
+      void reset(size_t n_agents, double alpha, double threshold);
+
+      /// Install the callback for throughput changes above the threshold
+      void on_change(LinkChangeCallback cb);
+
+      /**
+       * Fold in one throughput sample (and an RTT sample, if rtt_us>0).
+       * The first sample of a link initializes its estimate and reference value.
+       */
+      void observe(uint16_t agent_id, double kbps, double rtt_us);
+
+      /// Fold in an RTT sample only (e.g., from a message too small to say anything about throughput)
+      void observe_rtt(uint16_t agent_id, double rtt_us);
+
+      /// Note traffic on the link without a measurement (e.g., a received message)
+      void touch(uint16_t agent_id);
+
+      /// @return false if agent_id is out of range
+      bool get(uint16_t agent_id, LinkEstimate &out) const;
+
+      /// @return the time since the link last carried traffic (max duration if never)
+      std::chrono::steady_clock::duration idle_for(uint16_t agent_id) const;
+
+    private:
+      static void fold(double x, double alpha, double &mean, double &var, size_t &n);
+
+      mutable std::mutex mut;
+      double alpha;
+      double threshold;
+      std::vector<LinkEstimate> links;
+      std::vector<double> reported_kbps;
+      LinkChangeCallback cb;
+  };
+}
+
+#endif
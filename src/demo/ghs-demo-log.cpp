@@ -0,0 +1,232 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-log.cpp
+ *
+ */
+#include "ghs-demo-log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <strings.h>
+
+namespace demo{
+
+  /// Ring capacity in records, must be a power of two
+  static const size_t LOG_RING_SZ=4096;
+
+  /// The longest line written, including the level tag
+  static const size_t LOG_LINE_MAX=1024;
+
+  std::atomic<int> log_level_runtime(LOG_INFO);
+
+  void set_log_level(LogLevel lvl)
+  {
+    log_level_runtime.store(lvl, std::memory_order_relaxed);
+  }
+
+  LogLevel log_level_from_string(const char* name)
+  {
+    if (strcasecmp(name,"debug")==0){ return LOG_DEBUG; }
+    if (strcasecmp(name,"info")==0){ return LOG_INFO; }
+    if (strcasecmp(name,"warn")==0){ return LOG_WARN; }
+    if (strcasecmp(name,"error")==0){ return LOG_ERROR; }
+    if (strcasecmp(name,"none")==0){ return LOG_NONE; }
+    return LOG_INFO;
+  }
+
+  static const char* level_tag(int level)
+  {
+    switch (level){
+      case LOG_DEBUG: return "[debug] ";
+      case LOG_INFO:  return "[info] ";
+      case LOG_WARN:  return "[warn] ";
+      case LOG_ERROR: return "[error] ";
+      default:        return "";
+    }
+  }
+
+  Log& Log::inst()
+  {
+    static Log log;
+    return log;
+  }
+
+  Log::Log()
+  {
+    cells = new Cell[LOG_RING_SZ];
+    mask = LOG_RING_SZ-1;
+    for (size_t i=0;i<LOG_RING_SZ;i++){
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    head=0;
+    tail=0;
+    n_dropped=0;
+    n_reported=0;
+    running=false;
+    draining=false;
+    sink=stdout;
+  }
+
+  Log::~Log()
+  {
+    stop();
+    delete[] cells;
+  }
+
+  void Log::set_sink(FILE* f)
+  {
+    sink = f;
+  }
+
+  size_t Log::dropped() const
+  {
+    return n_dropped.load(std::memory_order_relaxed);
+  }
+
+  void Log::start()
+  {
+    if (writer.joinable()){
+      return;
+    }
+    draining=true;
+    writer = std::thread(&Log::drain_loop, this);
+    running.store(true, std::memory_order_release);
+  }
+
+  void Log::stop()
+  {
+    if (!writer.joinable()){
+      return;
+    }
+    //new records go straight to the sink from here on, and the writer
+    //empties the ring before it exits
+    running.store(false, std::memory_order_release);
+    draining=false;
+    writer.join();
+    while (drain_one()){}
+    fflush(sink);
+  }
+
+  void Log::flush()
+  {
+    size_t until = head.load(std::memory_order_acquire);
+    while (writer.joinable() && tail.load(std::memory_order_acquire) < until){
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    fflush(sink);
+  }
+
+  //Vyukov's bounded queue: a cell is free for position `pos` when its
+  //sequence equals pos, and holds a record for the consumer when it equals
+  //pos+1.
+  LogRecord* Log::claim(size_t &pos)
+  {
+    pos = head.load(std::memory_order_relaxed);
+    for (;;){
+      Cell &c = cells[pos & mask];
+      size_t seq = c.seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif==0){
+        if (head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)){
+          return &c.rec;
+        }
+      } else if (dif<0){
+        //full
+        return NULL;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void Log::publish(size_t pos)
+  {
+    cells[pos & mask].seq.store(pos+1, std::memory_order_release);
+  }
+
+  //single consumer, so no CAS needed on the tail
+  bool Log::drain_one()
+  {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell &c = cells[pos & mask];
+    if (c.seq.load(std::memory_order_acquire) != pos+1){
+      return false;
+    }
+    emit(c.rec);
+    c.seq.store(pos+mask+1, std::memory_order_release);
+    tail.store(pos+1, std::memory_order_release);
+    return true;
+  }
+
+  void Log::drain_loop()
+  {
+    while (draining){
+      bool any=false;
+      while (drain_one()){
+        any=true;
+      }
+      size_t d = n_dropped.load(std::memory_order_relaxed);
+      if (d != n_reported){
+        fprintf(sink, "[warn] log: dropped %zu records\n", d-n_reported);
+        n_reported = d;
+      }
+      if (any){
+        fflush(sink);
+      } else {
+        //producers never signal us, so poll; a millisecond of latency is fine for logs
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  void Log::emit(const LogRecord &r)
+  {
+    char line[LOG_LINE_MAX];
+    const char* tag = level_tag(r.level);
+    size_t n = strlen(tag);
+    memcpy(line, tag, n);
+    int ret = r.format(line+n, LOG_LINE_MAX-n-1, r.fmt, r.args);
+    if (ret<0){
+      return;
+    }
+    n += std::min((size_t)ret, LOG_LINE_MAX-n-2);
+    //formats may or may not end in a newline, so make sure there's one
+    if (n==0 || line[n-1]!='\n'){
+      line[n++]='\n';
+    }
+    fwrite(line, 1, n, sink);
+  }
+}
@@ -0,0 +1,285 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-log.h
+ *
+ * @brief leveled, asynchronous logging for the demo
+ *
+ */
+#ifndef GHS_DEMO_LOG
+#define GHS_DEMO_LOG
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+#ifndef GHS_DEMO_LOG_LEVEL
+/// Log statements below this level are compiled out entirely (0=debug, 1=info, 2=warn, 3=error, 4=none)
+#define GHS_DEMO_LOG_LEVEL 0
+#endif
+
+/// Evaluates to true if `lvl` is both compiled in and enabled at runtime
+#define DEMO_LOG_ON(lvl) (GHS_DEMO_LOG_LEVEL <= (lvl) && demo::log_enabled(lvl))
+
+//The dead printf() is never run, but lets the compiler check the format
+//string against the arguments. The arguments are only evaluated if the
+//level is on.
+#define DEMO_LOG(lvl, ...) do{                              \
+  if (DEMO_LOG_ON(lvl)) { demo::Log::inst().write(lvl, __VA_ARGS__); } \
+  else if (false) { printf(__VA_ARGS__); }                  \
+}while(0)
+
+/// Logs a printf-style message at debug level. Use a string literal for the format.
+#define DEMO_LOG_DEBUG(...) DEMO_LOG(demo::LOG_DEBUG, __VA_ARGS__)
+/// Logs a printf-style message at info level. Use a string literal for the format.
+#define DEMO_LOG_INFO(...)  DEMO_LOG(demo::LOG_INFO,  __VA_ARGS__)
+/// Logs a printf-style message at warn level. Use a string literal for the format.
+#define DEMO_LOG_WARN(...)  DEMO_LOG(demo::LOG_WARN,  __VA_ARGS__)
+/// Logs a printf-style message at error level. Use a string literal for the format.
+#define DEMO_LOG_ERROR(...) DEMO_LOG(demo::LOG_ERROR, __VA_ARGS__)
+
+///
+namespace demo{
+
+  /// Log severities, in increasing order
+  enum LogLevel
+  {
+    LOG_DEBUG=0, ///< Per-message detail, including message and edge dumps
+    LOG_INFO,    ///< Normal progress
+    LOG_WARN,    ///< Something odd, but recoverable
+    LOG_ERROR,   ///< Something failed
+    LOG_NONE,    ///< Disables all logging
+  };
+
+  /// The runtime level; anything below it is skipped without evaluating arguments
+  extern std::atomic<int> log_level_runtime;
+
+  /// @return true if messages at `lvl` are currently written
+  inline bool log_enabled(int lvl)
+  {
+    return lvl >= log_level_runtime.load(std::memory_order_relaxed);
+  }
+
+  /// Sets the runtime log level
+  void set_log_level(LogLevel lvl);
+
+  /// @return the level named by `name` (debug, info, warn, error, none), or LOG_INFO if unrecognized
+  LogLevel log_level_from_string(const char* name);
+
+  /// The max bytes (including the terminator) kept of each string argument
+  static const size_t LOG_STR_MAX=192;
+
+  /// The bytes available for the captured arguments of one record
+  static const size_t LOG_ARGS_MAX=448;
+
+  /**
+   * @brief A string argument, copied into the record at the call site
+   *
+   * The pointer passed to the log call need not outlive the call, which is
+   * the whole point. Longer strings are truncated.
+   */
+  struct LogStr
+  {
+    char s[LOG_STR_MAX];
+    LogStr(const char* p)
+    {
+      if (!p){ p="(null)"; }
+      size_t n=strlen(p);
+      if (n>=LOG_STR_MAX){ n=LOG_STR_MAX-1; }
+      memcpy(s,p,n);
+      s[n]=0;
+    }
+  };
+
+  /// How each argument type is stored in a record: strings by value, the rest as-is
+  template<typename T> struct LogCapture { typedef typename std::decay<T>::type type; };
+  template<> struct LogCapture<const char*> { typedef LogStr type; };
+  template<> struct LogCapture<char*> { typedef LogStr type; };
+  template<size_t N> struct LogCapture<const char[N]> { typedef LogStr type; };
+  template<size_t N> struct LogCapture<char[N]> { typedef LogStr type; };
+
+  /// @cond internal
+  template<typename T> inline const T& log_unwrap(const T& t){ return t; }
+  inline const char* log_unwrap(const LogStr& t){ return t.s; }
+
+  template<size_t...> struct LogSeq {};
+  template<size_t N, size_t... I> struct LogMakeSeq : LogMakeSeq<N-1, N-1, I...> {};
+  template<size_t... I> struct LogMakeSeq<0, I...> { typedef LogSeq<I...> type; };
+
+  template<typename Tuple, size_t... I>
+    inline int log_format_seq(char* out, size_t n, const char* fmt, const Tuple& t, LogSeq<I...>)
+    {
+      return snprintf(out, n, fmt, log_unwrap(std::get<I>(t))...);
+    }
+
+  template<typename Tuple>
+    inline int log_format_seq(char* out, size_t n, const char* fmt, const Tuple&, LogSeq<>)
+    {
+      return snprintf(out, n, "%s", fmt);
+    }
+
+  template<typename Tuple>
+    int log_format(char* out, size_t n, const char* fmt, const void* args)
+    {
+      typedef typename LogMakeSeq<std::tuple_size<Tuple>::value>::type seq;
+      return log_format_seq(out, n, fmt, *static_cast<const Tuple*>(args), seq());
+    }
+  /// @endcond
+
+  /**
+   * @brief One binary log record: the format, how to apply it, and the captured arguments
+   *
+   * Nothing is formatted until the background thread gets to it.
+   */
+  struct LogRecord
+  {
+    /// The severity
+    int level;
+    /// The format string, which must outlive the logger (i.e., a literal)
+    const char* fmt;
+    /// Formats `fmt` with the arguments stored in `args`
+    int (*format)(char* out, size_t n, const char* fmt, const void* args);
+    /// Storage for a std::tuple of the captured arguments
+    alignas(8) unsigned char args[LOG_ARGS_MAX];
+  };
+
+  /**
+   * @brief Asynchronous logger behind the DEMO_LOG_* macros
+   *
+   * Callers copy a LogRecord into a bounded lock-free multi-producer ring
+   * (Vyukov's MPMC queue, used with a single consumer) and return. A
+   * background thread started by start() formats and writes the records
+   * in order. Producers never block or allocate: if the ring is full the
+   * record is dropped and counted, and the count is reported in the log.
+   *
+   * Until start() is called (or after stop()), records are formatted and
+   * written immediately on the calling thread.
+   *
+   * Output looks like `[info] message`, one line per record.
+   */
+  class Log
+  {
+    public:
+      /// The process-wide logger
+      static Log& inst();
+
+      ~Log();
+
+      /// Starts the background writer thread
+      void start();
+
+      /// Writes everything still queued, then stops the background thread
+      void stop();
+
+      /// Blocks until everything logged so far has been written
+      void flush();
+
+      /// Changes where the output goes (stdout by default). Call before start().
+      void set_sink(FILE* f);
+
+      /// @return how many records were dropped because the ring was full
+      size_t dropped() const;
+
+      /// Queues a record. Use the DEMO_LOG_* macros instead, so that disabled levels cost nothing.
+      template<typename... Args>
+        void write(int level, const char* fmt, const Args&... args)
+        {
+          typedef std::tuple<typename LogCapture<Args>::type...> Tuple;
+          static_assert(sizeof(Tuple) <= LOG_ARGS_MAX, "too many or too large log arguments");
+          static_assert(alignof(Tuple) <= 8, "over-aligned log arguments");
+          static_assert(std::is_trivially_destructible<Tuple>::value, "log arguments must be plain values");
+
+          if (!running.load(std::memory_order_acquire)){
+            LogRecord r;
+            fill(r, level, fmt, &log_format<Tuple>);
+            new (r.args) Tuple(args...);
+            emit(r);
+            return;
+          }
+
+          size_t pos;
+          LogRecord *r = claim(pos);
+          if (!r){
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+          }
+          fill(*r, level, fmt, &log_format<Tuple>);
+          new (r->args) Tuple(args...);
+          publish(pos);
+        }
+
+    private:
+      Log();
+      Log(const Log&);
+
+      struct Cell
+      {
+        std::atomic<size_t> seq;
+        LogRecord rec;
+      };
+
+      static void fill(LogRecord &r, int level, const char* fmt,
+          int (*format)(char*, size_t, const char*, const void*))
+      {
+        r.level=level;
+        r.fmt=fmt;
+        r.format=format;
+      }
+
+      LogRecord* claim(size_t &pos);
+      void publish(size_t pos);
+      bool drain_one();
+      void drain_loop();
+      void emit(const LogRecord &r);
+
+      Cell* cells;
+      size_t mask;
+      alignas(64) std::atomic<size_t> head;
+      alignas(64) std::atomic<size_t> tail;
+      alignas(64) std::atomic<size_t> n_dropped;
+      size_t n_reported;
+      std::atomic<bool> running;
+      std::atomic<bool> draining;
+      std::thread writer;
+      FILE* sink;
+  };
+
+}
+
+#endif
@@ -0,0 +1,167 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-outbox.cpp
+ *
+ * @brief implements demo::Outbox
+ *
+ */
+
+#include "ghs-demo-outbox.h"
+#include "ghs-demo-log.h"
+
+#include <algorithm>
+
+///
+namespace demo{
+
+  static std::chrono::milliseconds to_ms(float s)
+  {
+    return std::chrono::milliseconds((long)(s*1000));
+  }
+
+  Outbox::State::State(const Config &config)
+    :peers(config.n_agents),
+    backoff(to_ms(config.retry_base_s), to_ms(config.retry_max_s), config.n_agents, config.my_id+1)
+  {
+  }
+
+  Outbox::Outbox(Comms &c, const Config &config)
+    :comms(c),retry(config.retry_connections),state(std::make_shared<State>(config))
+  {
+  }
+
+  Errno Outbox::push(const WireMessage &m)
+  {
+    std::lock_guard<std::mutex> lock(state->mut);
+    if (m.header.agent_to>=state->peers.size()){
+      return ERR_DEST_UNSET;
+    }
+    state->peers[m.header.agent_to].q.push_back(m);
+    state->total++;
+    return OK;
+  }
+
+  std::chrono::milliseconds Outbox::pump(std::chrono::milliseconds idle)
+  {
+    using namespace std::chrono;
+    auto now = Clock::now();
+    auto next = now + idle;
+    std::vector<uint16_t> ready;
+    {
+      std::lock_guard<std::mutex> lock(state->mut);
+      if (state->total==0){
+        return idle;
+      }
+      for (size_t i=0;i<state->peers.size();i++){
+        Peer &p = state->peers[i];
+        if (p.q.empty() || p.in_flight){
+          continue;
+        }
+        if (p.retry_at>now){
+          next = std::min(next, p.retry_at);
+          continue;
+        }
+        p.in_flight=true;
+        ready.push_back(i);
+      }
+    }
+
+    //send without the lock, in case the callback comes back on this thread
+    auto s = state;
+    Comms &c = comms;
+    bool r = retry;
+    for (uint16_t to : ready){
+      WireMessage m;
+      {
+        std::lock_guard<std::mutex> lock(state->mut);
+        m = state->peers[to].q.front();
+      }
+      Errno ret = comms.send_async(m, [s,&c,r,to](Errno result, long){
+          sent(*s, c, r, to, result);
+          });
+      if (ret!=OK){
+        //the callback will not come, and sending it again will not help
+        DEMO_LOG_ERROR("could not queue message to %u, dropping it (%d)\n", to, ret);
+        std::lock_guard<std::mutex> lock(state->mut);
+        Peer &p = state->peers[to];
+        p.q.pop_front();
+        p.in_flight=false;
+        state->total--;
+        next = now;
+      }
+    }
+    return std::max(milliseconds(0), duration_cast<milliseconds>(next-now));
+  }
+
+  void Outbox::sent(State &s, Comms &comms, bool retry, uint16_t to, Errno result)
+  {
+    {
+      std::lock_guard<std::mutex> lock(s.mut);
+      Peer &p = s.peers[to];
+      p.in_flight=false;
+      if (result==OK){
+        s.backoff.succeeded(to);
+        p.q.pop_front();
+        s.total--;
+      } else if (retry && (result==ERR_NNG || result==ERR_HANGUP
+            || result==ERR_TIMEOUT || result==ERR_TRANSPORT)){
+        auto wait = s.backoff.failed(to);
+        p.retry_at = Clock::now()+wait;
+        DEMO_LOG_ERROR("Could not send to %u (%d failures), will retry in %ld ms: %d\n",
+            to, s.backoff.failures(to), (long)wait.count(), result);
+      } else {
+        DEMO_LOG_ERROR("Could not send to %u, assuming gone: %d\n", to, result);
+        p.q.pop_front();
+        s.total--;
+      }
+    }
+    comms.wake();
+  }
+
+  size_t Outbox::size() const
+  {
+    std::lock_guard<std::mutex> lock(state->mut);
+    return state->total;
+  }
+
+  size_t Outbox::size(const uint16_t agent_id) const
+  {
+    std::lock_guard<std::mutex> lock(state->mut);
+    if (agent_id>=state->peers.size()){
+      return 0;
+    }
+    return state->peers[agent_id].q.size();
+  }
+}
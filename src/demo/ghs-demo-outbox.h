@@ -0,0 +1,133 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-outbox.h
+ *
+ * @brief per-peer outbound queues, so one slow or dead peer does not hold up the rest
+ *
+ */
+#ifndef GHS_DEMO_OUTBOX
+#define GHS_DEMO_OUTBOX
+
+#include "ghs-demo-comms.h"
+#include "ghs-demo-timerwheel.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @brief Holds the application's outgoing messages in one queue per peer
+   *
+   * The main loop push()es what it wants sent, and calls pump() on every
+   * spin. pump() hands the head of each peer's queue to
+   * Comms::send_async(), for every peer that is not already waiting on an
+   * acknowledgement or a retry, so a peer that is slow to answer (or gone)
+   * only delays the messages meant for it.
+   *
+   * One message per peer is in flight at a time. That keeps each peer's
+   * messages in order even when one of them fails and is sent again, which
+   * le::ghs::GhsState relies on. If Config::retry_connections is set and
+   * the peer could not be reached, a failed send is retried once the
+   * peer's Backoff (from Config::retry_base_s up to Config::retry_max_s)
+   * has passed, so a dead peer is tried less and less often. Otherwise it
+   * is dropped.
+   *
+   * The send_async() callbacks only touch state shared with them, and call
+   * Comms::wake() so the main loop notices, so an Outbox may go away while
+   * sends are still outstanding.
+   */
+  class Outbox
+  {
+    public:
+      /// Sends through `comms`, which must outlive every send this makes
+      Outbox(Comms &comms, const Config &config);
+
+      /**
+       * Queues `m` for `m.header.agent_to`, behind anything else waiting for that peer.
+       *
+       * @return ERR_DEST_UNSET if there is no such peer
+       */
+      Errno push(const WireMessage &m);
+
+      /**
+       * Sends the next message to every peer that is ready for one.
+       *
+       * @return how long until a retry is due, at most `idle` (which is also returned when nothing is waiting)
+       */
+      std::chrono::milliseconds pump(std::chrono::milliseconds idle);
+
+      /// @return the number of messages queued or in flight, to all peers
+      size_t size() const;
+
+      /// @return the number of messages queued or in flight to `agent_id`
+      size_t size(const uint16_t agent_id) const;
+
+    private:
+      typedef std::chrono::steady_clock Clock;
+
+      /// The retry state and queue of one peer
+      struct Peer
+      {
+        std::deque<WireMessage> q;
+        /// The head of q has been handed to Comms, and we wait for its callback
+        bool in_flight=false;
+        /// Do not send before this (after a failure)
+        Clock::time_point retry_at;
+      };
+
+      /// Shared with the send_async() callbacks, which may outlive us
+      struct State
+      {
+        mutable std::mutex mut;
+        std::vector<Peer> peers;
+        size_t total=0;
+        Backoff backoff;
+
+        State(const Config &config);
+      };
+
+      static void sent(State &s, Comms &comms, bool retry, uint16_t to, Errno result);
+
+      Comms &comms;
+      bool retry;
+      std::shared_ptr<State> state;
+  };
+}
+
+#endif
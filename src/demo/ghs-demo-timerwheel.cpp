@@ -0,0 +1,287 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-timerwheel.cpp
+ *
+ * @brief implements demo::TimerWheel and demo::Backoff
+ *
+ */
+#include "ghs-demo-timerwheel.h"
+
+#include <algorithm>
+#include <cstring>
+
+///
+namespace demo{
+
+  const TimerWheel::Handle TimerWheel::NONE;
+
+  /// The farthest an entry can be put off, in ticks (one turn of the last wheel)
+  static const uint64_t MAX_DELTA = (1ULL<<32)-1;
+
+  TimerWheel::TimerWheel(Clock::time_point o)
+    :origin(o),now_tick(0),count(0)
+  {
+    std::fill(heads, heads+LEVELS*SLOTS, NONE);
+    memset(occupied,0,sizeof(occupied));
+  }
+
+  uint64_t TimerWheel::to_tick(Clock::time_point t, bool round_up) const
+  {
+    using namespace std::chrono;
+    if (t<=origin){
+      return 0;
+    }
+    auto ns = duration_cast<nanoseconds>(t-origin).count();
+    uint64_t tick = ns/1000000;
+    if (round_up && ns%1000000){
+      tick++;
+    }
+    return tick;
+  }
+
+  TimerWheel::Handle TimerWheel::add(Clock::time_point due, int payload)
+  {
+    Handle h;
+    if (free_nodes.empty()){
+      h = (Handle)nodes.size();
+      nodes.push_back(Node());
+    } else {
+      h = free_nodes.back();
+      free_nodes.pop_back();
+    }
+    Node &n = nodes[h];
+    n.tick = std::min(std::max(to_tick(due,true), now_tick+1), now_tick+MAX_DELTA);
+    n.payload = payload;
+    link(h);
+    count++;
+    return h;
+  }
+
+  bool TimerWheel::cancel(Handle h)
+  {
+    if (h>=nodes.size() || nodes[h].slot<0){
+      return false;
+    }
+    unlink(h);
+    free_nodes.push_back(h);
+    count--;
+    return true;
+  }
+
+  //by distance, so a slot is never revisited before its entries are due
+  void TimerWheel::link(Handle h)
+  {
+    Node &n = nodes[h];
+    uint64_t delta = n.tick-now_tick;
+    int level=0;
+    while (level<LEVELS-1 && delta>=(1ULL<<(SLOT_BITS*(level+1)))){
+      level++;
+    }
+    int idx = (n.tick>>(SLOT_BITS*level)) & (SLOTS-1);
+    n.slot = level*SLOTS+idx;
+    n.prev = NONE;
+    n.next = heads[n.slot];
+    if (n.next!=NONE){
+      nodes[n.next].prev = h;
+    }
+    heads[n.slot] = h;
+    occupied[level][idx/64] |= (1ULL<<(idx%64));
+  }
+
+  void TimerWheel::unlink(Handle h)
+  {
+    Node &n = nodes[h];
+    if (n.prev!=NONE){
+      nodes[n.prev].next = n.next;
+    } else {
+      heads[n.slot] = n.next;
+    }
+    if (n.next!=NONE){
+      nodes[n.next].prev = n.prev;
+    }
+    if (heads[n.slot]==NONE){
+      int level = n.slot/SLOTS, idx = n.slot%SLOTS;
+      occupied[level][idx/64] &= ~(1ULL<<(idx%64));
+    }
+    n.slot = -1;
+  }
+
+  //re-files the current slot of `level` into the wheels below it
+  void TimerWheel::cascade(int level)
+  {
+    int idx = (now_tick>>(SLOT_BITS*level)) & (SLOTS-1);
+    int slot = level*SLOTS+idx;
+    Handle h = heads[slot];
+    heads[slot] = NONE;
+    occupied[level][idx/64] &= ~(1ULL<<(idx%64));
+    while (h!=NONE){
+      Handle next = nodes[h].next;
+      //a tick that is due now lands in the first wheel's current slot,
+      //which advance() takes next
+      nodes[h].tick = std::max(nodes[h].tick, now_tick);
+      link(h);
+      h = next;
+    }
+  }
+
+  int TimerWheel::next_set(int level, int from) const
+  {
+    for (int w=from/64; w<WORDS; w++){
+      uint64_t bits = occupied[level][w];
+      if (w==from/64){
+        bits &= (from%64) ? ~((1ULL<<(from%64))-1) : ~0ULL;
+      }
+      if (bits){
+        return w*64+__builtin_ctzll(bits);
+      }
+    }
+    return -1;
+  }
+
+  bool TimerWheel::any_set(int level) const
+  {
+    for (int w=0; w<WORDS; w++){
+      if (occupied[level][w]){
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void TimerWheel::advance(Clock::time_point now, std::vector<int> &expired)
+  {
+    uint64_t target = to_tick(now,false);
+    while (now_tick<target){
+      if (count==0){
+        now_tick = target;
+        break;
+      }
+      //skip straight to the next occupied slot of the first wheel, or to
+      //where it comes round and the next wheel has to be cascaded
+      int idx = now_tick & (SLOTS-1);
+      int next = (idx+1<SLOTS) ? next_set(0, idx+1) : -1;
+      uint64_t stop = (next>=0) ? (now_tick-idx+next) : ((now_tick|(SLOTS-1))+1);
+      if (stop>target){
+        now_tick = target;
+        break;
+      }
+      now_tick = stop;
+      for (int level=1; level<LEVELS; level++){
+        if (now_tick & ((1ULL<<(SLOT_BITS*level))-1)){
+          break;
+        }
+        cascade(level);
+      }
+      //take the slot in the order it was filled
+      int cur = now_tick & (SLOTS-1);
+      Handle h = heads[cur];
+      size_t first = expired.size();
+      while (h!=NONE){
+        Handle next_h = nodes[h].next;
+        expired.push_back(nodes[h].payload);
+        nodes[h].slot = -1;
+        free_nodes.push_back(h);
+        count--;
+        h = next_h;
+      }
+      std::reverse(expired.begin()+first, expired.end());
+      heads[cur] = NONE;
+      occupied[0][cur/64] &= ~(1ULL<<(cur%64));
+    }
+  }
+
+  bool TimerWheel::next_expiry(Clock::time_point &at) const
+  {
+    if (count==0){
+      return false;
+    }
+    uint64_t tick = now_tick+1;
+    for (int level=0; level<LEVELS; level++){
+      int shift = SLOT_BITS*level;
+      int idx = (now_tick>>shift) & (SLOTS-1);
+      int next = (idx+1<SLOTS) ? next_set(level, idx+1) : -1;
+      if (next>=0){
+        //the start of that slot's span
+        tick = ((now_tick>>(shift+SLOT_BITS))<<(shift+SLOT_BITS)) + ((uint64_t)next<<shift);
+        break;
+      }
+      if (any_set(level)){
+        //only slots behind us, which this wheel reaches on its next turn
+        tick = ((now_tick>>(shift+SLOT_BITS))+1)<<(shift+SLOT_BITS);
+        break;
+      }
+    }
+    at = origin + std::chrono::milliseconds(tick);
+    return true;
+  }
+
+  size_t TimerWheel::size() const
+  {
+    return count;
+  }
+
+  Backoff::Backoff(std::chrono::milliseconds b, std::chrono::milliseconds c, size_t n_peers, unsigned seed)
+    :base(std::max(b,std::chrono::milliseconds(1))),cap(std::max(c,b)),fails(n_peers,0),rng(seed)
+  {
+  }
+
+  std::chrono::milliseconds Backoff::failed(const uint16_t peer)
+  {
+    if (peer>=fails.size()){
+      return cap;
+    }
+    int n = ++fails[peer];
+    //doubling past the cap would only overflow
+    long long ms = base.count();
+    for (int i=1; i<n && ms<cap.count(); i++){
+      ms*=2;
+    }
+    ms = std::min<long long>(ms, cap.count());
+    std::uniform_int_distribution<long long> jitter(ms/2, ms);
+    return std::chrono::milliseconds(jitter(rng));
+  }
+
+  void Backoff::succeeded(const uint16_t peer)
+  {
+    if (peer<fails.size()){
+      fails[peer]=0;
+    }
+  }
+
+  int Backoff::failures(const uint16_t peer) const
+  {
+    return peer<fails.size() ? fails[peer] : 0;
+  }
+}
@@ -0,0 +1,175 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-timerwheel.h
+ *
+ * @brief a hierarchical timer wheel, and per-peer exponential backoff, for the demo runtime
+ *
+ */
+#ifndef GHS_DEMO_TIMERWHEEL
+#define GHS_DEMO_TIMERWHEEL
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @brief Keeps pending deadlines in four wheels of 256 slots, with O(1) add() and cancel()
+   *
+   * Time is counted in 1 ms ticks from the wheel's origin, and due times are
+   * rounded up to a whole tick, so nothing expires early. A deadline less
+   * than 256 ticks away goes in the first wheel, at its own tick; one less
+   * than 256^2 ticks away goes in the second, in the slot for its 256-tick
+   * span; and so on, up to about 49 days (later ones are clamped to that).
+   * Each slot is an intrusive list of entries, so add() and cancel() only
+   * touch a couple of nodes. When the first wheel comes round, the next
+   * slot of the second is cascaded into the first, and so on up.
+   *
+   * An entry carries an int chosen by the caller (EventLoop's timer id),
+   * which advance() hands back once it is due. Nodes are pooled and reused,
+   * so a Handle is only valid until its entry expires or is cancelled.
+   *
+   * Not thread safe: EventLoop only touches it from its own thread.
+   */
+  class TimerWheel
+  {
+    public:
+      typedef std::chrono::steady_clock Clock;
+
+      /// Identifies an entry for cancel()
+      typedef uint32_t Handle;
+
+      /// Never returned by add()
+      static const Handle NONE = UINT32_MAX;
+
+      /// Starts counting ticks at `origin`
+      explicit TimerWheel(Clock::time_point origin=Clock::now());
+
+      /**
+       * Adds an entry that is due at `due` (or on the next tick, if that has passed).
+       * @return its Handle
+       */
+      Handle add(Clock::time_point due, int payload);
+
+      /// Removes an entry. @return false if `h` is not pending
+      bool cancel(Handle h);
+
+      /**
+       * Moves time forward to `now`, and appends the payload of every entry
+       * that is due by then to `expired`, soonest tick first. They are
+       * removed from the wheel.
+       */
+      void advance(Clock::time_point now, std::vector<int> &expired);
+
+      /**
+       * The next time advance() has work to do: the tick of the soonest
+       * entry, or the point where a later wheel must be cascaded to find it.
+       *
+       * @return false if nothing is pending
+       */
+      bool next_expiry(Clock::time_point &at) const;
+
+      /// @return the number of pending entries
+      size_t size() const;
+
+    private:
+      static const int LEVELS=4;
+      static const int SLOT_BITS=8;
+      static const int SLOTS=1<<SLOT_BITS;
+      static const int WORDS=SLOTS/64;
+
+      struct Node
+      {
+        uint64_t tick;
+        int payload;
+        Handle prev;
+        Handle next;
+        /// level*SLOTS+index, or -1 if the node is free
+        int slot;
+      };
+
+      uint64_t to_tick(Clock::time_point t, bool round_up) const;
+      void link(Handle h);
+      void unlink(Handle h);
+      void cascade(int level);
+      int next_set(int level, int from) const;
+      bool any_set(int level) const;
+
+      Clock::time_point origin;
+      uint64_t now_tick;
+      size_t count;
+      std::vector<Node> nodes;
+      std::vector<Handle> free_nodes;
+      Handle heads[LEVELS*SLOTS];
+      uint64_t occupied[LEVELS][WORDS];
+  };
+
+  /**
+   * @brief Exponential backoff with jitter, kept per peer
+   *
+   * After the n-th failure in a row, a peer is left alone for a random time
+   * between half and all of `base`*2^(n-1), capped at `cap`. The jitter keeps
+   * agents that failed together (say, when a peer went down) from all
+   * coming back to it at once.
+   *
+   * Not thread safe.
+   */
+  class Backoff
+  {
+    public:
+      /// For agents 0 .. n_peers-1, seeded with `seed`
+      Backoff(std::chrono::milliseconds base, std::chrono::milliseconds cap, size_t n_peers, unsigned seed);
+
+      /// Records a failure, and @return how long to wait before trying `peer` again
+      std::chrono::milliseconds failed(const uint16_t peer);
+
+      /// Forgets `peer`'s failures
+      void succeeded(const uint16_t peer);
+
+      /// @return how many times in a row `peer` has failed
+      int failures(const uint16_t peer) const;
+
+    private:
+      std::chrono::milliseconds base;
+      std::chrono::milliseconds cap;
+      std::vector<int> fails;
+      std::mt19937 rng;
+  };
+}
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-emu.cpp
+ *
+ * @brief the demo::EmuTransport implementation
+ *
+ */
+#include "ghs-demo-transport-emu.h"
+#include "ghs-demo-log.h"
+
+#include <algorithm>
+
+///
+namespace demo{
+
+  const LinkProfile& link_profile(const Config &config, int a, int b)
+  {
+    auto it = config.emu_links.find(std::make_pair(std::min(a,b),std::max(a,b)));
+    if (it==config.emu_links.end()){
+      return config.emu_default;
+    }
+    return it->second;
+  }
+
+  /// Rounds up, so a timer never fires before `d` has passed
+  template <typename D>
+    static std::chrono::milliseconds ceil_ms(const D &d)
+    {
+      using namespace std::chrono;
+      auto ms = duration_cast<milliseconds>(d);
+      if (ms<d){
+        ms+=milliseconds(1);
+      }
+      return std::max(ms,milliseconds(0));
+    }
+
+  EmuTransport::EmuTransport(EventLoop &l, const Config &c, Transport *t)
+    :loop(l),cfg(c),inner(t),rng(c.my_id+1)
+  {
+    Link link;
+    link.timer=-1;
+    links.assign(cfg.n_agents, link);
+  }
+
+  EmuTransport::~EmuTransport()
+  {
+    //the loop is not running, so it is safe to touch it from here
+    for (auto &l : links){
+      if (l.timer>=0){
+        loop.cancel_timer(l.timer);
+      }
+    }
+    for (int id : ack_timers){
+      loop.cancel_timer(id);
+    }
+  }
+
+  Errno EmuTransport::listen()
+  {
+    return inner->listen();
+  }
+
+  void EmuTransport::receive(ReceiveCallback cb)
+  {
+    inner->receive(cb);
+  }
+
+  size_t EmuTransport::window() const
+  {
+    return inner->window();
+  }
+
+  EmuTransport::Clock::duration EmuTransport::one_way(const LinkProfile &p)
+  {
+    double ms = p.latency_ms;
+    if (p.jitter_ms>0){
+      ms += std::uniform_real_distribution<double>(-p.jitter_ms,p.jitter_ms)(rng);
+    }
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double,std::milli>(std::max(ms,0.0)));
+  }
+
+  Errno EmuTransport::send(const WireMessage &m, DeliveryCallback done)
+  {
+    using namespace std::chrono;
+    uint16_t to = m.header.agent_to;
+    const LinkProfile &p = link_profile(cfg, cfg.my_id, to);
+    if (p.loss>=1.0){
+      DEMO_LOG_DEBUG("emulated link to %u is down\n",to);
+      return OK;
+    }
+
+    Link &l = links[to];
+    auto now = Clock::now();
+
+    Clock::duration tx(0);
+    if (p.kbps>0){
+      double bits = 8.0*(sizeof(m.header)+m.header.payload_size);
+      tx = duration_cast<Clock::duration>(duration<double,std::milli>(bits/p.kbps));
+    }
+    //every lost copy costs a round trip before the next one goes out
+    int copies=1;
+    std::uniform_real_distribution<double> coin(0.0,1.0);
+    while (p.loss>0 && coin(rng)<p.loss){
+      copies++;
+    }
+    Clock::duration rto = std::max<Clock::duration>(milliseconds(1),
+        duration_cast<Clock::duration>(duration<double,std::milli>(2.0*p.latency_ms)));
+
+    l.free_at = std::max(now, l.free_at) + tx*copies + rto*(copies-1);
+    auto at = std::max(l.free_at + one_way(p), l.last_at);
+    l.last_at = at;
+
+    if (l.q.empty() && at<=now){
+      //nothing to emulate on this link
+      return forward(to, m, done);
+    }
+    Held h;
+    h.m = m;
+    h.done = done;
+    h.at = at;
+    l.q.push_back(h);
+    if (l.q.size()==1){
+      schedule(to);
+    }
+    return OK;
+  }
+
+  void EmuTransport::schedule(const uint16_t to)
+  {
+    Link &l = links[to];
+    l.timer = loop.add_timer(ceil_ms(l.q.front().at-Clock::now()), [this,to](){
+        links[to].timer=-1;
+        release(to);
+        });
+  }
+
+  void EmuTransport::release(const uint16_t to)
+  {
+    Link &l = links[to];
+    auto now = Clock::now();
+    while (!l.q.empty() && l.q.front().at<=now){
+      Held h = l.q.front();
+      l.q.pop_front();
+      Errno ret = forward(to, h.m, h.done);
+      if (ret!=OK && h.done){
+        h.done(ret);
+      }
+    }
+    if (!l.q.empty()){
+      schedule(to);
+    }
+  }
+
+  Errno EmuTransport::forward(const uint16_t to, const WireMessage &m, DeliveryCallback done)
+  {
+    auto back = ceil_ms(std::chrono::duration<double,std::milli>(link_profile(cfg, cfg.my_id, to).latency_ms));
+    return inner->send(m, [this,done,back](Errno result){
+        if (result!=OK || back.count()==0){
+          if (done){
+            done(result);
+          }
+          return;
+        }
+        //the acknowledgement crosses the link too
+        auto id = std::make_shared<int>(-1);
+        *id = loop.add_timer(back, [this,done,id](){
+            ack_timers.erase(*id);
+            if (done){
+              done(OK);
+            }
+            });
+        ack_timers.insert(*id);
+        });
+  }
+
+  void EmuTransport::cancel(const uint16_t to)
+  {
+    Link &l = links[to];
+    l.q.clear();
+    if (l.timer>=0){
+      loop.cancel_timer(l.timer);
+      l.timer=-1;
+    }
+    inner->cancel(to);
+  }
+}
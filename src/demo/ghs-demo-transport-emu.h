@@ -0,0 +1,136 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-emu.h
+ *
+ * @brief a demo::Transport that makes another one behave like a poor network link
+ *
+ */
+#ifndef GHS_DEMO_TRANSPORT_EMU
+#define GHS_DEMO_TRANSPORT_EMU
+
+#include "ghs-demo-comms.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @return the profile of the link between agents `a` and `b` (in either
+   * order): its entry in Config::emu_links, or Config::emu_default
+   */
+  const LinkProfile& link_profile(const Config &config, int a, int b);
+
+  /**
+   * @brief a Transport that delays, rate-limits and drops what another Transport sends
+   *
+   * When Config::emulate is set, make_transport() wraps every Transport in
+   * one of these, so any endpoint scheme (`mem://` in a cluster, or
+   * loopback) can stand in for a lossy mesh. Each link follows its
+   * LinkProfile (see link_profile()):
+   *
+   *   * A message occupies the link for its size divided by `kbps`, so
+   *     back-to-back messages queue behind each other.
+   *   * Each copy is lost with probability `loss`, and the next one goes
+   *     out a round trip later (twice `latency_ms`, at least 1 ms), as a
+   *     reliable link layer would. With `loss` at 1 nothing is delivered,
+   *     and Comms times the message out.
+   *   * It then arrives `latency_ms` (plus or minus up to `jitter_ms`)
+   *     later, and is handed to the wrapped Transport. Its acknowledgement
+   *     takes `latency_ms` to come back.
+   *
+   * A link never reorders its own messages (Comms would drop them as
+   * duplicates), but messages on different links overtake each other.
+   * Only the sending side is emulated, so each agent must use the same
+   * profiles.
+   *
+   * Link probes go through here too, so Comms::little_iperf() measures
+   * the emulated links rather than the real one underneath.
+   */
+  class EmuTransport : public Transport
+  {
+    public:
+      /// Takes ownership of `inner`
+      EmuTransport(EventLoop &loop, const Config &config, Transport *inner);
+      ~EmuTransport();
+
+      Errno listen();
+      void receive(ReceiveCallback cb);
+      Errno send(const WireMessage &m, DeliveryCallback done);
+      void cancel(const uint16_t agent_id);
+      size_t window() const;
+
+    private:
+      typedef std::chrono::steady_clock Clock;
+
+      /// A message on its way over the emulated link
+      struct Held
+      {
+        WireMessage m;
+        DeliveryCallback done;
+        Clock::time_point at;
+      };
+
+      /// The state of our side of one link
+      struct Link
+      {
+        std::deque<Held> q;
+        /// When the link has finished sending what it has been given
+        Clock::time_point free_at;
+        /// When the last message given to it arrives
+        Clock::time_point last_at;
+        int timer;
+      };
+
+      void schedule(const uint16_t agent_id);
+      void release(const uint16_t agent_id);
+      Errno forward(const uint16_t agent_id, const WireMessage &m, DeliveryCallback done);
+      Clock::duration one_way(const LinkProfile &p);
+
+      EventLoop &loop;
+      Config cfg;
+      std::unique_ptr<Transport> inner;
+      std::vector<Link> links;
+      /// acknowledgements on their way back
+      std::unordered_set<int> ack_timers;
+      std::mt19937 rng;
+  };
+}
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-mem.cpp
+ *
+ */
+#include "ghs-demo-transport-mem.h"
+#include "ghs-demo-log.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+///
+namespace demo{
+
+  /// A receiver's inbox. Senders keep it alive after the receiver is gone, and then see `closed`.
+  struct MemTransport::Inbox
+  {
+    std::mutex mut;
+    std::vector<WireMessage> msgs;
+    /// eventfd, written when msgs stops being empty
+    int fd=-1;
+    bool closed=false;
+
+    ~Inbox()
+    {
+      if (fd>=0){
+        close(fd);
+      }
+    }
+  };
+
+  /// Every listening MemTransport in the process, by endpoint
+  static std::mutex registry_mut;
+  /// Every listening MemTransport in the process, by endpoint
+  static std::unordered_map<std::string,std::weak_ptr<MemTransport::Inbox>> registry;
+
+  MemTransport::MemTransport(EventLoop &l, const Config &c):loop(l),cfg(c)
+  {
+    Peer p;
+    p.busy=false;
+    p.retry_timer=-1;
+    peers.assign(cfg.n_agents, p);
+  }
+
+  MemTransport::~MemTransport()
+  {
+    //the loop is not running, so it is safe to touch it from here
+    for (auto &p : peers){
+      if (p.retry_timer>=0){
+        loop.cancel_timer(p.retry_timer);
+      }
+    }
+    if (own){
+      {
+        std::lock_guard<std::mutex> guard(registry_mut);
+        auto it = registry.find(cfg.endpoints[cfg.my_id]);
+        if (it!=registry.end() && it->second.lock()==own){
+          registry.erase(it);
+        }
+      }
+      if (watching){
+        loop.unwatch(own->fd);
+      }
+      std::lock_guard<std::mutex> guard(own->mut);
+      own->closed=true;
+      own->msgs.clear();
+    }
+  }
+
+  Errno MemTransport::listen()
+  {
+    const std::string &endpoint = cfg.endpoints[cfg.my_id];
+    own = std::make_shared<Inbox>();
+    own->fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (own->fd<0){
+      DEMO_LOG_ERROR("eventfd: %s\n",strerror(errno));
+      own.reset();
+      return ERR_TRANSPORT;
+    }
+    std::lock_guard<std::mutex> guard(registry_mut);
+    auto &slot = registry[endpoint];
+    if (slot.lock()){
+      DEMO_LOG_ERROR("%s is already taken in this process\n", endpoint.c_str());
+      own.reset();
+      return ERR_TRANSPORT;
+    }
+    slot = own;
+    DEMO_LOG_DEBUG("Listening for ghs on : %s\n", endpoint.c_str());
+    return OK;
+  }
+
+  void MemTransport::receive(ReceiveCallback cb)
+  {
+    on_recv = cb;
+    if (!own){
+      return;
+    }
+    if (on_recv && !watching){
+      watching = loop.watch(own->fd, [this](){ drain(); });
+      //anything that arrived while nobody was watching
+      loop.post([this](){ drain(); });
+    } else if (!on_recv && watching){
+      loop.unwatch(own->fd);
+      watching = false;
+    }
+  }
+
+  void MemTransport::drain()
+  {
+    uint64_t count;
+    if (read(own->fd,&count,sizeof(count))<0 && errno!=EAGAIN){
+      DEMO_LOG_ERROR("eventfd read: %s\n",strerror(errno));
+    }
+    if (!on_recv){
+      return;
+    }
+    //take everything at once, so senders wait on the lock for one swap, not for us
+    draining.clear();
+    {
+      std::lock_guard<std::mutex> guard(own->mut);
+      draining.swap(own->msgs);
+    }
+    for (auto &m : draining){
+      on_recv(m);
+    }
+  }
+
+  bool MemTransport::push(const uint16_t to, const WireMessage &m)
+  {
+    Peer &p = peers[to];
+    if (p.inbox){
+      std::lock_guard<std::mutex> guard(p.inbox->mut);
+      if (p.inbox->closed){
+        //the peer went away, and may come back with a new inbox
+        p.inbox.reset();
+      }
+    }
+    if (!p.inbox){
+      std::lock_guard<std::mutex> guard(registry_mut);
+      auto it = registry.find(cfg.endpoints[to]);
+      if (it==registry.end() || !(p.inbox=it->second.lock())){
+        return false;
+      }
+    }
+    bool was_empty;
+    {
+      std::lock_guard<std::mutex> guard(p.inbox->mut);
+      if (p.inbox->closed){
+        return false;
+      }
+      was_empty = p.inbox->msgs.empty();
+      p.inbox->msgs.push_back(m);
+    }
+    if (was_empty){
+      uint64_t one=1;
+      if (write(p.inbox->fd,&one,sizeof(one))<0 && errno!=EAGAIN){
+        DEMO_LOG_ERROR("eventfd write: %s\n",strerror(errno));
+      }
+    }
+    complete(to, OK);
+    return true;
+  }
+
+  void MemTransport::retry(const uint16_t to)
+  {
+    peers[to].retry_timer = loop.add_timer(std::chrono::milliseconds(10), [this,to](){
+        Peer &peer = peers[to];
+        peer.retry_timer = -1;
+        if (peer.busy && !push(to, peer.m)){
+          retry(to);
+        }
+        });
+  }
+
+  Errno MemTransport::send(const WireMessage &m, DeliveryCallback done)
+  {
+    uint16_t to = m.header.agent_to;
+    Peer &p = peers[to];
+    p.busy = true;
+    p.done = done;
+    if (!push(to, m)){
+      //hold on to it until the peer shows up
+      p.m = m;
+      retry(to);
+    }
+    return OK;
+  }
+
+  void MemTransport::cancel(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    p.busy = false;
+    p.done = nullptr;
+    if (p.retry_timer>=0){
+      loop.cancel_timer(p.retry_timer);
+      p.retry_timer = -1;
+    }
+  }
+
+  void MemTransport::complete(const uint16_t to, const Errno result)
+  {
+    Peer &p = peers[to];
+    p.busy = false;
+    completed.push_back(std::make_pair(p.done, result));
+    p.done = nullptr;
+    //one post covers a whole burst, since flush() also runs whatever the
+    //callbacks it makes go on to complete
+    if (!flush_pending){
+      flush_pending = true;
+      loop.post([this](){ flush(); });
+    }
+  }
+
+  void MemTransport::flush()
+  {
+    while (!completed.empty()){
+      auto c = completed.front();
+      completed.pop_front();
+      if (c.first){
+        c.first(c.second);
+      }
+    }
+    flush_pending = false;
+  }
+}
@@ -0,0 +1,114 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-mem.h
+ *
+ * @brief the demo::Transport between agents in the same process (mem://)
+ *
+ */
+#ifndef GHS_DEMO_TRANSPORT_MEM
+#define GHS_DEMO_TRANSPORT_MEM
+
+#include "ghs-demo-comms.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @brief a Transport that hands messages to another Comms in this process
+   *
+   * Every MemTransport that listens on `mem://<name>` registers an inbox
+   * under that name in a process-wide table. Sending is a copy into the
+   * peer's inbox under its lock, and counts as delivered at once. The
+   * receiver's EventLoop is woken through an eventfd, but only when its
+   * inbox goes from empty to not, so a burst costs one wakeup.
+   *
+   * There is no socket, framing or kernel buffer in the way, which is the
+   * point: it is meant for running many agents as threads of one process
+   * (see GhsDemoExec::run_cluster()) and profiling everything above it.
+   *
+   * A peer that has not registered yet is retried from a timer until it
+   * does or Comms gives up on the message.
+   */
+  class MemTransport : public Transport
+  {
+    public:
+      MemTransport(EventLoop &loop, const Config &config);
+      ~MemTransport();
+
+      Errno listen();
+      void receive(ReceiveCallback cb);
+      Errno send(const WireMessage &m, DeliveryCallback done);
+      void cancel(const uint16_t agent_id);
+
+      /// Where messages for one listening MemTransport wait for it
+      struct Inbox;
+
+    private:
+
+      /// The peer's inbox, once found, and the message waiting for it to show up
+      struct Peer
+      {
+        std::shared_ptr<Inbox> inbox;
+        bool busy;
+        WireMessage m;
+        DeliveryCallback done;
+        int retry_timer;
+      };
+
+      bool push(const uint16_t agent_id, const WireMessage &m);
+      void retry(const uint16_t agent_id);
+      void complete(const uint16_t agent_id, const Errno result);
+      void flush();
+      void drain();
+
+      EventLoop &loop;
+      Config cfg;
+      std::shared_ptr<Inbox> own;
+      bool watching=false;
+      ReceiveCallback on_recv;
+      std::vector<Peer> peers;
+      std::vector<WireMessage> draining;
+      std::deque<std::pair<DeliveryCallback,Errno>> completed;
+      bool flush_pending=false;
+  };
+}
+
+#endif
@@ -0,0 +1,339 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-nng.cpp
+ *
+ */
+#include "ghs-demo-transport-nng.h"
+#include "ghs-demo-log.h"
+
+#include <nng/protocol/reqrep0/req.h>
+#include <nng/protocol/reqrep0/rep.h>
+#include <cstring>  //mem operations
+#include <algorithm>
+
+///
+namespace demo{
+
+  /** 
+   * Q: WHY REQ/REP SOCKETS?
+   *
+   * A: Look, we could use survey/respondent sockets for a lot of the GHS
+   * algorithm, but at this time, due to the radio, it's not clear if that's
+   * the right approach. In fact the radio specifically says we should *not*
+   * broadcast, and that (being a mesh) msgs to agent A may go through B.  For
+   * that reason, I _recommend_ that any broadcast-like action be handled with
+   * an MST-based broadcast to avoid duplication. See ghs.hpp, which could very
+   * easily be ported to the comms handler. 
+   *
+   * So, that leaves pt to pt comms, with fanout handled in the application
+   * layer.  That means nng_pair (1-1) or nng_req/nng_rep. The docs for req/rep
+   * say that it is reliable, because it will retry until a reply is  received.
+   * This reply is not handled at lower levels. it literally means that the
+   * application code has to package and send a response packet like an RPC call.
+   * You can't, for example, queue up reqs and handle them one at a time, because
+   * those req-holders will be waiting for replies (i.e., blocked). They can go
+   * on and send more reqs and override the last one, but now we're just back to
+   * nng_pair conops.
+   *
+   * The docs for pair say:
+   *
+   * > Even though this mode may appear to be "reliable", because back-pressure
+   * > prevents discarding messages most of the time there are topologies
+   * > involving devices (see nng_device(3)) or raw mode sockets where messages 
+   * > may be discarded
+   *
+   * If we do go with pair, I hope (https://stackoverflow.com/q/72293870/389599)
+   * that this means the network stack will handle reliable delivery at lvl 3,
+   * rather than trying to finagle something at lvl 4+. 
+   *
+   */
+  NngTransport::NngTransport(EventLoop &l, const Config &c):loop(l),cfg(c)
+  {
+    Peer p;
+    p.sock = NNG_SOCKET_INITIALIZER;
+    p.send_fd = -1;
+    p.recv_fd = -1;
+    peers.assign(cfg.n_agents, p);
+  }
+
+  NngTransport::~NngTransport()
+  {
+    //the loop is not running, so it is safe to stop watching from here
+    if (watching){
+      loop.unwatch(incoming_fd);
+    }
+    if (nng_socket_id(incoming) != -1){
+      nng_close(incoming);
+    }
+    for (auto &p : peers){
+      if (nng_socket_id(p.sock) != -1){
+        loop.unwatch(p.recv_fd);
+        loop.unwatch(p.send_fd);
+        nng_close(p.sock);
+      }
+    }
+  }
+
+  Errno NngTransport::listen()
+  {
+    //no timeouts: the I/O thread only reads when NNG_OPT_RECVFD says there is something to read
+    //ret=(nng_socket_set_int(incoming, NNG_OPT_RECVBUF, 256));
+    //ret=(nng_socket_set_size(incoming, NNG_OPT_RECVMAXSZ, sizeof(WireMessage)));
+    //ret=(nng_socket_set_ms(incoming, NNG_OPT_RECONNMINT,nng_duration(100)));
+    //ret=(nng_socket_set_ms(incoming, NNG_OPT_RECONNMAXT,nng_duration(10000)));
+    const char* endpoint = cfg.endpoints[cfg.my_id].c_str();
+    int ret = nng_rep0_open(&incoming);
+    if (ret==0){ ret = nng_listener_create(&listener,incoming,endpoint); }
+    if (ret==0){ ret = nng_listener_start(listener,0); }
+    if (ret==0){ ret = nng_socket_get_int(incoming, NNG_OPT_RECVFD, &incoming_fd); }
+    if (ret!=0){
+      DEMO_LOG_ERROR("cannot listen on %s: %s\n", endpoint, nng_strerror(ret));
+      return ERR_NNG;
+    }
+    DEMO_LOG_INFO("Listening for ghs on : %s\n", endpoint);
+    return OK;
+  }
+
+  void NngTransport::receive(ReceiveCallback cb)
+  {
+    on_recv = cb;
+    if (incoming_fd<0){
+      return;
+    }
+    if (on_recv && !watching){
+      watching = loop.watch(incoming_fd, [this](){ read_ready(); });
+    } else if (!on_recv && watching){
+      loop.unwatch(incoming_fd);
+      watching = false;
+    }
+  }
+
+  int NngTransport::recv(WireMessage &buf)
+  {
+
+    //this line saves 100 lines of C++ in the definition of WireMessage (constructing
+    //from buffer)
+    auto local_msg_charptr =  (uint8_t*) &buf ;
+    size_t recvsz=sizeof(WireMessage);
+
+    int ret = nng_recv( incoming, static_cast<void*>(local_msg_charptr), &recvsz, NNG_FLAG_NONBLOCK);
+    //Note, buf is now populated
+
+    const char* errstr = nng_strerror(ret);
+
+    switch (ret){
+      case 0: {break;}
+      case NNG_EAGAIN: {return 0;}
+      case NNG_ETIMEDOUT : {return 0;}
+      case NNG_ECLOSED: {DEMO_LOG_ERROR("RECV: Socket closed! Fatal.\n");return -ret;}
+      case NNG_EINVAL: {DEMO_LOG_ERROR("RECV: invalid flags! Fatal programmer error.\n");return -ret;}
+      case NNG_EMSGSIZE: {DEMO_LOG_ERROR("RECV: invalid msg size -- too big! nonfatal\n");return 0;}
+      case NNG_ENOMEM: {DEMO_LOG_ERROR("RECV: Out of memory. fatal!\n");return -ret;}
+      case NNG_ENOTSUP: {DEMO_LOG_ERROR("RECV: cannot recv on this socket. fatal programmer error!\n");return -ret;}
+      case NNG_ESTATE: {DEMO_LOG_ERROR("RECV: cannot recv on this socket at this time -- did you use the right protocol and correct socket creation function? fatal programmer error!\n");return -ret;}
+      default: {DEMO_LOG_ERROR("RECV: Unknown error! %d:%s", ret, errstr);return -ret;}
+    }
+
+    if (recvsz==0){
+      DEMO_LOG_ERROR("RECV: no bytes read by nng, but message returned. Fatal.\n");
+      return -1;
+    }
+
+    //nng_sock assures delivery before returning, but may send multiple times,
+    //so Comms drops duplicates by sequence number.
+    DEMO_LOG_DEBUG("RECV: sending confirmation\n");
+    SequenceCounter msg_seq = buf.control.sequence;
+    ret = nng_send(incoming,(void*)&msg_seq,sizeof(msg_seq),NNG_FLAG_NONBLOCK);
+    if (ret!=0){ 
+      DEMO_LOG_ERROR("RECV: failure to send confirmation: %s\n", nng_strerror(ret));
+    }
+
+    return recvsz;
+  }
+
+  void NngTransport::read_ready()
+  {
+    //NNG_OPT_RECVFD is level-triggered, so if we stop early we will simply be
+    //called again.
+    while(on_recv)
+    {
+      WireMessage m;
+      int ret = recv(m);
+
+      if (ret<0){ //fatal
+        loop.unwatch(incoming_fd);
+        watching = false;
+        return;
+      } else if (ret==0) { //nothing (more) to read
+        return;
+      } else { 
+        on_recv(m);
+      }
+    }
+  }
+
+  //Outgoing sockets are opened per peer, on first use, from the I/O thread.
+  //There's a couple of settings we may want that are TCP specific, too...
+  //NNG_OPT_TCP_KEEPALIVE  (true) to support "pings" periodically.
+  bool NngTransport::open_peer(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    if (nng_socket_id(p.sock) != -1){
+      return true;
+    }
+    //raw, so that more than one request may be in flight
+    int ret = nng_req0_open_raw(&p.sock);
+    if (ret!=0){
+      DEMO_LOG_ERROR("cannot open socket to %u: %s\n", to, nng_strerror(ret));
+      return false;
+    }
+    int recv_fd=-1, send_fd=-1;
+    //dial in the background; nng keeps redialing until the peer shows up
+    ret = nng_dial(p.sock, cfg.endpoints[to].c_str(), NULL, NNG_FLAG_NONBLOCK);
+    if (ret==0){ ret = nng_socket_get_int(p.sock, NNG_OPT_RECVFD, &recv_fd); }
+    if (ret==0){ ret = nng_socket_get_int(p.sock, NNG_OPT_SENDFD, &send_fd); }
+    if (ret!=0 || !loop.watch(recv_fd, [this,to](){ peer_reply(to); })){
+      DEMO_LOG_ERROR("cannot connect to %u at %s: %s\n", to, cfg.endpoints[to].c_str(), nng_strerror(ret));
+      nng_close(p.sock);
+      p.sock = NNG_SOCKET_INITIALIZER;
+      return false;
+    }
+    p.recv_fd=recv_fd;
+    p.send_fd=send_fd;
+    DEMO_LOG_INFO("Dialing: %s \n",cfg.endpoints[to].c_str());
+    return true;
+  }
+
+  Errno NngTransport::send(const WireMessage &m, DeliveryCallback done)
+  {
+    uint16_t to = m.header.agent_to;
+    if (!open_peer(to)){
+      return ERR_NNG;
+    }
+    Outgoing o;
+    o.m = m;
+    o.sent = false;
+    o.done = done;
+    peers[to].in_flight.push_back(o);
+    try_send(to);
+    return OK;
+  }
+
+  void NngTransport::cancel(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    //the requests may still be answered, and peer_reply() drops those answers
+    p.in_flight.clear();
+    loop.unwatch(p.send_fd);
+  }
+
+  size_t NngTransport::window() const
+  {
+    return std::max(cfg.nng_window,1);
+  }
+
+  void NngTransport::try_send(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    for (auto &o : p.in_flight){
+      if (o.sent){
+        continue;
+      }
+      //a raw req socket leaves the request ID to us: 31 bits, with the top bit set
+      nng_msg *msg = nullptr;
+      int ret = nng_msg_alloc(&msg, 0);
+      if (ret==0){ ret = nng_msg_header_append_u32(msg, 0x80000000u | (next_request++ & 0x7fffffffu)); }
+      if (ret==0){ ret = nng_msg_append(msg, (void*)&o.m, o.m.size()); }
+      if (ret==0){ ret = nng_sendmsg(p.sock, msg, NNG_FLAG_NONBLOCK); }
+      if (ret==0){
+        //nng owns it now
+        o.sent=true;
+        continue;
+      }
+      if (msg){
+        nng_msg_free(msg);
+      }
+      if (ret==NNG_EAGAIN){
+        //not connected yet or no room: try again when NNG_OPT_SENDFD says so
+        loop.watch(p.send_fd, [this,to](){ try_send(to); });
+        return;
+      }
+      DEMO_LOG_ERROR("send() error: %s\n", nng_strerror(ret)); 
+      //never from inside send(), and only if it is still waiting
+      o.sent=true;
+      SequenceCounter seq = o.m.control.sequence;
+      loop.post([this,to,seq](){ finish(to, seq, ERR_NNG); });
+    }
+    //nothing left to send
+    loop.unwatch(p.send_fd);
+  }
+
+  void NngTransport::peer_reply(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    nng_msg *msg = nullptr;
+    while (nng_recvmsg(p.sock, &msg, NNG_FLAG_NONBLOCK)==0){
+      //the request ID is in the header, and the body is the sequence number we sent
+      size_t return_seq=0;
+      bool ok = nng_msg_len(msg) >= sizeof(return_seq);
+      if (ok){
+        memcpy(&return_seq, nng_msg_body(msg), sizeof(return_seq));
+      }
+      nng_msg_free(msg);
+      if (!ok){
+        DEMO_LOG_WARN("short confirmation from %u, dropping\n", to);
+        continue;
+      }
+      DEMO_LOG_DEBUG("conf= %zu from %u\n", return_seq, to);
+      finish(to, return_seq, OK);
+    }
+  }
+
+  void NngTransport::finish(const uint16_t to, const SequenceCounter seq, const Errno result)
+  {
+    auto &q = peers[to].in_flight;
+    for (auto it = q.begin(); it != q.end(); ++it){
+      if (it->sent && it->m.control.sequence == seq){
+        DeliveryCallback done = it->done;
+        q.erase(it);
+        if (done){
+          done(result);
+        }
+        return;
+      }
+    }
+    DEMO_LOG_WARN("stale result for %zu to %u, dropping\n", seq, to);
+  }
+}
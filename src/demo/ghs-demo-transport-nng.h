@@ -0,0 +1,116 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-nng.h
+ *
+ * @brief the demo::Transport over nng req/rep sockets (tcp://, ipc://, ...)
+ *
+ */
+#ifndef GHS_DEMO_TRANSPORT_NNG
+#define GHS_DEMO_TRANSPORT_NNG
+
+#include "ghs-demo-comms.h"
+#include <nng/nng.h>//req_s, rep_s, msg
+#include <chrono>
+#include <deque>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @brief a Transport that sends each message as an nng req, and treats the rep as its acknowledgement
+   *
+   * Incoming messages arrive on one rep socket that listens on our endpoint.
+   * Outgoing messages go over one req socket per peer, which is dialed (in
+   * the background) the first time we send to that peer and then kept open.
+   * Every socket is driven without blocking, from nng's NNG_OPT_RECVFD and
+   * NNG_OPT_SENDFD descriptors.
+   *
+   * The req sockets are raw, so that up to Config::nng_window requests can
+   * be in flight to a peer at once, instead of one per round trip. Each
+   * request carries its own request ID, and the rep side answers them in
+   * order, over the one connection. A raw socket does not resend a request
+   * on its own; Comms times it out instead (Config::send_timeout_s).
+   */
+  class NngTransport : public Transport
+  {
+    public:
+      NngTransport(EventLoop &loop, const Config &config);
+      ~NngTransport();
+
+      Errno listen();
+      void receive(ReceiveCallback cb);
+      Errno send(const WireMessage &m, DeliveryCallback done);
+      void cancel(const uint16_t agent_id);
+      size_t window() const;
+
+    private:
+      /// A request to a peer, and whether it has gone to nng yet
+      struct Outgoing
+      {
+        WireMessage m;
+        bool sent;
+        DeliveryCallback done;
+      };
+
+      /// The req socket to one peer, and the requests in flight on it, oldest first
+      struct Peer
+      {
+        nng_socket sock;
+        int send_fd;
+        int recv_fd;
+        std::deque<Outgoing> in_flight;
+      };
+
+      bool open_peer(const uint16_t agent_id);
+      void try_send(const uint16_t agent_id);
+      void peer_reply(const uint16_t agent_id);
+      void finish(const uint16_t agent_id, const SequenceCounter seq, const Errno result);
+      void read_ready();
+      int recv(WireMessage &buf);
+
+      EventLoop &loop;
+      Config cfg;
+      nng_listener listener = NNG_LISTENER_INITIALIZER;
+      nng_socket incoming = NNG_SOCKET_INITIALIZER;
+      int incoming_fd=-1;
+      bool watching=false;
+      ReceiveCallback on_recv;
+      std::vector<Peer> peers;
+      uint32_t next_request=0;
+  };
+}
+
+#endif
@@ -0,0 +1,431 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-shm.cpp
+ *
+ */
+#include "ghs-demo-transport-shm.h"
+#include "ghs-demo-log.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+///
+namespace demo{
+
+  /// Changes whenever the layout of a segment does
+  static const uint32_t SHM_MAGIC = 0x67687331;
+
+  /// How long the waiter thread sleeps before checking if it should quit
+  static const long SHM_WAIT_NS = 100*1000*1000;
+
+  static_assert(sizeof(std::atomic<uint32_t>)==sizeof(uint32_t), "futex words must be plain 32-bit ints");
+  static_assert(ATOMIC_INT_LOCK_FREE==2, "shared memory atomics must be lock-free");
+
+  /// One sender's ring. The indices only ever grow, and wrap at 2^32.
+  struct ShmRing
+  {
+    /// Written by the sender: the next slot it will fill
+    alignas(64) std::atomic<uint32_t> tail;
+    /// Written by the receiver: the next slot it will read
+    alignas(64) std::atomic<uint32_t> head;
+  };
+
+  /**
+   * The start of a shared memory segment. It is followed by `n_rings`
+   * ShmRing objects, and then `n_rings * ring_slots` WireMessage slots.
+   */
+  struct ShmTransport::Segment
+  {
+    /// SHM_MAGIC, once the receiver has set the rest up
+    std::atomic<uint32_t> magic;
+    /// Set when the receiver goes away, so senders let go of the segment
+    std::atomic<uint32_t> closed;
+    /// How many rings (i.e., possible senders) there are
+    uint32_t n_rings;
+    /// How many slots each ring has (a power of two)
+    uint32_t ring_slots;
+    /// The futex word. Senders bump it after every message.
+    alignas(64) std::atomic<uint32_t> bell;
+    /// Set while the receiver is (about to be) asleep on the bell
+    std::atomic<uint32_t> sleeping;
+
+    static size_t size_for(uint32_t n_rings, uint32_t ring_slots)
+    {
+      return sizeof(Segment) + n_rings*sizeof(ShmRing) + (size_t)n_rings*ring_slots*sizeof(WireMessage);
+    }
+
+    ShmRing& ring(uint32_t sender)
+    {
+      return reinterpret_cast<ShmRing*>(this+1)[sender];
+    }
+
+    WireMessage& slot(uint32_t sender, uint32_t idx)
+    {
+      WireMessage *slots = reinterpret_cast<WireMessage*>(reinterpret_cast<ShmRing*>(this+1)+n_rings);
+      return slots[(size_t)sender*ring_slots + (idx & (ring_slots-1))];
+    }
+  };
+
+  static long futex_wait(std::atomic<uint32_t> *word, uint32_t expected, const struct timespec *timeout)
+  {
+    //not FUTEX_PRIVATE_FLAG: the word is shared with other processes
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, timeout, NULL, 0);
+  }
+
+  static void futex_wake(std::atomic<uint32_t> *word)
+  {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+
+  ShmTransport::ShmTransport(EventLoop &l, const Config &c):loop(l),cfg(c)
+  {
+    wait_continues=false;
+    //indices are masked, not taken modulo
+    ring_slots=2;
+    while (ring_slots < (uint32_t)cfg.shm_ring_slots){
+      ring_slots*=2;
+    }
+    Peer p;
+    p.seg=nullptr;
+    p.seg_sz=0;
+    p.busy=false;
+    p.retry_timer=-1;
+    peers.assign(cfg.n_agents, p);
+  }
+
+  ShmTransport::~ShmTransport()
+  {
+    //the loop is not running, so it is safe to touch it from here
+    for (size_t i=0;i<peers.size();i++){
+      if (peers[i].retry_timer>=0){
+        loop.cancel_timer(peers[i].retry_timer);
+      }
+      detach(i);
+    }
+    if (watching){
+      loop.unwatch(wake_fd);
+    }
+    if (own){
+      wait_continues=false;
+      futex_wake(&own->bell);
+      if (waiter.joinable()){
+        waiter.join();
+      }
+      own->closed.store(1);
+      munmap(own, own_sz);
+      shm_unlink(own_name.c_str());
+    }
+    if (wake_fd>=0){
+      close(wake_fd);
+    }
+  }
+
+  std::string ShmTransport::segment_name(const std::string &endpoint)
+  {
+    std::string name = endpoint;
+    size_t pos = name.find("://");
+    if (pos!=std::string::npos){
+      name = name.substr(pos+3);
+    }
+    //shm_open(3) names are one "/" followed by no others
+    for (auto &ch : name){
+      if (ch=='/'){
+        ch='_';
+      }
+    }
+    return "/"+name;
+  }
+
+  Errno ShmTransport::listen()
+  {
+    own_name = segment_name(cfg.endpoints[cfg.my_id]);
+    own_sz = Segment::size_for(cfg.n_agents, ring_slots);
+
+    //whatever is left over from an earlier run is stale
+    shm_unlink(own_name.c_str());
+    int fd = shm_open(own_name.c_str(), O_CREAT|O_EXCL|O_RDWR, 0600);
+    if (fd<0){
+      DEMO_LOG_ERROR("shm_open(%s): %s\n", own_name.c_str(), strerror(errno));
+      return ERR_TRANSPORT;
+    }
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, own_sz)==0){
+      mem = mmap(NULL, own_sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    close(fd);
+    if (mem==MAP_FAILED){
+      DEMO_LOG_ERROR("cannot map %s: %s\n", own_name.c_str(), strerror(err));
+      shm_unlink(own_name.c_str());
+      return ERR_TRANSPORT;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (wake_fd<0){
+      DEMO_LOG_ERROR("eventfd: %s\n",strerror(errno));
+      munmap(mem, own_sz);
+      shm_unlink(own_name.c_str());
+      return ERR_TRANSPORT;
+    }
+
+    //a new segment is all zeros, which is also what the rings start as
+    own = new (mem) Segment();
+    own->closed.store(0);
+    own->n_rings = cfg.n_agents;
+    own->ring_slots = ring_slots;
+    own->bell.store(0);
+    own->sleeping.store(0);
+
+    wait_continues=true;
+    waiter = std::thread(&ShmTransport::wait_loop, this);
+    //senders may attach from here on
+    own->magic.store(SHM_MAGIC, std::memory_order_release);
+
+    DEMO_LOG_INFO("Listening for ghs on : %s (%u x %u slots)\n",
+        cfg.endpoints[cfg.my_id].c_str(), own->n_rings, ring_slots);
+    return OK;
+  }
+
+  void ShmTransport::wait_loop()
+  {
+    struct timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = SHM_WAIT_NS;
+    uint32_t seen = 0;
+    while (wait_continues){
+      //senders check sleeping after ringing, so either they see it set and
+      //wake us, or the futex sees the bell has changed and does not sleep.
+      own->sleeping.store(1);
+      futex_wait(&own->bell, seen, &timeout);
+      own->sleeping.store(0);
+      uint32_t now = own->bell.load();
+      if (now!=seen){
+        seen=now;
+        uint64_t one=1;
+        if (write(wake_fd,&one,sizeof(one))<0 && errno!=EAGAIN){
+          DEMO_LOG_ERROR("eventfd write: %s\n",strerror(errno));
+        }
+      }
+    }
+  }
+
+  void ShmTransport::receive(ReceiveCallback cb)
+  {
+    on_recv = cb;
+    if (wake_fd<0){
+      return;
+    }
+    if (on_recv && !watching){
+      watching = loop.watch(wake_fd, [this](){ drain(); });
+      //anything that arrived while nobody was watching
+      loop.post([this](){ drain(); });
+    } else if (!on_recv && watching){
+      loop.unwatch(wake_fd);
+      watching = false;
+    }
+  }
+
+  void ShmTransport::drain()
+  {
+    uint64_t count;
+    if (read(wake_fd,&count,sizeof(count))<0 && errno!=EAGAIN){
+      DEMO_LOG_ERROR("eventfd read: %s\n",strerror(errno));
+    }
+    for (uint32_t i=0; i<own->n_rings && on_recv; i++){
+      ShmRing &r = own->ring(i);
+      uint32_t head = r.head.load(std::memory_order_relaxed);
+      while (on_recv && head != r.tail.load(std::memory_order_acquire)){
+        const WireMessage &s = own->slot(i,head);
+        WireMessage m;
+        memcpy(static_cast<void*>(&m), static_cast<const void*>(&s), sizeof(Control)+sizeof(Header));
+        bool sane = m.header.payload_size <= PAYLOAD_MAX_SZ;
+        if (sane){
+          memcpy(m.bytes, s.bytes, m.header.payload_size);
+        }
+        //the slot is the sender's again
+        head++;
+        r.head.store(head, std::memory_order_release);
+        if (!sane){
+          DEMO_LOG_ERROR("shm: bad payload size %u from ring %u, dropping\n", m.header.payload_size, i);
+          continue;
+        }
+        on_recv(m);
+      }
+    }
+  }
+
+  bool ShmTransport::attach(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    if (p.seg){
+      if (!p.seg->closed.load()){
+        return true;
+      }
+      //the peer restarted, and listens on a new segment
+      detach(to);
+    }
+    std::string name = segment_name(cfg.endpoints[to]);
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd<0){
+      //not up yet
+      return false;
+    }
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (fstat(fd,&st)==0 && (size_t)st.st_size>=sizeof(Segment)){
+      mem = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem==MAP_FAILED){
+      return false;
+    }
+    Segment *seg = static_cast<Segment*>(mem);
+    //until the magic is there, the rest may not be
+    if (seg->magic.load(std::memory_order_acquire)!=SHM_MAGIC 
+        || seg->n_rings<=(uint32_t)cfg.my_id
+        || (size_t)st.st_size<Segment::size_for(seg->n_rings,seg->ring_slots)){
+      munmap(mem, st.st_size);
+      return false;
+    }
+    p.seg = seg;
+    p.seg_sz = st.st_size;
+    DEMO_LOG_INFO("Attached to %s\n", cfg.endpoints[to].c_str());
+    return true;
+  }
+
+  void ShmTransport::detach(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    if (p.seg){
+      munmap(p.seg, p.seg_sz);
+      p.seg = nullptr;
+      p.seg_sz = 0;
+    }
+  }
+
+  bool ShmTransport::push(const uint16_t to, const WireMessage &m)
+  {
+    if (!attach(to)){
+      return false;
+    }
+    Segment *seg = peers[to].seg;
+    ShmRing &r = seg->ring(cfg.my_id);
+    //we are the only writer of tail
+    uint32_t tail = r.tail.load(std::memory_order_relaxed);
+    if (tail - r.head.load(std::memory_order_acquire) >= seg->ring_slots){
+      return false;
+    }
+    memcpy(static_cast<void*>(&seg->slot(cfg.my_id,tail)), static_cast<const void*>(&m), m.size());
+    r.tail.store(tail+1, std::memory_order_release);
+    seg->bell.fetch_add(1);
+    if (seg->sleeping.load()){
+      futex_wake(&seg->bell);
+    }
+    complete(to, OK);
+    return true;
+  }
+
+  void ShmTransport::retry(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    //a full ring drains quickly, a missing peer may take a while to start
+    std::chrono::milliseconds delay(p.seg ? 1 : 10);
+    p.retry_timer = loop.add_timer(delay, [this,to](){
+        Peer &peer = peers[to];
+        peer.retry_timer = -1;
+        if (peer.busy && !push(to, peer.m)){
+          retry(to);
+        }
+        });
+  }
+
+  Errno ShmTransport::send(const WireMessage &m, DeliveryCallback done)
+  {
+    uint16_t to = m.header.agent_to;
+    Peer &p = peers[to];
+    p.busy = true;
+    p.done = done;
+    if (!push(to, m)){
+      //hold on to it until it fits
+      p.m = m;
+      retry(to);
+    }
+    return OK;
+  }
+
+  void ShmTransport::cancel(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    p.busy = false;
+    p.done = nullptr;
+    if (p.retry_timer>=0){
+      loop.cancel_timer(p.retry_timer);
+      p.retry_timer = -1;
+    }
+  }
+
+  void ShmTransport::complete(const uint16_t to, const Errno result)
+  {
+    Peer &p = peers[to];
+    p.busy = false;
+    completed.push_back(std::make_pair(p.done, result));
+    p.done = nullptr;
+    //one post covers a whole burst, since flush() also runs whatever the
+    //callbacks it makes go on to complete
+    if (!flush_pending){
+      flush_pending = true;
+      loop.post([this](){ flush(); });
+    }
+  }
+
+  void ShmTransport::flush()
+  {
+    while (!completed.empty()){
+      auto c = completed.front();
+      completed.pop_front();
+      if (c.first){
+        c.first(c.second);
+      }
+    }
+    flush_pending = false;
+  }
+}
@@ -0,0 +1,127 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-shm.h
+ *
+ * @brief the demo::Transport over POSIX shared memory, for agents on the same host (shm://)
+ *
+ */
+#ifndef GHS_DEMO_TRANSPORT_SHM
+#define GHS_DEMO_TRANSPORT_SHM
+
+#include "ghs-demo-comms.h"
+#include <atomic>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+///
+namespace demo{
+
+  /**
+   * @brief a Transport that copies messages straight into the receiver's memory
+   *
+   * Each agent that listens on `shm://<name>` creates a POSIX shared memory
+   * segment `/<name>` (see shm_overview(7)) holding one single-producer,
+   * single-consumer ring per possible sender, indexed by agent id. Sending
+   * is a copy into our ring in the peer's segment, so a message counts as
+   * delivered as soon as it is there, with no framing, dialing or
+   * acknowledgement round trip.
+   *
+   * Receivers sleep on a futex(2) in the segment, which senders only ring
+   * when the receiver is actually asleep. A small thread waits on it and
+   * wakes the EventLoop through an eventfd, since a futex cannot be polled.
+   *
+   * If the peer's segment does not exist yet, or our ring in it is full, the
+   * message is retried from a timer until it fits or Comms gives up on it.
+   * Ring size is set by Config::shm_ring_slots.
+   */
+  class ShmTransport : public Transport
+  {
+    public:
+      ShmTransport(EventLoop &loop, const Config &config);
+      ~ShmTransport();
+
+      Errno listen();
+      void receive(ReceiveCallback cb);
+      Errno send(const WireMessage &m, DeliveryCallback done);
+      void cancel(const uint16_t agent_id);
+
+      /**
+       * @return the shm_open(3) name for an endpoint, e.g. "/ghs-0" for "shm://ghs-0"
+       */
+      static std::string segment_name(const std::string &endpoint);
+
+    private:
+      struct Segment;
+
+      /// Our ring in one peer's segment, and the message in flight to it
+      struct Peer
+      {
+        Segment *seg;
+        size_t seg_sz;
+        bool busy;
+        WireMessage m;
+        DeliveryCallback done;
+        int retry_timer;
+      };
+
+      bool attach(const uint16_t agent_id);
+      void detach(const uint16_t agent_id);
+      bool push(const uint16_t agent_id, const WireMessage &m);
+      void retry(const uint16_t agent_id);
+      void complete(const uint16_t agent_id, const Errno result);
+      void flush();
+      void drain();
+      void wait_loop();
+
+      EventLoop &loop;
+      Config cfg;
+      uint32_t ring_slots;
+      Segment *own=nullptr;
+      size_t own_sz=0;
+      std::string own_name;
+      int wake_fd=-1;
+      bool watching=false;
+      std::atomic<bool> wait_continues;
+      std::thread waiter;
+      ReceiveCallback on_recv;
+      std::vector<Peer> peers;
+      std::deque<std::pair<DeliveryCallback,Errno>> completed;
+      bool flush_pending=false;
+  };
+}
+
+#endif
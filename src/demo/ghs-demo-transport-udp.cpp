@@ -0,0 +1,472 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-udp.cpp
+ *
+ */
+#include "ghs-demo-transport-udp.h"
+#include "ghs-demo-log.h"
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+///
+namespace demo{
+
+  /// The RTO before we have any round trip samples
+  static const long UDP_RTO_INIT_US = 100*1000;
+  /// Never retransmit sooner than this
+  static const long UDP_RTO_MIN_US = 5*1000;
+  /// Never back off further than this
+  static const long UDP_RTO_MAX_US = 2*1000*1000;
+  /// Socket buffers big enough for a few full windows
+  static const int UDP_SOCK_BUF = 1<<20;
+
+  /// Sequence numbers wrap, so compare them by distance
+  static bool seq_before(uint32_t a, uint32_t b)
+  {
+    return (int32_t)(a-b) < 0;
+  }
+
+  UdpTransport::UdpTransport(EventLoop &l, const Config &c):loop(l),cfg(c),coin(0.0,1.0)
+  {
+    std::random_device rd;
+    epoch = rd();
+    rng.seed(epoch);
+    Peer p;
+    memset(&p.addr,0,sizeof(p.addr));
+    memset(&p.reply_addr,0,sizeof(p.reply_addr));
+    p.resolved=false;
+    p.next_seq=0;
+    p.rto_timer=-1;
+    p.srtt_us=0;
+    p.rttvar_us=0;
+    p.rto_us=UDP_RTO_INIT_US;
+    p.have_epoch=false;
+    p.epoch_in=0;
+    p.expected=0;
+    p.ack_due=false;
+    peers.assign(cfg.n_agents, p);
+    inbox.resize(UDP_BATCH);
+  }
+
+  UdpTransport::~UdpTransport()
+  {
+    //the loop is not running, so it is safe to touch it from here
+    for (auto &p : peers){
+      if (p.rto_timer>=0){
+        loop.cancel_timer(p.rto_timer);
+      }
+    }
+    if (watching){
+      loop.unwatch(fd);
+    }
+    if (fd>=0){
+      close(fd);
+    }
+  }
+
+  bool UdpTransport::resolve(const std::string &endpoint, sockaddr_in &addr)
+  {
+    if (endpoint_scheme(endpoint)!="udp"){
+      return false;
+    }
+    std::string hostport = endpoint.substr(strlen("udp://"));
+    size_t colon = hostport.rfind(':');
+    if (colon==std::string::npos){
+      return false;
+    }
+    std::string host = hostport.substr(0,colon);
+    std::string port = hostport.substr(colon+1);
+    struct addrinfo hints;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = host.empty() ? AI_PASSIVE : 0;
+    struct addrinfo *res=NULL;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res)!=0 || res==NULL){
+      return false;
+    }
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    freeaddrinfo(res);
+    return true;
+  }
+
+  bool UdpTransport::open_socket()
+  {
+    if (fd>=0){
+      return true;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd<0){
+      DEMO_LOG_ERROR("udp socket: %s\n", strerror(errno));
+      return false;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &UDP_SOCK_BUF, sizeof(UDP_SOCK_BUF));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &UDP_SOCK_BUF, sizeof(UDP_SOCK_BUF));
+    //ACKs arrive here too, so we read whether or not anyone is receiving
+    watching = loop.watch(fd, [this](){ read_ready(); });
+    return watching;
+  }
+
+  Errno UdpTransport::listen()
+  {
+    const std::string &endpoint = cfg.endpoints[cfg.my_id];
+    sockaddr_in addr;
+    if (!resolve(endpoint, addr)){
+      DEMO_LOG_ERROR("cannot resolve %s\n", endpoint.c_str());
+      return ERR_TRANSPORT;
+    }
+    if (!open_socket()){
+      return ERR_TRANSPORT;
+    }
+    if (bind(fd, (const sockaddr*)&addr, sizeof(addr))!=0){
+      DEMO_LOG_ERROR("cannot bind %s: %s\n", endpoint.c_str(), strerror(errno));
+      return ERR_TRANSPORT;
+    }
+    DEMO_LOG_INFO("Listening for ghs on : %s (window %zu)\n", endpoint.c_str(), window());
+    return OK;
+  }
+
+  void UdpTransport::receive(ReceiveCallback cb)
+  {
+    on_recv = cb;
+  }
+
+  size_t UdpTransport::window() const
+  {
+    return std::max(cfg.udp_window,1);
+  }
+
+  Errno UdpTransport::send(const WireMessage &m, DeliveryCallback done)
+  {
+    uint16_t to = m.header.agent_to;
+    Peer &p = peers[to];
+    if (!p.resolved){
+      if (!resolve(cfg.endpoints[to], p.addr)){
+        DEMO_LOG_ERROR("cannot resolve %s\n", cfg.endpoints[to].c_str());
+        return ERR_TRANSPORT;
+      }
+      p.resolved=true;
+    }
+    if (!open_socket()){
+      return ERR_TRANSPORT;
+    }
+    Outgoing o;
+    o.seq = p.next_seq++;
+    o.m = m;
+    o.done = done;
+    o.sent_at = std::chrono::steady_clock::now();
+    o.resent = false;
+    p.window.push_back(o);
+    queue_data(to, p.window.back());
+    //everything sent this turn of the loop goes out together
+    if (!flush_pending){
+      flush_pending=true;
+      loop.post([this](){ flush(); });
+    }
+    arm_rto(to);
+    return OK;
+  }
+
+  void UdpTransport::cancel(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    //the next DATA carries the new base, and the receiver skips ahead to it
+    p.window.clear();
+    if (p.rto_timer>=0){
+      loop.cancel_timer(p.rto_timer);
+      p.rto_timer=-1;
+    }
+  }
+
+  void UdpTransport::queue_data(const uint16_t to, const Outgoing &o)
+  {
+    const Peer &p = peers[to];
+    UdpHeader h;
+    h.kind = UDP_DATA;
+    h.from = cfg.my_id;
+    h.epoch = epoch;
+    h.seq = o.seq;
+    h.base = p.window.front().seq;
+    h.ack = 0;
+    queue(p.addr, h, &o.m);
+  }
+
+  void UdpTransport::queue(const sockaddr_in &to, const UdpHeader &h, const WireMessage *m)
+  {
+    if (cfg.udp_loss>0 && coin(rng)<cfg.udp_loss){
+      return;
+    }
+    outbox.emplace_back();
+    Datagram &d = outbox.back();
+    d.to = to;
+    memcpy(d.buf, &h, sizeof(h));
+    d.len = sizeof(h);
+    if (m){
+      memcpy(d.buf+sizeof(h), static_cast<const void*>(m), m->size());
+      d.len += m->size();
+    }
+  }
+
+  void UdpTransport::flush()
+  {
+    flush_pending=false;
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    size_t done=0;
+    while (done<outbox.size()){
+      size_t n = std::min((size_t)UDP_BATCH, outbox.size()-done);
+      memset(msgs,0,sizeof(msgs));
+      for (size_t i=0;i<n;i++){
+        Datagram &d = outbox[done+i];
+        iov[i].iov_base = d.buf;
+        iov[i].iov_len = d.len;
+        msgs[i].msg_hdr.msg_name = &d.to;
+        msgs[i].msg_hdr.msg_namelen = sizeof(d.to);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int sent = sendmmsg(fd, msgs, n, 0);
+      if (sent<=0){
+        //whatever did not go out is retransmitted later
+        if (sent<0 && errno!=EAGAIN && errno!=ENOBUFS){
+          DEMO_LOG_ERROR("sendmmsg: %s\n", strerror(errno));
+        }
+        break;
+      }
+      done+=sent;
+    }
+    outbox.clear();
+  }
+
+  void UdpTransport::read_ready()
+  {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    memset(msgs,0,sizeof(msgs));
+    for (size_t i=0;i<UDP_BATCH;i++){
+      iov[i].iov_base = inbox[i].buf;
+      iov[i].iov_len = sizeof(inbox[i].buf);
+      msgs[i].msg_hdr.msg_name = &inbox[i].to;
+      msgs[i].msg_hdr.msg_namelen = sizeof(inbox[i].to);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    //level-triggered: if there are more than UDP_BATCH, we are called again
+    int n = recvmmsg(fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (n<0){
+      if (errno!=EAGAIN && errno!=EINTR){
+        DEMO_LOG_ERROR("recvmmsg: %s\n", strerror(errno));
+      }
+      return;
+    }
+    for (int i=0;i<n;i++){
+      on_datagram(inbox[i].buf, msgs[i].msg_len, inbox[i].to);
+    }
+    //one cumulative ACK per sender per batch
+    for (auto from : acks_due){
+      Peer &p = peers[from];
+      p.ack_due=false;
+      UdpHeader h;
+      h.kind = UDP_ACK;
+      h.from = cfg.my_id;
+      h.epoch = p.epoch_in;
+      h.seq = 0;
+      h.base = 0;
+      h.ack = p.expected;
+      queue(p.reply_addr, h, NULL);
+    }
+    acks_due.clear();
+    flush();
+  }
+
+  void UdpTransport::on_datagram(const uint8_t *buf, size_t len, const sockaddr_in &src)
+  {
+    UdpHeader h;
+    if (len<sizeof(h)){
+      DEMO_LOG_WARN("udp: runt datagram (%zu bytes), dropping\n", len);
+      return;
+    }
+    memcpy(&h, buf, sizeof(h));
+    if (h.from>=peers.size()){
+      DEMO_LOG_WARN("udp: datagram from unknown agent %u, dropping\n", h.from);
+      return;
+    }
+    if (h.kind==UDP_ACK){
+      on_ack(h);
+      return;
+    }
+    WireMessage m;
+    size_t body = len-sizeof(h);
+    if (h.kind!=UDP_DATA || body<sizeof(Control)+sizeof(Header) || body>sizeof(WireMessage)){
+      DEMO_LOG_WARN("udp: malformed datagram from %u, dropping\n", h.from);
+      return;
+    }
+    memcpy(static_cast<void*>(&m), buf+sizeof(h), body);
+    if (m.size()!=body){
+      DEMO_LOG_WARN("udp: bad payload size from %u, dropping\n", h.from);
+      return;
+    }
+    on_data(h, m, src);
+  }
+
+  void UdpTransport::on_data(const UdpHeader &h, const WireMessage &m, const sockaddr_in &src)
+  {
+    if (!on_recv){
+      //not receiving yet: no ACK, so the sender tries again later
+      return;
+    }
+    Peer &p = peers[h.from];
+    if (!p.have_epoch || p.epoch_in!=h.epoch){
+      //a new sender, or the same one restarted
+      p.have_epoch = true;
+      p.epoch_in = h.epoch;
+      p.expected = h.base;
+      p.early.clear();
+    }
+    if (seq_before(p.expected, h.base)){
+      //the sender gave up on some messages, so we stop waiting for them
+      p.expected = h.base;
+      for (auto it=p.early.begin(); it!=p.early.end();){
+        if (seq_before(it->first, h.base)){
+          it = p.early.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    p.reply_addr = src;
+    if (!p.ack_due){
+      p.ack_due = true;
+      acks_due.push_back(h.from);
+    }
+
+    if (h.seq==p.expected){
+      p.expected++;
+      WireMessage in = m;
+      on_recv(in);
+      //and whatever was waiting for it
+      auto it = p.early.find(p.expected);
+      while (it!=p.early.end() && on_recv){
+        in = it->second;
+        p.early.erase(it);
+        p.expected++;
+        on_recv(in);
+        it = p.early.find(p.expected);
+      }
+    } else if (seq_before(p.expected, h.seq) && h.seq-p.expected < 2*window()){
+      p.early[h.seq] = m;
+    }
+    //otherwise it is a duplicate, and the ACK tells the sender so
+  }
+
+  void UdpTransport::on_ack(const UdpHeader &h)
+  {
+    if (h.epoch!=epoch){
+      //for an earlier incarnation of us
+      return;
+    }
+    Peer &p = peers[h.from];
+    auto now = std::chrono::steady_clock::now();
+    bool progressed = false;
+    while (!p.window.empty() && seq_before(p.window.front().seq, h.ack)){
+      Outgoing o = p.window.front();
+      p.window.pop_front();
+      progressed = true;
+      //Karn: a resent message's ACK may be for either copy
+      if (!o.resent){
+        sample_rtt(p, std::chrono::duration_cast<std::chrono::microseconds>(now-o.sent_at).count());
+      }
+      if (o.done){
+        o.done(OK);
+      }
+    }
+    if (progressed){
+      //restart the clock for what is left
+      if (p.rto_timer>=0){
+        loop.cancel_timer(p.rto_timer);
+        p.rto_timer=-1;
+      }
+      arm_rto(h.from);
+    }
+  }
+
+  //RFC 6298, with a 1ms clock. A fresh sample also undoes any backoff.
+  void UdpTransport::sample_rtt(Peer &p, long us)
+  {
+    if (p.srtt_us==0){
+      p.srtt_us = std::max(us,1L);
+      p.rttvar_us = us/2;
+    } else {
+      p.rttvar_us = (3*p.rttvar_us + std::abs(p.srtt_us-us))/4;
+      p.srtt_us = (7*p.srtt_us + us)/8;
+    }
+    long rto = p.srtt_us + std::max(1000L, 4*p.rttvar_us);
+    p.rto_us = std::min(std::max(rto, UDP_RTO_MIN_US), UDP_RTO_MAX_US);
+  }
+
+  void UdpTransport::arm_rto(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    if (p.rto_timer>=0 || p.window.empty()){
+      return;
+    }
+    std::chrono::milliseconds rto((p.rto_us+999)/1000);
+    p.rto_timer = loop.add_timer(rto, [this,to](){
+        peers[to].rto_timer=-1;
+        on_rto(to);
+        });
+  }
+
+  void UdpTransport::on_rto(const uint16_t to)
+  {
+    Peer &p = peers[to];
+    if (p.window.empty()){
+      return;
+    }
+    p.rto_us = std::min(p.rto_us*2, UDP_RTO_MAX_US);
+    DEMO_LOG_DEBUG("udp: resending %zu to %u, next rto %ld us\n", p.window.size(), to, p.rto_us);
+    for (auto &o : p.window){
+      o.resent = true;
+      queue_data(to, o);
+    }
+    flush();
+    arm_rto(to);
+  }
+}
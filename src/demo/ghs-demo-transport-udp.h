@@ -0,0 +1,189 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file ghs-demo-transport-udp.h
+ *
+ * @brief the demo::Transport over UDP, with its own windows, acknowledgements and retransmission (udp://)
+ *
+ */
+#ifndef GHS_DEMO_TRANSPORT_UDP
+#define GHS_DEMO_TRANSPORT_UDP
+
+#include "ghs-demo-comms.h"
+#include <netinet/in.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/// How many datagrams are moved per sendmmsg(2) / recvmmsg(2) call
+#define UDP_BATCH 32
+
+///
+namespace demo{
+
+  /**
+   * @brief The header in front of every datagram sent by UdpTransport
+   *
+   * Like WireMessage, it is sent in host byte order.
+   */
+  struct UdpHeader
+  {
+    /// UDP_DATA or UDP_ACK
+    uint16_t kind;
+    /// The agent that sent this datagram
+    uint16_t from;
+    /// Random per UdpTransport, so a restarted sender is not taken for a duplicate
+    uint32_t epoch;
+    /// DATA: this datagram's place in the stream to one peer
+    uint32_t seq;
+    /// DATA: the oldest seq the sender still retransmits (anything older was given up)
+    uint32_t base;
+    /// ACK: the next seq the receiver expects, i.e., everything before it arrived
+    uint32_t ack;
+  };
+
+  /// UdpHeader::kind of a datagram carrying a WireMessage
+#define UDP_DATA 1
+  /// UdpHeader::kind of a cumulative acknowledgement
+#define UDP_ACK  2
+
+  /**
+   * @brief a Transport that sends WireMessage objects as UDP datagrams, with reliability on top
+   *
+   * There is no handshake: the first message to a peer is the first
+   * datagram. Each peer gets a sliding window of up to Config::udp_window
+   * unacknowledged messages, numbered in order. The receiver delivers them
+   * in that order, holding early arrivals, and answers each batch of
+   * datagrams with one cumulative ACK per sender. The oldest unacknowledged
+   * message is guarded by a retransmit timer (the RTO), estimated from the
+   * round trip times as TCP does (RFC 6298) and doubled on every expiry,
+   * after which the whole window is sent again.
+   *
+   * All datagrams queued during one turn of the EventLoop go out with one
+   * sendmmsg(2), and readable datagrams are taken UDP_BATCH at a time with
+   * recvmmsg(2).
+   *
+   * Setting Config::udp_loss drops that fraction of the datagrams we send,
+   * data and ACKs alike, to exercise the retransmission on a clean network.
+   *
+   * Endpoints look like `udp://host:port` (IPv4).
+   */
+  class UdpTransport : public Transport
+  {
+    public:
+      UdpTransport(EventLoop &loop, const Config &config);
+      ~UdpTransport();
+
+      Errno listen();
+      void receive(ReceiveCallback cb);
+      Errno send(const WireMessage &m, DeliveryCallback done);
+      void cancel(const uint16_t agent_id);
+      size_t window() const;
+
+      /**
+       * Resolves `udp://host:port`
+       * @return false if it is not a valid udp endpoint
+       */
+      static bool resolve(const std::string &endpoint, sockaddr_in &addr);
+
+    private:
+      /// A message in a peer's window
+      struct Outgoing
+      {
+        uint32_t seq;
+        WireMessage m;
+        DeliveryCallback done;
+        std::chrono::steady_clock::time_point sent_at;
+        bool resent;
+      };
+
+      /// Everything we know about one peer, as a sender and as a receiver
+      struct Peer
+      {
+        bool resolved;
+        sockaddr_in addr;
+        uint32_t next_seq;
+        std::deque<Outgoing> window;
+        int rto_timer;
+        long srtt_us;
+        long rttvar_us;
+        long rto_us;
+        bool have_epoch;
+        uint32_t epoch_in;
+        uint32_t expected;
+        std::map<uint32_t,WireMessage> early;
+        bool ack_due;
+        sockaddr_in reply_addr;
+      };
+
+      /// One queued datagram
+      struct Datagram
+      {
+        sockaddr_in to;
+        size_t len;
+        uint8_t buf[sizeof(UdpHeader)+sizeof(WireMessage)];
+      };
+
+      bool open_socket();
+      void read_ready();
+      void on_datagram(const uint8_t *buf, size_t len, const sockaddr_in &src);
+      void on_data(const UdpHeader &h, const WireMessage &m, const sockaddr_in &src);
+      void on_ack(const UdpHeader &h);
+      void queue_data(const uint16_t agent_id, const Outgoing &o);
+      void queue(const sockaddr_in &to, const UdpHeader &h, const WireMessage *m);
+      void flush();
+      void arm_rto(const uint16_t agent_id);
+      void on_rto(const uint16_t agent_id);
+      void sample_rtt(Peer &p, long us);
+
+      EventLoop &loop;
+      Config cfg;
+      int fd=-1;
+      bool watching=false;
+      uint32_t epoch;
+      ReceiveCallback on_recv;
+      std::vector<Peer> peers;
+      std::vector<uint16_t> acks_due;
+      std::vector<Datagram> outbox;
+      std::vector<Datagram> inbox;
+      bool flush_pending=false;
+      std::minstd_rand rng;
+      std::uniform_real_distribution<double> coin;
+  };
+}
+
+#endif
@@ -40,13 +40,25 @@
 #include <unistd.h> //sleep
 #include <sstream> //better than iostream
 #include <cassert>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "ghs-demo-config.h"
 #include "ghs-demo-msgutils.h"
 #include "ghs-demo-comms.h"
+#include "ghs-demo-outbox.h"
+#include "ghs-demo-log.h"
 
 #include "ghs/ghs.h"
 #include "ghs/ghs_printer.h" //dump_edges
+#include "ghs/health.h"
+#include "ghs/broadcast.h"
 #include "ghs/msg_printer.h" //for printing GHS msgs.
 #include "ghs/agent.h"
 #include "ghs/edge.h"
@@ -61,6 +73,36 @@ using le::ghs::Msg;
 ///
 namespace demo{
 
+  /// The size of the GHS message queues, which bounds the fan-out of one step (and so the number of agents)
+  static const size_t COMMS_Q_SZ=1024;
+
+  /// What one agent's run of the main loop came to
+  struct AgentResult
+  {
+    /// 0 if the agent ran to completion, 2 if a failed peer broke the tree and the election must be run again
+    int ret;
+    /// true if le::ghs::GhsState::is_converged() was reached
+    bool converged;
+    /// The leader this agent ended up with
+    agent_t leader;
+    /// Its parent in the tree it ended up with (itself, if it leads)
+    agent_t parent;
+    /// From the start of run_agent() to convergence (or giving up)
+    std::chrono::microseconds elapsed;
+    /// From the start of run_agent() to le::ghs::GhsState::start_round(), which sends our first SRCH: the start-up barrier and the link measurements
+    std::chrono::microseconds cold_start;
+    /// From le::ghs::GhsState::start_round() to convergence (or giving up)
+    std::chrono::microseconds ghs_elapsed;
+    /// If Config::leader_deadline_s passed before convergence, the best leader known then (le::ghs::NO_AGENT otherwise)
+    le::ghs::LeaderEstimate early;
+    /// On the leader, the last health summary of the whole tree, if Config::health_period_s>0 (left empty elsewhere)
+    le::ghs::HealthReport health;
+    /// What arrived of Config::broadcast_file, once all of it did
+    std::vector<uint8_t> broadcast;
+    /// From convergence until all of Config::broadcast_file arrived (or was read, on the leader)
+    std::chrono::microseconds broadcast_elapsed;
+  };
+
   /**
    * @brief **The main demo logic** for executing le::ghs::GhsState across a network
    *
@@ -75,13 +117,17 @@ namespace demo{
        * The main loop consists of:
        *
        * 1. Reading demo::Config information about the peers and their tcp endpoints from an ini file and from stdin
-       * 2. Initializing all the nng sockets inside a demo::Comms object from that config
-       * 3. Using Comms::little_iperf() and Comms::exchange_iperf() to create link metrics
+       * 2. Initializing the transports (nng sockets, shared memory) inside a demo::Comms object from that config
+       * 3. Waiting in Comms::await_peers() until every peer is up (or Config::wait_s passes), then using Comms::little_iperf() and Comms::exchange_iperf() to create link metrics
        * 4. Populating a le::ghs::GhsState object from the Config object and link information gathered by demo::Comms
-       * 5. Calling le::ghs::GhsState::start_round() to get the first set of messages, and feeding those into Comms
-       * 6. Spinning on Comms::has_msg() and calling Comms::get_next() to retrieve a message, then pushing that message payload into le::ghs::GhsState::process() to get the next set of message to send
+       * 5. Calling le::ghs::GhsState::start_round() to get the first set of messages, and feeding those into an Outbox, which sends them through Comms
+       * 6. Sleeping in Comms::wait() and calling Comms::get_next() to retrieve a message, then pushing that message payload into le::ghs::GhsState::process() to get the next set of message to send
        * 7. Continuing that process until le::ghs::GhsState::is_converged() returns true
-       * 8. Printing stuff
+       * 8. Printing stuff, and, if Config::health_period_s>0, reporting liveness up the tree (le::ghs::TreeHealth) until told to stop
+       * 9. If Config::broadcast_file is set, passing it down the tree from the leader (le::ghs::TreeBroadcast) before exiting
+       *
+       * Steps 3-8 are run_agent(). With `--cluster N` (Config::cluster),
+       * steps 2-8 are done for N agents at once by run_cluster() instead.
        *
        * If you want to replicate this, study this loop, and pay close attention to how little_iperf() does its work **and especially sym_metric()**.
        *
@@ -93,8 +139,52 @@ namespace demo{
        *
        */
       int do_main(int argc,char**argv);
+
+      /**
+       * @brief Runs one agent, from measuring its links to convergence, on Comms that is already set up
+       *
+       * Returns early, unconverged, once keep_going is false. With
+       * Config::health_period_s>0, it does not return after converging
+       * either, until keep_going is false: it stays up to report the
+       * liveness of its subtree to its parent.
+       */
+      AgentResult run_agent(Config &config, Comms &comms, const std::atomic<bool> &keep_going);
+
+      /**
+       * @brief Runs Config::cluster agents as threads of this process
+       *
+       * Each agent has its own Config, Comms and le::ghs::GhsState, and its
+       * own thread running run_agent(), exactly as if it were a separate
+       * process. They talk over `mem://` endpoints (MemTransport), so all
+       * of the demo stack is exercised except the sockets, and the whole
+       * thing can be profiled as one process.
+       *
+       * @param results if set, filled in with every agent's AgentResult, by id
+       * @return 0 if every agent converged and they all agree on the leader
+       */
+      int run_cluster(Config &config, const std::atomic<bool> &keep_going, std::vector<AgentResult> *results=nullptr);
   };
 
+  /**
+   * Fills in the endpoints (`mem://ghs-<i>`) and ids for a cluster of
+   * Config::cluster agents. Every link is memory, so there is nothing for the
+   * background link probing to find; it is turned off, since n agents
+   * probing n-1 peers each would swamp the run. So is the failure detector,
+   * for the same reason: no agent of the process can fail on its own.
+   */
+  void cluster_config(Config &config)
+  {
+    config.n_agents = config.cluster;
+    config.endpoints.clear();
+    for (int i=0;i<config.cluster;i++){
+      config.endpoints.push_back("mem://ghs-"+std::to_string(i));
+    }
+    config.my_id = 0;
+    config.command = Config::START;
+    config.metric_idle_s = 0;
+    config.heartbeat_s = 0;
+  }
+
   /// Helper function to build edges from configuration information
   template<size_t AN, size_t QN>
     GhsState<AN,QN> initialize_ghs(Config& cfg, Comms& c)
@@ -114,76 +204,101 @@ namespace demo{
 
       //construct with all live links
       GhsState<AN,QN> ghs(cfg.my_id,edges.data(),edges.size());
+      ghs.set_recenter(cfg.center_leader);
+      ghs.set_max_degree(cfg.max_degree);
 
       //and eyeball-verify the links were added
       for(int i=0;i<cfg.n_agents;i++){
         if (i!=cfg.my_id){
-          printf("[info] Set edge: %d from %d (check=%d)\n",
+          DEMO_LOG_DEBUG("Set edge: %d from %d (check=%d)\n",
               i,
               cfg.my_id,
               ghs.has_edge(i));
           Edge e;
           ghs.get_edge(i,e);
-          printf("[info] (%d<--%d, %d %lu)\n",
+          DEMO_LOG_DEBUG("(%d<--%d, %d %lu)\n",
               e.peer,e.root,e.status,e.metric_val);
         }
       }
       return ghs;
     }
 
+  /**
+   * The start-up barrier: waits (at most Config::wait_s) for every peer to
+   * come up. With no wait_s, every peer is taken to be up already.
+   *
+   * @return how many peers are up
+   */
+  int wait_for_peers(Comms& comms, Config &config){
+    if (config.wait_s<=0){
+      return config.n_agents-1;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    int n_up = comms.await_peers(t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<float>(config.wait_s)));
+    DEMO_LOG_INFO("%d of %d peers up after %.3f s\n", n_up, config.n_agents-1,
+        std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count());
+    return n_up;
+  }
+
   /// Run a quick little_iperf() round to check connectivity
   int do_test_and_die(Comms& comms, Config &config){
-    printf("[info] running connectivity test after %fs!\n",config.wait_s);
-    sleep(config.wait_s);
+    DEMO_LOG_INFO("running connectivity test, waiting up to %fs for peers!\n",config.wait_s);
     comms.start_receiver();
-    sleep(1);
+    wait_for_peers(comms, config);
     comms.little_iperf();
-    sleep(1);
-    printf("[info]================= measured\n");
+    DEMO_LOG_INFO("================= measured\n");
     comms.print_iperf();
-    sleep(1);
-    printf("[info]================= exchanging \n");
+    DEMO_LOG_INFO("================= exchanging \n");
     comms.exchange_iperf();
-    sleep(1);
-    printf("[info]================= post-exchange\n");
-    comms.print_iperf();
-    sleep(1);
-    printf("[info]================= again\n");
+    DEMO_LOG_INFO("================= post-exchange\n");
     comms.print_iperf();
     comms.stop_receiver();
     return 0;
   }
 
+  /// Cleared by SIGINT
+  static std::atomic<bool> wegood(true);
+
   int GhsDemoExec::do_main(int argc, char** argv)
   {
 
     demo::Config config;
-    static const size_t COMMS_Q_SZ=256;
 
     demo::read_cfg_stdin(&config);
     demo::read_cfg_cli(argc,argv,&config);
 
-    printf("[info] Done configuring for id=%d... \n",config.my_id);
+    if (config.cluster>0){
+      demo::cluster_config(config);
+    }
+
+    DEMO_LOG_INFO("Done configuring for id=%d... \n",config.my_id);
 
     if (!demo::cfg_is_ok(config)){
       return 1;
     }
 
+    //from here on, logging is queued and written by a background thread
+    demo::set_log_level((demo::LogLevel)config.log_level);
+    demo::Log::inst().start();
 
-    //initialize the buffer used for input & output to get response messages from
-    //those state machines. 
-    //Use your own here ... 
-    seque::StaticQueue<Msg,COMMS_Q_SZ> buf;
-
+    //stop loop on sigint
+    signal(SIGINT,[](int s){
+        printf("...... Received shutdown, joining / killing all threads ..... \n");
+        wegood=false;
+        });
 
-    //here's the queue to/from ghs TODO: unify message types.
-    seque::StaticQueue<Msg,COMMS_Q_SZ> ghs_buf;
+    if (config.cluster>0){
+      int ret = run_cluster(config, wegood);
+      demo::Log::inst().stop();
+      return ret;
+    }
 
     demo::Comms comms;
     comms.with_config(config);
 
     if (!comms.ok()){
-      printf("[error] Cannot create comms from config\n");
+      DEMO_LOG_ERROR("Cannot create comms from config\n");
       return 1;
     }
 
@@ -191,51 +306,138 @@ namespace demo{
       return demo::do_test_and_die(comms,config);
     }
 
-    static bool wegood=true;
+    AgentResult result = run_agent(config, comms, wegood);
+    demo::Log::inst().stop();
 
-    //stop loop on sigint
-    signal(SIGINT,[](int s){
-        printf("...... Received shutdown, joining / killing all threads ..... \n");
-        wegood=false;
-        });
+    return result.ret;
+  }
 
-    if (config.wait_s>0){
-      printf("[info] sleeping for %f seconds\n",config.wait_s);
-      sleep(config.wait_s);
-    }
+  AgentResult GhsDemoExec::run_agent(Config &config, Comms &comms, const std::atomic<bool> &keep_going)
+  {
+    AgentResult result;
+    result.ret=0;
+    result.converged=false;
+    result.leader=-1;
+    result.parent=-1;
+    result.elapsed=std::chrono::microseconds(0);
+    result.ghs_elapsed=std::chrono::microseconds(0);
+    result.cold_start=std::chrono::microseconds(0);
+    result.broadcast_elapsed=std::chrono::microseconds(0);
+    result.early=le::ghs::LeaderEstimate{le::ghs::NO_AGENT, 0, 0};
+    auto t_start = std::chrono::steady_clock::now();
+
+    //here's the queue to/from ghs TODO: unify message types.
+    seque::StaticQueue<Msg,COMMS_Q_SZ> ghs_buf;
 
+    //start as soon as everyone is up and has measured, rather than after
+    //a fixed wait: exchange_iperf() returns once every peer has reported
     comms.start_receiver();
+    wait_for_peers(comms, config);
     comms.little_iperf();
     comms.print_iperf();
-    sleep(1);
     comms.exchange_iperf();
     comms.print_iperf();
-    sleep(1);
-    comms.print_iperf();
 
-    GhsState<MAX_N,COMMS_Q_SZ> ghsp(-1,{},0);
+    //keep the link metrics current while the algorithm runs
+    comms.on_metric_change([](uint16_t id, Kbps old_kbps, Kbps new_kbps){
+        DEMO_LOG_WARN("link to %u changed: %u -> %u kbps, the tree may need a re-election\n",
+            id, old_kbps, new_kbps);
+        });
+    comms.start_metrics();
+
+    //peers that fall silent are handed over from the I/O thread, to be
+    //dropped from the election below
+    std::mutex suspect_mut;
+    std::vector<uint16_t> suspects;
+    comms.on_suspect([&suspect_mut,&suspects,&comms,&config](uint16_t id, double phi){
+        if (phi >= config.suspect_phi){
+          std::lock_guard<std::mutex> guard(suspect_mut);
+          suspects.push_back(id);
+          comms.wake();
+        }
+        });
+    comms.start_liveness();
+    std::vector<bool> dropped(config.n_agents, false);
+
+    //0 agents: the peer storage is sized at runtime from the config
+    GhsState<0,COMMS_Q_SZ> ghsp(-1,{},0);
+    auto t_ghs = std::chrono::steady_clock::now();
+    result.cold_start = std::chrono::duration_cast<std::chrono::microseconds>(t_ghs-t_start);
+    DEMO_LOG_INFO("starting GHS %.3f s after start-up\n", result.cold_start.count()/1e6);
 
     if (config.command==demo::Config::START){
     //initialize all the message-driven state machines that need msg callbacks.
     //In this case. Just GHS...
-      ghsp =  demo::initialize_ghs<MAX_N,COMMS_Q_SZ>(config,comms);
+      ghsp =  demo::initialize_ghs<0,COMMS_Q_SZ>(config,comms);
       size_t sent;
       auto ret = ghsp.start_round(ghs_buf, sent);
       if (ret != le::OK){
-        printf("[error] could not start ghs! (%d)\n", ret);
-        return 1;
+        DEMO_LOG_ERROR("could not start ghs! (%d)\n", ret);
+        comms.stop_liveness();
+        comms.on_suspect(nullptr);
+        comms.stop_metrics();
+        comms.stop_receiver();
+        result.ret=1;
+        return result;
       }
     } 
 
+    demo::Outbox outbox(comms, config);
+    //start_round() may have left messages in ghs_buf, so do not sleep yet
+    std::chrono::milliseconds idle(0);
+    std::chrono::steady_clock::time_point flush_until;
+
+    //once converged, liveness goes up the tree once a period
+    le::ghs::TreeHealth health;
+    bool serving=false;
+    auto health_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(config.health_period_s));
+    std::chrono::steady_clock::time_point next_report;
+    //if we must have some leader by a deadline, the best one known by then
+    bool deadline_due = config.leader_deadline_s>0;
+    auto deadline = t_ghs + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(config.leader_deadline_s));
+    auto now_ms = [&t_start](){
+      return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now()-t_start).count();
+    };
+
+    //once converged, the leader may pass a file down the tree, a chunk per message
+    le::ghs::TreeBroadcast cast(PAYLOAD_MAX_SZ-sizeof(le::ghs::ChunkHeader), config.broadcast_window);
+    bool casting=false;
+    std::chrono::steady_clock::time_point t_converged;
+    std::vector<le::ghs::ChunkSend> chunks;
+    auto push_chunks = [&chunks,&outbox,&config](){
+      for (auto &c : chunks){
+        demo::WireMessage out;
+        out.header.agent_to=c.to;
+        out.header.agent_from=config.my_id;
+        out.header.type=demo::PAYLOAD_TYPE_CHUNK;
+        out.header.payload_size=sizeof(c.h)+c.h.len;
+        memcpy(out.bytes, &c.h, sizeof(c.h));
+        if (c.h.len>0){
+          memcpy(out.bytes+sizeof(c.h), c.data, c.h.len);
+        }
+        if (outbox.push(out)!=demo::OK){
+          DEMO_LOG_ERROR("could not queue a chunk for %d\n", c.to);
+        }
+      }
+      chunks.clear();
+    };
+    bool flushing=false;
 
-    while (wegood){
+    bool running=true;
+    while (running && keep_going){
 
       demo::WireMessage in;
+      //sleep until the background reader has something for us, one of our
+      //sends finishes, or a failed one is due to be sent again.
+      comms.wait(idle);
       //retrieve next message from background reader.
       bool ok = comms.get_next(in);
 
       if (ok){
-        printf("[info] recv'd msg from %d to %d\n",in.header.agent_from, in.header.agent_to);
+        DEMO_LOG_DEBUG("recv'd msg from %d to %d\n",in.header.agent_from, in.header.agent_to);
 
         //no shenanegans plz
         assert(in.header.agent_to==config.my_id);
@@ -249,48 +451,128 @@ namespace demo{
             }
           case demo::PAYLOAD_TYPE_GHS:
             {
+              //we have stopped waiting on them, so their part of the election is over too
+              if (dropped[in.header.agent_from]){
+                DEMO_LOG_WARN("ignoring a late msg from dropped agent %d\n", in.header.agent_from);
+                break;
+              }
               //with static size checking:
               //Msg payload_msg=from_bytes<MAX_MSG_SZ>(in.bytes); 
               //or with compression / variable sizes
               Msg payload_msg = from_bytes(in.bytes, in.header.payload_size);
               //push msg to the subsystem
-              std::stringstream ss;
-              ss<<payload_msg;
-              printf("[info] received GHS msg: %s\n",ss.str().c_str());
+              if (DEMO_LOG_ON(demo::LOG_DEBUG)){
+                std::stringstream ss;
+                ss<<payload_msg;
+                DEMO_LOG_DEBUG("received GHS msg: %s\n",ss.str().c_str());
+              }
               size_t new_msg_ct=0;
               le::Errno retval = ghsp.process(payload_msg,ghs_buf, new_msg_ct);
               if (retval != le::OK){
-                printf("[error] could not call ghsp.process():%s",le::strerror(retval));
-                return 1;
+                DEMO_LOG_ERROR("could not call ghsp.process():%s",le::strerror(retval));
+                result.ret=1;
+                running=false;
+                break;
               }
-              printf("[info] # response msgs: %zu\n", new_msg_ct);
-              printf("[info] GHS waiting: %zu, delayed: %zu, leader: %d, parent: %d, level: %d\n", 
+              DEMO_LOG_DEBUG("# response msgs: %zu\n", new_msg_ct);
+              DEMO_LOG_DEBUG("GHS waiting: %zu, delayed: %zu, leader: %d, parent: %d, level: %d\n", 
                   ghsp.waiting_count(),
                   ghsp.delayed_count(),
                   ghsp.get_leader_id(), 
                   ghsp.get_parent_id(),
                   ghsp.get_level());
-              printf("[info] Edges: %s\n",
+              //dump_edges() walks every agent, so it is only called at debug level
+              DEMO_LOG_DEBUG("Edges: %s\n",
                   dump_edges(ghsp).c_str());
               break;
             }
-          default: { printf("[error] unknown payload type: %d\n", in.header.type); wegood=false; break;}
+          case demo::PAYLOAD_TYPE_HEALTH:
+            {
+              //our children converge after us, so this cannot come early
+              le::ghs::HealthReport r;
+              if (!serving || in.header.payload_size!=sizeof(r)){
+                DEMO_LOG_WARN("ignoring a health report from %d\n", in.header.agent_from);
+                break;
+              }
+              memcpy(&r, in.bytes, sizeof(r));
+              le::Errno retval = health.receive(in.header.agent_from, r, now_ms());
+              if (retval != le::OK){
+                DEMO_LOG_WARN("ignoring a health report from %d: %s\n", in.header.agent_from, le::strerror(retval));
+              }
+              break;
+            }
+          case demo::PAYLOAD_TYPE_CHUNK:
+            {
+              //our parent converges before we do, and its chunks come after its last GHS msg
+              le::ghs::ChunkHeader h;
+              if (!casting || in.header.payload_size<sizeof(h)){
+                DEMO_LOG_WARN("ignoring a chunk from %d\n", in.header.agent_from);
+                break;
+              }
+              memcpy(&h, in.bytes, sizeof(h));
+              if (in.header.payload_size!=sizeof(h)+h.len){
+                DEMO_LOG_WARN("ignoring a chunk of the wrong size from %d\n", in.header.agent_from);
+                break;
+              }
+              bool had = cast.complete();
+              le::Errno retval = cast.receive(in.header.agent_from, h, in.bytes+sizeof(h), chunks);
+              if (retval != le::OK){
+                DEMO_LOG_WARN("ignoring a chunk from %d: %s\n", in.header.agent_from, le::strerror(retval));
+                break;
+              }
+              push_chunks();
+              if (!had && cast.complete()){
+                result.broadcast = cast.payload();
+                result.broadcast_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now()-t_converged);
+                DEMO_LOG_INFO("received the %zu byte broadcast %.3f s after converging\n",
+                    result.broadcast.size(), result.broadcast_elapsed.count()/1e6);
+              }
+              break;
+            }
+          default: { DEMO_LOG_ERROR("unknown payload type: %d\n", in.header.type); running=false; break;}
         }
 
 
       }
 
 
-      //now process the outgoing msgs 
-      //ghs example, others are similar:
+      //a peer that has failed will never answer, so stop waiting on it.
+      //Once we have converged, there is nothing left to wait on.
+      std::vector<uint16_t> lost;
+      {
+        std::lock_guard<std::mutex> guard(suspect_mut);
+        lost.swap(suspects);
+      }
+      for (auto id : lost){
+        if (result.converged || dropped[id]){
+          continue;
+        }
+        dropped[id]=true;
+        size_t new_msg_ct=0;
+        le::Errno retval = ghsp.drop_edge(id, ghs_buf, new_msg_ct);
+        if (retval == le::OK){
+          DEMO_LOG_WARN("dropped the edge to agent %u, going on without it\n", id);
+        } else if (retval == le::DROP_REQ_RESTART){
+          DEMO_LOG_ERROR("lost agent %u, which our tree goes through: the election must be run again\n", id);
+          result.ret=2;
+          running=false;
+        } else if (retval != le::NO_SUCH_PEER){
+          DEMO_LOG_ERROR("could not drop the edge to agent %u: %s\n", id, le::strerror(retval));
+          result.ret=1;
+          running=false;
+        }
+      }
+
+      //now hand the outgoing msgs to the outbox, which keeps a queue per
+      //peer, so one that is slow to answer does not hold up the others.
       //You don't really *need* to wrap messages like this ... 
       while(ghs_buf.size()>0){
         demo::WireMessage out;
         le::ghs::Msg out_pld;
 
-        printf("[info] Have %u msgs to send\n", ghs_buf.size());
         if (seque::OK!=ghs_buf.pop(out_pld)){
-          wegood=false;
+          running=false;
           break;
         }
         out.header.agent_to=out_pld.to();
@@ -300,37 +582,200 @@ namespace demo{
         size_t bsz = sizeof(out_pld);
         to_bytes(out_pld,out.bytes,bsz);
         assert(bsz==sizeof(out_pld));
-        demo::Errno retval=comms.send(out); 
 
-        if (retval==demo::OK){
+        if (outbox.push(out)==demo::OK){
+          if (DEMO_LOG_ON(demo::LOG_DEBUG)){
+            std::stringstream ss;
+            ss<<out_pld;
+            DEMO_LOG_DEBUG("Queued: %s\n",ss.str().c_str());
+          }
+        } else {
+          DEMO_LOG_ERROR("demo error. We may have populated a message incorreclty (to %d)\n",out_pld.to());
+        }
+      }
+      if (serving && std::chrono::steady_clock::now() >= next_report){
+        le::ghs::HealthReport r = health.report(now_ms());
+        if (health.is_root()){
+          result.health=r;
           std::stringstream ss;
-          ss<<out_pld;
-          printf("[info] Sent: %s\n",ss.str().c_str());
-        } else if (retval == demo::ERR_NNG || retval == demo::ERR_HANGUP){
-          if (config.retry_connections){
-            printf("[error] Could not send, will retry: %d\n",retval);
-            ghs_buf.push(out_pld);
-            break;
+          for (size_t i=0;i<le::ghs::HEALTH_MAX_MISSING && r.missing[i]!=le::ghs::NO_AGENT;i++){
+            ss<<" "<<r.missing[i];
+          }
+          if (r.n_missing>0){
+            DEMO_LOG_WARN("fleet health: %u alive, %u missing (lost:%s), oldest news %u ms\n",
+                r.n_alive, r.n_missing, ss.str().c_str(), r.oldest_ms);
           } else {
-            printf("[error] Could not send, assuming gone: %d\n",retval);
+            DEMO_LOG_INFO("fleet health: %u alive, oldest news %u ms\n", r.n_alive, r.oldest_ms);
           }
         } else {
-          printf("[error] demo error. We may have populated a message incorreclty %d\n",-retval);
+          demo::WireMessage out;
+          out.header.agent_to=health.get_parent_id();
+          out.header.agent_from=config.my_id;
+          out.header.type=demo::PAYLOAD_TYPE_HEALTH;
+          out.header.payload_size=sizeof(r);
+          memcpy(out.bytes, &r, sizeof(r));
+          if (outbox.push(out)!=demo::OK){
+            DEMO_LOG_ERROR("could not queue a health report for %d\n", health.get_parent_id());
+          }
         }
+        //if we fell behind, do not send a burst to catch up
+        next_report = std::max(next_report+health_period, std::chrono::steady_clock::now());
       }
 
-      if (ghsp.is_converged()){
-        printf("Converged!\n");
-        wegood=false;
+      idle = outbox.pump(std::chrono::milliseconds(500));
+      if (serving){
+        auto until_report = std::chrono::duration_cast<std::chrono::milliseconds>(
+            next_report-std::chrono::steady_clock::now());
+        idle = std::max(std::chrono::milliseconds(0), std::min(idle, until_report));
+      }
+      if (deadline_due && !result.converged && !ghsp.is_converged()){
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline){
+          deadline_due=false;
+          ghsp.current_leader(result.early);
+          DEMO_LOG_WARN("not converged %.3f s after starting GHS, best leader so far: %d (level %d, %u agents)\n",
+              std::chrono::duration<double>(now-t_ghs).count(), result.early.leader, result.early.level, result.early.size);
+        } else {
+          auto until_deadline = std::chrono::duration_cast<std::chrono::milliseconds>(deadline-now);
+          idle = std::max(std::chrono::milliseconds(0), std::min(idle, until_deadline));
+        }
+      }
+
+      if (!result.converged && ghsp.is_converged()){
+        auto now = std::chrono::steady_clock::now();
+        DEMO_LOG_INFO("Converged! (leader %d, %.3f s after starting GHS)\n", ghsp.get_leader_id(),
+            std::chrono::duration<double>(now-t_ghs).count());
+        result.converged=true;
+        result.leader=ghsp.get_leader_id();
+        result.parent=ghsp.get_parent_id();
+        result.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now-t_start);
+        result.ghs_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now-t_ghs);
+        t_converged = now;
+        if (!config.broadcast_file.empty()){
+          le::Errno retval = cast.reset(ghsp);
+          casting = retval==le::OK;
+          if (!casting){
+            DEMO_LOG_ERROR("could not start the broadcast: %s\n", le::strerror(retval));
+          } else if (cast.is_root()){
+            std::ifstream f(config.broadcast_file, std::ios::binary);
+            std::vector<uint8_t> blob((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+            if (!f.good() && !f.eof()){
+              DEMO_LOG_ERROR("could not read %s, sending nothing\n", config.broadcast_file.c_str());
+              blob.clear();
+            }
+            retval = cast.send(blob.data(), blob.size(), chunks);
+            if (retval != le::OK){
+              DEMO_LOG_ERROR("could not broadcast %s: %s\n", config.broadcast_file.c_str(), le::strerror(retval));
+              casting=false;
+            } else {
+              DEMO_LOG_INFO("broadcasting %zu bytes of %s\n", blob.size(), config.broadcast_file.c_str());
+              result.broadcast = blob;
+              result.broadcast_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now()-t_converged);
+              push_chunks();
+            }
+          }
+          idle=std::chrono::milliseconds(0);
+        }
+        if (config.health_period_s>0){
+          //a child that has not reported for three periods is missing
+          le::Errno retval = health.reset(ghsp, (uint32_t)(3000*config.health_period_s), now_ms());
+          if (retval == le::OK){
+            serving=true;
+            next_report=now;
+            idle=std::chrono::milliseconds(0);
+            DEMO_LOG_INFO("reporting health to %d every %.3f s\n", health.get_parent_id(), config.health_period_s);
+          } else {
+            DEMO_LOG_ERROR("could not start health reports: %s\n", le::strerror(retval));
+          }
+        }
+      }
+      //our last messages (to our children, say) may still be queued behind
+      //slower ones, so give them up to one send timeout to go out
+      if (!flushing && result.converged && !serving && (!casting || cast.done())){
+        flushing=true;
+        flush_until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(config.send_timeout_s));
+      }
+      if (flushing && (outbox.size()==0 || std::chrono::steady_clock::now()>flush_until)){
+        running=false;
       }
 
     }
+    if (!result.converged){
+      result.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now()-t_start);
+      result.ghs_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now()-t_ghs);
+    }
+    if (outbox.size()>0){
+      DEMO_LOG_WARN("%zu messages were never delivered\n", outbox.size());
+    }
 
-    printf("[info] waiting a bit for cleanup ... \n");
-    sleep(3);
+    comms.stop_liveness();
+    comms.on_suspect(nullptr);
+    comms.stop_metrics();
     comms.stop_receiver();
-    printf("[info] Comms stopped ... Exiting\n");
+    DEMO_LOG_INFO("Comms stopped ... Exiting\n");
 
-    return 0;
+    return result;
+  }
+
+  int GhsDemoExec::run_cluster(Config &config, const std::atomic<bool> &keep_going, std::vector<AgentResult> *all)
+  {
+    int n = config.n_agents;
+    DEMO_LOG_INFO("starting a cluster of %d agents\n", n);
+
+    //every agent listens before any of them starts, so nobody waits on a late peer
+    std::vector<Config> configs(n, config);
+    std::vector<std::unique_ptr<Comms>> comms;
+    for (int i=0;i<n;i++){
+      configs[i].my_id=i;
+      comms.push_back(std::unique_ptr<Comms>(new Comms()));
+      comms[i]->with_config(configs[i]);
+      if (!comms[i]->ok()){
+        DEMO_LOG_ERROR("Cannot create comms for agent %d\n", i);
+        return 1;
+      }
+    }
+
+    std::vector<AgentResult> results(n);
+    std::vector<std::thread> agents;
+    for (int i=0;i<n;i++){
+      agents.push_back(std::thread([this,i,&configs,&comms,&results,&keep_going](){
+            results[i] = run_agent(configs[i], *comms[i], keep_going);
+            }));
+    }
+    for (auto &t : agents){
+      t.join();
+    }
+
+    int ret=0;
+    std::chrono::microseconds slowest(0), slowest_ghs(0), slowest_start(0);
+    for (int i=0;i<n;i++){
+      const AgentResult &r = results[i];
+      if (r.ret!=0 || !r.converged){
+        DEMO_LOG_ERROR("agent %d did not converge (%d)\n", i, r.ret);
+        ret=1;
+      } else if (r.leader!=results[0].leader){
+        DEMO_LOG_ERROR("agent %d thinks %d leads, agent 0 thinks %d\n", i, r.leader, results[0].leader);
+        ret=1;
+      }
+      slowest = std::max(slowest, r.elapsed);
+      slowest_ghs = std::max(slowest_ghs, r.ghs_elapsed);
+      slowest_start = std::max(slowest_start, r.cold_start);
+    }
+    if (ret==0){
+      DEMO_LOG_INFO("cluster of %d agents converged on leader %d in %.3f s (%.3f s to the last first SRCH, %.3f s in GHS)\n",
+          n, results[0].leader, slowest.count()/1e6, slowest_start.count()/1e6, slowest_ghs.count()/1e6);
+      if (config.health_period_s>0){
+        const le::ghs::HealthReport &h = results[results[0].leader].health;
+        DEMO_LOG_INFO("last fleet health: %u alive, %u missing\n", h.n_alive, h.n_missing);
+      }
+    }
+    if (all){
+      *all = results;
+    }
+    return ret;
   }
 }
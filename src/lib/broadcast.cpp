@@ -0,0 +1,222 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file broadcast.cpp
+ *
+ */
+
+#include "ghs/broadcast.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace le{
+  namespace ghs{
+
+    TreeBroadcast::TreeBroadcast(size_t c, size_t w)
+      : chunk_sz(std::max(c,(size_t)1)), window(std::max(w,(size_t)1)),
+      my_id(0), parent(0), blob(0), size(0), n_chunks(0), in_order(0), acked_up(0)
+    {
+    }
+
+    le::Errno TreeBroadcast::reset(agent_t id, agent_t par, const agent_t *kids, size_t n_kids){
+      auto ctl = check_tree_links(id, par, kids, n_kids);
+      if (OK != ctl){
+        return ctl;
+      }
+      std::vector<Child> fresh;
+      fresh.reserve(n_kids);
+      for (size_t i=0;i<n_kids;i++){
+        Child c;
+        c.id=kids[i];
+        c.sent=0;
+        c.acked=0;
+        fresh.push_back(c);
+      }
+      my_id=id;
+      parent=par;
+      children.swap(fresh);
+      blob=0;
+      begin(0,0,0);
+      return OK;
+    }
+
+    void TreeBroadcast::begin(uint32_t id, uint32_t sz, uint32_t n){
+      blob=id;
+      size=sz;
+      n_chunks=n;
+      in_order=0;
+      acked_up=0;
+      buf.assign(sz,0);
+      have.assign(n,false);
+      for (auto &c : children){
+        c.sent=0;
+        c.acked=0;
+      }
+    }
+
+    void TreeBroadcast::span(uint32_t i, size_t &offset, size_t &len) const{
+      //every chunk but the last is the same size
+      size_t each = n_chunks>0 ? (size+n_chunks-1)/n_chunks : 0;
+      offset = std::min((size_t)size, i*each);
+      len = std::min((size_t)size, offset+each)-offset;
+    }
+
+    bool TreeBroadcast::done() const{
+      if (!complete()){
+        return false;
+      }
+      for (const auto &c : children){
+        if (c.acked<n_chunks){
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void TreeBroadcast::forward(Child &c, std::vector<ChunkSend> &out){
+      while (c.sent<in_order && c.sent-c.acked<window){
+        ChunkSend s;
+        s.to=c.id;
+        s.h.blob=blob;
+        s.h.index=c.sent;
+        s.h.n_chunks=n_chunks;
+        s.h.size=size;
+        s.h.ack=0;
+        s.h.window=(uint32_t)std::min(window,(size_t)std::numeric_limits<uint32_t>::max());
+        size_t offset, len;
+        span(c.sent, offset, len);
+        s.h.len=(uint32_t)len;
+        s.data=buf.data()+offset;
+        out.push_back(s);
+        c.sent++;
+      }
+    }
+
+    le::Errno TreeBroadcast::send(const uint8_t *data, size_t len, std::vector<ChunkSend> &out){
+      if (!is_root()){
+        return CAST_REQ_ROOT;
+      }
+      if (len>std::numeric_limits<uint32_t>::max()){
+        return BAD_MSG;
+      }
+      //an empty payload is still one (empty) chunk, so that it arrives
+      size_t n = std::max((size_t)1,(len+chunk_sz-1)/chunk_sz);
+      begin(blob+1,(uint32_t)len,(uint32_t)n);
+      if (len>0){
+        memcpy(buf.data(),data,len);
+      }
+      have.assign(n,true);
+      in_order=n_chunks;
+      for (auto &c : children){
+        forward(c,out);
+      }
+      return OK;
+    }
+
+    le::Errno TreeBroadcast::receive(agent_t from, const ChunkHeader &h, const uint8_t *data, std::vector<ChunkSend> &out){
+      if (from==my_id){
+        return PROCESS_SELFMSG;
+      }
+
+      if (h.ack){
+        for (auto &c : children){
+          if (c.id!=from){
+            continue;
+          }
+          if (h.blob<blob){
+            return OK;
+          }
+          if (h.blob>blob || h.index>c.sent){
+            return BAD_MSG;
+          }
+          c.acked=std::max(c.acked,h.index);
+          forward(c,out);
+          return OK;
+        }
+        return NO_SUCH_PEER;
+      }
+
+      if (from!=parent || is_root()){
+        return PROCESS_REQ_MST;
+      }
+      if (h.blob<blob){
+        return OK;
+      }
+      if (h.n_chunks==0 || h.index>=h.n_chunks || h.n_chunks>std::max(h.size,(uint32_t)1)){
+        return BAD_MSG;
+      }
+      if (h.blob>blob){
+        begin(h.blob,h.size,h.n_chunks);
+      } else if (h.size!=size || h.n_chunks!=n_chunks){
+        return BAD_MSG;
+      }
+      size_t offset, len;
+      span(h.index, offset, len);
+      if (h.len!=len || (len>0 && data==nullptr)){
+        return BAD_MSG;
+      }
+      if (!have[h.index]){
+        if (len>0){
+          memcpy(buf.data()+offset,data,len);
+        }
+        have[h.index]=true;
+      }
+      while (in_order<n_chunks && have[in_order]){
+        in_order++;
+      }
+
+      //ack before the sender's window fills, and when we have it all
+      uint32_t every = std::max((uint32_t)1,h.window/2);
+      if (in_order-acked_up>=every || (complete() && acked_up<in_order)){
+        ChunkSend a;
+        a.to=parent;
+        a.h.blob=blob;
+        a.h.index=in_order;
+        a.h.n_chunks=n_chunks;
+        a.h.size=size;
+        a.h.len=0;
+        a.h.ack=1;
+        a.data=nullptr;
+        out.push_back(a);
+        acked_up=in_order;
+      }
+      for (auto &c : children){
+        forward(c,out);
+      }
+      return OK;
+    }
+
+  }
+}
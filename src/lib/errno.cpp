@@ -79,6 +79,14 @@ namespace le{
       case ERR_NO_SUCH_ELEMENT: { return "Queue IDX >= size()"; }
       case PARTIAL_RESULT: { return "The algorithm has not converged!"; }
       case NO_AGENTS: { return "The algorithm has not converged!"; }
+      case DROP_REQ_RESTART: { return "Dropped an MST edge (or the chosen MWOE), the election must be restarted"; }
+      case AGG_STALE_ROUND: { return "That round of aggregation is already over"; }
+      case CAST_REQ_ROOT: { return "Only the root of the MST can start a broadcast"; }
+      case UPDATE_REQ_CONVERGED: { return "Edge metrics can only be updated once the algorithm has converged"; }
+      case HINT_MISMATCH: { return "The hints do not match the edges, the election starts from scratch"; }
+      case SESSION_STALE: { return "That session has been retired"; }
+      case SESSION_UNKNOWN: { return "No such session is open"; }
+      case SESSION_EXISTS: { return "That session is already open"; }
       // DO NOT ADD DEFAULT or you lose compile-time checks for new error codes.
     }
     return "You should not see this message (errno.cpp)";
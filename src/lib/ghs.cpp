@@ -41,5 +41,20 @@
 namespace le{
   namespace ghs{
 
+    le::Errno check_tree_links(agent_t id, agent_t parent, const agent_t *children, size_t n_children){
+      if (!is_valid(id) || !is_valid(parent)){
+        return SET_INVALID_EDGE_NO_AGENT;
+      }
+      for (size_t i=0;i<n_children;i++){
+        if (!is_valid(children[i])){
+          return SET_INVALID_EDGE_NO_AGENT;
+        }
+        if (children[i]==id){
+          return SET_INVALID_EDGE_SELF_LOOP;
+        }
+      }
+      return OK;
+    }
+
   }
 }
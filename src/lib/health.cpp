@@ -0,0 +1,136 @@
+/**
+ *   Copyright (c) 2022 California Institute of Technology (“Caltech”). 
+ *   U.S.  Government sponsorship acknowledged.
+ *
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    *  Neither the name of Caltech nor its operating division, the Jet
+ *    Propulsion Laboratory, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file health.cpp
+ *
+ */
+
+#include "ghs/health.h"
+#include <algorithm>
+
+namespace le{
+  namespace ghs{
+
+    namespace {
+      //the counts are 32 bits on the wire, so they stop at the top rather than wrap
+      uint32_t clamp32(uint64_t v){
+        return v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+      }
+
+      void add_missing(HealthReport &r, agent_t who){
+        for (size_t i=0;i<HEALTH_MAX_MISSING;i++){
+          if (r.missing[i]==NO_AGENT){
+            r.missing[i]=who;
+            return;
+          }
+        }
+      }
+    }
+
+    TreeHealth::TreeHealth()
+      : my_id(0), parent(0), miss_after_ms(0), seq(0)
+    {
+    }
+
+    le::Errno TreeHealth::reset(agent_t id, agent_t par, const agent_t *kids, size_t n_kids, uint32_t miss_after, uint64_t now_ms){
+      auto ctl = check_tree_links(id, par, kids, n_kids);
+      if (OK != ctl){
+        return ctl;
+      }
+      std::vector<Child> fresh;
+      fresh.reserve(n_kids);
+      for (size_t i=0;i<n_kids;i++){
+        Child c;
+        c.id=kids[i];
+        c.heard=false;
+        c.last_ms=now_ms;
+        fresh.push_back(c);
+      }
+      my_id=id;
+      parent=par;
+      miss_after_ms=miss_after;
+      seq=0;
+      children.swap(fresh);
+      return OK;
+    }
+
+    le::Errno TreeHealth::receive(agent_t from, const HealthReport &r, uint64_t now_ms){
+      if (from==my_id){
+        return PROCESS_SELFMSG;
+      }
+      for (auto &c : children){
+        if (c.id==from){
+          c.heard=true;
+          c.last_ms=now_ms;
+          c.last=r;
+          return OK;
+        }
+      }
+      return NO_SUCH_PEER;
+    }
+
+    HealthReport TreeHealth::report(uint64_t now_ms){
+      HealthReport r;
+      r.seq=++seq;
+      uint64_t alive=1, missing=0, oldest=0;
+      for (const auto &c : children){
+        //a child that has never reported has had since reset() to do so
+        uint64_t age = now_ms > c.last_ms ? now_ms-c.last_ms : 0;
+        if (age > miss_after_ms){
+          //all we know of its subtree is what it last told us
+          missing += c.heard ? (uint64_t)c.last.n_alive+c.last.n_missing : 1;
+          add_missing(r, c.id);
+          continue;
+        }
+        if (!c.heard){
+          //give it the benefit of the doubt, for now
+          alive++;
+          oldest = std::max(oldest, age);
+          continue;
+        }
+        alive += c.last.n_alive;
+        missing += c.last.n_missing;
+        oldest = std::max(oldest, age+c.last.oldest_ms);
+        for (size_t i=0;i<HEALTH_MAX_MISSING && c.last.missing[i]!=NO_AGENT;i++){
+          add_missing(r, c.last.missing[i]);
+        }
+      }
+      r.n_alive=clamp32(alive);
+      r.n_missing=clamp32(missing);
+      r.oldest_ms=clamp32(oldest);
+      return r;
+    }
+
+  }
+}
@@ -73,9 +73,71 @@ namespace le{
       type_=JOIN_US;
       data_.join_us=p;
     }
+    Msg::Msg(agent_t to, agent_t from, AbsorbedPayload p):to_(to),from_(from){
+      type_=ABSORBED;
+      data_.absorbed=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, RepairPayload p):to_(to),from_(from){
+      type_=REPAIR;
+      data_.repair=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, RepairAckPayload p):to_(to),from_(from){
+      type_=REPAIR_ACK;
+      data_.repair_ack=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, ProbePayload p):to_(to),from_(from){
+      type_=PROBE;
+      data_.probe=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, ProbeRetPayload p):to_(to),from_(from){
+      type_=PROBE_RET;
+      data_.probe_ret=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, CyclePayload p):to_(to),from_(from){
+      type_=CYCLE;
+      data_.cycle=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, CutPayload p):to_(to),from_(from){
+      type_=CUT;
+      data_.cut=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, WarmAckPayload p):to_(to),from_(from){
+      type_=WARM_ACK;
+      data_.warm_ack=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, WarmDonePayload p):to_(to),from_(from){
+      type_=WARM_DONE;
+      data_.warm_done=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, WarmNackPayload p):to_(to),from_(from){
+      type_=WARM_NACK;
+      data_.warm_nack=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, CenterPayload p):to_(to),from_(from){
+      type_=CENTER;
+      data_.center=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, ShedPayload p):to_(to),from_(from){
+      type_=SHED;
+      data_.shed=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, ShedDonePayload p):to_(to),from_(from){
+      type_=SHED_DONE;
+      data_.shed_done=p;
+    }
+    Msg::Msg(agent_t to, agent_t from, CrowdedPayload p):to_(to),from_(from){
+      type_=CROWDED;
+      data_.crowded=p;
+    }
     Msg::Msg(agent_t to, agent_t from, const Msg &other):to_(to),from_(from){
       type_=other.type();
       data_=other.data();
+      session_=other.session();
+    }
+    Msg::Msg(session_t session, const Msg &other):to_(other.to()),from_(other.from()){
+      type_=other.type();
+      data_=other.data();
+      session_=session;
     }
     Msg::Msg(agent_t to, agent_t from, Type t, Data d):to_(to),from_(from){
       type_=t;
@@ -52,6 +52,20 @@ std::string to_string(const msg::Type &type){
 		case msg::Type::ACK_PART:{return "ACK_PART";}
 		case msg::Type::NACK_PART:{return "NACK_PART";}
 		case msg::Type::JOIN_US:{return "JOIN_US";}
+		case msg::Type::ABSORBED:{return "ABSORBED";}
+		case msg::Type::REPAIR:{return "REPAIR";}
+		case msg::Type::REPAIR_ACK:{return "REPAIR_ACK";}
+		case msg::Type::PROBE:{return "PROBE";}
+		case msg::Type::PROBE_RET:{return "PROBE_RET";}
+		case msg::Type::CYCLE:{return "CYCLE";}
+		case msg::Type::CUT:{return "CUT";}
+		case msg::Type::WARM_ACK:{return "WARM_ACK";}
+		case msg::Type::WARM_DONE:{return "WARM_DONE";}
+		case msg::Type::WARM_NACK:{return "WARM_NACK";}
+		case msg::Type::CENTER:{return "CENTER";}
+		case msg::Type::SHED:{return "SHED";}
+		case msg::Type::SHED_DONE:{return "SHED_DONE";}
+		case msg::Type::CROWDED:{return "CROWDED";}
 		default: {return "??";};
 	}
 }
@@ -65,34 +79,53 @@ std::ostream& operator << ( std::ostream& outs, const msg::Type & type )
 std::ostream& operator << ( std::ostream& outs, const Msg & m)
 {
   using namespace le::ghs;
-  outs << "("<<m.from()<<"-->"<< m.to()<<") "<< m.type()<<" {";
+  outs << "("<<m.from()<<"-->"<< m.to()<<") ";
+  if (m.session() != NO_SESSION){
+    outs << "s:"<<m.session()<<" ";
+  }
+  outs << m.type()<<" {";
   switch (m.type()){
     case msg::Type::UNASSIGNED: { break; }
     case msg::Type::NOOP:
-      { break; }
+      {
+        outs<<"sz:"<<m.data().noop.size<<" ";
+        outs<<"ldr:"<<m.data().noop.leader<<" ";
+        outs<<"cost:"<<m.data().noop.cost;
+        if (m.data().noop.swapping){
+          outs<<" swapping";
+        }
+        break;
+      }
     case msg::Type::SRCH:
       {
         outs<<"ldr:"<<m.data().srch.your_leader<<" ";
-        outs<<"lvl:"<<m.data().srch.your_level;
+        outs<<"lvl:"<<m.data().srch.your_level<<" ";
+        outs<<"sz:"<<m.data().srch.your_size;
         break;
       }
     case msg::Type::SRCH_RET:
       {
         outs<<"peer"<<m.data().srch_ret.to<<" ";
         outs<<"root:"<<m.data().srch_ret.from<<" ";
-        outs<<"val:"<<m.data().srch_ret.metric;
+        outs<<"val:"<<m.data().srch_ret.metric<<" ";
+        outs<<"sz:"<<m.data().srch_ret.subtree_size<<" ";
+        outs<<"ht:"<<m.data().srch_ret.height;
         break;
       }
     case msg::Type::IN_PART:
       {
         outs<<"ldr:"<<m.data().in_part.leader<<" ";
-        outs<<"lvl:"<<m.data().in_part.level;
+        outs<<"lvl:"<<m.data().in_part.level<<" ";
+        outs<<"sz:"<<m.data().in_part.size;
         break;
       }
     case msg::Type::ACK_PART:
       { break; }
     case msg::Type::NACK_PART:
-      { break; }
+      {
+        outs<<"deg:"<<m.data().nack_part.degree;
+        break;
+      }
     case msg::Type::JOIN_US:
       {
         outs<<"peer:"<<m.data().join_us.join_peer<<" ";
@@ -101,6 +134,79 @@ std::ostream& operator << ( std::ostream& outs, const Msg & m)
         outs<<"root-lvl:"<<m.data().join_us.proposed_level;
         break;
       }
+    case msg::Type::ABSORBED:
+      {
+        outs<<"ldr:"<<m.data().absorbed.leader<<" ";
+        outs<<"lvl:"<<m.data().absorbed.level;
+        break;
+      }
+    case msg::Type::REPAIR:
+      {
+        outs<<"ldr:"<<m.data().repair.leader<<" ";
+        outs<<"lvl:"<<m.data().repair.level;
+        if (m.data().repair.shed){
+          outs<<" shed";
+        }
+        break;
+      }
+    case msg::Type::REPAIR_ACK:
+      { break; }
+    case msg::Type::PROBE:
+      { break; }
+    case msg::Type::PROBE_RET:
+      { break; }
+    case msg::Type::CYCLE:
+      {
+        outs<<"tgt:"<<m.data().cycle.target<<" ";
+        outs<<"org:"<<m.data().cycle.origin<<" ";
+        outs<<"max:"<<m.data().cycle.heavy_parent<<"-"<<m.data().cycle.heavy_child<<" ";
+        outs<<"max-val:"<<m.data().cycle.heaviest;
+        break;
+      }
+    case msg::Type::CUT:
+      {
+        outs<<"parent:"<<m.data().cut.parent<<" ";
+        outs<<"child:"<<m.data().cut.child;
+        if (m.data().cut.shed){
+          outs<<" shed";
+        }
+        break;
+      }
+    case msg::Type::WARM_ACK:
+      {
+        outs<<"ldr:"<<m.data().warm_ack.leader<<" ";
+        outs<<"lvl:"<<m.data().warm_ack.level;
+        break;
+      }
+    case msg::Type::WARM_DONE:
+      { break; }
+    case msg::Type::WARM_NACK:
+      { break; }
+    case msg::Type::CENTER:
+      {
+        outs<<"up:"<<m.data().center.up<<" ";
+        outs<<"sz:"<<m.data().center.size<<" ";
+        outs<<"cost:"<<m.data().center.cost;
+        break;
+      }
+    case msg::Type::SHED:
+      {
+        outs<<"tgt:"<<m.data().shed.target;
+        break;
+      }
+    case msg::Type::SHED_DONE:
+      {
+        outs<<"added:"<<m.data().shed_done.added<<" ";
+        outs<<"removed:"<<m.data().shed_done.removed;
+        break;
+      }
+    case msg::Type::CROWDED:
+      {
+        outs<<"crowded:"<<m.data().crowded.crowded<<" ";
+        outs<<"deg:"<<m.data().crowded.degree<<" ";
+        outs<<"rank:"<<(int)m.data().crowded.rank;
+        break;
+      }
   }
   outs<<"}";
   return outs;
@@ -40,10 +40,20 @@
 
 #include "doctest/doctest.h"
 #include "ghs/ghs.h"
+#include "ghs/health.h"
+#include "ghs/aggregate.h"
+#include "ghs/broadcast.h"
+#include "ghs/session.h"
 #include "ghs/ghs_printer.h"
 #include "ghs/msg_printer.h"
 #include <fstream>
 #include <vector>
+#include <deque>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <tuple>
 
 using namespace le::ghs;
 
@@ -313,6 +323,8 @@ TEST_CASE("unit-test start_round() on leader, discarded peers")
   CHECK_EQ(OK, s.start_round(buf, sz));
   //do they report no MWOE to parent? No, no parent
   CHECK_EQ(buf.size(),0);
+  //and with no live links, there is nothing left to do
+  CHECK(s.is_converged());
 }
 
 TEST_CASE("unit-test start_round() on leader, mixed peers")
@@ -861,6 +873,64 @@ TEST_CASE("unit-test process_nack_part, not-leader"){
 
 }
 
+TEST_CASE("unit-test drop_edge"){
+
+  //two outgoing unknown edges (1,2) and our parent, 3
+  auto s = get_state<4,32>(0,2,0,1,false);
+  StaticQueue<Msg,32> buf;
+  Msg m;
+  size_t sz;
+
+  CHECK_EQ(NO_SUCH_PEER,        s.drop_edge(4,buf,sz));
+  CHECK_EQ(IMPL_REQ_PEER_MY_ID, s.drop_edge(0,buf,sz));
+
+  //the search starts, and we ask 1 and 2 if they are in our partition
+  m =Msg(0,3,SrchPayload{3,0});
+  CHECK_EQ(OK,s.process(m, buf, sz));
+  CHECK_EQ(buf.size(),2);
+  buf.pop();
+  buf.pop();
+  CHECK_EQ(s.waiting_count(),2);
+
+  //2 is not, then 1 dies before it answers
+  m =Msg(0,2,NackPartPayload{});
+  CHECK_EQ(OK,s.process(m,buf, sz));
+  CHECK_EQ(s.waiting_count(),1);
+  CHECK_EQ(OK,s.drop_edge(1,buf,sz));
+  CHECK_EQ(s.waiting_count(),0);
+
+  //so the search ends, and the edge to 2 goes up to the leader
+  CHECK_EQ(sz,1);
+  CHECK_EQ(buf.size(),1);
+  Msg out;
+  CHECK(OK== (buf.front(out)) );
+  CHECK_EQ(out.type(),  msg::Type::SRCH_RET);
+  CHECK_EQ(out.to(),    3);
+  CHECK_EQ(out.data().srch_ret.to,     2);
+  CHECK_EQ(out.data().srch_ret.metric, 20);
+  buf.pop();
+
+  status_t st;
+  CHECK_EQ(OK,s.get_edge_status(1,st));
+  CHECK_EQ(st, DELETED);
+  //a late answer from 1 is refused
+  m =Msg(0,1,NackPartPayload{});
+  CHECK_EQ(ACK_NOT_WAITING,s.process(m,buf, sz));
+
+  //dropping it again changes nothing
+  CHECK_EQ(OK,s.drop_edge(1,buf,sz));
+  CHECK_EQ(sz,0);
+
+  //2 is the edge we reported to join over, and 3 holds the tree together
+  CHECK_EQ(DROP_REQ_RESTART,s.drop_edge(2,buf,sz));
+  CHECK_EQ(sz,0);
+  CHECK_EQ(DROP_REQ_RESTART,s.drop_edge(3,buf,sz));
+  CHECK_EQ(sz,0);
+  CHECK_EQ(OK,s.get_edge_status(3,st));
+  CHECK_EQ(st, DELETED);
+  CHECK_EQ(buf.size(),0);
+}
+
 TEST_CASE("unit-test join_us nodes pass")
 {
 
@@ -1336,6 +1406,1952 @@ TEST_CASE("sim-test 3 node frenzy")
 
 }
 
+TEST_CASE("unit-test dynamic peer storage")
+{
+  std::vector<Edge> edges;
+  for (agent_t i=1;i<=6;i++){
+    edges.push_back({i,0,UNKNOWN,(metric_t)i});
+  }
+  //fixed storage stops at NUM_AGENTS
+  GhsState<4,32> fixed(0,edges.data(),edges.size());
+  CHECK_EQ(fixed.get_n_peers(),4);
+  CHECK_FALSE(fixed.has_edge(5));
+
+  //dynamic storage takes them all
+  GhsState<0,32> dynamic(0,edges.data(),edges.size());
+  CHECK_EQ(dynamic.get_n_peers(),6);
+  size_t idx;
+  CHECK_EQ(dynamic.checked_index_of(6,idx),OK);
+  CHECK_EQ(idx,5);
+  Edge e;
+  CHECK_EQ(dynamic.get_edge(6,e),OK);
+  CHECK_EQ(e.metric_val,6);
+  CHECK_EQ(dynamic.waiting_count(),0);
+  CHECK_EQ(dynamic.delayed_count(),0);
+
+  //and empty is fine too
+  GhsState<0,32> empty(0,{},0);
+  CHECK_EQ(empty.get_n_peers(),0);
+  CHECK_FALSE(empty.has_edge(1));
+}
+
+TEST_CASE("sim-test dynamic peer storage, 12 node full graph")
+{
+  const int N=12;
+  std::vector<GhsState<0,1024>> states;
+  for (int i=0;i<N;i++){
+    std::vector<Edge> edges;
+    for (int j=0;j<N;j++){
+      if (i!=j){
+        edges.push_back({j,i,UNKNOWN,(metric_t)( (1<<i) + (1<<j))});
+      }
+    }
+    states.push_back(GhsState<0,1024>(i,edges.data(),edges.size()));
+    REQUIRE_EQ(states.back().get_n_peers(),N-1);
+  }
+
+  StaticQueue<Msg,1024> buf;
+  for (int i=0;i<N;i++){
+    size_t sz;
+    REQUIRE_EQ(states[i].start_round(buf, sz),OK);
+  }
+  int msg_limit = 100000;
+  int msg_count = 0;
+  while(buf.size()>0 && msg_count++ < msg_limit){
+    Msg m; 
+    if (OK!=buf.pop(m)){break;}
+    size_t sz;
+    REQUIRE_EQ(states[m.to()].process(m,buf, sz),OK);
+  }
+
+  CHECK_EQ(buf.size(),0);
+  CHECK_LT(msg_count, msg_limit);
+  for (int i=0;i<N;i++){
+    CHECK(states[i].is_converged());
+    CHECK_EQ(states[i].get_leader_id(), states[0].get_leader_id());
+  }
+}
+
+TEST_CASE("sim-test tree health")
+{
+  const int N=12;
+  std::vector<GhsState<0,1024>> states;
+  for (int i=0;i<N;i++){
+    std::vector<Edge> edges;
+    for (int j=0;j<N;j++){
+      if (i!=j){
+        edges.push_back({j,i,UNKNOWN,(metric_t)( (1<<i) + (1<<j))});
+      }
+    }
+    states.push_back(GhsState<0,1024>(i,edges.data(),edges.size()));
+  }
+
+  //not before the tree is done
+  le::ghs::TreeHealth early;
+  CHECK_EQ(early.reset(states[0], 300, 0), PARTIAL_RESULT);
+
+  StaticQueue<Msg,1024> buf;
+  for (int i=0;i<N;i++){
+    size_t sz;
+    REQUIRE_EQ(states[i].start_round(buf, sz),OK);
+  }
+  while(buf.size()>0){
+    Msg m; 
+    REQUIRE_EQ(buf.pop(m),OK);
+    size_t sz;
+    REQUIRE_EQ(states[m.to()].process(m,buf, sz),OK);
+  }
+
+  //the children lists and parents describe the same tree
+  agent_t root = states[0].get_leader_id();
+  size_t n_children=0;
+  std::vector<le::ghs::TreeHealth> health(N);
+  for (int i=0;i<N;i++){
+    REQUIRE(states[i].is_converged());
+    agent_t kids[N];
+    size_t n = states[i].mst_children(kids, N);
+    n_children += n;
+    for (size_t k=0;k<n;k++){
+      CHECK_EQ(states[kids[k]].get_parent_id(), i);
+    }
+    //and a short list is still counted in full
+    CHECK_EQ(states[i].mst_children(kids, 0), n);
+    REQUIRE_EQ(health[i].reset(states[i], 300, 0), OK);
+    CHECK_EQ(health[i].n_children(), n);
+    CHECK_EQ(health[i].is_root(), i==root);
+  }
+  CHECK_EQ(n_children, N-1);
+
+  //one period: everyone reports to their parent, as if it arrived at once
+  std::vector<bool> dead(N,false);
+  le::ghs::HealthReport summary;
+  auto period = [&](uint64_t now){
+    for (int i=0;i<N;i++){
+      if (dead[i]){
+        continue;
+      }
+      le::ghs::HealthReport r = health[i].report(now);
+      if (health[i].is_root()){
+        summary = r;
+      } else {
+        CHECK_EQ(health[health[i].get_parent_id()].receive(i, r, now), OK);
+      }
+    }
+  };
+  for (uint64_t t=100;t<=1000;t+=100){
+    period(t);
+  }
+  CHECK_EQ(summary.n_alive, N);
+  CHECK_EQ(summary.n_missing, 0);
+  CHECK_EQ(summary.missing[0], NO_AGENT);
+  CHECK(summary.oldest_ms <= 100*N);
+  CHECK(summary.seq >= 10);
+
+  //only children report to us
+  le::ghs::HealthReport stray;
+  CHECK_EQ(health[root].receive(root, stray, 1000), PROCESS_SELFMSG);
+  agent_t parent = health[root==0?1:0].get_parent_id();
+  CHECK_EQ(health[root==0?1:0].receive(parent, stray, 1000), NO_SUCH_PEER);
+
+  //kill the agent with the largest subtree below the root (and so all of it)
+  std::vector<int> size(N,0);
+  auto subtree = [&](int i){
+    for (int j=0;j<N;j++){
+      for (agent_t a=j; ; a=states[a].get_parent_id()){
+        if (a==i){
+          size[i]++;
+          break;
+        }
+        if (a==root){
+          break;
+        }
+      }
+    }
+  };
+  int victim=-1;
+  for (int i=0;i<N;i++){
+    if (i!=root){
+      subtree(i);
+      if (victim<0 || size[i]>size[victim]){
+        victim=i;
+      }
+    }
+  }
+  REQUIRE(victim>=0);
+  dead[victim]=true;
+  //not missing until 300 ms have passed
+  period(1100);
+  CHECK_EQ(summary.n_missing, 0);
+  for (uint64_t t=1200;t<=2000;t+=100){
+    period(t);
+  }
+  CHECK_EQ(summary.n_alive, N-size[victim]);
+  CHECK_EQ(summary.n_missing, size[victim]);
+  CHECK_EQ(summary.missing[0], victim);
+  CHECK_EQ(summary.missing[1], NO_AGENT);
+}
+
+TEST_CASE("sim-test aggregation")
+{
+  const int N=12;
+  std::vector<GhsState<0,1024>> states;
+  for (int i=0;i<N;i++){
+    std::vector<Edge> edges;
+    for (int j=0;j<N;j++){
+      if (i!=j){
+        edges.push_back({j,i,UNKNOWN,(metric_t)( (1<<i) + (1<<j))});
+      }
+    }
+    states.push_back(GhsState<0,1024>(i,edges.data(),edges.size()));
+  }
+
+  //min battery, sum of queue depths, max load, and a count, all at once
+  typedef le::ghs::Aggregator<long,4> Agg;
+  std::array<Agg::Combine,4> ops={{
+    [](const long &a, const long &b){ return std::min(a,b); },
+    [](const long &a, const long &b){ return a+b; },
+    [](const long &a, const long &b){ return std::max(a,b); },
+    [](const long &a, const long &b){ return a+b; },
+  }};
+  std::vector<Agg> aggs(N, Agg(ops));
+  CHECK_EQ(aggs[0].reset(states[0]), PARTIAL_RESULT);
+
+  StaticQueue<Msg,1024> buf;
+  for (int i=0;i<N;i++){
+    size_t sz;
+    REQUIRE_EQ(states[i].start_round(buf, sz),OK);
+  }
+  while(buf.size()>0){
+    Msg m; 
+    REQUIRE_EQ(buf.pop(m),OK);
+    size_t sz;
+    REQUIRE_EQ(states[m.to()].process(m,buf, sz),OK);
+  }
+  agent_t root = states[0].get_leader_id();
+  for (int i=0;i<N;i++){
+    REQUIRE_EQ(aggs[i].reset(states[i]), OK);
+  }
+
+  auto local = [](int i, uint32_t round){
+    return std::array<long,4>{{ 100-3*i+(long)round, i, (5*i)%11, 1 }};
+  };
+  //sends, (from, partial), delivered in random order
+  std::mt19937 rng(3);
+  std::vector<std::pair<agent_t,Agg::Partial>> wire;
+  Agg::Partial result;
+  bool finished=false;
+  int sent=0;
+  auto forward = [&](agent_t i, const Agg::Partial &out, bool done){
+    if (!done){
+      return;
+    }
+    if (aggs[i].is_root()){
+      result=out;
+      finished=true;
+    } else {
+      wire.push_back({i,out});
+      sent++;
+    }
+  };
+  auto deliver = [&](){
+    while (!wire.empty()){
+      size_t k = rng()%wire.size();
+      auto w = wire[k];
+      wire.erase(wire.begin()+k);
+      Agg::Partial out;
+      bool done;
+      agent_t to = aggs[w.first].get_parent_id();
+      REQUIRE_EQ(aggs[to].receive(w.first, w.second, out, done), OK);
+      forward(to, out, done);
+    }
+  };
+
+  for (uint32_t round=1;round<=2;round++){
+    finished=false;
+    sent=0;
+    //round 1 in id order, round 2 leaves first, so children are sometimes ahead of their parents
+    std::vector<int> order;
+    for (int i=0;i<N;i++){
+      order.push_back(round==1 ? i : N-1-i);
+    }
+    for (int i : order){
+      Agg::Partial out;
+      bool done;
+      REQUIRE_EQ(aggs[i].contribute(round, local(i,round), out, done), OK);
+      forward(i, out, done);
+    }
+    deliver();
+    REQUIRE(finished);
+    CHECK_EQ(result.round, round);
+    CHECK_EQ(result.values[0], 100-3*(N-1)+(long)round);
+    CHECK_EQ(result.values[1], N*(N-1)/2);
+    CHECK_EQ(result.values[2], 10);
+    CHECK_EQ(result.values[3], N);
+    //one message per agent, and none from the root
+    CHECK_EQ(sent, N-1);
+    CHECK_EQ(aggs[root].last_round(), round);
+  }
+
+  //round 3 is skipped by one agent, so it never finishes, but round 4 does
+  agent_t skip = root==0 ? 1 : 0;
+  finished=false;
+  for (int i=0;i<N;i++){
+    if (i!=skip){
+      Agg::Partial out;
+      bool done;
+      REQUIRE_EQ(aggs[i].contribute(3, local(i,3), out, done), OK);
+      forward(i, out, done);
+    }
+  }
+  deliver();
+  CHECK_FALSE(finished);
+  for (int i=0;i<N;i++){
+    Agg::Partial out;
+    bool done;
+    REQUIRE_EQ(aggs[i].contribute(4, local(i,4), out, done), OK);
+    forward(i, out, done);
+  }
+  deliver();
+  REQUIRE(finished);
+  CHECK_EQ(result.round, 4);
+  CHECK_EQ(result.values[3], N);
+
+  //rounds that are over, and strangers, are turned away
+  Agg::Partial out, old;
+  bool done;
+  old.round=2;
+  CHECK_EQ(aggs[root].contribute(4, local(root,4), out, done), AGG_STALE_ROUND);
+  CHECK_FALSE(done);
+  agent_t kid=NO_AGENT;
+  REQUIRE(states[root].mst_children(&kid, 1) > 0);
+  CHECK_EQ(aggs[root].receive(kid, old, out, done), AGG_STALE_ROUND);
+  CHECK_EQ(aggs[root].receive(root, old, out, done), PROCESS_SELFMSG);
+  CHECK_EQ(aggs[kid].receive(root, old, out, done), NO_SUCH_PEER);
+}
+
+TEST_CASE("sim-test tree broadcast pipelines chunks")
+{
+  //a chain 0-1-...-7, rooted at 0, is the worst case for store-and-forward
+  const int N=8;
+  const size_t CHUNK=100, WINDOW=4;
+  std::vector<le::ghs::TreeBroadcast> nodes(N, le::ghs::TreeBroadcast(CHUNK,WINDOW));
+  for (int i=0;i<N;i++){
+    agent_t kid=i+1;
+    REQUIRE_EQ(nodes[i].reset(i, i==0?0:i-1, &kid, i<N-1?1:0), OK);
+  }
+  std::vector<uint8_t> blob(64*CHUNK-37);
+  for (size_t i=0;i<blob.size();i++){
+    blob[i]=(uint8_t)(i*7+3);
+  }
+
+  //each step, every link (each way) carries one message
+  typedef std::pair<le::ghs::ChunkHeader,std::vector<uint8_t>> Wire;
+  std::map<std::pair<agent_t,agent_t>,std::deque<Wire>> links;
+  auto post = [&](agent_t from, std::vector<le::ghs::ChunkSend> &out){
+    for (auto &s : out){
+      std::vector<uint8_t> bytes;
+      if (s.data){
+        bytes.assign(s.data, s.data+s.h.len);
+      }
+      links[{from,s.to}].push_back({s.h,bytes});
+    }
+    out.clear();
+  };
+  std::vector<le::ghs::ChunkSend> out;
+  CHECK_EQ(nodes[1].send(blob.data(), blob.size(), out), CAST_REQ_ROOT);
+  REQUIRE_EQ(nodes[0].send(blob.data(), blob.size(), out), OK);
+  //no more than the window goes out at once
+  CHECK_EQ(out.size(), WINDOW);
+  post(0,out);
+
+  int steps=0, msgs=0;
+  auto all_done = [&](){
+    for (auto &n : nodes){
+      if (!n.done()){
+        return false;
+      }
+    }
+    return true;
+  };
+  while (!all_done() && steps<10000){
+    steps++;
+    std::vector<std::pair<std::pair<agent_t,agent_t>,Wire>> now;
+    for (auto &l : links){
+      if (!l.second.empty()){
+        now.push_back({l.first,l.second.front()});
+        l.second.pop_front();
+      }
+    }
+    for (auto &w : now){
+      msgs++;
+      agent_t from=w.first.first, to=w.first.second;
+      REQUIRE_EQ(nodes[to].receive(from, w.second.first, w.second.second.data(), out), OK);
+      post(to,out);
+    }
+  }
+  for (auto &n : nodes){
+    CHECK(n.complete());
+    CHECK(n.payload()==blob);
+  }
+  //store-and-forward would take depth*chunks = 7*64 steps; pipelined is about 7+64
+  CHECK(steps < 2*(N-1+64));
+  MESSAGE("64 chunks down a chain of " << N << ": " << steps << " steps, " << msgs << " messages");
+
+  //a chunk from anyone but our parent is refused, and so is a bad one
+  le::ghs::ChunkHeader h;
+  h.blob=nodes[2].get_blob();
+  h.n_chunks=64;
+  h.size=blob.size();
+  h.len=CHUNK;
+  CHECK_EQ(nodes[2].receive(3, h, blob.data(), out), PROCESS_REQ_MST);
+  CHECK_EQ(nodes[2].receive(2, h, blob.data(), out), PROCESS_SELFMSG);
+  h.len=CHUNK-1;
+  CHECK_EQ(nodes[2].receive(1, h, blob.data(), out), BAD_MSG);
+  h.ack=1;
+  CHECK_EQ(nodes[2].receive(0, h, nullptr, out), NO_SUCH_PEER);
+  CHECK(out.empty());
+}
+
+TEST_CASE("sim-test tree broadcast over a converged tree, in random order")
+{
+  const int N=12;
+  std::vector<GhsState<0,1024>> states;
+  for (int i=0;i<N;i++){
+    std::vector<Edge> edges;
+    for (int j=0;j<N;j++){
+      if (i!=j){
+        edges.push_back({j,i,UNKNOWN,(metric_t)( (1<<i) + (1<<j))});
+      }
+    }
+    states.push_back(GhsState<0,1024>(i,edges.data(),edges.size()));
+  }
+  std::vector<le::ghs::TreeBroadcast> nodes(N, le::ghs::TreeBroadcast(64,3));
+  CHECK_EQ(nodes[0].reset(states[0]), PARTIAL_RESULT);
+  StaticQueue<Msg,1024> buf;
+  for (int i=0;i<N;i++){
+    size_t sz;
+    REQUIRE_EQ(states[i].start_round(buf, sz),OK);
+  }
+  while(buf.size()>0){
+    Msg m; 
+    REQUIRE_EQ(buf.pop(m),OK);
+    size_t sz;
+    REQUIRE_EQ(states[m.to()].process(m,buf, sz),OK);
+  }
+  for (int i=0;i<N;i++){
+    REQUIRE_EQ(nodes[i].reset(states[i]), OK);
+  }
+  agent_t root = states[0].get_leader_id();
+
+  //deliver any message that is waiting, so chunks overtake each other
+  std::mt19937 rng(11);
+  std::vector<std::tuple<agent_t,agent_t,le::ghs::ChunkHeader,std::vector<uint8_t>>> wire;
+  std::vector<le::ghs::ChunkSend> out;
+  auto post = [&](agent_t from){
+    for (auto &s : out){
+      std::vector<uint8_t> bytes;
+      if (s.data){
+        bytes.assign(s.data, s.data+s.h.len);
+      }
+      wire.emplace_back(from,s.to,s.h,bytes);
+    }
+    out.clear();
+  };
+  auto run = [&](){
+    while (!wire.empty()){
+      size_t k = rng()%wire.size();
+      auto w = wire[k];
+      wire.erase(wire.begin()+k);
+      REQUIRE_EQ(nodes[std::get<1>(w)].receive(std::get<0>(w), std::get<2>(w), std::get<3>(w).data(), out), OK);
+      post(std::get<1>(w));
+    }
+  };
+
+  for (size_t sz : {1000, 1, 0, 64*5}){
+    std::vector<uint8_t> blob(sz);
+    for (size_t i=0;i<sz;i++){
+      blob[i]=(uint8_t)(rng());
+    }
+    REQUIRE_EQ(nodes[root].send(blob.data(), blob.size(), out), OK);
+    post(root);
+    run();
+    for (int i=0;i<N;i++){
+      CHECK(nodes[i].done());
+      CHECK_EQ(nodes[i].get_blob(), nodes[root].get_blob());
+      CHECK(nodes[i].payload()==blob);
+    }
+  }
+}
+
+TEST_CASE("sim-test random delivery order")
+{
+  //Each link is FIFO, like a real transport, but which link delivers next is
+  //random. Fragments then meet at different levels and at different points
+  //of their searches, which a single global queue never produces: absorbing
+  //a lower fragment in mid-search, absorbing a peer that then turns out to
+  //be our own MWOE, and absorbing a peer at our level that already told us
+  //it was not in our partition all used to stall or break the election.
+  //Full graphs, and sparse ones where a path 0-1-...-N-1 keeps them connected.
+  int runs=0;
+  for (int drop_pct : {0, 40}){
+    for (int N=3;N<=9;N++){
+      for (unsigned seed=0;seed<60;seed++){
+        std::mt19937 rng(seed*100+N);
+        std::vector<metric_t> w;
+        for (int k=0;k<N*(N-1)/2;k++){
+          w.push_back(k+1);
+        }
+        std::shuffle(w.begin(),w.end(),rng);
+        std::vector<std::vector<Edge>> edges(N);
+        std::vector<std::tuple<metric_t,int,int>> graph;
+        int k=0;
+        for (int i=0;i<N;i++){
+          for (int j=i+1;j<N;j++,k++){
+            if (j!=i+1 && (int)(rng()%100) < drop_pct){
+              continue;
+            }
+            edges[i].push_back({j,i,UNKNOWN,w[k]});
+            edges[j].push_back({i,j,UNKNOWN,w[k]});
+            graph.emplace_back(w[k],i,j);
+          }
+        }
+        std::vector<GhsState<0,64>> states;
+        for (int i=0;i<N;i++){
+          states.push_back(GhsState<0,64>(i,edges[i].data(),edges[i].size()));
+        }
+
+        std::map<std::pair<agent_t,agent_t>,std::deque<Msg>> links;
+        StaticQueue<Msg,64> buf;
+        auto post = [&](){
+          Msg m;
+          while (buf.size()>0){
+            buf.pop(m);
+            links[{m.from(),m.to()}].push_back(m);
+          }
+        };
+        for (int i=0;i<N;i++){
+          size_t sz;
+          REQUIRE_EQ(states[i].start_round(buf, sz),OK);
+          post();
+        }
+        int msg_count=0;
+        while (msg_count++ < 10000){
+          std::vector<std::pair<agent_t,agent_t>> busy;
+          for (auto &l : links){
+            if (!l.second.empty()){
+              busy.push_back(l.first);
+            }
+          }
+          if (busy.empty()){
+            break;
+          }
+          auto &q = links[busy[rng()%busy.size()]];
+          Msg m = q.front();
+          q.pop_front();
+          size_t sz;
+          REQUIRE_EQ(states[m.to()].process(m,buf, sz),OK);
+          post();
+        }
+        CHECK_LT(msg_count, 10000);
+
+        size_t mst_edges=0;
+        metric_t mst_weight=0;
+        for (int i=0;i<N;i++){
+          CHECK(states[i].is_converged());
+          CHECK_EQ(states[i].get_leader_id(), states[0].get_leader_id());
+          for (int j=0;j<N;j++){
+            Edge e;
+            if (i!=j && OK==states[i].get_edge(j,e) && (e.status==MST || e.status==MST_PARENT)){
+              mst_edges++;
+              mst_weight+=e.metric_val;
+            }
+          }
+        }
+        //a spanning tree, seen from both ends of every edge
+        CHECK_EQ(mst_edges, (size_t)2*(N-1));
+
+        //and the minimum one (Kruskal's, for reference)
+        std::sort(graph.begin(),graph.end());
+        std::vector<int> part(N);
+        for (int i=0;i<N;i++){
+          part[i]=i;
+        }
+        std::function<int(int)> find = [&](int i){ return part[i]==i ? i : part[i]=find(part[i]); };
+        metric_t best=0;
+        for (auto &e : graph){
+          int a=find(std::get<1>(e)), b=find(std::get<2>(e));
+          if (a!=b){
+            part[a]=b;
+            best+=std::get<0>(e);
+          }
+        }
+        CHECK_EQ(mst_weight, 2*best);
+        runs++;
+      }
+    }
+  }
+  CHECK_EQ(runs, 2*7*60);
+}
+
+/**
+ * A fleet of GhsState on random FIFO links, as in "sim-test random delivery
+ * order", that agents can be added to, and taken out of, as it runs
+ */
+struct SimFleet
+{
+  std::vector<GhsState<0,64>> states;
+  ///each message, and how many hops it is behind whatever set it off
+  std::map<std::pair<agent_t,agent_t>,std::deque<std::pair<Msg,int>>> links;
+  StaticQueue<Msg,64> buf;
+  std::mt19937 rng;
+  ///agents that have failed, whose messages and state are ignored
+  std::vector<bool> down;
+  ///the longest chain of messages in the last run()
+  int hops=0;
+
+  explicit SimFleet(unsigned seed):rng(seed){}
+
+  void post(int hop=1){
+    Msg m;
+    while (buf.size()>0){
+      buf.pop(m);
+      //nothing should go to an agent we have dropped
+      CHECK_FALSE(is_down(m.to()));
+      links[{m.from(),m.to()}].push_back({m,hop});
+    }
+  }
+
+  bool is_down(agent_t id) const {
+    return (size_t)id<down.size() && down[id];
+  }
+
+  void start(agent_t id){
+    size_t sz;
+    REQUIRE_EQ(states[id].start_round(buf, sz),OK);
+    post();
+  }
+
+  ///the link a-b goes down, and both ends notice
+  void cut(agent_t a, agent_t b){
+    size_t sz;
+    REQUIRE_EQ(states[a].drop_edge(b, buf, sz),OK);
+    post();
+    REQUIRE_EQ(states[b].drop_edge(a, buf, sz),OK);
+    post();
+  }
+
+  ///the agent fails, and each of its peers notices
+  void fail(agent_t id){
+    down.resize(states.size(), false);
+    down[id]=true;
+    for (size_t i=0;i<states.size();i++){
+      size_t sz;
+      if (!down[i] && states[i].has_edge(id)){
+        REQUIRE_EQ(states[i].drop_edge(id, buf, sz),OK);
+        post();
+      }
+    }
+  }
+
+  ///the metric of the link a-b changes, at both ends
+  void update(agent_t a, agent_t b, metric_t m){
+    size_t sz;
+    REQUIRE_EQ(states[a].update_edge_metric(b, m, buf, sz),OK);
+    post();
+    REQUIRE_EQ(states[b].update_edge_metric(a, m, buf, sz),OK);
+    post();
+  }
+
+  ///delivers one message from a random busy link, and returns false if there were none
+  bool step(){
+    std::vector<std::pair<agent_t,agent_t>> busy;
+    for (auto &l : links){
+      if (!l.second.empty()){
+        busy.push_back(l.first);
+      }
+    }
+    if (busy.empty()){
+      return false;
+    }
+    auto &q = links[busy[rng()%busy.size()]];
+    Msg m = q.front().first;
+    int hop = q.front().second;
+    q.pop_front();
+    hops = std::max(hops, hop);
+    size_t sz;
+    REQUIRE_EQ(states[m.to()].process(m,buf, sz),OK);
+    post(hop+1);
+    return true;
+  }
+
+  ///delivers until every link is empty, and returns how many messages that took
+  int run(int limit=100000){
+    int msg_count=0;
+    hops=0;
+    while (msg_count < limit && step()){
+      msg_count++;
+    }
+    CHECK_LT(msg_count, limit);
+    return msg_count;
+  }
+
+  ///the weight of the tree the fleet agrees on, or 0 if it is not one spanning tree
+  metric_t tree_weight(){
+    size_t mst_edges=0;
+    metric_t weight=0;
+    int n=(int)states.size();
+    int n_up=0;
+    agent_t leader=NO_AGENT;
+    for (int i=0;i<n;i++){
+      if (is_down(i)){
+        continue;
+      }
+      n_up++;
+      if (leader==NO_AGENT){
+        leader=states[i].get_leader_id();
+      }
+      if (!states[i].is_converged() || states[i].get_leader_id()!=leader){
+        return 0;
+      }
+      for (int j=0;j<n;j++){
+        Edge e, back;
+        if (i!=j && OK==states[i].get_edge(j,e) && (e.status==MST || e.status==MST_PARENT)){
+          if (OK!=states[j].get_edge(i,back) || (back.status!=MST && back.status!=MST_PARENT)){
+            return 0;
+          }
+          mst_edges++;
+          weight+=e.metric_val;
+        }
+      }
+    }
+    return mst_edges==(size_t)2*(n_up-1) ? weight/2 : 0;
+  }
+};
+
+///Kruskal's, for reference, which also counts the edges it took, if asked
+metric_t mst_weight(int n, std::vector<std::tuple<metric_t,int,int>> graph, size_t *n_taken=nullptr)
+{
+  std::sort(graph.begin(),graph.end());
+  std::vector<int> part(n);
+  for (int i=0;i<n;i++){
+    part[i]=i;
+  }
+  std::function<int(int)> find = [&](int i){ return part[i]==i ? i : part[i]=find(part[i]); };
+  metric_t best=0;
+  size_t taken=0;
+  for (auto &e : graph){
+    int a=find(std::get<1>(e)), b=find(std::get<2>(e));
+    if (a!=b){
+      part[a]=b;
+      best+=std::get<0>(e);
+      taken++;
+    }
+  }
+  if (n_taken){
+    *n_taken=taken;
+  }
+  return best;
+}
+
+///A connected random graph on n agents (a path 0-1-...-n-1, and drop_pct of the other links missing), weighted 1 to |E|
+std::vector<std::tuple<metric_t,int,int>> random_graph(int n, int drop_pct, std::mt19937 &rng)
+{
+  std::vector<std::tuple<metric_t,int,int>> graph;
+  for (int i=0;i<n;i++){
+    for (int j=i+1;j<n;j++){
+      if (j==i+1 || (int)(rng()%100) >= drop_pct){
+        graph.emplace_back(0,i,j);
+      }
+    }
+  }
+  std::vector<metric_t> w;
+  for (size_t k=0;k<graph.size();k++){
+    w.push_back(k+1);
+  }
+  std::shuffle(w.begin(),w.end(),rng);
+  for (size_t k=0;k<graph.size();k++){
+    std::get<0>(graph[k]) = w[k];
+  }
+  return graph;
+}
+
+///What an agent remembers of the tree it converged on
+struct TreeHints
+{
+  std::vector<Edge> edges;
+  agent_t leader=NO_AGENT;
+  level_t level=LEVEL_START;
+};
+
+///Each agent's hints, as it would persist them once converged
+std::vector<TreeHints> hints_of(const SimFleet &fleet)
+{
+  int n=(int)fleet.states.size();
+  std::vector<TreeHints> hints(n);
+  for (int i=0;i<n;i++){
+    hints[i].leader=fleet.states[i].get_leader_id();
+    hints[i].level=fleet.states[i].get_level();
+    for (int j=0;j<n;j++){
+      Edge e;
+      if (i!=j && OK==fleet.states[i].get_edge(j,e)){
+        hints[i].edges.push_back(e);
+      }
+    }
+  }
+  return hints;
+}
+
+///Brings up all n agents of graph at once, from their hints if there are any, and starts the election
+void bring_up(SimFleet &fleet, int n, const std::vector<std::tuple<metric_t,int,int>> &graph,
+    const std::vector<TreeHints> &hints={})
+{
+  std::vector<std::vector<Edge>> edges(n);
+  for (auto &e : graph){
+    int a=std::get<1>(e), b=std::get<2>(e);
+    edges[a].push_back({b,a,UNKNOWN,std::get<0>(e)});
+    edges[b].push_back({a,b,UNKNOWN,std::get<0>(e)});
+  }
+  fleet.states.clear();
+  for (int i=0;i<n;i++){
+    if ((size_t)i<hints.size() && hints[i].leader!=NO_AGENT){
+      const TreeHints &h = hints[i];
+      fleet.states.push_back(GhsState<0,64>(i,edges[i].data(),edges[i].size(),
+            h.edges.data(),h.edges.size(),h.leader,h.level));
+    } else {
+      fleet.states.push_back(GhsState<0,64>(i,edges[i].data(),edges[i].size()));
+    }
+  }
+  for (int i=0;i<n;i++){
+    fleet.start(i);
+  }
+}
+
+///As bring_up(), and runs the election to the end
+int elect(SimFleet &fleet, int n, const std::vector<std::tuple<metric_t,int,int>> &graph,
+    const std::vector<TreeHints> &hints={})
+{
+  bring_up(fleet, n, graph, hints);
+  return fleet.run();
+}
+
+TEST_CASE("unit-test add_peer")
+{
+  GhsState<0,32> s(0,{},0);
+  CHECK_EQ(s.add_peer({1,0,MST,10}), OK);
+  CHECK_EQ(s.get_n_peers(), 1);
+  Edge e;
+  REQUIRE_EQ(s.get_edge(1,e), OK);
+  CHECK_EQ(e.status, UNKNOWN);
+  CHECK_EQ(e.metric_val, 10);
+  CHECK_EQ(s.add_peer({1,0,UNKNOWN,20}), SET_INVALID_EDGE);
+  CHECK_EQ(s.add_peer({2,1,UNKNOWN,20}), SET_INVALID_EDGE_NOT_ROOT);
+  CHECK_EQ(s.add_peer({0,0,UNKNOWN,20}), SET_INVALID_EDGE_SELF_LOOP);
+
+  GhsState<1,32> full(0,{},0);
+  CHECK_EQ(full.add_peer({1,0,UNKNOWN,10}), OK);
+  CHECK_EQ(full.add_peer({2,0,UNKNOWN,20}), TOO_MANY_AGENTS);
+}
+
+TEST_CASE("sim-test newcomers join a converged tree")
+{
+  //Whoever joins a converged tree hangs off it by its MWOE, which costs
+  //an IN_PART and an answer on each of its links, a JOIN_US and an
+  //ABSORBED. The newcomers' links are the heaviest in the graph here, so
+  //that is also the MST, and the rest of the fleet never hears of them.
+  long join_msgs=0, restart_msgs=0;
+  int runs=0;
+  for (int drop_pct : {0, 40}){
+    for (int N=3;N<=9;N++){
+      for (unsigned seed=0;seed<20;seed++){
+        std::mt19937 rng(seed*100+N);
+        auto graph = random_graph(N, drop_pct, rng);
+        SimFleet fleet(seed);
+        elect(fleet, N, graph);
+        REQUIRE_EQ(fleet.tree_weight(), mst_weight(N, graph));
+        std::vector<GhsState<0,64>> before = fleet.states;
+
+        //one or two newcomers, which may know each other, and each know a few of us
+        int n_new = 1 + seed%2;
+        std::vector<std::vector<Edge>> edges(n_new);
+        metric_t w = graph.size()+1;
+        for (int x=0;x<n_new;x++){
+          agent_t me = N+x;
+          for (int i=0;i<N;i++){
+            if (i==0 || rng()%3==0){
+              edges[x].push_back({i,me,UNKNOWN,w});
+              REQUIRE_EQ(fleet.states[i].add_peer({me,i,UNKNOWN,w}), OK);
+              graph.emplace_back(w++,i,me);
+            }
+          }
+          if (x==1 && seed%4==1){
+            edges[1].push_back({N,N+1,UNKNOWN,w});
+            edges[0].push_back({N+1,N,UNKNOWN,w});
+            graph.emplace_back(w++,N,N+1);
+          }
+        }
+        for (int x=0;x<n_new;x++){
+          fleet.states.push_back(GhsState<0,64>(N+x,edges[x].data(),edges[x].size()));
+        }
+        for (int x=0;x<n_new;x++){
+          fleet.start(N+x);
+        }
+        int msgs = fleet.run();
+        CHECK_EQ(fleet.tree_weight(), mst_weight(N+n_new, graph));
+
+        //nobody else moved
+        for (int i=0;i<N;i++){
+          CHECK_EQ(fleet.states[i].get_leader_id(), before[i].get_leader_id());
+          CHECK_EQ(fleet.states[i].get_level(), before[i].get_level());
+          CHECK_EQ(fleet.states[i].get_parent_id(), before[i].get_parent_id());
+        }
+        if (n_new==1){
+          CHECK_EQ((size_t)msgs, 2*edges[0].size()+2);
+        }
+
+        //against everyone starting over
+        SimFleet again(seed);
+        join_msgs += msgs;
+        restart_msgs += elect(again, N+n_new, graph);
+        CHECK_EQ(again.tree_weight(), fleet.tree_weight());
+        runs++;
+      }
+    }
+  }
+  CHECK_EQ(runs, 2*7*20);
+  CHECK_LT(join_msgs*5, restart_msgs);
+  MESSAGE("newcomers joined in " << join_msgs << " messages, re-electing took " << restart_msgs);
+}
+
+TEST_CASE("sim-test repair after a link or an agent fails")
+{
+  //A converged tree loses a tree link, an agent, or its leader. The
+  //subtrees cut off from the leader search again from where they are, and
+  //everyone else stays as they were. The lightest way back is the MST of
+  //what is left, since the rest of the tree still is.
+  long repair_msgs=0, restart_msgs=0, repair_hops=0, restart_hops=0;
+  int runs=0;
+  for (int drop_pct : {0, 40}){
+    for (int N=4;N<=12;N++){
+      for (unsigned seed=0;seed<15;seed++){
+        std::mt19937 rng(seed*100+N);
+        auto graph = random_graph(N, drop_pct, rng);
+        SimFleet fleet(seed);
+        elect(fleet, N, graph);
+        REQUIRE_EQ(fleet.tree_weight(), mst_weight(N, graph));
+        std::vector<GhsState<0,64>> before = fleet.states;
+        agent_t leader = fleet.states[0].get_leader_id();
+
+        //what fails, and who loses their way to the leader because of it
+        agent_t failed=NO_AGENT, cut_from=NO_AGENT, cut_to=NO_AGENT;
+        if (seed%3==0){
+          do {
+            cut_from = rng()%N;
+          } while (cut_from == leader);
+          cut_to = fleet.states[cut_from].get_parent_id();
+        } else if (seed%3==1){
+          do {
+            failed = rng()%N;
+          } while (failed == leader);
+        } else {
+          failed = leader;
+        }
+        auto cut_off = [&](agent_t i){
+          for (agent_t at=i; at!=leader; at=before[at].get_parent_id()){
+            agent_t up = before[at].get_parent_id();
+            if ((at==cut_from && up==cut_to) || up==failed){
+              return true;
+            }
+          }
+          return false;
+        };
+        std::vector<std::tuple<metric_t,int,int>> left;
+        for (auto &e : graph){
+          int a=std::get<1>(e), b=std::get<2>(e);
+          if (a!=failed && b!=failed && !(a==cut_from && b==cut_to) && !(a==cut_to && b==cut_from)){
+            left.push_back(e);
+          }
+        }
+        size_t taken=0;
+        metric_t best = mst_weight(N, left, &taken);
+        if (taken+1 != (size_t)(failed==NO_AGENT ? N : N-1)){
+          //nothing to repair: what is left is in pieces
+          continue;
+        }
+
+        if (failed==NO_AGENT){
+          fleet.cut(cut_from, cut_to);
+        } else {
+          fleet.fail(failed);
+        }
+        int msgs = fleet.run();
+        CHECK_EQ(fleet.tree_weight(), best);
+        for (int i=0;i<N;i++){
+          if (i!=failed && failed!=leader && !cut_off(i)){
+            CHECK_EQ(fleet.states[i].get_leader_id(), before[i].get_leader_id());
+            CHECK_EQ(fleet.states[i].get_level(), before[i].get_level());
+            CHECK_EQ(fleet.states[i].get_parent_id(), before[i].get_parent_id());
+          }
+        }
+
+        //against everyone starting over without it
+        SimFleet again(seed);
+        int restart = elect(again, N, left);
+        if (failed!=NO_AGENT){
+          again.down.assign(N, false);
+          again.down[failed]=true;
+        }
+        CHECK_EQ(again.tree_weight(), best);
+        repair_msgs += msgs;
+        repair_hops += fleet.hops;
+        restart_msgs += restart;
+        restart_hops += again.hops;
+        runs++;
+      }
+    }
+  }
+  CHECK_GT(runs, 2*9*15*3/4);
+  CHECK_LT(repair_msgs*2, restart_msgs);
+  CHECK_LT(repair_hops, restart_hops);
+  MESSAGE(runs << " repairs took " << repair_msgs << " messages and " << repair_hops
+      << " hops in all, re-electing took " << restart_msgs << " messages and " << restart_hops << " hops");
+}
+
+TEST_CASE("unit-test update_edge_metric")
+{
+  Edge edges[2] = {{1,0,UNKNOWN,10},{2,0,UNKNOWN,20}};
+  GhsState<0,32> s(0,edges,2);
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  CHECK_EQ(s.update_edge_metric(1, 5, buf, sz), UPDATE_REQ_CONVERGED);
+  CHECK_EQ(s.update_edge_metric(1, WORST_METRIC, buf, sz), SET_INVALID_EDGE_METRIC);
+  CHECK_EQ(s.update_edge_metric(3, 5, buf, sz), NO_SUCH_PEER);
+  metric_t m;
+  REQUIRE_EQ(s.get_edge_metric(1, m), OK);
+  CHECK_EQ(m, 10);
+  CHECK_EQ(buf.size(), 0);
+}
+
+TEST_CASE("sim-test metric changes keep a converged tree minimal")
+{
+  //A tree edge gets worse, or an edge outside the tree gets better. Only
+  //the subtree below the edge that has to go searches again, and comes
+  //back over the lightest edge out; everyone else stays where they are.
+  long update_msgs=0, restart_msgs=0, update_hops=0, restart_hops=0;
+  int runs=0, swaps=0;
+  for (int drop_pct : {0, 40}){
+    for (int N=3;N<=10;N++){
+      for (unsigned seed=0;seed<16;seed++){
+        std::mt19937 rng(seed*100+N);
+        auto graph = random_graph(N, drop_pct, rng);
+        //even weights, so that any odd one is free for the new metric
+        for (auto &e : graph){
+          std::get<0>(e) *= 2;
+        }
+        SimFleet fleet(seed);
+        elect(fleet, N, graph);
+        REQUIRE_EQ(fleet.tree_weight(), mst_weight(N, graph));
+        std::vector<GhsState<0,64>> before = fleet.states;
+
+        //an edge in the tree to make worse, or one outside it to make better
+        bool worse = seed%2==0;
+        std::vector<size_t> pick;
+        for (size_t k=0;k<graph.size();k++){
+          Edge e;
+          REQUIRE_EQ(fleet.states[std::get<1>(graph[k])].get_edge(std::get<2>(graph[k]), e), OK);
+          if ((e.status==MST || e.status==MST_PARENT) == worse){
+            pick.push_back(k);
+          }
+        }
+        if (pick.empty()){
+          continue;
+        }
+        auto &changed = graph[pick[rng()%pick.size()]];
+        metric_t was = std::get<0>(changed);
+        metric_t m = worse ? was + 1 + 2*(rng()%graph.size()) : 1 + 2*(rng()%(was/2));
+        std::get<0>(changed) = m;
+
+        fleet.update(std::get<1>(changed), std::get<2>(changed), m);
+        int msgs = fleet.run();
+        metric_t best = mst_weight(N, graph);
+        CHECK_EQ(fleet.tree_weight(), best);
+        bool moved=false;
+        for (int i=0;i<N;i++){
+          CHECK_EQ(fleet.states[i].get_leader_id(), before[i].get_leader_id());
+          moved = moved || fleet.states[i].get_parent_id() != before[i].get_parent_id();
+        }
+        swaps += moved;
+        if (!worse && !moved){
+          //the question went over each tree edge once, and that was all
+          CHECK_LT(msgs, N);
+        }
+
+        //against everyone starting over with the new metric
+        SimFleet again(seed);
+        restart_msgs += elect(again, N, graph);
+        restart_hops += again.hops;
+        CHECK_EQ(again.tree_weight(), best);
+        update_msgs += msgs;
+        update_hops += fleet.hops;
+        runs++;
+      }
+    }
+  }
+  CHECK_GT(runs, 2*8*16*3/4);
+  CHECK_GT(swaps, runs/4);
+  CHECK_LT(update_msgs*4, restart_msgs);
+  CHECK_LT(update_hops, restart_hops);
+  MESSAGE(runs << " metric changes (" << swaps << " changed the tree) took " << update_msgs << " messages and "
+      << update_hops << " hops in all, re-electing took " << restart_msgs << " messages and " << restart_hops << " hops");
+}
+
+TEST_CASE("unit-test set_hints")
+{
+  Edge edges[2] = {{1,0,UNKNOWN,10},{2,0,UNKNOWN,20}};
+  GhsState<0,32> s(0,edges,2);
+  Edge good[2] = {{1,0,MST,10},{2,0,DELETED,20}};
+  CHECK_EQ(s.set_hints(good,2,0,3), OK);
+  CHECK_EQ(s.get_leader_id(), 0);
+  CHECK_EQ(s.get_level(), 3);
+  CHECK_FALSE(s.is_converged());
+
+  //another metric, a missing edge, no parent though we did not lead, or an UNKNOWN edge
+  Edge moved[2] = {{1,0,MST,10},{2,0,DELETED,21}};
+  CHECK_EQ(s.set_hints(moved,2,0,3), HINT_MISMATCH);
+  CHECK_EQ(s.set_hints(good,1,0,3), HINT_MISMATCH);
+  CHECK_EQ(s.set_hints(good,2,1,3), HINT_MISMATCH);
+  Edge unknown[2] = {{1,0,MST,10},{2,0,UNKNOWN,20}};
+  CHECK_EQ(s.set_hints(unknown,2,0,3), HINT_MISMATCH);
+  Edge e;
+  REQUIRE_EQ(s.get_edge(1,e), OK);
+  CHECK_EQ(e.status, UNKNOWN);
+
+  //which falls back at the start, telling everyone, and searches from scratch
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  REQUIRE_EQ(s.start_round(buf,sz), OK);
+  CHECK_EQ(sz, 4);
+  Msg m;
+  for (msg::Type t : {msg::Type::WARM_NACK, msg::Type::WARM_NACK, msg::Type::IN_PART, msg::Type::IN_PART}){
+    buf.pop(m);
+    CHECK_EQ(m.type(), t);
+  }
+  CHECK_EQ(s.get_level(), LEVEL_START);
+}
+
+TEST_CASE("sim-test warm start from the last tree")
+{
+  //The fleet restarts with what each agent remembers of the tree. If
+  //nothing has changed, the tree is confirmed up and down once. If a
+  //metric has changed, an agent is new, or an agent's hints are from
+  //another tree, whoever notices falls back, everyone follows, and they
+  //elect from scratch.
+  long warm_msgs=0, cold_msgs=0, warm_hops=0, cold_hops=0;
+  int runs=0;
+  for (int drop_pct : {0, 40}){
+    for (int N=3;N<=12;N++){
+      for (unsigned seed=0;seed<12;seed++){
+        std::mt19937 rng(seed*100+N);
+        auto graph = random_graph(N, drop_pct, rng);
+        SimFleet before(seed);
+        int cold = elect(before, N, graph);
+        metric_t best = mst_weight(N, graph);
+        REQUIRE_EQ(before.tree_weight(), best);
+        auto hints = hints_of(before);
+
+        int change = seed%4;
+        if (change==1){
+          //a link got heavier
+          auto &e = graph[rng()%graph.size()];
+          std::get<0>(e) += graph.size();
+          best = mst_weight(N, graph);
+        } else if (change==2){
+          //someone lost their memory
+          hints[rng()%N].leader = NO_AGENT;
+        } else if (change==3){
+          //someone remembers a different leader
+          int who = rng()%N;
+          hints[who].leader = hints[who].leader==0 ? 1 : 0;
+        }
+
+        SimFleet after(seed+1);
+        int msgs = elect(after, N, graph, hints);
+        CHECK_EQ(after.tree_weight(), best);
+        if (change==0){
+          CHECK_EQ(msgs, 2*(N-1));
+          for (int i=0;i<N;i++){
+            CHECK_EQ(after.states[i].get_leader_id(), before.states[i].get_leader_id());
+            CHECK_EQ(after.states[i].get_parent_id(), before.states[i].get_parent_id());
+          }
+          warm_msgs += msgs;
+          warm_hops += after.hops;
+          cold_msgs += cold;
+          cold_hops += before.hops;
+        }
+        runs++;
+      }
+    }
+  }
+  CHECK_EQ(runs, 2*10*12);
+  CHECK_LT(warm_msgs*10, cold_msgs);
+  CHECK_LT(warm_hops*2, cold_hops);
+  MESSAGE("warm starts took " << warm_msgs << " messages and " << warm_hops
+      << " hops in all, cold starts took " << cold_msgs << " messages and " << cold_hops << " hops");
+}
+
+TEST_CASE("sim-test a warm-started tree repairs like any other")
+{
+  //Once a warm start has converged, the hints are spent. A link that goes
+  //down or changes its metric afterwards is repaired in place, as in a
+  //tree elected from scratch, and a WARM_NACK that arrives late is ignored.
+  int runs=0;
+  for (int drop_pct : {0, 40}){
+    for (int N=3;N<=10;N++){
+      for (unsigned seed=0;seed<12;seed++){
+        std::mt19937 rng(seed*100+N);
+        auto graph = random_graph(N, drop_pct, rng);
+        //even weights, so that any odd one is free for the new metric
+        for (auto &e : graph){
+          std::get<0>(e) *= 2;
+        }
+        SimFleet cold(seed);
+        elect(cold, N, graph);
+        SimFleet fleet(seed+1);
+        REQUIRE_EQ(elect(fleet, N, graph, hints_of(cold)), 2*(N-1));
+        REQUIRE_EQ(fleet.tree_weight(), mst_weight(N, graph));
+        std::vector<GhsState<0,64>> before = fleet.states;
+        agent_t leader = fleet.states[0].get_leader_id();
+
+        //a neighbour that fell back too late for us
+        agent_t late = rng()%N;
+        agent_t nack_from = std::get<1>(graph[0])==late ? std::get<2>(graph[0]) : std::get<1>(graph[0]);
+        if (fleet.states[late].has_edge(nack_from)){
+          size_t sz;
+          REQUIRE_EQ(fleet.states[late].process(Msg(late, nack_from, WarmNackPayload{}), fleet.buf, sz), OK);
+          CHECK_EQ(sz, 0);
+          CHECK(fleet.states[late].is_converged());
+        }
+
+        metric_t best;
+        if (seed%2==0){
+          //a tree link below the leader goes down
+          agent_t from;
+          do {
+            from = rng()%N;
+          } while (from == leader);
+          agent_t to = fleet.states[from].get_parent_id();
+          std::vector<std::tuple<metric_t,int,int>> left;
+          for (auto &e : graph){
+            int a=std::get<1>(e), b=std::get<2>(e);
+            if (!(a==from && b==to) && !(a==to && b==from)){
+              left.push_back(e);
+            }
+          }
+          size_t taken=0;
+          best = mst_weight(N, left, &taken);
+          if (taken+1 != (size_t)N){
+            continue;
+          }
+          fleet.cut(from, to);
+        } else {
+          //any link gets worse or better
+          auto &changed = graph[rng()%graph.size()];
+          metric_t was = std::get<0>(changed);
+          metric_t m = rng()%2 ? was + 1 + 2*(rng()%graph.size()) : 1 + 2*(rng()%(was/2));
+          std::get<0>(changed) = m;
+          best = mst_weight(N, graph);
+          fleet.update(std::get<1>(changed), std::get<2>(changed), m);
+        }
+        fleet.run();
+        CHECK_EQ(fleet.tree_weight(), best);
+        for (int i=0;i<N;i++){
+          CHECK_EQ(fleet.states[i].get_leader_id(), before[i].get_leader_id());
+        }
+        runs++;
+      }
+    }
+  }
+  CHECK_GT(runs, 2*8*12*3/4);
+}
+
+TEST_CASE("unit-test current_leader")
+{
+  Edge edges[2] = {{1,0,MST,10},{2,0,UNKNOWN,20}};
+  GhsState<4,32> s(0,edges,2);
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  LeaderEstimate est;
+  CHECK_EQ(s.current_leader(est), PARTIAL_RESULT);
+  CHECK_EQ(est.leader, 0);
+  CHECK_EQ(est.level, 0);
+  CHECK_EQ(est.size, 1);
+
+  //a bigger partition next door is a better bet than ours
+  REQUIRE_EQ(s.process(Msg(0,2,InPartPayload{5,1,3}), buf, sz), OK);
+  CHECK_EQ(sz, 0);
+  CHECK_EQ(s.current_leader(est), PARTIAL_RESULT);
+  CHECK_EQ(est.leader, 5);
+  CHECK_EQ(est.level, 1);
+  CHECK_EQ(est.size, 3);
+
+  //until our search finds ours is bigger
+  REQUIRE_EQ(s.start_round(buf, sz), OK);
+  REQUIRE_EQ(sz, 2);
+  Msg m;
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::SRCH);
+  CHECK_EQ(m.data().srch.your_size, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::IN_PART);
+  CHECK_EQ(m.data().in_part.size, 1);
+  REQUIRE_EQ(s.process(Msg(0,1,SrchRetPayload{0,0,WORST_METRIC,4}), buf, sz), OK);
+  CHECK_EQ(sz, 0);
+  REQUIRE_EQ(s.process(Msg(0,2,NackPartPayload{}), buf, sz), OK);
+  CHECK_EQ(s.current_leader(est), PARTIAL_RESULT);
+  CHECK_EQ(est.leader, 0);
+  CHECK_EQ(est.size, 5);
+  while (buf.size()>0){
+    buf.pop(m);
+  }
+
+  //once the last search comes back empty, everyone is told how many there are
+  Edge one[1] = {{1,0,MST,10}};
+  GhsState<4,32> t(0,one,1);
+  REQUIRE_EQ(t.start_round(buf, sz), OK);
+  buf.pop(m);
+  REQUIRE_EQ(t.process(Msg(0,1,SrchRetPayload{0,0,WORST_METRIC,2}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::NOOP);
+  CHECK_EQ(m.data().noop.size, 3);
+  CHECK_EQ(t.current_leader(est), OK);
+  CHECK_EQ(est.leader, 0);
+  CHECK_EQ(est.size, 3);
+
+  Edge up[1] = {{0,1,MST_PARENT,10}};
+  GhsState<4,32> u(1,up,1);
+  REQUIRE_EQ(u.process(m, buf, sz), OK);
+  CHECK_EQ(u.current_leader(est), OK);
+  CHECK_EQ(est.size, 3);
+}
+
+TEST_CASE("sim-test current_leader before convergence")
+{
+  //Stop the election after every message, and ask each agent who it would
+  //follow. Compare how many would follow the same one as the most others
+  //if they went by current_leader(), and by get_leader_id().
+  double agree=0, agree_naive=0;
+  long samples=0;
+  int runs=0;
+  for (int N=4;N<=16;N++){
+    for (unsigned seed=0;seed<10;seed++){
+      std::mt19937 rng(seed*31+N);
+      auto graph = random_graph(N, 50, rng);
+      SimFleet fleet(seed);
+      bring_up(fleet, N, graph);
+      do {
+        std::map<agent_t,int> votes, naive;
+        for (auto &st : fleet.states){
+          LeaderEstimate est;
+          auto err = st.current_leader(est);
+          CHECK((err==OK || err==PARTIAL_RESULT));
+          CHECK_EQ(err==OK, st.is_converged());
+          CHECK_GE(est.size, 1);
+          CHECK_LE(est.size, (uint32_t)N);
+          CHECK_GE(est.leader, 0);
+          CHECK_LT(est.leader, N);
+          votes[est.leader]++;
+          naive[st.get_leader_id()]++;
+        }
+        int most=0, most_naive=0;
+        for (auto &v : votes){ most = std::max(most, v.second); }
+        for (auto &v : naive){ most_naive = std::max(most_naive, v.second); }
+        agree += (double)most/N;
+        agree_naive += (double)most_naive/N;
+        samples++;
+      } while (fleet.step());
+
+      //once converged, every agent knows the leader and how many follow it
+      agent_t leader = fleet.states[0].get_leader_id();
+      for (auto &st : fleet.states){
+        LeaderEstimate est;
+        REQUIRE_EQ(st.current_leader(est), OK);
+        CHECK_EQ(est.leader, leader);
+        CHECK_EQ(est.size, (uint32_t)N);
+      }
+      runs++;
+    }
+  }
+  agree /= samples;
+  agree_naive /= samples;
+  CHECK_GT(agree, agree_naive);
+  MESSAGE(runs << " runs: " << 100*agree << "% of agents agree on current_leader() on average, against "
+      << 100*agree_naive << "% on get_leader_id()");
+}
+
+TEST_CASE("unit-test set_recenter")
+{
+  //we lead, and one child reaches 3 hops down, the other 1
+  Edge edges[2] = {{1,0,MST,10},{2,0,MST,20}};
+  GhsState<4,32> s(0,edges,2);
+  s.set_recenter(true);
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  REQUIRE_EQ(s.start_round(buf, sz), OK);
+  REQUIRE_EQ(sz, 2);
+  Msg m;
+  buf.pop(m);
+  buf.pop(m);
+  REQUIRE_EQ(s.process(Msg(0,1,SrchRetPayload{0,0,WORST_METRIC,3,2}), buf, sz), OK);
+  CHECK_EQ(sz, 0);
+
+  //so the center is one hop towards the first
+  REQUIRE_EQ(s.process(Msg(0,2,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::CENTER);
+  CHECK_EQ(m.to(), 1);
+  CHECK_EQ(m.data().center.up, 2);
+  CHECK_EQ(m.data().center.size, 5);
+  CHECK_EQ(s.get_parent_id(), 1);
+  CHECK_FALSE(s.is_converged());
+
+  //which says so, and we pass it on to our other child
+  REQUIRE_EQ(s.process(Msg(0,1,NoopPayload{5,1}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::NOOP);
+  CHECK_EQ(m.to(), 2);
+  CHECK(s.is_converged());
+  CHECK_EQ(s.get_leader_id(), 1);
+  CHECK_EQ(s.get_parent_id(), 1);
+
+  //the center only takes the lead from its parent
+  Edge up[2] = {{0,1,MST_PARENT,10},{3,1,MST,30}};
+  GhsState<4,32> t(1,up,2);
+  CHECK_EQ(t.process(Msg(1,3,CenterPayload{1,5}), buf, sz), PROCESS_REQ_MST);
+
+  //and keeps it if moving on would not make the tree shallower
+  REQUIRE_EQ(t.process(Msg(1,0,SrchPayload{0,1,1}), buf, sz), OK);
+  while (buf.size()>0){
+    buf.pop(m);
+  }
+  REQUIRE_EQ(t.process(Msg(1,3,SrchRetPayload{0,0,WORST_METRIC,2,1}), buf, sz), OK);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::SRCH_RET);
+  CHECK_EQ(m.data().srch_ret.height, 2);
+  REQUIRE_EQ(t.process(Msg(1,0,CenterPayload{2,5}), buf, sz), OK);
+  REQUIRE_EQ(sz, 2);
+  CHECK_EQ(t.get_leader_id(), 1);
+  CHECK_EQ(t.get_parent_id(), 1);
+  CHECK(t.is_converged());
+  LeaderEstimate est;
+  CHECK_EQ(t.current_leader(est), OK);
+  CHECK_EQ(est.size, 5);
+}
+
+///How far the furthest agent is from the leader, following parents, or -1 if they do not lead to it
+int tree_depth(const SimFleet &fleet)
+{
+  int n=(int)fleet.states.size();
+  int deepest=0;
+  for (int i=0;i<n;i++){
+    int d=0;
+    agent_t at=i;
+    while (fleet.states[at].get_parent_id()!=at && d<=n){
+      at=fleet.states[at].get_parent_id();
+      d++;
+    }
+    if (at!=fleet.states[i].get_leader_id()){
+      return -1;
+    }
+    deepest=std::max(deepest,d);
+  }
+  return deepest;
+}
+
+TEST_CASE("sim-test recentering halves the broadcast depth")
+{
+  //The same elections with and without set_recenter(): the tree is the
+  //same, but rooted at its center, so it is as shallow as a tree can be
+  int deep=0, shallow=0, runs=0, walked=0, n_msgs=0, n_msgs_plain=0;
+  for (int N=3;N<=24;N++){
+    for (unsigned seed=0;seed<8;seed++){
+      std::mt19937 rng(seed*7+N);
+      //sparse graphs have long, thin trees
+      auto graph = random_graph(N, 85, rng);
+      SimFleet plain(seed), centered(seed);
+      n_msgs_plain += elect(plain, N, graph);
+      bring_up(centered, N, graph);
+      for (auto &st : centered.states){
+        st.set_recenter(true);
+      }
+      n_msgs += centered.run();
+      REQUIRE_EQ(centered.tree_weight(), mst_weight(N, graph));
+      REQUIRE_EQ(plain.tree_weight(), centered.tree_weight());
+
+      //the radius of the tree is the least depth any root could give it
+      std::vector<std::vector<int>> adj(N);
+      for (int i=0;i<N;i++){
+        agent_t p = centered.states[i].get_parent_id();
+        if (p!=i){
+          adj[i].push_back(p);
+          adj[p].push_back(i);
+        }
+      }
+      int radius=N, diameter=0;
+      for (int i=0;i<N;i++){
+        std::vector<int> dist(N,-1);
+        std::deque<int> q{i};
+        dist[i]=0;
+        int ecc=0;
+        while (!q.empty()){
+          int a=q.front();
+          q.pop_front();
+          ecc=std::max(ecc,dist[a]);
+          for (int b : adj[a]){
+            if (dist[b]<0){
+              dist[b]=dist[a]+1;
+              q.push_back(b);
+            }
+          }
+        }
+        radius=std::min(radius,ecc);
+        diameter=std::max(diameter,ecc);
+      }
+      int before=tree_depth(plain), after=tree_depth(centered);
+      REQUIRE_GE(before, 0);
+      REQUIRE_GE(after, 0);
+      CHECK_EQ(after, radius);
+      CHECK_LE(2*after, diameter+1);
+      for (auto &st : centered.states){
+        LeaderEstimate est;
+        REQUIRE_EQ(st.current_leader(est), OK);
+        CHECK_EQ(est.size, (uint32_t)N);
+      }
+      walked += centered.states[0].get_leader_id()!=plain.states[0].get_leader_id();
+      deep += before;
+      shallow += after;
+      runs++;
+    }
+  }
+  MESSAGE(runs << " elections: the leader moved in " << walked << ", and the trees were "
+      << shallow << " hops deep in all, against " << deep << " (" << n_msgs << " messages against " << n_msgs_plain << ")");
+}
+
+TEST_CASE("unit-test SessionMux")
+{
+  Edge edges[1] = {{1,0,UNKNOWN,10}};
+  SessionMux<0,32> mux;
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  CHECK_EQ(mux.newest(), NO_SESSION);
+  REQUIRE_EQ(mux.open(1, GhsState<0,32>(0,edges,1)), OK);
+  REQUIRE_EQ(mux.open(2, GhsState<0,32>(0,edges,1)), OK);
+  CHECK_EQ(mux.open(1, GhsState<0,32>(0,edges,1)), SESSION_EXISTS);
+  CHECK_EQ(mux.size(), 2);
+  CHECK_EQ(mux.newest(), 2);
+
+  //what a session sends is stamped with it
+  REQUIRE_EQ(mux.start(2, buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  Msg m;
+  buf.pop(m);
+  CHECK_EQ(m.session(), 2);
+  CHECK_EQ(m.type(), msg::Type::IN_PART);
+  CHECK_EQ(mux.start(3, buf, sz), SESSION_UNKNOWN);
+
+  //and what comes in goes to its session only
+  Msg ack(0, 1, msg::AckPartPayload{});
+  CHECK_EQ(mux.process(Msg(3, ack), buf, sz), SESSION_UNKNOWN);
+  CHECK_EQ(mux.process(Msg(1, ack), buf, sz), ACK_NOT_WAITING);
+  CHECK_EQ(sz, 0);
+
+  //a retired session is dropped, and cannot come back
+  REQUIRE_EQ(mux.retire_before(2), OK);
+  CHECK_EQ(mux.size(), 1);
+  CHECK(mux.find(1) == nullptr);
+  CHECK(mux.find(2) != nullptr);
+  CHECK_EQ(mux.process(Msg(1, ack), buf, sz), SESSION_STALE);
+  CHECK_EQ(mux.open(1, GhsState<0,32>(0,edges,1)), SESSION_STALE);
+  REQUIRE_EQ(mux.retire_before(1), OK);
+  CHECK_EQ(mux.oldest_allowed(), 2);
+  CHECK_EQ(mux.close(2), OK);
+  CHECK_EQ(mux.close(2), SESSION_UNKNOWN);
+  CHECK_EQ(mux.size(), 0);
+
+  //a state stays where it is while other sessions come and go
+  REQUIRE_EQ(mux.open(5, GhsState<0,32>(0,edges,1)), OK);
+  GhsState<0,32> *five = mux.find(5);
+  REQUIRE(five != nullptr);
+  REQUIRE_EQ(five->start_round(buf, sz), OK);
+  for (session_t s=6;s<40;s++){
+    REQUIRE_EQ(mux.open(s, GhsState<0,32>(0,edges,1)), OK);
+  }
+  REQUIRE_EQ(mux.close(6), OK);
+  REQUIRE_EQ(mux.open(3, GhsState<0,32>(0,edges,1)), OK);
+  REQUIRE_EQ(mux.retire_before(4), OK);
+  CHECK(mux.find(5) == five);
+  CHECK_EQ(five->get_id(), 0);
+  CHECK_EQ(five->waiting_count(), 1);
+}
+
+TEST_CASE("sim-test elections share links in sessions")
+{
+  //First, two elections on different graphs run at once over the same
+  //links. Then a third starts, and part way through one agent gives up on
+  //it and starts a fourth on yet another graph; the rest join the fourth
+  //when they first hear of it, and drop whatever the third still has on
+  //its way.
+  long stale=0;
+  int runs=0;
+  for (int N=3;N<=10;N++){
+    for (unsigned seed=0;seed<12;seed++){
+      std::mt19937 rng(seed*100+N);
+      std::map<session_t,std::vector<std::tuple<metric_t,int,int>>> graphs;
+      for (session_t s : {1u, 2u, 3u, 4u}){
+        graphs[s] = random_graph(N, 40, rng);
+      }
+      auto state_of = [&](session_t s, int i){
+        std::vector<Edge> edges;
+        for (auto &e : graphs[s]){
+          if (std::get<1>(e)==i){
+            edges.push_back({std::get<2>(e),i,UNKNOWN,std::get<0>(e)});
+          } else if (std::get<2>(e)==i){
+            edges.push_back({std::get<1>(e),i,UNKNOWN,std::get<0>(e)});
+          }
+        }
+        return GhsState<0,64>(i,edges.data(),edges.size());
+      };
+
+      std::vector<SessionMux<0,64>> mux(N);
+      std::map<std::pair<agent_t,agent_t>,std::deque<Msg>> links;
+      StaticQueue<Msg,64> buf;
+      size_t sz;
+      auto post = [&](){
+        Msg m;
+        while (buf.size()>0){
+          buf.pop(m);
+          links[{m.from(),m.to()}].push_back(m);
+        }
+      };
+      auto begin = [&](int i, session_t s){
+        REQUIRE_EQ(mux[i].open(s, state_of(s,i)), OK);
+        REQUIRE_EQ(mux[i].start(s, buf, sz), OK);
+        post();
+      };
+      //deliver in random order until the links are quiet, calling restart() after the given number of messages
+      auto drive = [&](int restart_at, std::function<void()> restart){
+        int delivered=0;
+        while (true){
+          std::vector<std::pair<agent_t,agent_t>> busy;
+          for (auto &l : links){
+            if (!l.second.empty()){
+              busy.push_back(l.first);
+            }
+          }
+          if (busy.empty()){
+            break;
+          }
+          if (delivered++ == restart_at){
+            restart();
+          }
+          auto &q = links[busy[rng()%busy.size()]];
+          Msg m = q.front();
+          q.pop_front();
+          agent_t to = m.to();
+          auto err = mux[to].process(m, buf, sz);
+          if (err == SESSION_UNKNOWN && m.session() > mux[to].newest()){
+            mux[to].retire_before(m.session());
+            begin(to, m.session());
+            err = mux[to].process(m, buf, sz);
+          }
+          if (err == SESSION_STALE){
+            stale++;
+            continue;
+          }
+          REQUIRE_EQ(err, OK);
+          post();
+        }
+      };
+      auto check_mst = [&](session_t s){
+        SimFleet fleet(0);
+        for (int i=0;i<N;i++){
+          REQUIRE(mux[i].find(s) != nullptr);
+          fleet.states.push_back(*mux[i].find(s));
+        }
+        CHECK_EQ(fleet.tree_weight(), mst_weight(N, graphs[s]));
+      };
+
+      for (int i=0;i<N;i++){
+        begin(i,1);
+        begin(i,2);
+      }
+      drive(-1, []{});
+      check_mst(1);
+      check_mst(2);
+
+      for (int i=0;i<N;i++){
+        begin(i,3);
+      }
+      drive(rng()%(4*N), [&]{
+        mux[0].retire_before(4);
+        begin(0,4);
+      });
+      check_mst(4);
+      for (int i=0;i<N;i++){
+        CHECK_EQ(mux[i].size(), 1);
+      }
+      runs++;
+    }
+  }
+  CHECK_GT(stale, 0);
+  MESSAGE(runs << " runs dropped " << stale << " messages from retired elections");
+}
+
+TEST_CASE("unit-test set_max_degree")
+{
+  //we lead three children, one more than the cap
+  Edge edges[3] = {{1,0,MST,10},{2,0,MST,30},{3,0,MST,20}};
+  GhsState<4,32> s(0,edges,3);
+  s.set_max_degree(2);
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  REQUIRE_EQ(s.start_round(buf, sz), OK);
+  REQUIRE_EQ(sz, 3);
+  Msg m;
+  while (buf.size()>0){
+    buf.pop(m);
+  }
+  REQUIRE_EQ(s.process(Msg(0,1,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  REQUIRE_EQ(s.process(Msg(0,3,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  CHECK_EQ(sz, 0);
+
+  //so once the last search is back, the tree converges but for the swaps,
+  //and we cut off our heaviest child
+  REQUIRE_EQ(s.process(Msg(0,2,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  REQUIRE_EQ(sz, 4);
+  for (int i=0;i<3;i++){
+    buf.pop(m);
+    CHECK_EQ(m.type(), msg::Type::NOOP);
+    CHECK(m.data().noop.swapping);
+  }
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::CUT);
+  CHECK_EQ(m.to(), 2);
+  CHECK(m.data().cut.shed);
+  CHECK_FALSE(s.is_converged());
+  LeaderEstimate est;
+  CHECK_EQ(s.current_leader(est), PARTIAL_RESULT);
+  status_t status;
+  REQUIRE_EQ(s.get_edge_status(2, status), OK);
+  CHECK_EQ(status, UNKNOWN);
+
+  //its subtree searches a level up, and learns we are at the cap
+  REQUIRE_EQ(s.process(Msg(0,2,InPartPayload{2,LEVEL_START+1,1}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::NACK_PART);
+  CHECK_EQ(m.data().nack_part.degree, 2);
+
+  //it finds no room elsewhere, and comes back, and we look again
+  REQUIRE_EQ(s.process(Msg(0,2,JoinUsPayload{0,2,2,LEVEL_START+1}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::ABSORBED);
+  REQUIRE_EQ(s.process(Msg(0,2,ShedDonePayload{30,30}), buf, sz), OK);
+  REQUIRE_EQ(sz, 3);
+  while (buf.size()>0){
+    buf.pop(m);
+    CHECK_EQ(m.type(), msg::Type::SRCH);
+  }
+
+  //we have tried that child, so we try the next heaviest, and the tree
+  //has already converged
+  REQUIRE_EQ(s.process(Msg(0,1,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  REQUIRE_EQ(s.process(Msg(0,2,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  REQUIRE_EQ(s.process(Msg(0,3,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::CUT);
+  CHECK_EQ(m.to(), 3);
+  CHECK_EQ(s.get_degree_cost(), 0);
+
+  //a child cut off to cap its parent ranks an agent with room above the
+  //way back, even if it is heavier
+  Edge up[2] = {{0,2,MST_PARENT,30},{4,2,UNKNOWN,40}};
+  GhsState<4,32> t(2,up,2);
+  t.set_max_degree(2);
+  REQUIRE_EQ(t.process(Msg(2,0,CutPayload{0,2,true}), buf, sz), OK);
+  REQUIRE_EQ(sz, 2);
+  while (buf.size()>0){
+    buf.pop(m);
+    CHECK_EQ(m.type(), msg::Type::IN_PART);
+    CHECK_EQ(m.data().in_part.level, LEVEL_START+1);
+  }
+  REQUIRE_EQ(t.process(Msg(2,0,NackPartPayload{2}), buf, sz), OK);
+  CHECK_EQ(sz, 0);
+  REQUIRE_EQ(t.process(Msg(2,4,NackPartPayload{1}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::JOIN_US);
+  CHECK_EQ(m.to(), 4);
+
+  //and once it is taken in, tells the leader what that cost
+  REQUIRE_EQ(t.process(Msg(2,4,AbsorbedPayload{0,LEVEL_START}), buf, sz), OK);
+  REQUIRE_EQ(sz, 1);
+  buf.pop(m);
+  CHECK_EQ(m.type(), msg::Type::SHED_DONE);
+  CHECK_EQ(m.to(), 4);
+  CHECK_EQ(m.data().shed_done.added, 40);
+  CHECK_EQ(m.data().shed_done.removed, 30);
+  CHECK_EQ(t.get_parent_id(), 4);
+  CHECK_EQ(t.get_leader_id(), 0);
+}
+
+TEST_CASE("unit-test CROWDED goes ahead of SRCH_RET only under a cap")
+{
+  //the degree cap costs uncapped trees nothing on the wire
+  CHECK_EQ(sizeof(Msg), 40);
+
+  //we have a parent and three children, so four tree edges
+  Edge edges[4] = {{0,1,MST_PARENT,10},{2,1,MST,10},{3,1,MST,20},{4,1,MST,30}};
+  for (uint32_t cap : {0u, 2u}){
+    GhsState<5,32> s(1,edges,4);
+    s.set_max_degree(cap);
+    StaticQueue<Msg,32> buf;
+    size_t sz;
+    Msg m;
+    REQUIRE_EQ(s.process(Msg(1,0,SrchPayload{0,LEVEL_START}), buf, sz), OK);
+    REQUIRE_EQ(sz, 3);
+    while (buf.size()>0){
+      buf.pop(m);
+    }
+    REQUIRE_EQ(s.process(Msg(1,2,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+    REQUIRE_EQ(s.process(Msg(1,3,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+    REQUIRE_EQ(s.process(Msg(1,4,SrchRetPayload{0,0,WORST_METRIC,1,0}), buf, sz), OK);
+    if (cap == 0){
+      REQUIRE_EQ(sz, 1);
+    } else {
+      //over the cap: we name ourselves first, on the same link
+      REQUIRE_EQ(sz, 2);
+      buf.pop(m);
+      CHECK_EQ(m.type(), msg::Type::CROWDED);
+      CHECK_EQ(m.to(), 0);
+      CHECK_EQ(m.data().crowded.crowded, 1);
+      CHECK_EQ(m.data().crowded.degree, 4);
+      CHECK_EQ(m.data().crowded.rank, 0);
+    }
+    buf.pop(m);
+    CHECK_EQ(m.type(), msg::Type::SRCH_RET);
+    CHECK_EQ(m.to(), 0);
+    CHECK_EQ(m.data().srch_ret.subtree_size, 4);
+  }
+
+  //and only a child we wait on may say it
+  Edge down[1] = {{1,0,MST,10}};
+  GhsState<5,32> p(0,down,1);
+  StaticQueue<Msg,32> buf;
+  size_t sz;
+  CHECK_EQ(p.process(Msg(0,1,CrowdedPayload{1,4,0}), buf, sz), UNEXPECTED_SRCH_RET);
+}
+
+///How many ticks a broadcast from the leader takes to reach everyone, if
+///each agent sends to one child per tick, in the order mst_broadcast() does
+int broadcast_ticks(const SimFleet &fleet, agent_t from)
+{
+  agent_t kids[64];
+  size_t k = std::min(fleet.states[from].mst_children(kids, 64), (size_t)64);
+  std::vector<agent_t> ours(kids, kids+k);
+  int ticks=0;
+  for (size_t i=0;i<ours.size();i++){
+    ticks = std::max(ticks, (int)i+1+broadcast_ticks(fleet, ours[i]));
+  }
+  return ticks;
+}
+
+///The most tree edges any agent has
+uint32_t max_tree_degree(const SimFleet &fleet)
+{
+  uint32_t most=0;
+  for (auto &st : fleet.states){
+    uint32_t d = (uint32_t)st.mst_children(nullptr, 0) + (st.get_parent_id()!=st.get_id());
+    most = std::max(most, d);
+  }
+  return most;
+}
+
+TEST_CASE("sim-test degree cap shortens broadcasts from hubs")
+{
+  //Random graphs, and graphs where one or two agents have the lightest
+  //links, as a well-placed base station would, so the MST is mostly
+  //stars. The same elections with and without set_max_degree().
+  const uint32_t CAP=3;
+  int runs=0, capped=0, hub_ticks=0, capped_ticks=0, worst_hub=0, worst_capped=0;
+  int n_msgs=0, n_msgs_plain=0;
+  uint32_t hub_degree=0;
+  double gap=0;
+  for (int N=6;N<=24;N+=2){
+    for (unsigned seed=0;seed<6;seed++){
+      std::mt19937 rng(seed*11+N);
+      auto graph = random_graph(N, 60, rng);
+      //the hubs' links come first, in the random order they had
+      int hubs = seed%3;
+      std::sort(graph.begin(), graph.end(), [&](const std::tuple<metric_t,int,int> &a, const std::tuple<metric_t,int,int> &b){
+          bool a_hub = std::get<1>(a) < hubs, b_hub = std::get<1>(b) < hubs;
+          return a_hub != b_hub ? a_hub : std::get<0>(a) < std::get<0>(b);
+          });
+      for (size_t k=0;k<graph.size();k++){
+        std::get<0>(graph[k]) = k+1;
+      }
+
+      SimFleet plain(seed), fleet(seed);
+      n_msgs_plain += elect(plain, N, graph);
+      bring_up(fleet, N, graph);
+      for (auto &st : fleet.states){
+        st.set_max_degree(CAP);
+        //half of them move the leader, too, once the swaps are done
+        st.set_recenter(seed%2==1);
+      }
+      n_msgs += fleet.run();
+
+      metric_t best = mst_weight(N, graph);
+      REQUIRE_EQ(plain.tree_weight(), best);
+      metric_t weight = fleet.tree_weight();
+      REQUIRE_GE(weight, best);
+      REQUIRE_GE(tree_depth(fleet), 0);
+      for (auto &st : fleet.states){
+        CHECK_EQ(st.get_degree_cost(), weight-best);
+        LeaderEstimate est;
+        REQUIRE_EQ(st.current_leader(est), OK);
+        CHECK_EQ(est.size, (uint32_t)N);
+      }
+
+      //the swaps never make things worse
+      uint32_t before = max_tree_degree(plain), after = max_tree_degree(fleet);
+      CHECK_LE(after, std::max(before, CAP));
+      capped += after <= CAP;
+      int t_hub = broadcast_ticks(plain, plain.states[0].get_leader_id());
+      int t_capped = broadcast_ticks(fleet, fleet.states[0].get_leader_id());
+      hub_ticks += t_hub;
+      capped_ticks += t_capped;
+      worst_hub = std::max(worst_hub, t_hub);
+      worst_capped = std::max(worst_capped, t_capped);
+      hub_degree = std::max(hub_degree, before);
+      gap += double(weight-best)/best;
+      runs++;
+    }
+  }
+  //a dense graph almost always has a tree within the cap, and the swaps
+  //find it
+  CHECK_GE(capped*10, runs*9);
+  CHECK_LT(capped_ticks, hub_ticks);
+  CHECK_LT(worst_capped, worst_hub);
+  MESSAGE(runs << " elections, with up to " << hub_degree << " tree edges at one agent: capped at " << CAP << " in "
+      << capped << ", broadcasts took " << capped_ticks << " ticks in all against " << hub_ticks
+      << ", and " << worst_capped << " at worst against " << worst_hub << ", for trees "
+      << 100*gap/runs << "% heavier than the MST on average (" << n_msgs << " messages against " << n_msgs_plain << ")");
+}
+
 TEST_CASE("ghs_metric")
 {
   metric_t m= METRIC_NOT_SET;